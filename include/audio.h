@@ -4,7 +4,53 @@
 #include <Arduino.h>
 #include <driver/i2s.h>
 #include "freertos/ringbuf.h"
+#include <atomic>
 #include "events.h"
+#include "audio_codec.h"
+#include "vad.h"
+#include "biquad.h"
+#include "resampler.h"
+#include "message_store.h"
+#include "prompt_cache.h"
+#include "upload_pacer.h"
+
+constexpr size_t I2S_DMA_BUF_MAX_BYTES = 4092; // Largest DMA buffer the I2S driver will allocate
+
+struct JitterStats {
+    uint32_t underruns;      // Times playback ran dry while the stream was still arriving
+    uint32_t concealedBytes; // Silence written to cover underruns
+    uint32_t overruns;       // Prefetch chunks dropped because they exceeded the granted credit
+    size_t minFill;
+    size_t maxFill;
+};
+
+struct I2SStats {
+    uint32_t framesRead;
+    uint32_t framesWritten;
+    uint32_t rxOverruns;  // DMA buffers the driver dropped because capture fell behind
+    uint32_t txUnderruns; // DMA buffers that played out empty because playback fell behind
+    uint32_t dmaErrors;
+};
+
+struct PromptStats {
+    uint32_t played;
+    uint32_t missing;       // Requested prompts that are not in the flash image
+    uint32_t lastLatencyUs; // From the triggering event being posted to the prompt's first block entering the I2S DMA
+    uint32_t maxLatencyUs;
+};
+
+struct StageTiming {
+    uint32_t blocks;
+    uint64_t totalMicros;
+    uint32_t maxMicros;
+};
+
+struct CaptureTiming {
+    StageTiming frames;    // CPU time per captured frame: read, convert, filter, VAD and staging, DMA wait excluded
+    StageTiming bursts;    // Copies of a full bounce buffer into the message store
+    uint64_t burstBytes;   // Bytes copied into PSRAM by those bursts
+    uint32_t forcedBursts; // Bursts that could not wait for slack because the other bounce buffer was full
+};
 
 class Audio {
 public:
@@ -24,28 +70,185 @@ public:
 
     static void stopPrefetch();
 
+    // Prefetches like startPrefetch() but begins playing once AUDIO_JITTER_WATERMARK_MS of audio is buffered
+    static void startStreamingPlayback();
+
+    static JitterStats getJitterStats();
+
+    static VadStats getVadStats();
+
+    // Capture counters cover the current or last recording, playback counters the current or last playback
+    static I2SStats getI2SStats();
+
+    // Time spent in the capture filter chain per DMA block, for the current or last recording
+    static StageTiming getFilterTiming();
+
+    // Capture CPU time and PSRAM write bandwidth, for the current or last recording
+    static CaptureTiming getCaptureTiming();
+
+    // Called once an AUDIO_DATA_READY chunk has been handed to the network, with how long the socket write took
+    static void chunkSent(size_t bytes, uint32_t writeMicros, bool ok);
+
+    // Pacing and goodput for the current or last upload
+    static UploadStats getUploadStats();
+
+    // Hands both I2S ports to the intercom, reinstalled with its low-latency configs.
+    // Fails while a message is being recorded, uploaded, downloaded or played.
+    static bool suspendForIntercom(const i2s_config_t &rxConfig, const i2s_config_t &txConfig);
+
+    static void resumeFromIntercom();
+
+    // Codecs and rates negotiated with the server; each recording or prefetch keeps the ones in effect when it started
+    static void setCodecs(const CodecSelection &selection);
+
+    // Queues a prompt from the flash cache behind any already playing. Refused while a message is recorded or
+    // played. requestedAt is the micros() the triggering event was posted at, 0 to leave it out of the stats.
+    static bool playPrompt(PromptId id, uint32_t requestedAt);
+
+    static PromptStats getPromptStats();
+
 private:
     static void audioTask(void *parameter);
 
     static EventDispatcher *eventDispatcher;
+    static TaskHandle_t taskHandle;
 
     // I2S configuration
     static const i2s_config_t i2sConfigRx;
     static const i2s_pin_config_t i2sPinConfigRx;
     static const i2s_config_t i2sConfigTx;
     static const i2s_pin_config_t i2sPinConfigTx;
+    static int32_t *captureSlots; // One DMA buffer of raw microphone slots, in internal RAM
+    static int32_t micDcOffset;
+    static BiquadChain captureFilter;
+    static StageTiming filterTiming;
+    // Captured PCM is processed in two internal, DMA-capable bounce buffers and reaches PSRAM in bursts
+    static int16_t *bounceBuffers[2];
+    static size_t bounceFill[2]; // Bytes staged
+    static uint8_t bounceActive; // Being filled; the other is empty or full and waiting for its burst
+    static CaptureTiming captureTiming;
+    static QueueHandle_t rxEvents;
+    static QueueHandle_t txEvents;
+    static I2SStats i2sStats;
+    static size_t framesPrimed; // Playback frames written before the first TX_DONE is awaited
 
     static volatile bool isRecording;
     static volatile bool isPlaying;
     static volatile bool isPrefetching;
+    static volatile bool uploadPending;
+    static volatile bool streamPending;
+    static volatile bool playbackRequested;
+    static volatile bool suspended; // I2S is lent to the intercom
+
+    // Messages in the store: the recording being captured and uploaded, the owner message being downloaded,
+    // and the message being played, which is the download itself while streaming
+    static uint16_t recordingId;
+    static volatile uint16_t prefetchId;
+    static volatile uint16_t playbackId;
+    static volatile size_t playbackIndex; // Read cursor, advanced as blocks are written to I2S
+    static size_t playbackBytesMoved;
+    static uint32_t prefetchCopiedStart;
+
+    static AudioCodecType uplinkCodec;
+    static AudioCodecType downlinkCodec;
+    static AudioCodecType prefetchCodec;
+    static uint32_t uplinkRate;
+    static uint32_t downlinkRate;
+    static Resampler prefetchResampler; // Server rate to SAMPLE_RATE
+
+    // Upload stream state; chunks are encoded from the recording as it fills
+    static AudioCodecType uploadCodec;
+    static AdpcmState uploadAdpcm;
+    static Resampler uploadResampler; // SAMPLE_RATE to the upload rate
+    static PooledBuffer unsentChunk;  // Encoded chunk the event queue had no room for, retried first
+    static size_t uploadIndex;
+    static uint32_t uploadCopiedStart;
+    static uint32_t recordingStoppedAt;
+    static UploadPacer uploadPacer; // Shared with the dispatcher under uploadLock
+
+    // Silence trimming state for the current recording, and which stop ends it
+    static SilenceTrimmer silenceTrimmer;
+
+    // Prompts waiting to play, handed over from the dispatcher under promptLock
+    static constexpr size_t PROMPT_QUEUE_LENGTH = 4;
+    struct QueuedPrompt {
+        Prompt prompt;
+        uint32_t requestedAt;
+    };
+    static QueuedPrompt promptQueue[PROMPT_QUEUE_LENGTH];
+    static size_t promptQueueHead;
+    static size_t promptQueueCount;
+    static QueuedPrompt currentPrompt;
+    static size_t promptIndex;
+    static volatile bool promptPlaying;
+    static PromptStats promptStats;
+
+    // Jitter buffer state for streamed playback
+    static size_t grantedCredit;
+    static JitterStats jitterStats;
+    static bool inUnderrun;
+    static int16_t lastSample;
+
+    static void installI2S(const i2s_config_t &rxConfig, const i2s_config_t &txConfig);
+
+    // Wakes the audio task when it is idle
+    static void wake();
+
+    // Blocks on the driver's event queue until a DMA buffer of the given kind completes, counting
+    // overruns, underruns and errors on the way. Returns false on timeout.
+    static bool waitForDma(QueueHandle_t queue, i2s_event_type_t doneType);
+
+    // Discards capture DMA buffers that filled while nobody was recording
+    static void beginCapture();
+
+    static void beginPlayout();
+
+    static void captureNextFrame();
+
+    // Copies a bounce buffer to the end of the recording and empties it
+    static void flushBounce(uint8_t index);
+
+    // Flushes the full bounce buffer, then the partly filled one
+    static void flushCapture();
+
+    // Recorded bytes, including those still staged in the bounce buffers
+    static size_t recordedLength();
+
+    // Plays a stored message from its start. Audio task only, like endPlayback()
+    static void playMessage(uint16_t id);
+
+    // Marks the stopped message played and releases the cursor
+    static void endPlayback();
+
+    static void waitForTxSlot();
+
+    static void playNextBlock();
+
+    static void concealUnderrun();
+
+    // Moves the next queued prompt to currentPrompt. Returns false if there is none.
+    static bool takePrompt();
+
+    static void playPromptBlock();
+
+    static void applyFade(uint8_t *data, size_t length, bool fadeIn);
+
+    static void grantPrefetchCredit(bool force);
+
+    // Classifies a captured frame. Returns false for a frame cut from a long pause.
+    static bool trimSilence(const int16_t *frame, size_t frameBytes);
+
+    // Until speech starts only the pre-roll is kept
+    static void dropLeadingSilence();
 
-    static uint8_t *audioBuffer;
-    static size_t audioBufferIndex;
-    static size_t audioBufferSize;
+    // Cuts trailing silence that has not been uploaded yet
+    static void trimTrailingSilence();
 
-    static void clearAudioBuffer();
+    // Posts chunks between uploadIndex and the end of the recording; partial chunks only when flushing.
+    // Returns true once everything recorded so far has been posted.
+    static bool publishAudioChunks(bool flush);
 
-    static void sendAudioData();
+    static void finishUpload();
 
     static size_t min(size_t a, size_t b);
 };
@@ -0,0 +1,61 @@
+#ifndef AUDIO_CODEC_H
+#define AUDIO_CODEC_H
+
+#include <cstdint>
+#include <cstddef>
+
+enum class AudioCodecType : uint8_t {
+    PCM16 = 0, // 16-bit little-endian PCM, sent as is
+    MULAW,     // G.711 mu-law, 2:1
+    IMA_ADPCM, // IMA ADPCM, 4:1 plus a 4-byte header per chunk
+};
+
+// Predictor and step index an IMA ADPCM stream carries from one chunk to the next. Restarting them per
+// chunk would click at every boundary while the step size re-adapts.
+struct AdpcmState {
+    int32_t predictor = 0;
+    int32_t stepIndex = 0;
+};
+
+// Every encoded chunk is self-contained: an IMA ADPCM chunk starts with the stream's predictor and step index
+// as they stood before its first sample (int16 little-endian predictor, uint8 index, uint8 flags), so a lost
+// or reordered chunk never corrupts the ones after it. Flag bit 0 marks an odd sample count, whose last
+// nibble is padding.
+class AudioCodec {
+public:
+    static const char *name(AudioCodecType type);
+
+    static bool fromName(const char *name, AudioCodecType &type);
+
+    // Encoded size of a chunk of `samples` samples, including any header
+    static size_t encodedSize(AudioCodecType type, size_t samples);
+
+    // Encodes one chunk of a stream into out, which must hold encodedSize() bytes, advancing state for the
+    // next chunk. Returns the bytes written.
+    static size_t encode(AudioCodecType type, const int16_t *pcm, size_t samples, uint8_t *out, AdpcmState &state);
+
+    static uint8_t encodeMulaw(int16_t sample);
+
+    static int16_t decodeMulaw(uint8_t value);
+};
+
+// Decodes one chunk incrementally, so the output can be split at a ring buffer's wrap point
+class AudioChunkDecoder {
+public:
+    AudioChunkDecoder(AudioCodecType type, const uint8_t *data, size_t length);
+
+    size_t remainingSamples() const { return totalSamples - decodedSamples; }
+
+    // Decodes up to maxSamples samples into out. Returns the number decoded.
+    size_t decode(int16_t *out, size_t maxSamples);
+
+private:
+    AudioCodecType type;
+    const uint8_t *data;
+    size_t totalSamples;
+    size_t decodedSamples = 0;
+    int32_t predictor = 0;
+    int32_t stepIndex = 0;
+};
+
+#endif // AUDIO_CODEC_H
@@ -0,0 +1,106 @@
+#ifndef AUDIO_SPOOL_H
+#define AUDIO_SPOOL_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "events.h"
+#include "spool_log.h"
+
+struct SpoolStats {
+    SpoolLogStats log;
+    uint64_t flashMicros;    // Time spent writing and erasing flash
+    uint32_t droppedChunks;  // Chunks not spooled because the spool task fell behind
+    uint32_t droppedRequests; // Session starts, ends and acks lost because even the reserved slots were taken
+    uint32_t replayedChunks;
+    uint32_t replayedBytes;
+    uint32_t resumes;       // Live uploads whose gap was refilled after a reconnect
+    uint32_t resumedBytes;
+};
+
+// Keeps every recording on flash until the server acknowledges it. Uploaded chunks are copied to a SpoolLog
+// on the spool partition by a low-priority task, so the dispatcher never waits on a flash write or erase.
+// While the WebSocket is up, recordings the server has not acknowledged are replayed from the last
+// acknowledged offset, oldest first, one chunk in flight at a time. A recording still being captured when the
+// link comes back is resumed instead: the server's spool_ack of it is the highest contiguous offset it holds, and
+// the gap from there to what was spooled is sent while the live stream carries on past it.
+class AudioSpool {
+public:
+    static void begin(EventDispatcher &dispatcher);
+
+    // Opens a spool session for the recording and returns its id. Ids are handed out even while the spool
+    // is unavailable, since they also name the recording's upload stream.
+    static uint32_t beginSession(const RecordingStart &start);
+
+    // Session of the recording being captured, 0 between recordings
+    static uint32_t currentSessionId() { return currentSession; }
+
+    static void append(const PooledBuffer &chunk);
+
+    // Closes the current session and returns its id, 0 if there was none
+    static uint32_t endSession();
+
+    static void acknowledge(const SpoolPosition &ack);
+
+    static void setOnline(bool online);
+
+    // Resumes the recording being captured from the server's next spool_ack of it. Returns its session, 0 if
+    // there is none or it is not spooled.
+    static uint32_t requestResume();
+
+    // Called once a SPOOL_CHUNK_READY chunk has been handed to the network
+    static void chunkSent();
+
+    static SpoolStats getStats();
+
+    static void logStats();
+
+private:
+    static void spoolTask(void *parameter);
+
+    static void process(const Event &request);
+
+    // Posts the next chunk of the oldest unacknowledged recording. Returns false when there is nothing to send.
+    static bool replayNext();
+
+    // Posts the next chunk of the gap in a resumed recording. Returns false when there is nothing to send.
+    static bool resumeNext();
+
+    // Posts the spooled chunk of the recording that ends beyond offset and moves offset past it, or to end if the
+    // rest is unreadable. Returns false if the chunk could not be posted.
+    static bool postChunk(uint32_t session, uint32_t &offset, uint32_t end, size_t &length);
+
+    // Pushes a session start, end or ack into the slots chunks leave free. Returns false, and counts it, if even
+    // those are taken; the dispatcher never waits on the spool task.
+    static bool pushRequest(Event &&request);
+
+    static void wake();
+
+    static EventDispatcher *eventDispatcher;
+    static TaskHandle_t taskHandle;
+    static EventQueue *requests;
+    static SpoolLog *log;
+
+    // Dispatcher side
+    static uint32_t nextSession;
+    static uint32_t currentSession;
+    static bool currentDropped; // A chunk was dropped, so the rest of the recording is not spooled
+
+    // Spool task side
+    static uint32_t writeSession;
+    static uint32_t endedSession; // Most recent recording closed, and when; the live upload gets a chance first
+    static uint32_t endedAt;
+    static uint32_t replaySession;
+    static uint32_t replayOffset;  // End of the last chunk replayed
+    static uint32_t replayedUpTo;  // Sessions up to this id have been replayed since going online
+    static uint32_t replayDoneAt;  // millis() when the last pass over the pending recordings finished
+    static uint32_t resumeSession; // Live recording being refilled up to resumeEnd, 0 if none
+    static uint32_t resumeOffset;
+    static uint32_t resumeEnd;
+
+    static std::atomic<uint32_t> resumeRequested; // Live recording whose next spool_ack starts a resume
+    static std::atomic<bool> online;
+    static std::atomic<bool> chunkInFlight;
+    static SpoolStats stats;
+};
+
+#endif // AUDIO_SPOOL_H
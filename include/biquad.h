@@ -0,0 +1,90 @@
+#ifndef BIQUAD_H
+#define BIQUAD_H
+
+#include <cstdint>
+#include <cstddef>
+
+constexpr int BIQUAD_FRACTION_BITS = 14;
+constexpr size_t BIQUAD_MAX_STAGES = 4;
+
+// Normalised coefficients in Q14 (a0 == 1)
+struct BiquadCoefficients {
+    int32_t b0, b1, b2, a1, a2;
+};
+
+// Compile-time RBJ cookbook designs, so the chain carries no floating point at run time
+namespace Biquad {
+    namespace detail {
+        constexpr double PI = 3.14159265358979323846;
+
+        constexpr double power(double x, int n) { return n == 0 ? 1.0 : x * power(x, n - 1); }
+
+        constexpr double factorial(int n) { return n <= 1 ? 1.0 : n * factorial(n - 1); }
+
+        // Taylor series; accurate to double precision for |x| <= pi
+        constexpr double sine(double x, int n = 0) {
+            return n > 12 ? 0.0 : (n % 2 ? -1.0 : 1.0) * power(x, 2 * n + 1) / factorial(2 * n + 1) + sine(x, n + 1);
+        }
+
+        constexpr double cosine(double x, int n = 0) {
+            return n > 12 ? 0.0 : (n % 2 ? -1.0 : 1.0) * power(x, 2 * n) / factorial(2 * n) + cosine(x, n + 1);
+        }
+
+        constexpr double exponential(double x, int n = 0) {
+            return n > 30 ? 0.0 : power(x, n) / factorial(n) + exponential(x, n + 1);
+        }
+
+        constexpr int32_t toFixed(double value) {
+            return static_cast<int32_t>(value * (1 << BIQUAD_FRACTION_BITS) + (value >= 0 ? 0.5 : -0.5));
+        }
+
+        constexpr BiquadCoefficients normalise(double b0, double b1, double b2, double a0, double a1, double a2) {
+            return {toFixed(b0 / a0), toFixed(b1 / a0), toFixed(b2 / a0), toFixed(a1 / a0), toFixed(a2 / a0)};
+        }
+
+        constexpr double omega(double sampleRate, double frequency) { return 2 * PI * frequency / sampleRate; }
+
+        constexpr BiquadCoefficients highPass(double cosW, double alpha) {
+            return normalise((1 + cosW) / 2, -(1 + cosW), (1 + cosW) / 2, 1 + alpha, -2 * cosW, 1 - alpha);
+        }
+
+        constexpr BiquadCoefficients peaking(double cosW, double alpha, double amplitude) {
+            return normalise(1 + alpha * amplitude, -2 * cosW, 1 - alpha * amplitude,
+                             1 + alpha / amplitude, -2 * cosW, 1 - alpha / amplitude);
+        }
+    }
+
+    constexpr BiquadCoefficients highPass(double sampleRate, double frequency, double q) {
+        return detail::highPass(detail::cosine(detail::omega(sampleRate, frequency)),
+                                detail::sine(detail::omega(sampleRate, frequency)) / (2 * q));
+    }
+
+    // gainDb boosts (or cuts) a band around frequency
+    constexpr BiquadCoefficients peaking(double sampleRate, double frequency, double q, double gainDb) {
+        return detail::peaking(detail::cosine(detail::omega(sampleRate, frequency)),
+                               detail::sine(detail::omega(sampleRate, frequency)) / (2 * q),
+                               detail::exponential(gainDb / 40 * 2.302585092994046));
+    }
+}
+
+// Cascade of fixed-point Direct Form I biquads, processed in place one block at a time.
+// Each stage costs five 32x16 multiplies per sample with a 64-bit accumulator, so no input can overflow it.
+class BiquadChain {
+public:
+    BiquadChain(const BiquadCoefficients *stages, size_t stageCount);
+
+    void process(int16_t *samples, size_t count);
+
+    void reset();
+
+private:
+    struct State {
+        int32_t x1, x2, y1, y2;
+    };
+
+    const BiquadCoefficients *stages;
+    size_t stageCount;
+    State state[BIQUAD_MAX_STAGES];
+};
+
+#endif // BIQUAD_H
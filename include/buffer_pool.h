@@ -0,0 +1,90 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Bytes reserved in front of every chunk's payload so protocol and WebSocket headers can be written in place
+constexpr size_t POOL_CHUNK_HEADROOM = 32;
+constexpr size_t POOL_CHUNK_SIZE = 8 * 1024;
+
+struct PoolChunk {
+    std::atomic<uint16_t> refs;
+    uint16_t nextFree;
+    size_t size;
+    uint8_t *memory; // POOL_CHUNK_HEADROOM + POOL_CHUNK_SIZE bytes
+};
+
+// Ref-counted view of a pool chunk. Copies share the chunk; it returns to the pool when the last view goes away.
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+
+    PooledBuffer(const PooledBuffer &other);
+
+    PooledBuffer(PooledBuffer &&other) noexcept;
+
+    PooledBuffer &operator=(const PooledBuffer &other);
+
+    PooledBuffer &operator=(PooledBuffer &&other) noexcept;
+
+    ~PooledBuffer();
+
+    uint8_t *data() const { return chunk ? chunk->memory + POOL_CHUNK_HEADROOM : nullptr; }
+
+    size_t size() const { return chunk ? chunk->size : 0; }
+
+    void setSize(size_t size) const { chunk->size = size; }
+
+    static constexpr size_t capacity() { return POOL_CHUNK_SIZE; }
+
+    explicit operator bool() const { return chunk != nullptr; }
+
+    void reset();
+
+private:
+    friend class BufferPool;
+
+    explicit PooledBuffer(PoolChunk *chunk) : chunk(chunk) {}
+
+    PoolChunk *chunk = nullptr;
+};
+
+struct BufferPoolStats {
+    size_t chunkCount;
+    size_t chunksInUse;
+    size_t minFree;
+    uint32_t exhausted;
+    uint32_t bytesCopied;
+};
+
+class BufferPool {
+public:
+    static bool begin(size_t chunkCount);
+
+    // Returns an empty buffer if the pool is exhausted
+    static PooledBuffer acquire();
+
+    static PooledBuffer copyFrom(const uint8_t *data, size_t length);
+
+    // Accounts for a payload copy made outside the pool so the stats cover the whole audio path
+    static void recordCopy(size_t bytes);
+
+    static BufferPoolStats getStats();
+
+private:
+    friend class PooledBuffer;
+
+    static void release(PoolChunk *chunk);
+
+    static PoolChunk *chunks;
+    static size_t chunkCount;
+    static uint16_t freeHead;
+    static size_t freeCount;
+    static size_t minFree;
+    static uint32_t exhaustedCount;
+    static std::atomic<uint32_t> bytesCopied;
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,178 @@
+#ifndef COMMAND_REGISTRY_H
+#define COMMAND_REGISTRY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+enum class FieldType : uint8_t {
+    STRING, // const char *, pointing into the frame
+    BOOL,
+    UINT8,
+    UINT16,
+    UINT32,
+};
+
+// One member of a command's "data" object, decoded into the command's field struct at `offset`
+struct FieldSpec {
+    const char *name;
+    FieldType type;
+    uint8_t offset;
+    bool required;
+};
+
+template<typename M>
+struct FieldTypeOf;
+
+template<>
+struct FieldTypeOf<const char *> : std::integral_constant<FieldType, FieldType::STRING> {
+};
+
+template<>
+struct FieldTypeOf<bool> : std::integral_constant<FieldType, FieldType::BOOL> {
+};
+
+template<>
+struct FieldTypeOf<uint8_t> : std::integral_constant<FieldType, FieldType::UINT8> {
+};
+
+template<>
+struct FieldTypeOf<uint16_t> : std::integral_constant<FieldType, FieldType::UINT16> {
+};
+
+template<>
+struct FieldTypeOf<uint32_t> : std::integral_constant<FieldType, FieldType::UINT32> {
+};
+
+// FieldSpec for a member of a field struct, its type taken from the declaration
+#define COMMAND_FIELD(name, Struct, member, required) \
+    FieldSpec{name, FieldTypeOf<decltype(Struct::member)>::value, offsetof(Struct, member), required}
+
+struct CommandSpec {
+    const char *name; // event_type
+    const FieldSpec *fields;
+    uint8_t fieldCount;
+    void (*handler)(const void *fields);
+};
+
+// Largest field struct a command may decode into
+constexpr size_t COMMAND_FIELDS_SIZE = 32;
+
+// Commands are found by a perfect hash of event_type: the top COMMAND_SLOT_BITS of a seeded FNV-1a hash pick a
+// slot, and the table is checked for collisions at compile time. A new command that collides fails the build;
+// try another COMMAND_HASH_SEED.
+constexpr uint32_t COMMAND_HASH_SEED = 55;
+constexpr size_t COMMAND_SLOT_BITS = 4;
+constexpr size_t COMMAND_SLOTS = size_t(1) << COMMAND_SLOT_BITS;
+
+constexpr uint32_t commandHash(const char *name, uint32_t hash = 2166136261u ^ COMMAND_HASH_SEED) {
+    return *name ? commandHash(name + 1, (hash ^ static_cast<uint8_t>(*name)) * 16777619u) : hash;
+}
+
+constexpr size_t commandSlot(const char *name) {
+    return commandHash(name) >> (32 - COMMAND_SLOT_BITS);
+}
+
+template<typename T, void (*Handle)(const T &)>
+void invokeCommand(const void *fields) {
+    Handle(*static_cast<const T *>(fields));
+}
+
+// Table entry for a command whose data decodes into T and is handled by Handle
+template<typename T, void (*Handle)(const T &), size_t N>
+constexpr CommandSpec command(const char *name, const FieldSpec (&fields)[N]) {
+    static_assert(sizeof(T) <= COMMAND_FIELDS_SIZE, "Command fields too large");
+    static_assert(N <= 32, "Too many command fields");
+    return {name, fields, static_cast<uint8_t>(N), &invokeCommand<T, Handle>};
+}
+
+struct NoFields {
+};
+
+// Table entry for a command that takes no data
+template<void (*Handle)(const NoFields &)>
+constexpr CommandSpec command(const char *name) {
+    return {name, nullptr, 0, &invokeCommand<NoFields, Handle>};
+}
+
+// Slot to command: 1 + the command's index in the table, 0 for an empty slot
+struct CommandSlots {
+    uint8_t index[COMMAND_SLOTS];
+};
+
+template<size_t N>
+constexpr uint8_t commandInSlot(const CommandSpec (&commands)[N], size_t slot, size_t i = 0) {
+    return i == N ? 0 : commandSlot(commands[i].name) == slot ? static_cast<uint8_t>(i + 1)
+                                                                : commandInSlot(commands, slot, i + 1);
+}
+
+template<size_t N>
+constexpr bool commandSlotsUnique(const CommandSpec (&commands)[N], size_t i = 0, size_t j = 1) {
+    return i + 1 >= N ? true
+         : j == N ? commandSlotsUnique(commands, i + 1, i + 2)
+         : commandSlot(commands[i].name) != commandSlot(commands[j].name) && commandSlotsUnique(commands, i, j + 1);
+}
+
+template<size_t... I>
+struct SlotList {
+};
+
+template<size_t N, size_t... I>
+struct MakeSlotList : MakeSlotList<N - 1, N - 1, I...> {
+};
+
+template<size_t... I>
+struct MakeSlotList<0, I...> {
+    using type = SlotList<I...>;
+};
+
+template<size_t N, size_t... I>
+constexpr CommandSlots buildCommandSlots(const CommandSpec (&commands)[N], SlotList<I...>) {
+    return {{commandInSlot(commands, I)...}};
+}
+
+template<size_t N>
+constexpr CommandSlots buildCommandSlots(const CommandSpec (&commands)[N]) {
+    static_assert(N < 256, "Too many commands");
+    return buildCommandSlots(commands, typename MakeSlotList<COMMAND_SLOTS>::type());
+}
+
+enum class CommandStatus : uint8_t {
+    HANDLED,
+    MALFORMED,     // Not a JSON object
+    NO_EVENT_TYPE,
+    UNKNOWN,       // event_type names no command
+    INVALID_FIELD, // A required field is missing, or a field has the wrong type
+    INVALID_DATA,  // data is not an object
+};
+
+// What dispatch() did with a frame, for the caller to log
+struct CommandOutcome {
+    CommandStatus status;
+    const CommandSpec *command; // Set when HANDLED
+    const char *eventType;      // Terminated in the frame; nullptr until it was found
+    const char *field;          // The offending field for INVALID_FIELD
+};
+
+// Decodes {"event_type": ..., "data": {...}} text frames and runs the matching command. Parsing happens in
+// place in the frame: no document is built, strings are unescaped and terminated where they lie, and each data
+// member is written straight into the command's field struct. Members a command does not declare are skipped.
+// Check the table with commandSlotsUnique() where it is defined.
+class CommandRegistry {
+public:
+    template<size_t N>
+    constexpr CommandRegistry(const CommandSpec (&commands)[N])
+            : commands(commands), slots(buildCommandSlots(commands)) {}
+
+    // Runs the frame's command if it decodes. String fields, and the outcome's eventType, point into text, so
+    // they only live as long as the frame.
+    CommandOutcome dispatch(char *text, size_t length) const;
+
+    const CommandSpec *find(const char *name, size_t length) const;
+
+private:
+    const CommandSpec *commands;
+    CommandSlots slots;
+};
+
+#endif // COMMAND_REGISTRY_H
@@ -17,8 +17,65 @@ extern const char *WS_SERVER;
 #define MOTOR_PIN2 38
 #define MOTOR_ENABLE 47
 
+// Event dispatcher configuration
+#define EVENT_QUEUE_SIZE 64
+#define EVENT_DISPATCHER_PRIORITY 3 // One task per lane; the critical lane's runs one above this
+#define EVENT_DISPATCHER_CORE 0
+#define EVENT_MAX_CALLBACKS 96 // Callback registrations across all event types
+#define EVENT_JOURNAL_SIZE (128 * 1024) // Event recorder ring (Allocated in PSRAM), 0 disables recording
+
 // Audio buffer size
-#define AUDIO_BUFFER_SIZE (6 * 1024 * 1024) // 6MB buffer (Allocated in PSRAM)
+#define AUDIO_BUFFER_SIZE (6 * 1024 * 1024) // 6MB message store (Allocated in PSRAM)
+#define MESSAGE_SLAB_SIZE (32 * 1024) // Unit the message store hands out to recordings and prefetched messages
+#define MESSAGE_STORE_MAX_MESSAGES 16 // Inbound and outbound messages held at once
+#define AUDIO_POOL_CHUNKS 32 // 8KB chunks shared by audio events (Allocated in PSRAM)
+#define AUDIO_STREAM_UPLOAD 1 // Upload chunks while recording instead of after it stops
+#define AUDIO_UPLOAD_WINDOW 4 // Max upload chunks queued for the network at once, the pacer's largest window
+#define UPLOAD_MIN_CHUNK 1024 // Smallest chunk the upload pacer shrinks to, in bytes
+#define UPLOAD_STALL_US 40000 // A socket write slower than this halves the upload window
+#define AUDIO_JITTER_WATERMARK_MS 500 // Buffered audio needed before streamed playback starts
+#define AUDIO_CREDIT_STEP (64 * 1024) // Prefetch credit is re-granted to the server in steps of this many bytes
+
+// Flash spool for recordings the server has not acknowledged
+#define SPOOL_ENABLED 1
+#define SPOOL_PARTITION_LABEL "spool" // Data partition, subtype 0x40, in partitions.csv
+#define SPOOL_SEGMENT_SIZE (64 * 1024) // Erase and reclaim unit, a multiple of the 4KB flash sector
+#define SPOOL_QUEUE_SIZE 16 // Chunks waiting for the flash
+#define SPOOL_CONTROL_SLOTS 4 // Queue slots chunks may not take, kept for session starts, ends and acks
+#define SPOOL_ACK_TIMEOUT_MS 10000 // A finished recording still unacknowledged after this is replayed
+
+// Outbound events held while the WebSocket is down
+#define OUTBOX_ENABLED 1
+#define OUTBOX_PARTITION_LABEL "outbox" // Data partition, subtype 0x42, in partitions.csv
+#define OUTBOX_SEGMENT_SIZE 4096 // Erase and reclaim unit for spilled events
+#define OUTBOX_RAM_EVENTS 32 // Events queued in RAM (Allocated in PSRAM)
+#define OUTBOX_SPILL_WATERMARK 24 // Events queued in RAM at which an outage spills them to flash
+#define OUTBOX_SPILL_DELAY_MS 30000 // Events queued this long in an outage spill too, so they survive a reboot
+#define OUTBOX_MAX_EVENT 256 // Largest serialized event, in bytes
+
+// Prompts and chimes played from flash; the image is built from prompts/*.wav by tools/pack_prompts.py
+#define PROMPTS_ENABLED 1
+#define PROMPTS_PARTITION_LABEL "prompts" // Data partition, subtype 0x41, in partitions.csv
+
+// Voice activity detection on the record path
+#define VAD_ENABLED 1
+#define VAD_ENERGY_THRESHOLD 300 // Mean absolute amplitude of a speech frame
+#define VAD_ZCR_THRESHOLD 25 // Zero crossings per 100 samples of quieter unvoiced speech
+#define VAD_PREROLL_MS 200 // Audio kept before speech starts
+#define VAD_HANGOVER_MS 300 // Audio kept after speech ends
+#define VAD_MAX_PAUSE_MS 1000 // Longer internal pauses are collapsed to this length, 0 keeps them whole
+#define VAD_AUTO_STOP_MS 5000 // Recording stops after this much continuous silence, 0 disables
+
+// Intercom (live full-duplex audio)
+#define INTERCOM_FRAME_SAMPLES 320 // 20 ms frames, also the I2S DMA buffer length while the intercom runs
+#define INTERCOM_DMA_BUF_COUNT 3
+#define INTERCOM_CAPTURE_FRAMES 8 // Captured frames waiting for the uplink; the oldest is dropped when full
+#define INTERCOM_PLAYBACK_SAMPLES 4096 // Downlink ring (power of two)
+#define INTERCOM_JITTER_MS 60 // Downlink audio buffered before playout starts
+#define INTERCOM_ECHO_THRESHOLD 200 // Speaker frame level (mean absolute amplitude) that arms echo suppression
+#define INTERCOM_DOUBLE_TALK_THRESHOLD 2000 // Mic level that counts as the visitor talking over the speaker
+#define INTERCOM_ECHO_ATTENUATION_SHIFT 3 // Mic attenuation while suppressing echo (3 is about -18 dB)
+#define INTERCOM_ECHO_HANGOVER_FRAMES 5 // Frames suppression stays on after the speaker goes quiet
 
 // PIR sensor configuration
 #define PIR_PIN 42
@@ -49,9 +106,24 @@ extern const char *WS_SERVER;
 #define SAMPLE_RATE 16000
 #define BITS_PER_SAMPLE 16
 
+// Microphone sample format (INMP441: 24-bit samples, MSB first, in 32-bit slots)
+#define MIC_SLOT_BITS 32
+#define MIC_SAMPLE_SHIFT 16 // Right shift from a slot to 16-bit PCM; 16 keeps the top bits, each step lower adds 6 dB
+#define MIC_GAIN 256 // Q8 digital gain after DC removal, 256 is unity
+#define AUDIO_PIE_KERNELS 0 // ESP32-S3 SIMD conversion kernels; enable once test/embedded/test_pcm_convert passes on target
+
+// Capture filter chain; coefficients are computed at compile time for SAMPLE_RATE
+#define CAPTURE_FILTER_ENABLED 1
+#define CAPTURE_HIGHPASS_HZ 100 // Cuts wind and traffic rumble
+#define CAPTURE_PRESENCE_HZ 3000 // Centre of the speech presence peak
+#define CAPTURE_PRESENCE_DB 4
+
 // DMA buffer settings
 #define DMA_BUF_COUNT 8
-#define DMA_BUF_LEN 1024
+#define DMA_BUF_LEN 1024 // Samples per playback DMA buffer, the unit the audio task writes
+#define CAPTURE_DMA_BUF_LEN 512 // Mic slots per capture DMA buffer, the unit the audio task reads; 32-bit slots must fit 4092 bytes
+#define CAPTURE_BOUNCE_FRAMES 8 // Captured DMA buffers staged in internal RAM per burst into PSRAM; two stages alternate
+#define I2S_EVENT_QUEUE_SIZE 16
 
 // Fingerprint sensor configuration
 #define FINGERPRINT_TX 1
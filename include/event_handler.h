@@ -28,11 +28,26 @@ private:
     ESPNow &espNow;
     FingerprintHandler &fingerprint;
     PIRSensor &pir;
+    TimerHandle_t displayTimer = nullptr; // Posts DISPLAY_READY once the display is up after motion
 
     void handleTelegramAudioCommand(const Event &event);
 
     void handleAudioDataReceived(const Event &event);
 
+    void handleAudioCredit(const Event &event);
+
+    void handleSetCodec(const Event &event);
+
+    void handleIntercomAudioReady(const Event &event);
+
+    void handleIntercomEnded();
+
+    void handleSpoolChunkReady(const Event &event);
+
+    void handleSpoolSent(const Event &event);
+
+    void handleConnected(const Event &event);
+
     void handleFingerprintMatch(const Event &event);
 
     void handleChangeState(const Event &event);
@@ -50,17 +65,21 @@ private:
 
     void handleResidentAuthorized();
 
-    void handleAccessGranted();
+    void handleAccessGranted(const Event &event);
 
     void handleAccessDenied();
 
     void handleMotionDetected();
 
+    void handleDisplayReady();
+
+    static void displayTimerCallback(TimerHandle_t timer);
+
     void handlePasswordInvalid();
 
     void handlePersonDetected();
 
-    void handleRecordingSent();
+    void handleAudioStreamEnd(const Event &event);
 
     void handleFingerprintEnroll(const Event &event);
 
@@ -0,0 +1,76 @@
+#ifndef EVENT_JOURNAL_H
+#define EVENT_JOURNAL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include "event_types.h"
+
+// Compact binary record of dispatched events. Each record is an 8-byte header followed by its payload:
+//   uint8 type | uint8 flags | uint16 payload length | uint32 timestamp (us) | [typed payload] [data or buffer bytes]
+// Recording and replay need only event_types.h and a BufferPool, so a journal captured on the device replays
+// on a host build against fake back ends (see test/native/test_event_journal).
+struct JournalRecordHeader {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t length;
+    uint32_t timestamp;
+};
+
+enum JournalFlags : uint8_t {
+    JOURNAL_TYPED_PAYLOAD = 1 << 0, // EVENT_PAYLOAD_SIZE bytes of typed payload precede the data
+    JOURNAL_BUFFER = 1 << 1,        // Data travelled in a pooled buffer
+    JOURNAL_TRUNCATED = 1 << 2,     // Data bytes were not captured, only their length
+};
+
+// Ring of journal records over caller-provided memory (PSRAM on the device). When full, the oldest records are dropped.
+class EventJournal {
+public:
+    EventJournal(uint8_t *storage, size_t capacity, bool captureBuffers = false);
+
+    void record(const Event &event, uint32_t timestamp);
+
+    void clear();
+
+    // Copies the journal, oldest record first, into dst. Returns the number of bytes written (whole records only).
+    size_t copyOut(uint8_t *dst, size_t maxLength) const;
+
+    size_t size() const;
+
+    uint32_t recordCount() const;
+
+    uint32_t droppedCount() const;
+
+private:
+    void write(const void *src, size_t length);
+
+    void read(size_t position, void *dst, size_t length) const;
+
+    void dropOldest();
+
+    uint8_t *storage;
+    size_t capacity;
+    bool captureBuffers;
+    size_t head = 0; // Oldest record
+    size_t used = 0;
+    uint32_t records = 0;
+    uint32_t dropped = 0;
+    mutable std::mutex lock;
+};
+
+struct ReplayStats {
+    uint32_t events;
+    uint32_t skipped;
+    uint64_t handlerMicros;
+    uint32_t maxHandlerMicros;
+    uint64_t wallMicros;
+};
+
+// Feeds a journal back, one event at a time, to sink on the calling task. speed scales the recorded
+// inter-event gaps: 1.0 is real time, 10.0 is ten times faster and 0 replays back to back.
+class EventReplayer {
+public:
+    static ReplayStats replay(const uint8_t *journal, size_t length, const EventCallback &sink, float speed);
+};
+
+#endif // EVENT_JOURNAL_H
@@ -0,0 +1,130 @@
+#ifndef EVENT_OUTBOX_H
+#define EVENT_OUTBOX_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+#include "events.h"
+#include "spool_log.h"
+
+// Events that replace any queued event with the same key, so replay only sends the latest
+enum class OutboxKey : uint8_t {
+    NONE = 0,
+    GATE_STATE,
+    LIGHT_STATE,
+    COUNT,
+};
+
+struct OutboxStats {
+    uint32_t queued;         // Events that could not go out straight away
+    uint32_t depth;          // Events waiting now, in RAM and on flash
+    uint32_t maxDepth;
+    uint32_t spilledEvents;  // Moved from RAM to flash during an outage
+    uint32_t spilledBytes;
+    uint32_t coalesced;      // Left out of replay because a later event with the same key replaced them
+    uint32_t dropped;        // Lost because RAM was full and could not spill
+    uint32_t batches;
+    uint32_t replayedEvents;
+    uint32_t lastReplayMs;   // From the link coming back to the queue draining, for the last outage
+};
+
+// Holds serialized events while the WebSocket is down and replays them in order once it is back. Events wait
+// in RAM; a long or busy outage spills them to a SpoolLog on the outbox partition, so they also survive a
+// reboot. Every spill of one outage goes to the same SpoolLog session, closed when the link comes back, so the
+// log's session table does not fill however long the outage lasts. Replay runs on a low-priority task: flash
+// first, then RAM, packed into "event_batch" frames of up to a pool chunk that the dispatcher sends one at a time.
+class EventOutbox {
+public:
+    static void begin(EventDispatcher &dispatcher);
+
+    // True when nothing is waiting, so a new event may be sent directly without overtaking queued ones
+    static bool isEmpty();
+
+    // Queues one serialized event object. Returns false if it was dropped.
+    static bool push(const char *json, size_t length, OutboxKey key);
+
+    static void setOnline(bool online);
+
+    // Called once an OUTBOX_BATCH_READY frame has been handed to the network
+    static void batchSent(bool ok);
+
+    static OutboxStats getStats();
+
+    static void logStats();
+
+private:
+    struct Entry {
+        uint32_t sequence;
+        uint32_t queuedAt; // millis()
+        uint16_t length;
+        OutboxKey key;
+        char json[OUTBOX_MAX_EVENT];
+    };
+
+    // Spilled events are SpoolLog data records: this header, then the JSON
+    struct RecordHeader {
+        uint32_t sequence;
+        uint32_t queuedAt;
+        OutboxKey key;
+        uint8_t reserved[3];
+    };
+
+    static void outboxTask(void *parameter);
+
+    // Reads the spilled events back to restore sequence numbers and the latest event per key
+    static void scanSpilled();
+
+    // Moves the events in RAM to the outage's spill session on flash, opening it on the first spill
+    static void spill();
+
+    // Ends the open spill session so it can be replayed
+    static void closeSpill();
+
+    // Packs the next events into a batch and posts it. Returns false when there is nothing to send.
+    static bool postFlashBatch();
+
+    static bool postRamBatch();
+
+    // Applies the outcome of the batch in flight once the dispatcher has sent it
+    static void finishBatch();
+
+    static bool isSuperseded(uint32_t sequence, OutboxKey key);
+
+    // Appends an event to the batch being packed. Returns false if it does not fit.
+    static bool addToBatch(const char *json, size_t length, uint32_t queuedAt, bool thisBoot);
+
+    static bool postBatch();
+
+    static void wake();
+
+    static EventDispatcher *eventDispatcher;
+    static TaskHandle_t taskHandle;
+    static SpoolLog *log;
+
+    // RAM queue, filled by any task under the lock and drained only by the outbox task
+    static Entry *entries;
+    static size_t head;
+    static size_t count;
+    static uint32_t nextSequence;
+    static uint32_t latest[static_cast<size_t>(OutboxKey::COUNT)]; // Sequence of the newest event per key
+
+    // Outbox task side
+    static uint32_t nextSession;
+    static uint32_t spillSession; // Open for the current outage, 0 if nothing has spilled since the link went down
+    static uint32_t bootSession; // Spill sessions up to this id were written before this boot
+    static std::atomic<uint32_t> flashEvents; // Spilled events not yet replayed
+    static PooledBuffer batch;
+    static size_t batchEvents;
+    static size_t batchRecords;   // Events the batch covers, coalesced ones included
+    static bool batchFromFlash;
+    static uint32_t batchSession;
+    static uint32_t batchEnd;     // Offset in the spill session just past the batch
+    static uint32_t onlineAt;
+
+    static std::atomic<bool> online;
+    static std::atomic<bool> batchInFlight;
+    static std::atomic<bool> batchOk;
+    static OutboxStats stats;
+};
+
+#endif // EVENT_OUTBOX_H
@@ -0,0 +1,232 @@
+#ifndef EVENT_TYPES_H
+#define EVENT_TYPES_H
+
+#include <new>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include "buffer_pool.h"
+#include "audio_codec.h"
+
+// Events, their payloads and callbacks. Nothing here needs FreeRTOS, so the event journal and host tests can
+// use it without the dispatcher in events.h.
+
+using EventType = uint8_t;
+
+enum class Device : uint8_t {
+    GATE,
+    LIGHT,
+};
+
+struct ChangeStateCommand {
+    Device device;
+    bool on; // Open for the gate
+};
+
+struct EnrollFingerprintCommand {
+    uint8_t id;
+};
+
+struct AudioCredit {
+    uint32_t offset; // Stream offset the server may send up to, counted in decoded PCM bytes
+};
+
+struct AudioStreamEnd {
+    uint32_t bytes;
+    uint32_t stoppedAt; // micros() when recording stopped
+};
+
+struct RecordingStart {
+    uint32_t session; // Spool session, filled in by the spool
+    uint16_t sampleRate;
+    AudioCodecType codec;
+};
+
+struct SpoolPosition {
+    uint32_t session;
+    uint32_t offset; // Bytes into the recording
+};
+
+struct CodecSelection {
+    AudioCodecType uplink;   // Recording upload
+    AudioCodecType downlink; // Prefetch download
+    uint16_t uplinkRate;     // Hz
+    uint16_t downlinkRate;
+};
+
+// Maps an event type to the struct it carries. Only specialised types (see below the Events enum) have a
+// typed payload, so posting or reading a payload on any other type fails to compile.
+template<EventType Type>
+struct EventPayload;
+
+constexpr size_t EVENT_PAYLOAD_SIZE = 8;
+
+struct Event {
+    EventType type;
+    std::string data;
+    size_t dataLength;
+    PooledBuffer buffer; // Bulk payload (audio); shared by reference instead of copied
+    uint32_t postedAt; // micros() when queued, 0 for synchronous dispatch
+
+    Event() : type(0), dataLength(0), postedAt(0) {}
+
+    Event(EventType t, const std::string &d = "", size_t s = 0) : type(t), data(d), dataLength(s == 0 ? d.size() : s), postedAt(0) {}
+
+    Event(EventType t, PooledBuffer b) : type(t), dataLength(b.size()), buffer(std::move(b)), postedAt(0) {}
+
+    template<EventType Type>
+    static Event of(const typename EventPayload<Type>::type &payload) {
+        using T = typename EventPayload<Type>::type;
+        static_assert(sizeof(T) <= EVENT_PAYLOAD_SIZE, "Payload too large for Event");
+        static_assert(std::is_trivially_copyable<T>::value, "Payload must be trivially copyable");
+        Event event(Type);
+        memcpy(event.payloadStorage, &payload, sizeof(T));
+        return event;
+    }
+
+    template<EventType Type>
+    const typename EventPayload<Type>::type &payload() const {
+        return *reinterpret_cast<const typename EventPayload<Type>::type *>(payloadStorage);
+    }
+
+private:
+    friend class EventJournal;
+    friend class EventReplayer;
+
+    alignas(4) unsigned char payloadStorage[EVENT_PAYLOAD_SIZE]{};
+};
+
+// Heap-free callable with inline storage. Accepts trivially copyable callables up to STORAGE_SIZE bytes
+// (e.g. lambdas capturing `this`) or a bound member function. Two delegates compare equal when they
+// invoke the same code on the same captured state, which is what duplicate detection relies on. A bound
+// method is the same code wherever it is bound; every lambda expression is its own type, so the same
+// lambda written twice is two different callbacks. Keep the delegate to unregister a lambda later.
+class EventCallback {
+public:
+    static constexpr size_t STORAGE_SIZE = 2 * sizeof(void *);
+
+    EventCallback() = default;
+
+    template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, EventCallback>::value>::type>
+    EventCallback(F function) {
+        static_assert(sizeof(F) <= STORAGE_SIZE, "Callback capture too large for inline storage");
+        static_assert(std::is_trivially_copyable<F>::value, "Callback capture must be trivially copyable");
+        new(storage) F(function);
+        invoker = [](const void *s, const Event &event) { (*static_cast<const F *>(s))(event); };
+    }
+
+    template<typename T, void (T::*Method)(const Event &)>
+    static EventCallback bind(T *object) {
+        EventCallback callback;
+        memcpy(callback.storage, &object, sizeof(object));
+        callback.invoker = [](const void *s, const Event &event) { ((*static_cast<T *const *>(s))->*Method)(event); };
+        return callback;
+    }
+
+    void operator()(const Event &event) const { invoker(storage, event); }
+
+    explicit operator bool() const { return invoker != nullptr; }
+
+    bool operator==(const EventCallback &other) const {
+        return invoker == other.invoker && memcmp(storage, other.storage, STORAGE_SIZE) == 0;
+    }
+
+private:
+    using Invoker = void (*)(const void *, const Event &);
+
+    alignas(void *) unsigned char storage[STORAGE_SIZE]{};
+    Invoker invoker = nullptr;
+};
+
+enum Events : EventType {
+    WS_CONNECTED = 0,
+    CMD_TG_AUDIO,
+    CMD_ESP_AUDIO,
+    FINGERPRINT_MATCHED,
+    FINGERPRINT_NO_MATCH,
+    AUDIO_DATA_RECEIVED,
+    ESPNOW_DATA_RECEIVED,
+    MOTION_DETECTED,
+    CMD_CHANGE_STATE,
+    INACTIVITY_DETECTED,
+    GATE_OPENED,
+    GATE_CLOSED,
+    LED_TURNED_ON,
+    PERSON_DETECTED,
+    LED_TURNED_OFF,
+    PASSWORD_VALID,
+    PASSWORD_INVALID,
+    CMD_GRANT_ACCESS,
+    CMD_DENY_ACCESS,
+    AUDIO_DATA_READY,
+    AUDIO_STREAM_END,
+    NO_AUDIO_DATA,
+    VISITOR_ENTERED,
+    CMD_ENROLL_FINGERPRINT,
+    PLACE_FINGER,
+    PLACE_FINGER_AGAIN,
+    REMOVE_FINGER,
+    FINGERPRINT_ENROLLED,
+    FINGERPRINT_ENROLL_FAILED,
+    MOTION_ENABLE,
+    DISABLE_STATUS_LED,
+    AUDIO_CREDIT,
+    CMD_SET_CODEC,
+    INTERCOM_AUDIO_READY,
+    INTERCOM_ENDED,
+    WS_DISCONNECTED,
+    RECORDING_STARTED,
+    SPOOL_CHUNK_READY,
+    SPOOL_SENT,
+    SPOOL_ACK,
+    OUTBOX_BATCH_READY,
+    DISPLAY_READY, // The display woken by motion has had time to power up
+};
+
+template<>
+struct EventPayload<CMD_CHANGE_STATE> {
+    using type = ChangeStateCommand;
+};
+
+template<>
+struct EventPayload<CMD_ENROLL_FINGERPRINT> {
+    using type = EnrollFingerprintCommand;
+};
+
+template<>
+struct EventPayload<AUDIO_CREDIT> {
+    using type = AudioCredit;
+};
+
+template<>
+struct EventPayload<CMD_SET_CODEC> {
+    using type = CodecSelection;
+};
+
+template<>
+struct EventPayload<AUDIO_STREAM_END> {
+    using type = AudioStreamEnd;
+};
+
+template<>
+struct EventPayload<RECORDING_STARTED> {
+    using type = RecordingStart;
+};
+
+template<>
+struct EventPayload<SPOOL_CHUNK_READY> {
+    using type = SpoolPosition;
+};
+
+template<>
+struct EventPayload<SPOOL_SENT> {
+    using type = SpoolPosition;
+};
+
+template<>
+struct EventPayload<SPOOL_ACK> {
+    using type = SpoolPosition;
+};
+
+#endif // EVENT_TYPES_H
@@ -1,74 +1,182 @@
 #ifndef EVENTS_H
 #define EVENTS_H
 
-#include <functional>
-#include <vector>
-#include <bitset>
+#include <atomic>
+#include <memory>
 #include <cstdint>
-#include <string>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "event_types.h"
+#include "event_journal.h"
 
 constexpr size_t MAX_EVENTS = 128;
 
-using EventType = uint8_t;
+// Bounded lock-free queue (Vyukov ring). Any number of producers, including ISRs, may push concurrently
+// with the dispatcher task popping. Capacity is rounded up to a power of two.
+class EventQueue {
+public:
+    explicit EventQueue(size_t capacity);
+
+    bool push(Event &&event);
+
+    bool pop(Event &event);
+
+    size_t size() const;
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Event event;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    std::atomic<size_t> enqueuePos;
+    std::atomic<size_t> dequeuePos;
+};
+
+// Dispatch lanes. Each has its own task, so a slow handler only holds up its own lane, and the critical
+// lane's task runs one priority above the others so it preempts their handlers.
+enum class EventClass : uint8_t {
+    CRITICAL = 0, // Safety and access control
+    INTERACTIVE,  // UI feedback and ordinary commands
+    BULK,         // Audio payloads, and the events that start, stop or reconfigure their streams
+};
 
-struct Event {
-    EventType type;
-    std::string data;
-    size_t dataLength;
+constexpr size_t EVENT_CLASS_COUNT = 3;
+constexpr size_t LATENCY_BUCKETS = 16;
 
-    Event(EventType t, const std::string &d = "", size_t s = 0) : type(t), data(d), dataLength(s == 0 ? d.size() : s) {}
+// Queue-to-dispatch latency, bucket i counts events that waited [2^(i-1), 2^i) microseconds; the last bucket is open-ended
+struct LatencyHistogram {
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t maxMicros;
 };
 
-using EventCallback = std::function<void(const Event &)>;
+struct EventQueueStats {
+    uint32_t posted;
+    uint32_t dispatched;
+    uint32_t dropped;
+    size_t depth;
+    size_t highWatermark;
+};
 
 class EventDispatcher {
 public:
-    void registerCallback(EventType type, EventCallback callback);
+    // Starts one dispatcher task per lane. Events posted before begin() are dropped.
+    void begin(size_t queueCapacity, UBaseType_t priority, BaseType_t core);
+
+    // callbackCapacity bounds the subscriptions across all event types
+    explicit EventDispatcher(size_t callbackCapacity);
 
+    // Returns false if the type is out of range, the callback is already registered or every subscription
+    // slot is taken. Safe while events are being dispatched.
+    bool registerCallback(EventType type, EventCallback callback);
+
+    // Safe while events are being dispatched, but a call already under way on the dispatcher may still be
+    // running when this returns.
+    bool unregisterCallback(EventType type, const EventCallback &callback);
+
+    // Runs the callbacks synchronously on the calling task. Handlers of different lanes can run at the same
+    // time; within a lane they run one at a time, in the order their events were posted.
     void dispatchEvent(const Event &event);
 
+    // Queues the event on its class's lane for that lane's task. Returns false if the lane is full.
+    bool post(const Event &event);
+
+    bool post(Event &&event);
+
+    // ISR-safe variant; carries no payload so nothing is allocated in interrupt context.
+    bool postFromISR(EventType type, BaseType_t *higherPriorityTaskWoken);
+
+    EventQueueStats getStats() const;
+
+    LatencyHistogram getLatencyHistogram(EventClass eventClass) const;
+
+    void logStats() const;
+
+    // Every dispatched event is also written to the journal; pass nullptr to stop recording
+    void setRecorder(EventJournal *journal) { recorder = journal; }
+
+    // Feeds a journal through the callbacks on the calling task, see EventReplayer. Recording pauses
+    // meanwhile, so the replayed events are not journalled a second time.
+    ReplayStats replay(const uint8_t *journal, size_t length, float speed);
+
+    EventJournal *getRecorder() const { return recorder; }
+
 private:
-    struct CallbackEntry {
-        EventType type;
+    [[noreturn]] static void dispatcherTask(void *parameter);
+
+    // Pops and dispatches one event from the lane. Returns false if it had no published event.
+    bool dispatchNext(size_t lane, Event &event);
+
+    void recordDepth();
+
+    void recordLatency(const Event &event);
+
+    bool enqueue(size_t lane, Event &&event);
+
+    static constexpr uint16_t NO_SUBSCRIBER = UINT16_MAX;
+
+    // Subscriptions come from one pool and each event type chains its own, so dispatch only visits the type's
+    // subscribers. A node never moves or leaves its chain: unregistering clears it for reuse by the same type,
+    // so the dispatcher can walk a chain while another task changes it.
+    struct Subscriber {
         EventCallback callback;
+        std::atomic<uint16_t> next{NO_SUBSCRIBER};
     };
 
-    std::vector<CallbackEntry> callbacks;
-    std::bitset<MAX_EVENTS> registeredEvents;
-};
+    std::unique_ptr<Subscriber[]> subscribers;
+    size_t subscriberCapacity;
+    size_t subscriberCount = 0;
+    std::atomic<uint16_t> chains[MAX_EVENTS];
+    EventJournal *recorder = nullptr;
 
-enum Events : EventType {
-    WS_CONNECTED = 0,
-    CMD_TG_AUDIO,
-    CMD_ESP_AUDIO,
-    FINGERPRINT_MATCHED,
-    FINGERPRINT_NO_MATCH,
-    AUDIO_DATA_RECEIVED,
-    ESPNOW_DATA_RECEIVED,
-    MOTION_DETECTED,
-    CMD_CHANGE_STATE,
-    INACTIVITY_DETECTED,
-    GATE_OPENED,
-    GATE_CLOSED,
-    LED_TURNED_ON,
-    PERSON_DETECTED,
-    LED_TURNED_OFF,
-    PASSWORD_VALID,
-    PASSWORD_INVALID,
-    CMD_GRANT_ACCESS,
-    CMD_DENY_ACCESS,
-    AUDIO_DATA_READY,
-    RECORDING_SENT,
-    NO_AUDIO_DATA,
-    VISITOR_ENTERED,
-    CMD_ENROLL_FINGERPRINT,
-    PLACE_FINGER,
-    PLACE_FINGER_AGAIN,
-    REMOVE_FINGER,
-    FINGERPRINT_ENROLLED,
-    FINGERPRINT_ENROLL_FAILED,
-    MOTION_ENABLE,
-    DISABLE_STATUS_LED,
+    // What a lane's task needs, passed as its parameter
+    struct LaneTask {
+        EventDispatcher *dispatcher;
+        size_t lane;
+    };
+
+    std::unique_ptr<EventQueue> queues[EVENT_CLASS_COUNT];
+    SemaphoreHandle_t pending[EVENT_CLASS_COUNT] = {}; // Counts each lane's published events
+    LaneTask laneTasks[EVENT_CLASS_COUNT];
+    std::atomic<uint32_t> postedCount{0};
+    std::atomic<uint32_t> dispatchedCount{0};
+    std::atomic<uint32_t> droppedCount{0};
+    std::atomic<size_t> highWatermark{0};
+    std::atomic<uint32_t> latencyBuckets[EVENT_CLASS_COUNT][LATENCY_BUCKETS]{};
+    std::atomic<uint32_t> maxLatency[EVENT_CLASS_COUNT]{};
 };
 
-#endif // EVENTS_H
\ No newline at end of file
+
+inline EventClass eventClassOf(EventType type) {
+    switch (type) {
+        case CMD_GRANT_ACCESS:
+        case CMD_DENY_ACCESS:
+        case CMD_CHANGE_STATE:
+        case FINGERPRINT_MATCHED:
+        case PASSWORD_VALID:
+        case GATE_OPENED:
+        case GATE_CLOSED:
+        case VISITOR_ENTERED:
+            return EventClass::CRITICAL;
+        case AUDIO_DATA_READY:
+        case INTERCOM_AUDIO_READY:
+        case AUDIO_DATA_RECEIVED:
+        case AUDIO_STREAM_END: // Must stay behind the chunks it terminates
+        case RECORDING_STARTED: // Must stay ahead of the chunks it starts
+        case SPOOL_CHUNK_READY:
+        case SPOOL_SENT:
+        // Server audio commands and codec changes control the downlink stream, so they must not overtake
+        // AUDIO_DATA_RECEIVED chunks sent before them (a stop_prefetch ahead of the tail would drop it)
+        case CMD_TG_AUDIO:
+        case CMD_SET_CODEC:
+            return EventClass::BULK;
+        default:
+            return EventClass::INTERACTIVE;
+    }
+}
+
+#endif // EVENTS_H
@@ -0,0 +1,46 @@
+#ifndef FRAME_PROTOCOL_H
+#define FRAME_PROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+
+enum class FrameType : uint8_t {
+    AUDIO = 1, // Recording upload, streamed live
+    TALK,      // Intercom uplink
+    SPOOL,     // Recording replayed from the flash spool
+    JOURNAL,   // Event journal dump
+};
+
+enum FrameFlags : uint8_t {
+    FRAME_FIRST = 0x01, // First frame of the stream
+    FRAME_LAST = 0x02,  // Stream complete; a frame carrying only this flag has no payload
+};
+
+// Starts every binary frame the device sends, little-endian. The server tells streams apart by type and
+// stream id and places each payload at its offset, so a replayed or duplicated frame is harmless.
+struct FrameHeader {
+    uint8_t version;    // FrameCodec::VERSION
+    uint8_t type;       // FrameType
+    uint8_t flags;      // FrameFlags
+    uint8_t headerSize; // Payload starts this many bytes into the frame; later versions may grow the header
+    uint32_t stream;    // Spool session for AUDIO and SPOOL, intercom session for TALK
+    uint32_t sequence;  // Frame number within the stream, from 0
+    uint32_t offset;    // Byte offset of the payload within the stream
+};
+
+class FrameCodec {
+public:
+    static constexpr uint8_t VERSION = 1;
+    static constexpr size_t HEADER_SIZE = sizeof(FrameHeader);
+
+    // Writes the header into the HEADER_SIZE bytes in front of payload and returns the start of the frame
+    static uint8_t *encode(const FrameHeader &header, uint8_t *payload);
+
+    // Returns false if the frame is too short or from an unknown version
+    static bool decode(const uint8_t *frame, size_t length, FrameHeader &header, const uint8_t *&payload,
+                       size_t &payloadLength);
+
+    static const char *name(FrameType type);
+};
+
+#endif // FRAME_PROTOCOL_H
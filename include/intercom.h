@@ -0,0 +1,134 @@
+#ifndef INTERCOM_H
+#define INTERCOM_H
+
+#include <Arduino.h>
+#include <driver/i2s.h>
+#include <atomic>
+#include "events.h"
+#include "audio_codec.h"
+
+struct IntercomStats {
+    uint32_t framesCaptured;
+    uint32_t framesSent;
+    uint32_t framesDropped;    // Captured frames dropped because the uplink backed up
+    uint32_t framesPlayed;
+    uint32_t underruns;        // Playout frames filled with silence
+    uint32_t overflowSamples;  // Downlink samples dropped because the ring was full
+    uint32_t framesSkipped;    // Playout frames skipped to pull latency back down
+    uint32_t suppressedFrames; // Mic frames attenuated by the echo suppressor
+    uint64_t captureWaitUs;    // Time frames spent in the capture ring, summed over framesSent
+    uint64_t dispatchWaitUs;   // Time frames spent in the event queue, summed over framesSent
+    uint32_t maxDispatchWaitUs;
+    uint64_t playoutFillSamples; // Downlink ring fill at each played frame, summed over framesPlayed
+};
+
+// Single-producer single-consumer ring of samples. The dispatcher writes downlink audio, the intercom task plays it.
+class SampleRing {
+public:
+    bool begin(size_t capacity); // Power of two
+
+    size_t size() const { return head.load() - tail.load(); }
+
+    size_t space() const { return capacity - size(); }
+
+    // Contiguous free samples at the write position; fill them, then commit
+    int16_t *writeRegion(size_t &count);
+
+    void commitWrite(size_t count) { head.store(head.load() + count); }
+
+    size_t read(int16_t *dst, size_t count);
+
+    void skip(size_t count) { tail.store(tail.load() + count); }
+
+    void clear() { tail.store(head.load()); }
+
+private:
+    int16_t *samples = nullptr;
+    size_t capacity = 0;
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+};
+
+// Live full-duplex audio: I2S_NUM_0 capture and I2S_NUM_1 playback run together on one task, paced by the
+// capture DMA. Frames go up as INTERCOM_AUDIO_READY TALK frames in the uplink codec; while the intercom
+// is active, downlink binary frames feed its playback ring instead of the message buffer.
+class Intercom {
+public:
+    static void begin(EventDispatcher &dispatcher);
+
+    static bool start();
+
+    static void stop();
+
+    static bool isActive() { return active; }
+
+    // Names the TALK frame stream; a new one each start()
+    static uint32_t sessionId() { return session; }
+
+    static void setCodecs(AudioCodecType uplink, AudioCodecType downlink);
+
+    static void addPlaybackData(const uint8_t *data, size_t length);
+
+    // Called once an INTERCOM_AUDIO_READY frame has been handed to the network
+    static void frameSent(uint32_t postedAt);
+
+    static IntercomStats getStats();
+
+    // Device-side share of the mouth-to-ear latency, in milliseconds
+    static uint32_t captureLatencyMs();
+
+    static uint32_t uplinkLatencyMs();
+
+    static uint32_t jitterLatencyMs();
+
+    static uint32_t playoutLatencyMs();
+
+private:
+    static void intercomTask(void *parameter);
+
+    static void captureFrame();
+
+    static void publishFrames();
+
+    static void playFrame();
+
+    // Ducks the mic while the speaker is loud, unless the visitor is clearly talking over it
+    static void suppressEcho(int16_t *frame);
+
+    static void logLatencyBudget();
+
+    static EventDispatcher *eventDispatcher;
+    static TaskHandle_t taskHandle;
+    static const i2s_config_t i2sConfigRx;
+    static const i2s_config_t i2sConfigTx;
+
+    static volatile bool active;
+    static uint32_t session;
+    static volatile bool stopRequested;
+    static AudioCodecType uplinkCodec;
+    static AdpcmState uplinkAdpcm;
+    static AudioCodecType downlinkCodec;
+
+    // Capture ring of whole frames, only touched by the intercom task
+    static int16_t *captureFrames;
+    static uint32_t *captureTimes; // micros() when each frame was read
+    static size_t captureHead;
+    static size_t captureTail;
+    static std::atomic<uint32_t> framesInFlight;
+
+    static int32_t *captureSlots; // One frame of raw microphone slots
+    static int32_t micDcOffset;
+
+    static SampleRing playbackRing;
+    static int16_t *playbackFrame;
+    static bool playing;
+
+    // Echo suppressor state
+    static uint32_t speakerLevel;
+    static uint32_t hangoverFrames;
+    static int32_t micGain; // Q8, ramped across each frame
+
+    static IntercomStats stats;
+};
+
+#endif // INTERCOM_H
@@ -0,0 +1,68 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Streams JSON into a fixed buffer, with no intermediate document. Running out of room is sticky: later writes
+// are ignored and ok() turns false, so a caller checks once at the end and never sends a truncated text.
+class JsonWriter {
+public:
+    JsonWriter(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+    JsonWriter &beginObject();
+
+    JsonWriter &endObject();
+
+    JsonWriter &key(const char *name);
+
+    JsonWriter &value(const char *text);
+
+    JsonWriter &value(bool flag) { return raw(flag ? "true" : "false"); }
+
+    JsonWriter &value(int number) { return writeSigned(number); }
+
+    JsonWriter &value(long number) { return writeSigned(number); }
+
+    JsonWriter &value(long long number) { return writeSigned(number); }
+
+    JsonWriter &value(unsigned int number) { return writeUnsigned(number); }
+
+    JsonWriter &value(unsigned long number) { return writeUnsigned(number); }
+
+    JsonWriter &value(unsigned long long number) { return writeUnsigned(number); }
+
+    template<typename T>
+    JsonWriter &field(const char *name, T fieldValue) {
+        key(name);
+        return value(fieldValue);
+    }
+
+    size_t length() const { return used; }
+
+    bool ok() const { return !overflowed; }
+
+private:
+    JsonWriter &writeSigned(long long number);
+
+    JsonWriter &writeUnsigned(unsigned long long number);
+
+    // Writes the comma a value needs when it is not the first in its object
+    void separate();
+
+    JsonWriter &raw(const char *text);
+
+    void put(char c);
+
+    void put(const char *text, size_t length);
+
+    char *buffer;
+    size_t capacity;
+    size_t used = 0;
+    uint32_t open = 0;     // Bit per nesting level: set once the object has a member
+    uint8_t depth = 0;
+    bool afterKey = false; // The next value belongs to the key just written
+    bool overflowed = false;
+};
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,120 @@
+#ifndef MESSAGE_STORE_H
+#define MESSAGE_STORE_H
+
+#include <cstdint>
+#include <cstddef>
+
+enum class MessageDirection : uint8_t {
+    INBOUND = 0, // Owner message prefetched from the server, played to the visitor
+    OUTBOUND,    // Visitor message recorded here, uploaded to the server
+};
+
+struct MessageInfo {
+    uint16_t id;
+    MessageDirection direction;
+    bool played;        // Inbound: played to the visitor. Outbound: fully handed to the network.
+    size_t length;      // Bytes written, including any released by release()
+    uint32_t timestamp; // millis() when the message was created
+};
+
+struct StoredMessage {
+    MessageInfo info;
+    uint16_t firstSlab;
+    uint16_t lastSlab;
+    uint16_t slabCount;
+    size_t baseOffset;   // Message offset where firstSlab starts; release() moves it forward
+    uint16_t cursorSlab; // Last slab looked up, so sequential reads do not walk the chain from the start
+    size_t cursorOffset;
+};
+
+struct MessageStoreStats {
+    size_t slabCount;
+    size_t freeSlabs;
+    size_t minFreeSlabs;
+    size_t messages;
+    size_t storedBytes; // Audio held in slabs
+    size_t slackBytes;  // Unused tail of each message's last slab. Slabs are fixed-size, so this is the only fragmentation.
+    uint32_t evictions;
+    uint32_t allocationFailures;
+};
+
+// Audio messages in PSRAM, each a chain of fixed-size slabs taken from one free list, so allocating or
+// freeing a slab is O(1) and any free slab fits any message. Several inbound and outbound messages can be
+// queued at once. When a message needs a slab and none is free, the oldest played message is evicted;
+// unplayed messages are never evicted, the write fails instead.
+class MessageStore {
+public:
+    static bool begin(size_t capacity);
+
+    // Returns the new message's id, or 0 if the index is full of unplayed messages
+    static uint16_t create(MessageDirection direction);
+
+    static void remove(uint16_t id);
+
+    static bool getInfo(uint16_t id, MessageInfo &info);
+
+    // Oldest unplayed message in the given direction, or 0
+    static uint16_t nextUnplayed(MessageDirection direction);
+
+    static void markPlayed(uint16_t id);
+
+    static size_t length(uint16_t id);
+
+    // Bytes that can still be appended to the message, counting free slabs and slabs held by played messages
+    static size_t writableBytes(uint16_t id);
+
+    // Contiguous space at the end of the message, taking a new slab when the last one is full.
+    // Returns nullptr if no slab can be had. Fill it, then commitWrite().
+    static uint8_t *writeRegion(uint16_t id, size_t &length);
+
+    static void commitWrite(uint16_t id, size_t length);
+
+    // Appends across slab boundaries. Returns the bytes written, short if the store ran out of slabs.
+    static size_t write(uint16_t id, const uint8_t *data, size_t length);
+
+    // Contiguous bytes at offset, up to the end of its slab or the message. Returns nullptr past the end.
+    static uint8_t *readRegion(uint16_t id, size_t offset, size_t &length);
+
+    // Shortens the message, freeing slabs beyond the new end
+    static void truncate(uint16_t id, size_t length);
+
+    // Drops the first `bytes` bytes and moves the rest to the front. Costs a copy of the remainder.
+    static void discardFront(uint16_t id, size_t bytes);
+
+    // Frees slabs that lie wholly before offset, so a message can be played while it is still arriving
+    // without holding all of it. Released bytes can no longer be read.
+    static void release(uint16_t id, size_t offset);
+
+    static MessageStoreStats getStats();
+
+    static void logStats();
+
+private:
+    // The following expect storeLock to be held
+    static StoredMessage *find(uint16_t id);
+
+    static StoredMessage *findFree();
+
+    // A slab for the message `forId`, which is never evicted to make room for itself
+    static uint16_t allocateSlab(uint16_t forId);
+
+    static void freeSlabs(uint16_t first, uint16_t last, uint16_t count);
+
+    static bool evictOldestPlayed(uint16_t keepId);
+
+    // Slab holding offset, and the message offset where that slab starts
+    static uint16_t slabAt(StoredMessage &message, size_t offset, size_t &slabStart);
+
+    static uint8_t *memory;
+    static uint16_t *nextSlab; // Free list and message chains share one link per slab
+    static size_t slabCount;
+    static uint16_t freeHead;
+    static size_t freeCount;
+    static size_t minFree;
+    static uint32_t evictions;
+    static uint32_t allocationFailures;
+    static uint16_t lastId;
+    static StoredMessage messages[];
+};
+
+#endif // MESSAGE_STORE_H
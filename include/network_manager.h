@@ -3,7 +3,37 @@
 
 #include "WebSocketsClient.h"
 #include "events.h"
-#include "ArduinoJson.h"
+#include "frame_protocol.h"
+#include "event_outbox.h"
+#include "json_writer.h"
+
+// An outbound event, serialized as it is built into a buffer of its own: {"event_type":...,"data":{...}}. Room
+// is left in front for the WebSocket header, so the text is sent from where it was written. It takes nothing
+// from the buffer pool, so an event is never lost to audio holding every chunk.
+class OutboundEvent {
+public:
+    explicit OutboundEvent(const char *eventType);
+
+    template<typename T>
+    OutboundEvent &add(const char *name, T value) {
+        json.field(name, value);
+        return *this;
+    }
+
+    const char *type() const { return eventType; }
+
+private:
+    friend class NetworkManager;
+
+    // Closes the text. Logs and returns false if it did not fit.
+    bool finish();
+
+    uint8_t *text() { return buffer + WEBSOCKETS_MAX_HEADER_SIZE; }
+
+    const char *eventType;
+    uint8_t buffer[WEBSOCKETS_MAX_HEADER_SIZE + OUTBOX_MAX_EVENT];
+    JsonWriter json;
+};
 
 class NetworkManager {
 public:
@@ -11,9 +41,33 @@ public:
 
     [[noreturn]] static void loop(void *pvParameters);
 
-    static void sendAudioChunk(const uint8_t *data, size_t len);
+    // Sends a chunk as one binary frame at the given stream offset. The frame and WebSocket headers are written
+    // into the chunk's headroom, so the payload is sent in place. Returns false if the write did not happen.
+    static bool sendFrameAt(const PooledBuffer &chunk, FrameType type, uint32_t stream, uint32_t offset, uint8_t flags = 0);
 
-    static void sendEvent(const char *eventType, const JsonObject &data);
+    // Sends a chunk as the continuation of the stream's previous frame
+    static bool sendFrame(const PooledBuffer &chunk, FrameType type, uint32_t stream, uint8_t flags = 0);
+
+    // Sends an empty FRAME_LAST frame at the end of the stream's previous frame
+    static bool endStream(FrameType type, uint32_t stream);
+
+    // Bytes framed so far for the stream, sent or not; 0 for a stream that has not started
+    static uint32_t streamOffset(FrameType type, uint32_t stream);
+
+    static void sendEvent(OutboundEvent &event);
+
+    // Like sendEvent, but an event that cannot go out now waits in the outbox and is replayed on reconnect.
+    // A queued event with the same key is replaced by this one.
+    static void queueEvent(OutboundEvent &event, OutboxKey key = OutboxKey::NONE);
+
+    // Sends a chunk holding JSON text as one text frame, the WebSocket header written into its headroom
+    static bool sendText(const PooledBuffer &chunk);
+
+    // Same for text with WEBSOCKETS_MAX_HEADER_SIZE bytes free in front of it
+    static bool sendText(uint8_t *text, size_t length);
+
+    // Sends the recorded event journal as a JOURNAL frame
+    static void sendJournal();
 
     [[noreturn]] static void reconnectTask(void *pvParameters);
 
@@ -22,8 +76,19 @@ public:
 private:
     static void webSocketEvent(WStype_t type, uint8_t *payload, size_t length);
 
+    // Per frame type, the stream last sent and where it got to
+    struct FrameStream {
+        uint32_t stream;
+        uint32_t sequence;
+        uint32_t offset;
+        bool started;
+    };
+
+    static FrameStream &frameStream(FrameType type);
+
     static EventDispatcher *eventDispatcher;
     static WebSocketsClient webSocket;
+    static FrameStream frameStreams[];
 
 };
 
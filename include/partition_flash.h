@@ -0,0 +1,30 @@
+#ifndef PARTITION_FLASH_H
+#define PARTITION_FLASH_H
+
+#include <esp_partition.h>
+#include "spool_log.h"
+
+// SpoolFlash bound to a data partition
+class PartitionFlash : public SpoolFlash {
+public:
+    explicit PartitionFlash(const esp_partition_t *partition) : partition(partition) {}
+
+    size_t size() const override { return partition->size; }
+
+    bool read(size_t offset, void *dst, size_t length) override {
+        return esp_partition_read(partition, offset, dst, length) == ESP_OK;
+    }
+
+    bool write(size_t offset, const void *src, size_t length) override {
+        return esp_partition_write(partition, offset, src, length) == ESP_OK;
+    }
+
+    bool erase(size_t offset, size_t length) override {
+        return esp_partition_erase_range(partition, offset, length) == ESP_OK;
+    }
+
+private:
+    const esp_partition_t *partition;
+};
+
+#endif // PARTITION_FLASH_H
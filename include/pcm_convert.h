@@ -0,0 +1,36 @@
+#ifndef PCM_CONVERT_H
+#define PCM_CONVERT_H
+
+#include <cstdint>
+#include <cstddef>
+
+constexpr int32_t PCM_UNITY_GAIN = 256; // Gains are Q8
+
+// Sample format kernels for the capture path. The portable scalar versions are the reference, tested on the host
+// by test/native/test_pcm_convert. On the ESP32-S3 removeDcAndGain() can use a PIE SIMD version, behind
+// AUDIO_PIE_KERNELS, that must match it bit for bit; test/embedded/test_pcm_convert checks that and times every
+// kernel. narrow32() stays scalar: PIE has no saturating 32-to-16 narrowing, and its 128-bit loads cannot stride
+// over the other channel's slots. So does mean(), until that benchmark shows it matters.
+class PcmConvert {
+public:
+    // Narrows `frames` 32-bit I2S slots to 16-bit PCM as (slot >> shift) saturated. With interleaved channels,
+    // `channel` of every `channels` slots is kept, so stereo is reduced to mono in the same pass.
+    static void narrow32(const int32_t *src, int16_t *dst, size_t frames, uint8_t shift,
+                         size_t channels = 1, size_t channel = 0);
+
+    static int32_t mean(const int16_t *samples, size_t count);
+
+    // In place: sample = saturate((saturate(sample - offset) * gain) >> 8)
+    static void removeDcAndGain(int16_t *samples, size_t count, int16_t offset, int16_t gain);
+
+    static void removeDcAndGainScalar(int16_t *samples, size_t count, int16_t offset, int16_t gain);
+
+    // Only built for the ESP32-S3, whatever AUDIO_PIE_KERNELS says, so it can be tested before it is enabled
+    static void removeDcAndGainPie(int16_t *samples, size_t count, int16_t offset, int16_t gain);
+
+    static int16_t saturate(int32_t value) {
+        return static_cast<int16_t>(value > INT16_MAX ? INT16_MAX : (value < INT16_MIN ? INT16_MIN : value));
+    }
+};
+
+#endif // PCM_CONVERT_H
@@ -0,0 +1,61 @@
+#ifndef PROMPT_CACHE_H
+#define PROMPT_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Ids are fixed at build time: tools/pack_prompts.py reads this enum and packs prompts/<name>.wav,
+// lower-cased, as the prompt with that id. Append new prompts at the end.
+enum class PromptId : uint8_t {
+    DOORBELL = 0,
+    PLEASE_WAIT,
+    ACCESS_GRANTED,
+    ACCESS_DENIED,
+    TRY_AGAIN,
+    WELCOME,
+};
+
+// Partition image: a header, `count` index entries, then the prompts as 16-bit PCM at SAMPLE_RATE,
+// each 4-byte aligned. All fields little-endian.
+struct PromptImageHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t sampleRate;
+    uint32_t reserved;
+};
+
+struct PromptIndexEntry {
+    uint8_t id;
+    uint8_t reserved[3];
+    uint32_t offset; // From the start of the image
+    uint32_t length; // Bytes
+};
+
+struct Prompt {
+    const int16_t *samples; // In memory-mapped flash
+    size_t length;          // Bytes
+};
+
+// Pre-encoded prompts and chimes in the flash "prompts" partition, mapped into the address space once at
+// boot so they play straight from flash: no network round trip and no copy into PSRAM.
+class PromptCache {
+public:
+    static constexpr uint32_t IMAGE_MAGIC = 0x544D5250; // "PRMT"
+    static constexpr uint16_t IMAGE_VERSION = 1;
+
+    static bool begin();
+
+    // Returns false if the prompt is not in the image
+    static bool find(PromptId id, Prompt &prompt);
+
+    static const char *name(PromptId id);
+
+private:
+    static const uint8_t *image;
+    static size_t imageSize;
+    static const PromptIndexEntry *index;
+    static uint16_t count;
+};
+
+#endif // PROMPT_CACHE_H
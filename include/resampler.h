@@ -0,0 +1,49 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstdint>
+#include <cstddef>
+
+constexpr size_t RESAMPLER_TAPS = 32;     // Taps without decimation; decimating by r takes r times as many
+constexpr size_t RESAMPLER_MAX_TAPS = 96; // Enough for 48 kHz to 16 kHz; larger ratios trade pass band for it
+constexpr int RESAMPLER_PHASE_BITS = 6;
+constexpr size_t RESAMPLER_PHASES = 1 << RESAMPLER_PHASE_BITS;
+constexpr size_t RESAMPLER_BLOCK = 256; // Input samples filtered per pass
+constexpr uint32_t RESAMPLER_MIN_RATE = 8000;
+constexpr uint32_t RESAMPLER_MAX_RATE = 48000;
+
+// Kaiser-windowed sinc polyphase resampler between any two rates, with its stop band starting at the lower
+// rate's Nyquist (about 60 dB down). It runs incrementally over consecutive chunks of one stream, carrying its
+// filter history across calls, so no pass ever needs the whole buffer. An instance is about 13 KB: keep it
+// static, never on a task stack.
+class Resampler {
+public:
+    static bool supports(uint32_t inputRate, uint32_t outputRate);
+
+    // Designs the filter for the pair. Returns false for rates outside RESAMPLER_MIN_RATE..RESAMPLER_MAX_RATE.
+    bool configure(uint32_t inputRate, uint32_t outputRate);
+
+    bool isPassthrough() const { return inputRate == outputRate; }
+
+    void reset();
+
+    // Most samples process() can write for count more input samples
+    size_t maxOutput(size_t inputCount) const;
+
+    // Largest input that is guaranteed to produce at most outputCapacity samples
+    size_t maxInput(size_t outputCapacity) const;
+
+    // Consumes all of input and writes up to maxOutput(count) samples to out. Returns the number written.
+    size_t process(const int16_t *input, size_t count, int16_t *out);
+
+private:
+    uint32_t inputRate = 0;
+    uint32_t outputRate = 0;
+    uint64_t step = 0;     // Input samples per output sample, Q32
+    uint64_t position = 0; // Next output sample, in input samples from window[0], Q32
+    size_t taps = RESAMPLER_TAPS;
+    int16_t coefficients[RESAMPLER_PHASES][RESAMPLER_MAX_TAPS]; // Q14, each phase sums to one
+    int16_t window[RESAMPLER_MAX_TAPS - 1 + RESAMPLER_BLOCK];   // Filter history followed by the current input block
+};
+
+#endif // RESAMPLER_H
@@ -0,0 +1,168 @@
+#ifndef SPOOL_LOG_H
+#define SPOOL_LOG_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Flash as the spool sees it: erase sets bytes to 0xFF in sector units, write can only clear bits.
+// The device binds it to a partition; anything else (a file, a RAM image) can stand in for it.
+class SpoolFlash {
+public:
+    static constexpr size_t SECTOR_SIZE = 4096;
+
+    virtual ~SpoolFlash() = default;
+
+    virtual size_t size() const = 0;
+
+    virtual bool read(size_t offset, void *dst, size_t length) = 0;
+
+    virtual bool write(size_t offset, const void *src, size_t length) = 0;
+
+    virtual bool erase(size_t offset, size_t length) = 0;
+};
+
+enum class SpoolRecordType : uint8_t {
+    BEGIN = 1, // A recording starts. Payload: SpoolBegin
+    DATA,      // One encoded chunk at `offset` in the recording
+    END,       // The recording is complete at `offset` bytes
+    ACK,       // The server holds the recording up to `offset`
+};
+
+// Each segment starts with a header, then records back to back, 4-byte aligned. A record never spans
+// segments. Segments are opened in sequence order and reclaimed oldest first.
+struct SpoolSegmentHeader {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t tailSequence; // Oldest segment still needed when this one was opened; older ones are stale
+    uint32_t eraseCount;   // Times this segment has been erased, carried across erases
+    uint32_t crc;
+};
+
+struct SpoolRecordHeader {
+    SpoolRecordType type;
+    uint8_t reserved;
+    uint16_t length; // Payload bytes that follow
+    uint32_t session;
+    uint32_t offset;
+    uint32_t crc; // CRC-32 of the header with this field zeroed, then the payload
+};
+
+struct SpoolBegin {
+    uint16_t sampleRate;
+    uint8_t codec;
+    uint8_t reserved;
+};
+
+struct SpoolSession {
+    uint32_t id;
+    SpoolBegin format;
+    uint32_t firstSegment; // Sequence of the segment holding the BEGIN record
+    uint32_t written;      // Bytes spooled
+    uint32_t acked;        // Highest contiguous offset the server confirmed
+    bool ended;
+    bool truncated; // Chunks were lost because the spool was full
+};
+
+struct SpoolLogStats {
+    uint32_t segments;
+    uint32_t liveSegments;
+    uint32_t pendingSessions; // Ended and not fully acknowledged
+    uint32_t pendingBytes;
+    uint32_t bytesWritten;
+    uint32_t recordsWritten;
+    uint32_t droppedBytes; // Chunks refused because every segment held unacknowledged audio
+    uint32_t tornRecords;  // Partly written records found when mounting, from a power cut
+    uint32_t erases;
+    uint32_t minEraseCount;
+    uint32_t maxEraseCount;
+};
+
+// Append-only log of recordings on flash. Appends fill the head segment; when it is full the least-worn
+// free segment is erased and opened, so erases spread evenly over the partition. A segment is free again
+// once every recording with data in it has been acknowledged. Only the standard library is used, so the
+// format and its recovery after a power cut can be exercised on a host against an emulated flash.
+class SpoolLog {
+public:
+    static constexpr uint32_t SEGMENT_MAGIC = 0x4C4F5053; // "SPOL"
+    static constexpr size_t MAX_SESSIONS = 16;
+    static constexpr size_t MAX_SEGMENTS = 256;
+
+    SpoolLog(SpoolFlash &flash, size_t segmentSize);
+
+    // Scans the flash and rebuilds the recordings from it. Unreadable or foreign segments are treated as free.
+    bool mount();
+
+    // Returns false if the session table is full of unacknowledged recordings
+    bool beginSession(uint32_t id, const SpoolBegin &format);
+
+    // Returns false if the chunk was dropped; the recording is then marked truncated
+    bool append(uint32_t id, const uint8_t *data, size_t length);
+
+    bool endSession(uint32_t id);
+
+    bool acknowledge(uint32_t id, uint32_t offset);
+
+    const SpoolSession *findSession(uint32_t id) const;
+
+    // Oldest ended recording with data the server has not confirmed and whose id is above `after`, or nullptr
+    const SpoolSession *nextPending(uint32_t after) const;
+
+    // Copies the first chunk of the recording that ends beyond fromOffset into dst. Returns its length,
+    // 0 once the recording has no more chunks. Sequential calls resume where the last one stopped.
+    size_t readChunk(uint32_t id, uint32_t fromOffset, uint8_t *dst, size_t capacity, uint32_t &chunkOffset);
+
+    // Erases the segment the next append will open, so a full head does not stall a write on an erase
+    void prepareNextSegment();
+
+    // Highest session id seen, so ids keep increasing across reboots
+    uint32_t lastSessionId() const { return lastSession; }
+
+    SpoolLogStats getStats() const;
+
+private:
+    struct Segment {
+        uint32_t sequence; // 0 when blank or unusable
+        uint32_t eraseCount;
+        bool erased; // Known blank, ready to open
+    };
+
+    bool writeRecord(SpoolRecordType type, uint32_t session, uint32_t offset, const void *payload, size_t length);
+
+    bool openSegment();
+
+    int pickFreeSegment() const;
+
+    bool eraseSegment(size_t index);
+
+    // Oldest segment sequence a recording still needs, UINT32_MAX when there are none
+    uint32_t tailSequence() const;
+
+    bool isFree(size_t index) const;
+
+    void applyRecord(const SpoolRecordHeader &header, const uint8_t *payload, uint32_t segmentSequence);
+
+    SpoolSession *session(uint32_t id);
+
+    void dropCompleted();
+
+    SpoolFlash &flash;
+    size_t segmentSize;
+    size_t segmentCount;
+    Segment segments[MAX_SEGMENTS];
+    int head = -1;               // Segment being appended to
+    size_t headPosition = 0;     // Next free byte in the head segment
+    uint32_t headSequence = 0;
+    int spare = -1;              // Erased by prepareNextSegment()
+    SpoolSession sessions[MAX_SESSIONS];
+    uint32_t lastSession = 0;
+
+    // Read cursor for readChunk()
+    uint32_t readSession = 0;
+    uint32_t readSequence = 0;
+    size_t readPosition = 0;
+    uint32_t readOffset = 0; // End of the last chunk returned
+
+    SpoolLogStats stats{};
+};
+
+#endif // SPOOL_LOG_H
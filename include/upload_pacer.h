@@ -0,0 +1,69 @@
+#ifndef UPLOAD_PACER_H
+#define UPLOAD_PACER_H
+
+#include <cstdint>
+#include <cstddef>
+#include "buffer_pool.h"
+
+struct UploadStats {
+    uint64_t bytesSent;
+    uint32_t chunksSent;
+    uint32_t chunksFailed;   // Chunks the socket refused, usually because it was down
+    uint32_t goodputBps;     // Bytes written per second, from the first chunk posted to the last one written
+    uint32_t stalls;         // Writes slower than UPLOAD_STALL_US, typically TCP retransmits or a full send buffer
+    uint64_t stallMicros;    // Time spent in those writes
+    uint32_t maxQueueDepth;  // Most chunks waiting for the network at once
+    uint64_t queueDepthSum;  // Chunks waiting, summed over every post; divide by postedChunks for the mean
+    uint32_t postedChunks;
+    uint32_t window;         // Congestion window now, bytes
+    uint32_t minWindow;      // Smallest window reached during the upload
+};
+
+// AIMD pacing for the upload stream. The window is the bytes allowed to wait for the network at once; it grows
+// by one full chunk per window written and halves, at most once per window, when a socket write stalls. Chunks
+// shrink with the window so at least two are in flight, and a stall also holds off the next post for half the
+// stalled write, giving the TCP send buffer time to drain. Times are micros(); the caller serialises access.
+class UploadPacer {
+public:
+    // At most maxChunks wait for the network at once, chunks shrink no further than minChunk bytes, and a write
+    // taking stallMicros or longer counts as a stall
+    UploadPacer(uint32_t maxChunks, size_t minChunk, uint32_t stallMicros);
+
+    // Starts a new upload. The window carries over, so a link that was good stays good.
+    void reset(uint32_t now);
+
+    // Payload bytes for the next chunk
+    size_t chunkBytes() const;
+
+    // Whether another chunk may be posted now
+    bool canPost(uint32_t now) const;
+
+    void posted(size_t bytes);
+
+    // Undoes posted() for a chunk the event queue refused
+    void withdraw(size_t bytes);
+
+    // Called once a chunk has been handed to the socket, with how long the write took
+    void sent(size_t bytes, uint32_t writeMicros, bool ok, uint32_t now);
+
+    const UploadStats &getStats() const { return stats; }
+
+private:
+    static constexpr size_t INITIAL_WINDOW = 2 * POOL_CHUNK_SIZE;
+
+    const uint32_t maxChunks;
+    const size_t minChunk;
+    const uint32_t stallMicros;
+    const size_t minWindow;
+    const size_t maxWindow;
+    size_t window = INITIAL_WINDOW;
+    size_t inFlightBytes = 0;
+    uint32_t inFlightChunks = 0;
+    size_t recoveryBytes = 0; // Bytes to write before a stall may halve the window again
+    uint32_t holdUntil = 0;
+    bool holding = false;
+    uint32_t startedAt = 0;
+    UploadStats stats = {};
+};
+
+#endif // UPLOAD_PACER_H
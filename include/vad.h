@@ -0,0 +1,86 @@
+#ifndef VAD_H
+#define VAD_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+struct VadConfig {
+    uint16_t energyThreshold; // Mean absolute amplitude at or above which a frame is speech
+    uint16_t zcrThreshold;    // Zero crossings per 100 samples that mark quieter unvoiced speech
+};
+
+// Energy and zero-crossing voice activity detector. One pass per frame with no multiplies in the loop,
+// budgeted at 8 cycles per sample (about 4k cycles for a 512-sample DMA frame).
+class VoiceActivityDetector {
+public:
+    explicit VoiceActivityDetector(const VadConfig &config) : config(config) {}
+
+    // Classifies one frame and updates the tracked DC offset
+    bool process(const int16_t *samples, size_t count);
+
+    void reset() { dcOffset = 0; }
+
+private:
+    VadConfig config;
+    int32_t dcOffset = 0; // Microphone bias, tracked across frames so the loop needs only one pass
+};
+
+struct VadStats {
+    uint32_t trimmedBytes; // Silence left out of the last recording
+    uint32_t speechFrames;
+    uint32_t silentFrames;
+    bool autoStopped;
+};
+
+struct SilenceTrimConfig {
+    size_t prerollBytes;  // Kept before speech starts
+    size_t hangoverBytes; // Kept after speech ends
+    size_t maxPauseBytes; // Longer internal pauses are collapsed to this length, 0 keeps them whole
+    size_t autoStopBytes; // Continuous silence that stops the recording, 0 disables
+};
+
+struct TrimVerdict {
+    bool keep;     // False for a frame cut from a long pause
+    bool autoStop; // The silence just reached the auto-stop threshold; set on one frame per recording at most
+};
+
+// Decides which parts of a recording are silence, and when a recording ends. Offsets are bytes into the
+// recording as it is stored, so the caller owns the store and this stays buildable on the host.
+class SilenceTrimmer {
+public:
+    SilenceTrimmer(const VadConfig &vadConfig, const SilenceTrimConfig &config) : vad(vadConfig), config(config) {}
+
+    // Arms a new recording. With keepEverything set every frame counts as speech, as with VAD off.
+    void start(bool keepEverything);
+
+    // Ends the recording. Only the first call after start() returns true, so the stop key, an auto-stop and
+    // a full store cannot each end the same recording. Safe from any task.
+    bool stop() { return recording.exchange(false); }
+
+    // Classifies one frame that follows `recorded` bytes of the recording
+    TrimVerdict frame(const int16_t *samples, size_t bytes, size_t recorded);
+
+    // Until speech starts, the pre-roll slides forward once twice that has built up. Returns how much to
+    // drop from the front; only the `stored` bytes that reached the store can go.
+    size_t leadingDrop(size_t recorded, size_t stored);
+
+    // Where to cut the finished recording: the hangover after the last speech, or nothing at all if there
+    // was none. Never before `uploaded`, which has already left.
+    size_t trailingEnd(size_t recorded, size_t uploaded);
+
+    bool heardSpeech() const { return speech; }
+
+    VadStats stats() const { return vadStats; }
+
+private:
+    VoiceActivityDetector vad;
+    SilenceTrimConfig config;
+    std::atomic<bool> recording{false};
+    VadStats vadStats = {};
+    bool speech = false;
+    size_t silentBytes = 0;    // Continuous silence read, kept or not
+    size_t speechEndIndex = 0; // End of the last speech frame in the recording
+};
+
+#endif // VAD_H
@@ -1,26 +1,114 @@
 #include "audio.h"
 #include "config.h"
 #include "logger.h"
+#include "pcm_convert.h"
 
 static const char *TAG = "AUDIO";
 
+static constexpr size_t BYTES_PER_SECOND = SAMPLE_RATE * (BITS_PER_SAMPLE / 8);
+static constexpr size_t JITTER_WATERMARK_BYTES = AUDIO_JITTER_WATERMARK_MS * BYTES_PER_SECOND / 1000;
+static constexpr size_t DMA_FRAME_BYTES = DMA_BUF_LEN * (BITS_PER_SAMPLE / 8);
+static constexpr size_t CAPTURE_FRAME_BYTES = CAPTURE_DMA_BUF_LEN * (BITS_PER_SAMPLE / 8);
+static constexpr size_t CAPTURE_SLOT_BYTES = CAPTURE_DMA_BUF_LEN * (MIC_SLOT_BITS / 8);
+static constexpr int CAPTURE_DMA_BUF_COUNT = DMA_BUF_COUNT * DMA_BUF_LEN / CAPTURE_DMA_BUF_LEN; // As deep in time as playback
+static constexpr size_t BOUNCE_BYTES = CAPTURE_BOUNCE_FRAMES * CAPTURE_FRAME_BYTES;
+static constexpr uint32_t DMA_TIMEOUT_MS = 4 * DMA_BUF_LEN * 1000 / SAMPLE_RATE;
+static_assert(CAPTURE_SLOT_BYTES <= I2S_DMA_BUF_MAX_BYTES, "A capture DMA buffer must hold CAPTURE_DMA_BUF_LEN whole slots");
+static constexpr BiquadCoefficients CAPTURE_FILTER[] = {
+        Biquad::highPass(SAMPLE_RATE, CAPTURE_HIGHPASS_HZ, 0.7071),
+        Biquad::peaking(SAMPLE_RATE, CAPTURE_PRESENCE_HZ, 1.0, CAPTURE_PRESENCE_DB),
+};
+static constexpr size_t VAD_PREROLL_BYTES = VAD_PREROLL_MS * BYTES_PER_SECOND / 1000;
+static constexpr size_t VAD_HANGOVER_BYTES = VAD_HANGOVER_MS * BYTES_PER_SECOND / 1000;
+static constexpr size_t VAD_MAX_PAUSE_BYTES = VAD_MAX_PAUSE_MS * BYTES_PER_SECOND / 1000;
+static constexpr size_t VAD_AUTO_STOP_BYTES = VAD_AUTO_STOP_MS * BYTES_PER_SECOND / 1000;
+
+static portMUX_TYPE promptLock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE uploadLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void recordTiming(StageTiming &timing, uint32_t elapsed) {
+    timing.blocks++;
+    timing.totalMicros += elapsed;
+    if (elapsed > timing.maxMicros) {
+        timing.maxMicros = elapsed;
+    }
+}
+
+// Reports how many payload bytes were copied per second of audio moved through a stage
+static void logCopyStats(const char *stage, uint32_t copiedBefore, size_t audioBytes) {
+    if (audioBytes == 0) {
+        return;
+    }
+    uint32_t copied = BufferPool::getStats().bytesCopied - copiedBefore;
+    LOG_I(TAG, "%s: %u bytes copied for %u ms of audio (%u bytes copied per second)", stage, copied,
+          static_cast<uint32_t>(audioBytes * 1000 / BYTES_PER_SECOND),
+          static_cast<uint32_t>(static_cast<uint64_t>(copied) * BYTES_PER_SECOND / audioBytes));
+}
+
 EventDispatcher *Audio::eventDispatcher = nullptr;
+TaskHandle_t Audio::taskHandle = nullptr;
+int32_t *Audio::captureSlots = nullptr;
+int32_t Audio::micDcOffset = 0;
+BiquadChain Audio::captureFilter(CAPTURE_FILTER, sizeof(CAPTURE_FILTER) / sizeof(CAPTURE_FILTER[0]));
+StageTiming Audio::filterTiming = {};
+int16_t *Audio::bounceBuffers[2] = {nullptr, nullptr};
+size_t Audio::bounceFill[2] = {0, 0};
+uint8_t Audio::bounceActive = 0;
+CaptureTiming Audio::captureTiming = {};
+QueueHandle_t Audio::rxEvents = nullptr;
+QueueHandle_t Audio::txEvents = nullptr;
+I2SStats Audio::i2sStats = {};
+size_t Audio::framesPrimed = 0;
 volatile bool Audio::isRecording = false;
 volatile bool Audio::isPlaying = false;
 volatile bool Audio::isPrefetching = false;
-uint8_t *Audio::audioBuffer = nullptr;
-size_t Audio::audioBufferIndex = 0;
-size_t Audio::audioBufferSize = AUDIO_BUFFER_SIZE;
+volatile bool Audio::uploadPending = false;
+volatile bool Audio::streamPending = false;
+volatile bool Audio::playbackRequested = false;
+volatile bool Audio::suspended = false;
+uint16_t Audio::recordingId = 0;
+volatile uint16_t Audio::prefetchId = 0;
+volatile uint16_t Audio::playbackId = 0;
+volatile size_t Audio::playbackIndex = 0;
+size_t Audio::playbackBytesMoved = 0;
+uint32_t Audio::prefetchCopiedStart = 0;
+AudioCodecType Audio::uplinkCodec = AudioCodecType::PCM16;
+AudioCodecType Audio::downlinkCodec = AudioCodecType::PCM16;
+AudioCodecType Audio::prefetchCodec = AudioCodecType::PCM16;
+AudioCodecType Audio::uploadCodec = AudioCodecType::PCM16;
+uint32_t Audio::uplinkRate = SAMPLE_RATE;
+uint32_t Audio::downlinkRate = SAMPLE_RATE;
+Resampler Audio::prefetchResampler;
+Resampler Audio::uploadResampler;
+AdpcmState Audio::uploadAdpcm;
+PooledBuffer Audio::unsentChunk;
+size_t Audio::uploadIndex = 0;
+uint32_t Audio::uploadCopiedStart = 0;
+uint32_t Audio::recordingStoppedAt = 0;
+UploadPacer Audio::uploadPacer(AUDIO_UPLOAD_WINDOW, UPLOAD_MIN_CHUNK, UPLOAD_STALL_US);
+SilenceTrimmer Audio::silenceTrimmer({VAD_ENERGY_THRESHOLD, VAD_ZCR_THRESHOLD},
+                                     {VAD_PREROLL_BYTES, VAD_HANGOVER_BYTES, VAD_MAX_PAUSE_BYTES, VAD_AUTO_STOP_BYTES});
+size_t Audio::grantedCredit = 0;
+JitterStats Audio::jitterStats = {};
+bool Audio::inUnderrun = false;
+Audio::QueuedPrompt Audio::promptQueue[PROMPT_QUEUE_LENGTH] = {};
+size_t Audio::promptQueueHead = 0;
+size_t Audio::promptQueueCount = 0;
+Audio::QueuedPrompt Audio::currentPrompt = {};
+size_t Audio::promptIndex = 0;
+volatile bool Audio::promptPlaying = false;
+PromptStats Audio::promptStats = {};
+int16_t Audio::lastSample = 0;
 
 const i2s_config_t Audio::i2sConfigRx = {
         .mode = (i2s_mode_t) (I2S_MODE_MASTER | I2S_MODE_RX),
         .sample_rate = SAMPLE_RATE,
-        .bits_per_sample = static_cast<i2s_bits_per_sample_t>(BITS_PER_SAMPLE),
+        .bits_per_sample = static_cast<i2s_bits_per_sample_t>(MIC_SLOT_BITS),
         .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
         .communication_format = I2S_COMM_FORMAT_STAND_I2S,
         .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-        .dma_buf_count = DMA_BUF_COUNT,
-        .dma_buf_len = DMA_BUF_LEN,
+        .dma_buf_count = CAPTURE_DMA_BUF_COUNT,
+        .dma_buf_len = CAPTURE_DMA_BUF_LEN,
         .use_apll = true,
         .tx_desc_auto_clear = false,
         .fixed_mclk = 0
@@ -57,20 +145,226 @@ const i2s_pin_config_t Audio::i2sPinConfigTx = {
 void Audio::begin(EventDispatcher &dispatcher) {
     eventDispatcher = &dispatcher;
 
-    // Allocate audio buffer in PSRAM
-    audioBuffer = (uint8_t *) ps_malloc(AUDIO_BUFFER_SIZE);
-    if (audioBuffer == nullptr) {
-        LOG_E(TAG, "Failed to allocate audio buffer in PSRAM");
+    // Messages live in PSRAM slabs
+    if (!MessageStore::begin(AUDIO_BUFFER_SIZE)) {
+        LOG_E(TAG, "Failed to allocate message store in PSRAM");
+        return;
+    }
+    PromptCache::begin();
+    captureSlots = static_cast<int32_t *>(heap_caps_malloc(CAPTURE_SLOT_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    for (int16_t *&bounce : bounceBuffers) {
+        bounce = static_cast<int16_t *>(heap_caps_malloc(BOUNCE_BYTES, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+    }
+    if (captureSlots == nullptr || bounceBuffers[0] == nullptr || bounceBuffers[1] == nullptr) {
+        LOG_E(TAG, "Failed to allocate capture buffers");
         return;
     }
 
-    // Install and configure I2S drivers
-    ESP_ERROR_CHECK(i2s_driver_install(I2S_NUM_0, &i2sConfigRx, 0, nullptr));
+    installI2S(i2sConfigRx, i2sConfigTx);
+
+    xTaskCreatePinnedToCore(audioTask, "AudioTask", 8192, nullptr, 5, &taskHandle, 1);
+}
+
+void Audio::installI2S(const i2s_config_t &rxConfig, const i2s_config_t &txConfig) {
+    // The event queues report every completed DMA buffer, plus buffers the driver dropped or played out empty
+    ESP_ERROR_CHECK(i2s_driver_install(I2S_NUM_0, &rxConfig, I2S_EVENT_QUEUE_SIZE, &rxEvents));
     ESP_ERROR_CHECK(i2s_set_pin(I2S_NUM_0, &i2sPinConfigRx));
-    ESP_ERROR_CHECK(i2s_driver_install(I2S_NUM_1, &i2sConfigTx, 0, nullptr));
+    ESP_ERROR_CHECK(i2s_driver_install(I2S_NUM_1, &txConfig, I2S_EVENT_QUEUE_SIZE, &txEvents));
     ESP_ERROR_CHECK(i2s_set_pin(I2S_NUM_1, &i2sPinConfigTx));
+}
+
+void Audio::wake() {
+    if (taskHandle != nullptr) {
+        xTaskNotifyGive(taskHandle);
+    }
+}
+
+bool Audio::waitForDma(QueueHandle_t queue, i2s_event_type_t doneType) {
+    i2s_event_t event;
+    while (xQueueReceive(queue, &event, pdMS_TO_TICKS(DMA_TIMEOUT_MS)) == pdTRUE) {
+        if (event.type == doneType) {
+            return true;
+        }
+        switch (event.type) {
+            case I2S_EVENT_RX_Q_OVF:
+                i2sStats.rxOverruns++;
+                break;
+            case I2S_EVENT_TX_Q_OVF:
+                i2sStats.txUnderruns++;
+                break;
+            case I2S_EVENT_DMA_ERROR:
+                i2sStats.dmaErrors++;
+                break;
+            default:
+                break;
+        }
+    }
+    return false;
+}
 
-    xTaskCreatePinnedToCore(audioTask, "AudioTask", 8192, nullptr, 5, nullptr, 1);
+void Audio::beginCapture() {
+    size_t bytesRead = 0;
+    while (i2s_read(I2S_NUM_0, captureSlots, CAPTURE_SLOT_BYTES, &bytesRead, 0) == ESP_OK && bytesRead > 0) {
+    }
+    xQueueReset(rxEvents);
+    i2sStats.framesRead = 0;
+    i2sStats.rxOverruns = 0;
+    i2sStats.dmaErrors = 0;
+    captureFilter.reset();
+    filterTiming = {};
+    bounceFill[0] = bounceFill[1] = 0;
+    bounceActive = 0;
+    captureTiming = {};
+}
+
+void Audio::beginPlayout() {
+    // TX DMA free-runs on silence while idle, so its queue is full of stale events and underruns
+    xQueueReset(txEvents);
+    framesPrimed = 0;
+    i2sStats.framesWritten = 0;
+    i2sStats.txUnderruns = 0;
+}
+
+void Audio::waitForTxSlot() {
+    // The first DMA_BUF_COUNT frames fill empty buffers; after that each write waits for one to drain
+    if (framesPrimed < DMA_BUF_COUNT) {
+        framesPrimed++;
+    } else if (!waitForDma(txEvents, I2S_EVENT_TX_DONE)) {
+        LOG_W(TAG, "No TX_DONE from I2S within %u ms", DMA_TIMEOUT_MS);
+    }
+}
+
+void Audio::captureNextFrame() {
+    if (!waitForDma(rxEvents, I2S_EVENT_RX_DONE)) {
+        LOG_W(TAG, "No RX_DONE from I2S within %u ms", DMA_TIMEOUT_MS);
+        return;
+    }
+    uint32_t frameStart = micros();
+
+    // A completed buffer is waiting, so this never blocks. It may return nothing if the driver dropped it.
+    size_t bytesRead = 0;
+    // A short read comes back as ESP_ERR_TIMEOUT; whatever it did read is still audio.
+    esp_err_t result = i2s_read(I2S_NUM_0, captureSlots, CAPTURE_SLOT_BYTES, &bytesRead, 0);
+    if (result != ESP_OK && bytesRead == 0) {
+        LOG_E(TAG, "Error reading from I2S: %d", result);
+        return;
+    }
+    size_t samples = bytesRead / sizeof(int32_t);
+    if (samples == 0) {
+        return;
+    }
+    i2sStats.framesRead++;
+
+    // Raw slots become 16-bit PCM in the active bounce buffer; every pass over the frame stays in internal
+    // RAM and PSRAM only sees whole bursts. The DC estimate trails by one buffer.
+    size_t frameBytes = samples * sizeof(int16_t);
+    int16_t *pcm = bounceBuffers[bounceActive] + bounceFill[bounceActive] / sizeof(int16_t);
+    PcmConvert::narrow32(captureSlots, pcm, samples, MIC_SAMPLE_SHIFT);
+    int32_t blockMean = PcmConvert::mean(pcm, samples);
+    PcmConvert::removeDcAndGain(pcm, samples, PcmConvert::saturate(micDcOffset), MIC_GAIN);
+    micDcOffset += (blockMean - micDcOffset) / 8;
+
+#if CAPTURE_FILTER_ENABLED
+    uint32_t filterStart = micros();
+    captureFilter.process(pcm, samples);
+    recordTiming(filterTiming, micros() - filterStart);
+#endif
+
+#if VAD_ENABLED
+    bool keep = trimSilence(pcm, frameBytes);
+#else
+    bool keep = true;
+#endif
+    if (keep) {
+        bounceFill[bounceActive] += frameBytes;
+    }
+    if (BOUNCE_BYTES - bounceFill[bounceActive] < CAPTURE_FRAME_BYTES) {
+        uint8_t other = bounceActive ^ 1;
+        if (bounceFill[other] > 0) {
+            captureTiming.forcedBursts++; // Its burst never found slack; it must go before this one
+            flushBounce(other);
+        }
+        bounceActive = other;
+    }
+#if VAD_ENABLED
+    if (!silenceTrimmer.heardSpeech()) {
+        dropLeadingSilence();
+    }
+#endif
+    recordTiming(captureTiming.frames, micros() - frameStart);
+
+    // The full buffer goes to PSRAM at a lower priority than capture: only while no DMA buffer is waiting
+    uint8_t full = bounceActive ^ 1;
+    if (isRecording && bounceFill[full] > 0 && uxQueueMessagesWaiting(rxEvents) == 0) {
+        flushBounce(full);
+    }
+#if AUDIO_STREAM_UPLOAD
+    // Held back until speech starts, the pre-roll still moves until then
+    if (silenceTrimmer.heardSpeech()) {
+        publishAudioChunks(false);
+    }
+#endif
+}
+
+void Audio::flushBounce(uint8_t index) {
+    uint32_t burstStart = micros();
+    size_t length = bounceFill[index];
+    bounceFill[index] = 0;
+    size_t written = MessageStore::write(recordingId, reinterpret_cast<const uint8_t *>(bounceBuffers[index]), length);
+    recordTiming(captureTiming.bursts, micros() - burstStart);
+    captureTiming.burstBytes += written;
+    if (written < length) {
+        LOG_W(TAG, "Message store full. %u bytes of the recording lost", length - written);
+        if (isRecording) {
+            stopRecording();
+        }
+    }
+}
+
+void Audio::flushCapture() {
+    uint8_t older = bounceActive ^ 1;
+    if (bounceFill[older] > 0) {
+        flushBounce(older);
+    }
+    if (bounceFill[bounceActive] > 0) {
+        flushBounce(bounceActive);
+    }
+}
+
+size_t Audio::recordedLength() {
+    return MessageStore::length(recordingId) + bounceFill[0] + bounceFill[1];
+}
+
+CaptureTiming Audio::getCaptureTiming() {
+    return captureTiming;
+}
+
+I2SStats Audio::getI2SStats() {
+    return i2sStats;
+}
+
+StageTiming Audio::getFilterTiming() {
+    return filterTiming;
+}
+
+bool Audio::suspendForIntercom(const i2s_config_t &rxConfig, const i2s_config_t &txConfig) {
+    if (suspended || isRecording || isPlaying || isPrefetching || uploadPending || streamPending || playbackRequested ||
+        promptPlaying) {
+        LOG_W(TAG, "Audio busy. Intercom not started");
+        return false;
+    }
+    suspended = true;
+    i2s_driver_uninstall(I2S_NUM_0);
+    i2s_driver_uninstall(I2S_NUM_1);
+    installI2S(rxConfig, txConfig);
+    return true;
+}
+
+void Audio::resumeFromIntercom() {
+    i2s_driver_uninstall(I2S_NUM_0);
+    i2s_driver_uninstall(I2S_NUM_1);
+    installI2S(i2sConfigRx, i2sConfigTx);
+    suspended = false;
 }
 
 size_t Audio::min(size_t a, size_t b) {
@@ -78,109 +372,580 @@ size_t Audio::min(size_t a, size_t b) {
 }
 
 void Audio::startRecording() {
+    if (suspended) {
+        LOG_W(TAG, "Intercom active. Recording not started");
+        return;
+    }
+    if (isRecording || uploadPending) {
+        LOG_W(TAG, "Previous recording still in progress. Recording not started");
+        return;
+    }
+    uint16_t id = MessageStore::create(MessageDirection::OUTBOUND);
+    if (id == 0) {
+        LOG_W(TAG, "No room for a new message. Recording not started");
+        return;
+    }
+    recordingId = id;
+    uploadIndex = 0;
+    uploadCodec = uplinkCodec;
+    uploadResampler.configure(SAMPLE_RATE, uplinkRate);
+    uploadAdpcm = {};
+    unsentChunk.reset();
+    silenceTrimmer.start(!VAD_ENABLED); // With VAD off every frame is kept and uploaded as it fills
+    uploadCopiedStart = BufferPool::getStats().bytesCopied;
+    portENTER_CRITICAL(&uploadLock);
+    uploadPacer.reset(micros());
+    portEXIT_CRITICAL(&uploadLock);
+    // Posted before the audio task can post the first chunk, so the spool opens the recording ahead of its audio
+    eventDispatcher->post(Event::of<RECORDING_STARTED>({0, static_cast<uint16_t>(uplinkRate), uploadCodec}));
     isRecording = true;
-    audioBufferIndex = 0;
-    LOG_I(TAG, "Recording started");
+    wake();
+    LOG_I(TAG, "Recording message %u started", id);
 }
 
 void Audio::stopRecording() {
-    LOG_I(TAG, "Recording stopped. Recorded %d bytes", audioBufferIndex);
+    if (!silenceTrimmer.stop()) {
+        return; // Already stopped by the stop key, an auto-stop or a full store
+    }
+    LOG_I(TAG, "Recording stopped. Recorded %u bytes", recordedLength());
+    recordingStoppedAt = micros();
     isRecording = false;
-    vTaskDelay(pdMS_TO_TICKS(100)); // Wait for last audio chunk to be read
-    sendAudioData();
+    uploadPending = true; // The audio task uploads once the last chunk is read, keeping the dispatcher free
+    wake();
 }
 
 void Audio::startPlayback() {
-    if (audioBufferIndex > 0) {
+    if (isPlaying) {
+        return; // Already playing, possibly a streamed message whose cursor must not be reset
+    }
+    playbackRequested = true; // The audio task starts it, once any message it is still playing out is released
+    wake();
+}
+
+void Audio::playMessage(uint16_t id) {
+    if (isPlaying) {
+        return;
+    }
+    if (suspended) {
+        LOG_W(TAG, "Intercom active. Playback not started");
+        return;
+    }
+    size_t length = MessageStore::length(id);
+    if (length > 0) {
+        playbackId = id;
+        playbackIndex = 0;
+        playbackBytesMoved = 0;
         isPlaying = true;
-        LOG_I(TAG, "Playback started with %d bytes", audioBufferIndex);
+        wake();
+        LOG_I(TAG, "Playback of message %u started with %u bytes", id, length);
     } else {
         LOG_W(TAG, "Playback not started. No audio data available.");
-        eventDispatcher->dispatchEvent({NO_AUDIO_DATA, ""});
+        eventDispatcher->post({NO_AUDIO_DATA, ""});
     }
 }
 
 void Audio::stopPlayback() {
     isPlaying = false;
-    vTaskDelay(100); // Wait for last audio chunk to be sent
+    streamPending = false;
+    playbackRequested = false;
+    if (playbackId != 0 && playbackId == prefetchId) {
+        isPrefetching = false; // Stopping a streamed message also ends its download
+    }
+    wake(); // The audio task releases the message once the block it is writing is out
+}
+
+void Audio::endPlayback() {
     LOG_I(TAG, "Playback stopped");
-    clearAudioBuffer();
+    // Heard, whether or not to the end; its slabs are reused once another message needs them
+    MessageStore::markPlayed(playbackId);
+    playbackId = 0;
+    playbackIndex = 0;
 }
 
 void Audio::startPrefetch() {
+    if (suspended) {
+        LOG_W(TAG, "Intercom active. Prefetch not started");
+        return;
+    }
+    // An earlier download still in progress keeps whatever it received and stays queued
+    uint16_t id = MessageStore::create(MessageDirection::INBOUND);
+    if (id == 0) {
+        LOG_W(TAG, "No room for a new message. Prefetch not started");
+        return;
+    }
+    prefetchId = id;
+    grantedCredit = 0;
+    prefetchCodec = downlinkCodec;
+    prefetchResampler.configure(downlinkRate, SAMPLE_RATE);
+    jitterStats = {};
+    jitterStats.minFill = SIZE_MAX;
+    prefetchCopiedStart = BufferPool::getStats().bytesCopied;
     isPrefetching = true;
-    audioBufferIndex = 0;
-    LOG_I(TAG, "Prefetching started");
+    grantPrefetchCredit(true);
+    LOG_I(TAG, "Prefetching message %u started", id);
+}
+
+void Audio::startStreamingPlayback() {
+    startPrefetch();
+    if (!isPrefetching) {
+        return;
+    }
+    streamPending = true; // The audio task starts playback once the jitter buffer reaches its watermark
+    wake();
+    LOG_I(TAG, "Streaming playback armed, watermark %u bytes", JITTER_WATERMARK_BYTES);
 }
 
 void Audio::stopPrefetch() {
     isPrefetching = false;
-    LOG_I(TAG, "Prefetching stopped. Collected %d bytes", audioBufferIndex);
+    wake(); // An armed stream plays whatever arrived
+    size_t received = MessageStore::length(prefetchId);
+    LOG_I(TAG, "Prefetching stopped. Collected %u bytes", received);
+    logCopyStats("Prefetch", prefetchCopiedStart, received);
+    if (received == 0 && !streamPending && playbackId != prefetchId) {
+        MessageStore::remove(prefetchId); // Nothing to queue
+    }
 }
 
 void Audio::addPrefetchData(const uint8_t *data, size_t length) {
-    if (isPrefetching && (audioBufferIndex + length) <= audioBufferSize) {
-        memcpy(audioBuffer + audioBufferIndex, data, length);
-        audioBufferIndex += length;
+    if (!isPrefetching) {
+        return;
+    }
+
+    // Decoding replaces the plain copy into the store; positions and credit are counted in decoded PCM bytes
+    AudioChunkDecoder decoder(prefetchCodec, data, length);
+    size_t pcmLength = prefetchResampler.maxOutput(decoder.remainingSamples()) * sizeof(int16_t);
+
+    // Credit never exceeds what the store can take, so anything beyond that means the server ignored it
+    if (pcmLength > MessageStore::writableBytes(prefetchId)) {
+        jitterStats.overruns++;
+        LOG_W(TAG, "Prefetch overrun: dropped %u bytes beyond granted credit", pcmLength);
+        return;
+    }
+
+    if (prefetchResampler.isPassthrough()) {
+        // Decoded straight into the message, one slab at a time
+        while (decoder.remainingSamples() > 0) {
+            size_t space = 0;
+            auto *region = reinterpret_cast<int16_t *>(MessageStore::writeRegion(prefetchId, space));
+            if (region == nullptr) {
+                break;
+            }
+            size_t count = decoder.decode(region, space / sizeof(int16_t));
+            MessageStore::commitWrite(prefetchId, count * sizeof(int16_t));
+            BufferPool::recordCopy(count * sizeof(int16_t));
+        }
+    } else {
+        // Other server rates go through the resampler one block at a time
+        static int16_t decoded[RESAMPLER_BLOCK];
+        static int16_t resampled[RESAMPLER_BLOCK * SAMPLE_RATE / RESAMPLER_MIN_RATE + 2];
+        while (decoder.remainingSamples() > 0) {
+            size_t count = decoder.decode(decoded, RESAMPLER_BLOCK);
+            size_t bytes = prefetchResampler.process(decoded, count, resampled) * sizeof(int16_t);
+            MessageStore::write(prefetchId, reinterpret_cast<const uint8_t *>(resampled), bytes);
+            BufferPool::recordCopy(bytes);
+        }
+    }
+
+    size_t fill = MessageStore::length(prefetchId) - (playbackId == prefetchId ? playbackIndex : 0);
+    if (fill > jitterStats.maxFill) {
+        jitterStats.maxFill = fill;
+    }
+    if (streamPending) {
+        wake(); // Let the audio task check the watermark
     }
 }
 
-void Audio::clearAudioBuffer() {
-    memset(audioBuffer, 0, audioBufferSize);
-    audioBufferIndex = 0;
+JitterStats Audio::getJitterStats() {
+    return jitterStats;
 }
 
-void Audio::sendAudioData() {
-    const size_t chunkSize = 1024 * 8; // Send 8KB at a time
-    size_t remainingBytes = audioBufferIndex;
-    size_t offset = 0;
+VadStats Audio::getVadStats() {
+    return silenceTrimmer.stats();
+}
 
-    while (remainingBytes > 0) {
-        size_t bytesToSend = min(chunkSize, remainingBytes);
-        eventDispatcher->dispatchEvent({AUDIO_DATA_READY, std::string(reinterpret_cast<char *>(audioBuffer + offset), bytesToSend)});
-        remainingBytes -= bytesToSend;
-        offset += bytesToSend;
-        vTaskDelay(pdMS_TO_TICKS(10));
+bool Audio::trimSilence(const int16_t *frame, size_t frameBytes) {
+    TrimVerdict verdict = silenceTrimmer.frame(frame, frameBytes, recordedLength());
+    if (verdict.autoStop) {
+        LOG_I(TAG, "%u ms of silence. Stopping recording", VAD_AUTO_STOP_MS);
+        // Same path as the stop key, so the server and UI hear about it
+        eventDispatcher->post({CMD_ESP_AUDIO, "stop_recording"});
     }
+    return verdict.keep;
+}
 
-    LOG_I(TAG, "Dispatched %u bytes of audio data in chunks", audioBufferIndex);
+void Audio::dropLeadingSilence() {
+    // Staged frames count towards the pre-roll, but only what already reached the store can be dropped
+    size_t stored = MessageStore::length(recordingId);
+    size_t dropped = silenceTrimmer.leadingDrop(recordedLength(), stored);
+    if (dropped > 0) {
+        MessageStore::discardFront(recordingId, dropped);
+        BufferPool::recordCopy(stored - dropped);
+    }
+}
 
-    eventDispatcher->dispatchEvent({RECORDING_SENT, ""});
+void Audio::trimTrailingSilence() {
+    size_t recorded = MessageStore::length(recordingId);
+    size_t end = silenceTrimmer.trailingEnd(recorded, uploadIndex);
+    if (end < recorded) {
+        MessageStore::truncate(recordingId, end);
+    }
+    VadStats stats = silenceTrimmer.stats();
+    LOG_I(TAG, "VAD trimmed %u bytes (%u ms) of silence, %u speech and %u silent frames", stats.trimmedBytes,
+          static_cast<uint32_t>(static_cast<uint64_t>(stats.trimmedBytes) * 1000 / BYTES_PER_SECOND),
+          stats.speechFrames, stats.silentFrames);
 }
 
-void Audio::audioTask(void *parameter) {
-    size_t bytesRead = 0;
+void Audio::chunkSent(size_t bytes, uint32_t writeMicros, bool ok) {
+    portENTER_CRITICAL(&uploadLock);
+    uploadPacer.sent(bytes, writeMicros, ok, micros());
+    portEXIT_CRITICAL(&uploadLock);
+}
+
+UploadStats Audio::getUploadStats() {
+    portENTER_CRITICAL(&uploadLock);
+    UploadStats stats = uploadPacer.getStats();
+    portEXIT_CRITICAL(&uploadLock);
+    return stats;
+}
+
+void Audio::setCodecs(const CodecSelection &selection) {
+    uplinkCodec = selection.uplink;
+    downlinkCodec = selection.downlink;
+    uplinkRate = Resampler::supports(SAMPLE_RATE, selection.uplinkRate) ? selection.uplinkRate : SAMPLE_RATE;
+    downlinkRate = Resampler::supports(selection.downlinkRate, SAMPLE_RATE) ? selection.downlinkRate : SAMPLE_RATE;
+    LOG_I(TAG, "Codecs set: uplink %s at %u Hz, downlink %s at %u Hz", AudioCodec::name(uplinkCodec), uplinkRate,
+          AudioCodec::name(downlinkCodec), downlinkRate);
+}
+
+bool Audio::publishAudioChunks(bool flush) {
+    while (uploadIndex < MessageStore::length(recordingId) || unsentChunk) {
+        portENTER_CRITICAL(&uploadLock);
+        bool canPost = uploadPacer.canPost(micros());
+        // Every codec encodes PCM into at most as many bytes, whatever the upload rate
+        size_t chunkSamples = uploadResampler.maxInput(uploadPacer.chunkBytes() / sizeof(int16_t));
+        portEXIT_CRITICAL(&uploadLock);
+        if (!canPost) {
+            return false;
+        }
+
+        if (!unsentChunk) {
+            size_t available = (MessageStore::length(recordingId) - uploadIndex) / sizeof(int16_t);
+            if (available < chunkSamples && !flush) {
+                return false; // Wait for a full chunk while still recording
+            }
+            // A chunk ends early at a slab boundary
+            size_t contiguous = 0;
+            const auto *pcm = reinterpret_cast<const int16_t *>(MessageStore::readRegion(recordingId, uploadIndex, contiguous));
+            size_t samples = min(min(chunkSamples, available), contiguous / sizeof(int16_t));
+            if (samples == 0) {
+                return true; // A trailing odd byte is not a sample
+            }
+            PooledBuffer chunk = BufferPool::acquire();
+            if (!chunk) {
+                return false;
+            }
+
+            if (uploadResampler.isPassthrough()) {
+                chunk.setSize(AudioCodec::encode(uploadCodec, pcm, samples, chunk.data(), uploadAdpcm));
+            } else {
+                // Resample into a second chunk, then encode from it
+                PooledBuffer resampled = BufferPool::acquire();
+                if (!resampled) {
+                    return false;
+                }
+                auto *out = reinterpret_cast<int16_t *>(resampled.data());
+                size_t outSamples = uploadResampler.process(pcm, samples, out);
+                BufferPool::recordCopy(outSamples * sizeof(int16_t));
+                chunk.setSize(AudioCodec::encode(uploadCodec, out, outSamples, chunk.data(), uploadAdpcm));
+            }
+            BufferPool::recordCopy(chunk.size());
+            // The resampler has consumed these samples, so a chunk the queue rejects is kept rather than rebuilt
+            uploadIndex += samples * sizeof(int16_t);
+            unsentChunk = std::move(chunk);
+        }
+
+        size_t bytes = unsentChunk.size();
+        portENTER_CRITICAL(&uploadLock);
+        uploadPacer.posted(bytes);
+        portEXIT_CRITICAL(&uploadLock);
+        if (!eventDispatcher->post({AUDIO_DATA_READY, unsentChunk})) {
+            portENTER_CRITICAL(&uploadLock);
+            uploadPacer.withdraw(bytes);
+            portEXIT_CRITICAL(&uploadLock);
+            return false;
+        }
+        unsentChunk.reset();
+    }
+    return true;
+}
+
+void Audio::finishUpload() {
+    flushCapture();
+#if VAD_ENABLED
+    trimTrailingSilence();
+#endif
+    // Flush whatever the live stream has not sent yet, bounded by the in-flight window
+    while (!publishAudioChunks(true)) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+
+    size_t recorded = MessageStore::length(recordingId);
+    LOG_I(TAG, "Dispatched %u bytes of audio data in chunks", recorded);
+    LOG_I(TAG, "I2S capture: %u frames read, %u DMA overruns (%u samples dropped), %u DMA errors",
+          i2sStats.framesRead, i2sStats.rxOverruns, i2sStats.rxOverruns * CAPTURE_DMA_BUF_LEN, i2sStats.dmaErrors);
+#if CAPTURE_FILTER_ENABLED
+    if (filterTiming.blocks > 0) {
+        LOG_I(TAG, "Capture filter: %u us average, %u us max per %u-sample block (%u us of audio)",
+              static_cast<uint32_t>(filterTiming.totalMicros / filterTiming.blocks), filterTiming.maxMicros,
+              CAPTURE_DMA_BUF_LEN, static_cast<uint32_t>(CAPTURE_DMA_BUF_LEN * 1000000ULL / SAMPLE_RATE));
+    }
+#endif
+    if (captureTiming.frames.blocks > 0 && captureTiming.bursts.totalMicros > 0) {
+        LOG_I(TAG, "Capture: %u us average, %u us max CPU per frame; %u bursts into PSRAM at %u KB/s, %u forced",
+              static_cast<uint32_t>(captureTiming.frames.totalMicros / captureTiming.frames.blocks),
+              captureTiming.frames.maxMicros, captureTiming.bursts.blocks,
+              static_cast<uint32_t>(captureTiming.burstBytes * 1000000 / 1024 / captureTiming.bursts.totalMicros),
+              captureTiming.forcedBursts);
+    }
+    logCopyStats("Upload", uploadCopiedStart, recorded);
+    eventDispatcher->logStats();
+
+    // Uploaded, so the recording is the first to go when the store needs room
+    MessageStore::markPlayed(recordingId);
+    MessageStore::logStats();
+
+    // Without the end marker neither the spool session nor the server stream is ever closed, so wait for room
+    // in the bulk lane as the chunks do
+    Event end = Event::of<AUDIO_STREAM_END>({static_cast<uint32_t>(recorded), recordingStoppedAt});
+    while (!eventDispatcher->post(end)) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+}
+
+void Audio::playNextBlock() {
+    size_t bytesWritten = 0;
+    bool streaming = isPrefetching && playbackId == prefetchId;
+    size_t available = MessageStore::length(playbackId) - playbackIndex;
+
+    if (available == 0) {
+        if (streaming) {
+            concealUnderrun();
+            return;
+        }
+        LOG_I(TAG, "Playback completed. Moved %u bytes for %u ms of audio (%u bytes per second)",
+              static_cast<uint32_t>(playbackBytesMoved),
+              static_cast<uint32_t>(playbackIndex * 1000 / BYTES_PER_SECOND),
+              static_cast<uint32_t>(playbackIndex ? static_cast<uint64_t>(playbackBytesMoved) * BYTES_PER_SECOND / playbackIndex : 0));
+        LOG_I(TAG, "Jitter buffer: %u underruns (%u bytes concealed), %u overruns, fill %u-%u bytes",
+              jitterStats.underruns, jitterStats.concealedBytes, jitterStats.overruns, jitterStats.minFill, jitterStats.maxFill);
+        LOG_I(TAG, "I2S playback: %u frames written, %u DMA underruns, %u DMA errors",
+              i2sStats.framesWritten, i2sStats.txUnderruns, i2sStats.dmaErrors);
+        MessageStore::logStats();
+        stopPlayback();
+        return;
+    }
+
+    if (available < jitterStats.minFill) {
+        jitterStats.minFill = available;
+    }
+
+    // A block never crosses a slab boundary
+    size_t contiguous = 0;
+    uint8_t *block = MessageStore::readRegion(playbackId, playbackIndex, contiguous);
+    if (block == nullptr) {
+        LOG_E(TAG, "Message %u unreadable at offset %u", playbackId, playbackIndex);
+        stopPlayback();
+        return;
+    }
+    size_t bytesToWrite = min(DMA_FRAME_BYTES, contiguous);
+    if (inUnderrun) {
+        applyFade(block, bytesToWrite, true);
+        inUnderrun = false;
+    }
+
+    waitForTxSlot();
+    esp_err_t result = i2s_write(I2S_NUM_1, block, bytesToWrite, &bytesWritten, portMAX_DELAY);
+    if (result == ESP_OK) {
+        i2sStats.framesWritten++;
+        lastSample = reinterpret_cast<const int16_t *>(block)[bytesWritten / sizeof(int16_t) - 1];
+        playbackIndex += bytesWritten;
+        playbackBytesMoved += bytesWritten;
+        if (streaming) {
+            // Played slabs go back to the store, so a stream can outgrow it
+            MessageStore::release(playbackId, playbackIndex);
+        }
+        grantPrefetchCredit(false);
+    } else {
+        LOG_E(TAG, "Error writing to I2S: %d", result);
+    }
+}
+
+bool Audio::playPrompt(PromptId id, uint32_t requestedAt) {
+    if (suspended || isRecording || isPlaying) {
+        return false;
+    }
+    Prompt prompt{};
+    if (!PromptCache::find(id, prompt)) {
+        promptStats.missing++;
+        LOG_W(TAG, "Prompt %s is not in the flash image", PromptCache::name(id));
+        return false;
+    }
+
+    portENTER_CRITICAL(&promptLock);
+    bool queued = promptQueueCount < PROMPT_QUEUE_LENGTH;
+    if (queued) {
+        promptQueue[(promptQueueHead + promptQueueCount++) % PROMPT_QUEUE_LENGTH] = {prompt, requestedAt};
+    }
+    portEXIT_CRITICAL(&promptLock);
+    if (!queued) {
+        LOG_W(TAG, "Prompt queue full. Prompt %s not played", PromptCache::name(id));
+        return false;
+    }
+    wake();
+    return true;
+}
+
+PromptStats Audio::getPromptStats() {
+    return promptStats;
+}
+
+bool Audio::takePrompt() {
+    portENTER_CRITICAL(&promptLock);
+    bool taken = promptQueueCount > 0;
+    if (taken) {
+        currentPrompt = promptQueue[promptQueueHead];
+        promptQueueHead = (promptQueueHead + 1) % PROMPT_QUEUE_LENGTH;
+        promptQueueCount--;
+    }
+    portEXIT_CRITICAL(&promptLock);
+    if (taken) {
+        promptIndex = 0;
+        promptPlaying = true;
+    }
+    return taken;
+}
+
+void Audio::playPromptBlock() {
+    // Written straight from memory-mapped flash; the driver's copy into the DMA buffer is the only one
+    const auto *block = reinterpret_cast<const uint8_t *>(currentPrompt.prompt.samples) + promptIndex;
+    size_t bytesToWrite = min(DMA_FRAME_BYTES, currentPrompt.prompt.length - promptIndex);
+    size_t bytesWritten = 0;
+    waitForTxSlot();
+    esp_err_t result = i2s_write(I2S_NUM_1, block, bytesToWrite, &bytesWritten, portMAX_DELAY);
+    if (result != ESP_OK) {
+        LOG_E(TAG, "Error writing prompt to I2S: %d", result);
+        promptPlaying = false;
+        return;
+    }
+    i2sStats.framesWritten++;
+
+    if (promptIndex == 0 && currentPrompt.requestedAt != 0) {
+        uint32_t latency = micros() - currentPrompt.requestedAt;
+        promptStats.lastLatencyUs = latency;
+        promptStats.maxLatencyUs = latency > promptStats.maxLatencyUs ? latency : promptStats.maxLatencyUs;
+        LOG_I(TAG, "Prompt started %u us after its event (max %u us)", latency, promptStats.maxLatencyUs);
+    }
+    promptIndex += bytesWritten;
+    if (promptIndex >= currentPrompt.prompt.length) {
+        promptStats.played++;
+        promptPlaying = false;
+    }
+}
+
+void Audio::concealUnderrun() {
+    // Fade from the last sample to silence instead of stalling the DMA on stale data, then hold silence
+    static int16_t silence[DMA_FRAME_BYTES / sizeof(int16_t)];
+    const size_t samples = sizeof(silence) / sizeof(silence[0]);
+    for (size_t i = 0; i < samples; i++) {
+        silence[i] = static_cast<int16_t>(lastSample * static_cast<int32_t>(samples - 1 - i) / static_cast<int32_t>(samples));
+    }
+    lastSample = 0;
+
+    if (!inUnderrun) {
+        jitterStats.underruns++;
+        inUnderrun = true;
+    }
+    jitterStats.minFill = 0;
+
     size_t bytesWritten = 0;
+    waitForTxSlot();
+    i2s_write(I2S_NUM_1, silence, sizeof(silence), &bytesWritten, portMAX_DELAY);
+    jitterStats.concealedBytes += bytesWritten;
+}
+
+void Audio::applyFade(uint8_t *data, size_t length, bool fadeIn) {
+    auto *samples = reinterpret_cast<int16_t *>(data);
+    const size_t count = length / sizeof(int16_t);
+    for (size_t i = 0; i < count; i++) {
+        int32_t gain = fadeIn ? static_cast<int32_t>(i) : static_cast<int32_t>(count - 1 - i);
+        samples[i] = static_cast<int16_t>(samples[i] * gain / static_cast<int32_t>(count));
+    }
+}
+
+void Audio::grantPrefetchCredit(bool force) {
+    // Credit is the absolute stream offset the server may send up to: everything received plus what the store can take
+    if (!isPrefetching) {
+        return;
+    }
+    size_t credit = MessageStore::length(prefetchId) + MessageStore::writableBytes(prefetchId);
+    if (force || (credit > grantedCredit && credit - grantedCredit >= AUDIO_CREDIT_STEP)) {
+        grantedCredit = credit;
+        eventDispatcher->post(Event::of<AUDIO_CREDIT>({static_cast<uint32_t>(credit)}));
+    }
+}
+
+void Audio::audioTask(void *parameter) {
+    bool capturing = false;
+    bool playingOut = false;
     while (true) {
+        capturing = capturing && isRecording;
+        playingOut = playingOut && (isPlaying || promptPlaying);
+        if (isRecording || isPlaying) {
+            // Prompts are feedback for the moment they were asked for; a message cuts them off
+            portENTER_CRITICAL(&promptLock);
+            promptQueueCount = 0;
+            portEXIT_CRITICAL(&promptLock);
+            promptPlaying = false;
+        }
+        if (uploadPending && !isRecording) {
+            uploadPending = false;
+            finishUpload();
+        }
+        // Only this task moves the playback cursor, so only it can tell the last block is out
+        if (!isPlaying && playbackId != 0) {
+            endPlayback();
+        }
+        if (playbackRequested) {
+            playbackRequested = false;
+            // Owner messages play in the order they arrived
+            playMessage(MessageStore::nextUnplayed(MessageDirection::INBOUND));
+        }
+
+        // Active paths block on the DMA; the task only sleeps when there is nothing to do
         if (isRecording) {
-            if (audioBufferIndex + DMA_BUF_LEN <= audioBufferSize) {
-                esp_err_t result = i2s_read(I2S_NUM_0, audioBuffer + audioBufferIndex, DMA_BUF_LEN, &bytesRead, portMAX_DELAY);
-                if (result == ESP_OK) {
-                    audioBufferIndex += bytesRead;
-                } else {
-                    LOG_E(TAG, "Error reading from I2S: %d", result);
-                }
-            } else {
-                LOG_W(TAG, "Audio buffer full. Stopping recording.");
-                stopRecording();
+            if (!capturing) {
+                beginCapture();
+                capturing = true;
             }
-        } else if (isPlaying && audioBufferIndex > 0) {
-            size_t bytesToWrite = min(DMA_BUF_LEN, audioBufferIndex);
-            esp_err_t result = i2s_write(I2S_NUM_1, audioBuffer, bytesToWrite, &bytesWritten, portMAX_DELAY);
-
-            if (result == ESP_OK) {
-                // Shift the remaining audio data to the beginning of the buffer
-                memmove(audioBuffer, audioBuffer + bytesWritten, audioBufferIndex - bytesWritten);
-                audioBufferIndex -= bytesWritten;
-            } else {
-                LOG_E(TAG, "Error writing to I2S: %d", result);
+            captureNextFrame();
+        } else if (isPlaying) {
+            if (!playingOut) {
+                beginPlayout();
+                playingOut = true;
             }
-            if (audioBufferIndex == 0) {
-                LOG_I(TAG, "Playback completed.");
-                stopPlayback();
+            playNextBlock();
+        } else if (promptPlaying || takePrompt()) {
+            if (!playingOut) {
+                beginPlayout();
+                playingOut = true;
             }
-
+            playPromptBlock();
+        } else if (streamPending && (MessageStore::length(prefetchId) >= JITTER_WATERMARK_BYTES || !isPrefetching)) {
+            streamPending = false;
+            LOG_I(TAG, "Streaming playback started with %u bytes buffered", MessageStore::length(prefetchId));
+            playMessage(prefetchId);
+        } else {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         }
-        vTaskDelay(pdMS_TO_TICKS(10)); // Small delay to prevent task from hogging CPU
     }
-}
\ No newline at end of file
+}
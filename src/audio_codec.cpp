@@ -0,0 +1,200 @@
+#include "audio_codec.h"
+#include <cstring>
+
+static constexpr size_t ADPCM_HEADER_SIZE = 4;
+static constexpr uint8_t ADPCM_ODD_COUNT = 0x01; // Header flag: the last nibble is padding
+
+static const int16_t adpcmStepTable[89] = {
+        7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+        50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+        337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+        2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+        12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t adpcmIndexTable[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+static int32_t clamp(int32_t value, int32_t low, int32_t high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+// Applies one 4-bit code to the decoder state; shared by the encoder so both sides track the same predictor
+static int16_t adpcmStep(uint8_t code, int32_t &predictor, int32_t &stepIndex) {
+    int32_t step = adpcmStepTable[stepIndex];
+    int32_t diff = step >> 3;
+    if (code & 4) diff += step;
+    if (code & 2) diff += step >> 1;
+    if (code & 1) diff += step >> 2;
+    predictor = clamp(code & 8 ? predictor - diff : predictor + diff, INT16_MIN, INT16_MAX);
+    stepIndex = clamp(stepIndex + adpcmIndexTable[code], 0, 88);
+    return static_cast<int16_t>(predictor);
+}
+
+static uint8_t adpcmEncodeSample(int16_t sample, int32_t &predictor, int32_t &stepIndex) {
+    int32_t step = adpcmStepTable[stepIndex];
+    int32_t diff = sample - predictor;
+    uint8_t code = 0;
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+    if (diff >= step) {
+        code |= 4;
+        diff -= step;
+    }
+    if (diff >= step >> 1) {
+        code |= 2;
+        diff -= step >> 1;
+    }
+    if (diff >= step >> 2) {
+        code |= 1;
+    }
+    adpcmStep(code, predictor, stepIndex);
+    return code;
+}
+
+const char *AudioCodec::name(AudioCodecType type) {
+    switch (type) {
+        case AudioCodecType::MULAW:
+            return "mulaw";
+        case AudioCodecType::IMA_ADPCM:
+            return "ima_adpcm";
+        default:
+            return "pcm16";
+    }
+}
+
+bool AudioCodec::fromName(const char *name, AudioCodecType &type) {
+    if (name == nullptr) {
+        return false;
+    }
+    if (strcmp(name, "pcm16") == 0) {
+        type = AudioCodecType::PCM16;
+    } else if (strcmp(name, "mulaw") == 0) {
+        type = AudioCodecType::MULAW;
+    } else if (strcmp(name, "ima_adpcm") == 0) {
+        type = AudioCodecType::IMA_ADPCM;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+size_t AudioCodec::encodedSize(AudioCodecType type, size_t samples) {
+    switch (type) {
+        case AudioCodecType::MULAW:
+            return samples;
+        case AudioCodecType::IMA_ADPCM:
+            return ADPCM_HEADER_SIZE + (samples + 1) / 2;
+        default:
+            return samples * sizeof(int16_t);
+    }
+}
+
+size_t AudioCodec::encode(AudioCodecType type, const int16_t *pcm, size_t samples, uint8_t *out, AdpcmState &state) {
+    switch (type) {
+        case AudioCodecType::MULAW:
+            for (size_t i = 0; i < samples; i++) {
+                out[i] = encodeMulaw(pcm[i]);
+            }
+            break;
+        case AudioCodecType::IMA_ADPCM: {
+            int32_t predictor = state.predictor;
+            int32_t stepIndex = state.stepIndex;
+            out[0] = static_cast<uint8_t>(predictor & 0xFF);
+            out[1] = static_cast<uint8_t>((predictor >> 8) & 0xFF);
+            out[2] = static_cast<uint8_t>(stepIndex);
+            out[3] = samples & 1 ? ADPCM_ODD_COUNT : 0;
+            uint8_t *nibbles = out + ADPCM_HEADER_SIZE;
+            for (size_t i = 0; i < samples; i += 2) {
+                uint8_t low = adpcmEncodeSample(pcm[i], predictor, stepIndex);
+                uint8_t high = i + 1 < samples ? adpcmEncodeSample(pcm[i + 1], predictor, stepIndex) : 0;
+                nibbles[i / 2] = static_cast<uint8_t>(low | (high << 4));
+            }
+            state.predictor = predictor;
+            state.stepIndex = stepIndex;
+            break;
+        }
+        default:
+            memcpy(out, pcm, samples * sizeof(int16_t));
+            break;
+    }
+    return encodedSize(type, samples);
+}
+
+uint8_t AudioCodec::encodeMulaw(int16_t sample) {
+    static const int32_t BIAS = 0x84;
+    static const int32_t CLIP = 32635;
+
+    int32_t value = sample;
+    uint8_t sign = 0;
+    if (value < 0) {
+        value = -value;
+        sign = 0x80;
+    }
+    value = (value > CLIP ? CLIP : value) + BIAS;
+
+    uint8_t exponent = 7;
+    for (int32_t mask = 0x4000; (value & mask) == 0 && exponent > 0; mask >>= 1) {
+        exponent--;
+    }
+    uint8_t mantissa = (value >> (exponent + 3)) & 0x0F;
+    return static_cast<uint8_t>(~(sign | (exponent << 4) | mantissa));
+}
+
+int16_t AudioCodec::decodeMulaw(uint8_t value) {
+    value = ~value;
+    int32_t exponent = (value >> 4) & 0x07;
+    int32_t magnitude = (((value & 0x0F) << 3) + 0x84) << exponent;
+    return static_cast<int16_t>(value & 0x80 ? 0x84 - magnitude : magnitude - 0x84);
+}
+
+AudioChunkDecoder::AudioChunkDecoder(AudioCodecType type, const uint8_t *data, size_t length)
+        : type(type), data(data) {
+    switch (type) {
+        case AudioCodecType::MULAW:
+            totalSamples = length;
+            break;
+        case AudioCodecType::IMA_ADPCM:
+            if (length < ADPCM_HEADER_SIZE) {
+                totalSamples = 0;
+                break;
+            }
+            predictor = static_cast<int16_t>(data[0] | (data[1] << 8));
+            stepIndex = clamp(data[2], 0, 88);
+            this->data = data + ADPCM_HEADER_SIZE;
+            totalSamples = (length - ADPCM_HEADER_SIZE) * 2;
+            if (totalSamples > 0 && (data[3] & ADPCM_ODD_COUNT)) {
+                totalSamples--;
+            }
+            break;
+        default:
+            totalSamples = length / sizeof(int16_t);
+            break;
+    }
+}
+
+size_t AudioChunkDecoder::decode(int16_t *out, size_t maxSamples) {
+    size_t count = remainingSamples() < maxSamples ? remainingSamples() : maxSamples;
+
+    switch (type) {
+        case AudioCodecType::MULAW:
+            for (size_t i = 0; i < count; i++) {
+                out[i] = AudioCodec::decodeMulaw(data[decodedSamples + i]);
+            }
+            break;
+        case AudioCodecType::IMA_ADPCM:
+            for (size_t i = 0; i < count; i++) {
+                size_t sample = decodedSamples + i;
+                uint8_t code = (sample & 1) ? data[sample / 2] >> 4 : data[sample / 2] & 0x0F;
+                out[i] = adpcmStep(code, predictor, stepIndex);
+            }
+            break;
+        default:
+            memcpy(out, data + decodedSamples * sizeof(int16_t), count * sizeof(int16_t));
+            break;
+    }
+
+    decodedSamples += count;
+    return count;
+}
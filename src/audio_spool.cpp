@@ -0,0 +1,338 @@
+#include "audio_spool.h"
+#include "config.h"
+#include "logger.h"
+#include "partition_flash.h"
+
+static const char *TAG = "SPOOL";
+
+// Largest record the spool writes, so a replayed record fits one pool chunk
+static constexpr size_t MAX_RECORD = POOL_CHUNK_SIZE;
+
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+EventDispatcher *AudioSpool::eventDispatcher = nullptr;
+TaskHandle_t AudioSpool::taskHandle = nullptr;
+EventQueue *AudioSpool::requests = nullptr;
+SpoolLog *AudioSpool::log = nullptr;
+uint32_t AudioSpool::nextSession = 1;
+uint32_t AudioSpool::currentSession = 0;
+bool AudioSpool::currentDropped = false;
+uint32_t AudioSpool::writeSession = 0;
+uint32_t AudioSpool::endedSession = 0;
+uint32_t AudioSpool::endedAt = 0;
+uint32_t AudioSpool::replaySession = 0;
+uint32_t AudioSpool::replayOffset = 0;
+uint32_t AudioSpool::replayedUpTo = 0;
+uint32_t AudioSpool::replayDoneAt = 0;
+uint32_t AudioSpool::resumeSession = 0;
+uint32_t AudioSpool::resumeOffset = 0;
+uint32_t AudioSpool::resumeEnd = 0;
+std::atomic<uint32_t> AudioSpool::resumeRequested(0);
+std::atomic<bool> AudioSpool::online(false);
+std::atomic<bool> AudioSpool::chunkInFlight(false);
+SpoolStats AudioSpool::stats = {};
+
+void AudioSpool::begin(EventDispatcher &dispatcher) {
+    eventDispatcher = &dispatcher;
+    if (!SPOOL_ENABLED) {
+        return;
+    }
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                static_cast<esp_partition_subtype_t>(0x40),
+                                                                SPOOL_PARTITION_LABEL);
+    if (partition == nullptr) {
+        LOG_E(TAG, "No \"%s\" partition. Recordings are not spooled", SPOOL_PARTITION_LABEL);
+        return;
+    }
+
+    uint32_t startedAt = micros();
+    log = new SpoolLog(*new PartitionFlash(partition), SPOOL_SEGMENT_SIZE);
+    if (!log->mount()) {
+        LOG_E(TAG, "Failed to mount the spool partition (%u bytes)", partition->size);
+        delete log;
+        log = nullptr;
+        return;
+    }
+    nextSession = log->lastSessionId() + 1;
+    stats.log = log->getStats();
+    LOG_I(TAG, "Spool mounted in %u ms: %u recordings (%u bytes) awaiting acknowledgement, %u torn records",
+          (micros() - startedAt) / 1000, stats.log.pendingSessions, stats.log.pendingBytes, stats.log.tornRecords);
+
+    requests = new EventQueue(SPOOL_QUEUE_SIZE);
+    xTaskCreatePinnedToCore(spoolTask, "SpoolTask", 4096, nullptr, 2, &taskHandle, 0);
+}
+
+uint32_t AudioSpool::beginSession(const RecordingStart &start) {
+    endSession(); // In case the last recording's AUDIO_STREAM_END was dropped
+    currentSession = nextSession++;
+    // Without its start the spool task would file the chunks under another recording
+    currentDropped = requests == nullptr ||
+                     !pushRequest(Event::of<RECORDING_STARTED>({currentSession, start.sampleRate, start.codec}));
+    return currentSession;
+}
+
+void AudioSpool::append(const PooledBuffer &chunk) {
+    if (currentSession == 0 || currentDropped) {
+        return;
+    }
+    // The chunk is shared, not copied; it stays out of the pool until the spool task has written it. Only this
+    // task pushes, so the room seen here cannot shrink before the push.
+    if (requests->size() + SPOOL_CONTROL_SLOTS >= requests->capacity() || !requests->push({AUDIO_DATA_READY, chunk})) {
+        // Later chunks are dropped too, so the spooled recording has no gaps
+        currentDropped = true;
+        portENTER_CRITICAL(&statsLock);
+        stats.droppedChunks++;
+        portEXIT_CRITICAL(&statsLock);
+        LOG_W(TAG, "Spool queue full. Recording %u is spooled only up to here", currentSession);
+        return;
+    }
+    wake();
+}
+
+uint32_t AudioSpool::endSession() {
+    uint32_t session = currentSession;
+    if (session != 0 && requests != nullptr) {
+        pushRequest(Event::of<AUDIO_STREAM_END>({})); // If lost, the next recording's start closes it
+    }
+    currentSession = 0;
+    return session;
+}
+
+void AudioSpool::acknowledge(const SpoolPosition &ack) {
+    if (requests != nullptr) {
+        pushRequest(Event::of<SPOOL_ACK>(ack)); // If lost, a later ack covers it or the recording is replayed
+    }
+}
+
+void AudioSpool::setOnline(bool isOnline) {
+    online = isOnline;
+    wake();
+}
+
+uint32_t AudioSpool::requestResume() {
+    if (requests == nullptr || currentSession == 0 || currentDropped) {
+        return 0;
+    }
+    resumeRequested = currentSession;
+    return currentSession;
+}
+
+void AudioSpool::chunkSent() {
+    chunkInFlight = false;
+    wake();
+}
+
+SpoolStats AudioSpool::getStats() {
+    portENTER_CRITICAL(&statsLock);
+    SpoolStats snapshot = stats;
+    portEXIT_CRITICAL(&statsLock);
+    return snapshot;
+}
+
+void AudioSpool::logStats() {
+    SpoolStats snapshot = getStats();
+    uint32_t throughput = snapshot.flashMicros ? static_cast<uint32_t>(
+            uint64_t(snapshot.log.bytesWritten) * 1000000 / 1024 / snapshot.flashMicros) : 0;
+    LOG_I(TAG, "%u recordings (%u bytes) pending in %u/%u segments, %u bytes written at %u KB/s, %u erases "
+               "(wear %u-%u), %u bytes, %u chunks and %u requests dropped, %u bytes replayed, %u bytes resumed in %u uploads",
+          snapshot.log.pendingSessions,
+          snapshot.log.pendingBytes, snapshot.log.liveSegments, snapshot.log.segments, snapshot.log.bytesWritten,
+          throughput, snapshot.log.erases, snapshot.log.minEraseCount, snapshot.log.maxEraseCount,
+          snapshot.log.droppedBytes, snapshot.droppedChunks, snapshot.droppedRequests, snapshot.replayedBytes, snapshot.resumedBytes,
+          snapshot.resumes);
+}
+
+void AudioSpool::spoolTask(void *parameter) {
+    bool wasOnline = false;
+    while (true) {
+        Event request;
+        while (requests->pop(request)) {
+            process(request);
+        }
+
+        bool isOnline = online;
+        if (isOnline && !wasOnline) {
+            // Start over from the oldest recording; the server may have lost anything it had not acknowledged
+            replaySession = 0;
+            replayedUpTo = 0;
+        }
+        if (!isOnline) {
+            resumeSession = 0; // Asked for again once the link is back
+        }
+        wasOnline = isOnline;
+        while (isOnline && !chunkInFlight && (resumeNext() || replayNext())) {
+        }
+
+        uint32_t startedAt = micros();
+        log->prepareNextSegment();
+        SpoolLogStats logStats = log->getStats();
+        portENTER_CRITICAL(&statsLock);
+        stats.flashMicros += micros() - startedAt;
+        stats.log = logStats;
+        portEXIT_CRITICAL(&statsLock);
+
+        // Pending recordings are retried once their ack times out, so poll while there are any
+        ulTaskNotifyTake(pdTRUE, logStats.pendingSessions ? pdMS_TO_TICKS(1000) : portMAX_DELAY);
+    }
+}
+
+void AudioSpool::process(const Event &request) {
+    uint32_t startedAt = micros();
+    switch (request.type) {
+        case RECORDING_STARTED: {
+            const RecordingStart &start = request.payload<RECORDING_STARTED>();
+            if (writeSession != 0) {
+                log->endSession(writeSession); // Its AUDIO_STREAM_END was dropped
+            }
+            writeSession = start.session;
+            if (!log->beginSession(start.session, {start.sampleRate, static_cast<uint8_t>(start.codec), 0})) {
+                LOG_W(TAG, "Spool full. Recording %u is not spooled", start.session);
+            }
+            break;
+        }
+        case AUDIO_DATA_READY:
+            for (size_t offset = 0; offset < request.buffer.size(); offset += MAX_RECORD) {
+                size_t length = request.buffer.size() - offset < MAX_RECORD ? request.buffer.size() - offset : MAX_RECORD;
+                if (!log->append(writeSession, request.buffer.data() + offset, length)) {
+                    break;
+                }
+            }
+            break;
+        case AUDIO_STREAM_END:
+            log->endSession(writeSession);
+            endedSession = writeSession;
+            endedAt = millis();
+            writeSession = 0;
+            break;
+        case SPOOL_ACK: {
+            const SpoolPosition &ack = request.payload<SPOOL_ACK>();
+            log->acknowledge(ack.session, ack.offset);
+            const SpoolSession *entry = log->findSession(ack.session);
+            uint32_t expected = ack.session;
+            if (entry != nullptr && resumeRequested.compare_exchange_strong(expected, 0)) {
+                // Only what was spooled by now is missing; later chunks go out live
+                resumeSession = ack.session;
+                resumeOffset = entry->acked;
+                resumeEnd = entry->written;
+                portENTER_CRITICAL(&statsLock);
+                stats.resumes++;
+                portEXIT_CRITICAL(&statsLock);
+                LOG_I(TAG, "Resuming recording %u from byte %u, %u bytes to refill", ack.session, entry->acked,
+                      entry->written - entry->acked);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    portENTER_CRITICAL(&statsLock);
+    stats.flashMicros += micros() - startedAt;
+    portEXIT_CRITICAL(&statsLock);
+}
+
+bool AudioSpool::replayNext() {
+    const SpoolSession *entry = log->findSession(replaySession);
+    if (entry == nullptr || replayOffset >= entry->written) {
+        if (entry != nullptr) {
+            eventDispatcher->post(Event::of<SPOOL_SENT>({entry->id, entry->written}));
+        }
+        if (replaySession != 0) {
+            replayedUpTo = replaySession;
+            replayDoneAt = millis();
+            replaySession = 0;
+        }
+
+        entry = log->nextPending(replayedUpTo);
+        if (entry == nullptr) {
+            // Anything still unacknowledged a while after its replay is sent again
+            if (replayedUpTo != 0 && log->nextPending(0) != nullptr && millis() - replayDoneAt >= SPOOL_ACK_TIMEOUT_MS) {
+                replayedUpTo = 0;
+            }
+            return false;
+        }
+        if (entry->id == endedSession && millis() - endedAt < SPOOL_ACK_TIMEOUT_MS) {
+            return false; // Just uploaded live; give the server time to acknowledge it
+        }
+        replaySession = entry->id;
+        replayOffset = entry->acked;
+        LOG_I(TAG, "Replaying recording %u from byte %u of %u", entry->id, entry->acked, entry->written);
+    }
+    replayOffset = entry->acked > replayOffset ? entry->acked : replayOffset;
+
+    size_t length = 0;
+    if (!postChunk(replaySession, replayOffset, entry->written, length)) {
+        return false;
+    }
+    portENTER_CRITICAL(&statsLock);
+    stats.replayedChunks += length > 0;
+    stats.replayedBytes += length;
+    portEXIT_CRITICAL(&statsLock);
+    return true;
+}
+
+bool AudioSpool::resumeNext() {
+    if (resumeSession == 0) {
+        return false;
+    }
+    const SpoolSession *entry = log->findSession(resumeSession);
+    resumeOffset = entry != nullptr && entry->acked > resumeOffset ? entry->acked : resumeOffset;
+    if (entry == nullptr || resumeOffset >= resumeEnd) {
+        LOG_I(TAG, "Recording %u refilled up to byte %u", resumeSession, resumeEnd);
+        resumeSession = 0;
+        return false;
+    }
+
+    size_t length = 0;
+    if (!postChunk(resumeSession, resumeOffset, resumeEnd, length)) {
+        return false;
+    }
+    portENTER_CRITICAL(&statsLock);
+    stats.resumedBytes += length;
+    portEXIT_CRITICAL(&statsLock);
+    return true;
+}
+
+bool AudioSpool::postChunk(uint32_t session, uint32_t &offset, uint32_t end, size_t &length) {
+    PooledBuffer chunk = BufferPool::acquire();
+    if (!chunk) {
+        return false;
+    }
+    uint32_t chunkOffset = 0;
+    length = log->readChunk(session, offset, chunk.data(), MAX_RECORD, chunkOffset);
+    if (length == 0) {
+        offset = end; // The rest is unreadable; the recording is sent as far as it goes
+        return true;
+    }
+
+    chunk.setSize(length);
+    chunkInFlight = true;
+    Event ready = Event::of<SPOOL_CHUNK_READY>({session, chunkOffset});
+    ready.buffer = std::move(chunk);
+    if (!eventDispatcher->post(std::move(ready))) {
+        chunkInFlight = false;
+        length = 0;
+        return false;
+    }
+    offset = chunkOffset + length;
+    return true;
+}
+
+bool AudioSpool::pushRequest(Event &&request) {
+    EventType type = request.type;
+    if (!requests->push(std::move(request))) {
+        portENTER_CRITICAL(&statsLock);
+        stats.droppedRequests++;
+        portEXIT_CRITICAL(&statsLock);
+        LOG_W(TAG, "Spool queue full. Request %d dropped", static_cast<int>(type));
+        return false;
+    }
+    wake();
+    return true;
+}
+
+void AudioSpool::wake() {
+    if (taskHandle != nullptr) {
+        xTaskNotifyGive(taskHandle);
+    }
+}
@@ -0,0 +1,36 @@
+#include "biquad.h"
+#include "pcm_convert.h"
+
+BiquadChain::BiquadChain(const BiquadCoefficients *stages, size_t stageCount)
+        : stages(stages), stageCount(stageCount < BIQUAD_MAX_STAGES ? stageCount : BIQUAD_MAX_STAGES) {
+    reset();
+}
+
+void BiquadChain::reset() {
+    for (size_t i = 0; i < BIQUAD_MAX_STAGES; i++) {
+        state[i] = {};
+    }
+}
+
+void BiquadChain::process(int16_t *samples, size_t count) {
+    static constexpr int64_t ROUNDING = 1 << (BIQUAD_FRACTION_BITS - 1);
+
+    // Stage by stage over the whole block keeps one stage's coefficients and state in registers
+    for (size_t s = 0; s < stageCount; s++) {
+        const BiquadCoefficients c = stages[s];
+        State st = state[s];
+        for (size_t i = 0; i < count; i++) {
+            int32_t x = samples[i];
+            int64_t acc = static_cast<int64_t>(c.b0) * x + static_cast<int64_t>(c.b1) * st.x1 +
+                          static_cast<int64_t>(c.b2) * st.x2 - static_cast<int64_t>(c.a1) * st.y1 -
+                          static_cast<int64_t>(c.a2) * st.y2;
+            int16_t y = PcmConvert::saturate(static_cast<int32_t>((acc + ROUNDING) >> BIQUAD_FRACTION_BITS));
+            st.x2 = st.x1;
+            st.x1 = x;
+            st.y2 = st.y1;
+            st.y1 = y;
+            samples[i] = y;
+        }
+        state[s] = st;
+    }
+}
@@ -0,0 +1,145 @@
+#include "buffer_pool.h"
+#include <Arduino.h>
+#include <new>
+#include "logger.h"
+
+static const char *TAG = "BufferPool";
+
+static constexpr uint16_t NO_CHUNK = 0xFFFF;
+static portMUX_TYPE poolLock = portMUX_INITIALIZER_UNLOCKED;
+
+PoolChunk *BufferPool::chunks = nullptr;
+size_t BufferPool::chunkCount = 0;
+uint16_t BufferPool::freeHead = NO_CHUNK;
+size_t BufferPool::freeCount = 0;
+size_t BufferPool::minFree = 0;
+uint32_t BufferPool::exhaustedCount = 0;
+std::atomic<uint32_t> BufferPool::bytesCopied(0);
+
+PooledBuffer::PooledBuffer(const PooledBuffer &other) : chunk(other.chunk) {
+    if (chunk) {
+        chunk->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other) noexcept: chunk(other.chunk) {
+    other.chunk = nullptr;
+}
+
+PooledBuffer &PooledBuffer::operator=(const PooledBuffer &other) {
+    if (this != &other) {
+        reset();
+        chunk = other.chunk;
+        if (chunk) {
+            chunk->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return *this;
+}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other) noexcept {
+    if (this != &other) {
+        reset();
+        chunk = other.chunk;
+        other.chunk = nullptr;
+    }
+    return *this;
+}
+
+PooledBuffer::~PooledBuffer() {
+    reset();
+}
+
+void PooledBuffer::reset() {
+    if (chunk && chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        BufferPool::release(chunk);
+    }
+    chunk = nullptr;
+}
+
+bool BufferPool::begin(size_t count) {
+    if (count >= NO_CHUNK) {
+        LOG_E(TAG, "Too many chunks requested: %u", count);
+        return false;
+    }
+
+    auto *memory = static_cast<uint8_t *>(ps_malloc(count * (POOL_CHUNK_HEADROOM + POOL_CHUNK_SIZE)));
+    chunks = new(std::nothrow) PoolChunk[count];
+    if (memory == nullptr || chunks == nullptr) {
+        LOG_E(TAG, "Failed to allocate %u pool chunks", count);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        chunks[i].refs.store(0, std::memory_order_relaxed);
+        chunks[i].size = 0;
+        chunks[i].memory = memory + i * (POOL_CHUNK_HEADROOM + POOL_CHUNK_SIZE);
+        chunks[i].nextFree = (i + 1 < count) ? static_cast<uint16_t>(i + 1) : NO_CHUNK;
+    }
+    chunkCount = count;
+    freeHead = count > 0 ? 0 : NO_CHUNK;
+    freeCount = count;
+    minFree = count;
+
+    LOG_I(TAG, "Buffer pool ready: %u chunks of %u bytes", count, POOL_CHUNK_SIZE);
+    return true;
+}
+
+PooledBuffer BufferPool::acquire() {
+    PoolChunk *chunk = nullptr;
+
+    portENTER_CRITICAL(&poolLock);
+    if (freeHead != NO_CHUNK) {
+        chunk = &chunks[freeHead];
+        freeHead = chunk->nextFree;
+        freeCount--;
+        if (freeCount < minFree) {
+            minFree = freeCount;
+        }
+    } else {
+        exhaustedCount++;
+    }
+    portEXIT_CRITICAL(&poolLock);
+
+    if (chunk == nullptr) {
+        return {};
+    }
+
+    chunk->refs.store(1, std::memory_order_relaxed);
+    chunk->size = 0;
+    return PooledBuffer(chunk);
+}
+
+PooledBuffer BufferPool::copyFrom(const uint8_t *data, size_t length) {
+    if (length > POOL_CHUNK_SIZE) {
+        LOG_E(TAG, "Payload of %u bytes exceeds chunk size", length);
+        return {};
+    }
+
+    PooledBuffer buffer = acquire();
+    if (buffer) {
+        memcpy(buffer.data(), data, length);
+        buffer.setSize(length);
+        recordCopy(length);
+    }
+    return buffer;
+}
+
+void BufferPool::recordCopy(size_t bytes) {
+    bytesCopied.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void BufferPool::release(PoolChunk *chunk) {
+    portENTER_CRITICAL(&poolLock);
+    chunk->nextFree = freeHead;
+    freeHead = static_cast<uint16_t>(chunk - chunks);
+    freeCount++;
+    portEXIT_CRITICAL(&poolLock);
+}
+
+BufferPoolStats BufferPool::getStats() {
+    portENTER_CRITICAL(&poolLock);
+    BufferPoolStats stats = {chunkCount, chunkCount - freeCount, minFree, exhaustedCount, bytesCopied.load()};
+    portEXIT_CRITICAL(&poolLock);
+    return stats;
+}
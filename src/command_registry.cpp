@@ -0,0 +1,404 @@
+#include "command_registry.h"
+#include <cstring>
+
+static constexpr int MAX_DEPTH = 16; // Nesting skipped inside an unknown member before the frame is rejected
+
+namespace {
+
+// Walks a JSON text without building anything. Strings are unescaped over themselves and null-terminated,
+// which always fits: an escape is never shorter than what it stands for.
+class Scanner {
+public:
+    Scanner(char *text, size_t length) : pos(text), end(text + length) {}
+
+    void skipSpace() {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r')) {
+            pos++;
+        }
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (pos < end && *pos == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool atEnd() {
+        skipSpace();
+        return pos == end;
+    }
+
+    char *position() const { return pos; }
+
+    // Parses a string in place. Returns its start, or nullptr if it is not a valid string.
+    char *string(size_t &length) {
+        if (!consume('"')) {
+            return nullptr;
+        }
+        char *start = pos;
+        char *out = pos;
+        while (pos < end) {
+            char c = *pos++;
+            if (c == '"') {
+                *out = '\0';
+                length = out - start;
+                return start;
+            }
+            if (static_cast<uint8_t>(c) < 0x20) {
+                return nullptr;
+            }
+            if (c != '\\') {
+                *out++ = c;
+                continue;
+            }
+            if (pos == end) {
+                return nullptr;
+            }
+            switch (*pos++) {
+                case '"': *out++ = '"'; break;
+                case '\\': *out++ = '\\'; break;
+                case '/': *out++ = '/'; break;
+                case 'b': *out++ = '\b'; break;
+                case 'f': *out++ = '\f'; break;
+                case 'n': *out++ = '\n'; break;
+                case 'r': *out++ = '\r'; break;
+                case 't': *out++ = '\t'; break;
+                case 'u': {
+                    uint32_t code;
+                    if (!hex4(code)) {
+                        return nullptr;
+                    }
+                    if (code >= 0xD800 && code < 0xDC00) {
+                        uint32_t low;
+                        if (end - pos < 6 || pos[0] != '\\' || pos[1] != 'u') {
+                            return nullptr;
+                        }
+                        pos += 2;
+                        if (!hex4(low) || low < 0xDC00 || low >= 0xE000) {
+                            return nullptr;
+                        }
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    } else if (code >= 0xDC00 && code < 0xE000) {
+                        return nullptr;
+                    }
+                    out = utf8(out, code);
+                    break;
+                }
+                default:
+                    return nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // Parses a non-negative integer. Fractions, exponents and signs are rejected rather than rounded.
+    bool unsignedNumber(uint32_t &value) {
+        skipSpace();
+        if (pos == end || *pos < '0' || *pos > '9') {
+            return false;
+        }
+        uint64_t result = 0;
+        while (pos < end && *pos >= '0' && *pos <= '9') {
+            result = result * 10 + (*pos++ - '0');
+            if (result > UINT32_MAX) {
+                return false;
+            }
+        }
+        if (pos < end && (*pos == '.' || *pos == 'e' || *pos == 'E')) {
+            return false;
+        }
+        value = static_cast<uint32_t>(result);
+        return true;
+    }
+
+    bool literal(const char *word) {
+        skipSpace();
+        size_t length = strlen(word);
+        if (static_cast<size_t>(end - pos) < length || memcmp(pos, word, length) != 0) {
+            return false;
+        }
+        pos += length;
+        return true;
+    }
+
+    // Steps over any value without unescaping it, so the text is left as it was
+    bool skipValue(int depth = 0) {
+        skipSpace();
+        if (pos == end || depth > MAX_DEPTH) {
+            return false;
+        }
+        switch (*pos) {
+            case '"':
+                return skipString();
+            case '{':
+            case '[': {
+                char close = *pos == '{' ? '}' : ']';
+                pos++;
+                if (consume(close)) {
+                    return true;
+                }
+                do {
+                    if (close == '}' && (!skipString() || !consume(':'))) {
+                        return false;
+                    }
+                    if (!skipValue(depth + 1)) {
+                        return false;
+                    }
+                } while (consume(','));
+                return consume(close);
+            }
+            case 't':
+                return literal("true");
+            case 'f':
+                return literal("false");
+            case 'n':
+                return literal("null");
+            default:
+                return skipNumber();
+        }
+    }
+
+private:
+    bool skipString() {
+        if (!consume('"')) {
+            return false;
+        }
+        while (pos < end) {
+            char c = *pos++;
+            if (c == '"') {
+                return true;
+            }
+            if (c == '\\' && pos++ == end) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool skipNumber() {
+        char *start = pos;
+        while (pos < end && ((*pos >= '0' && *pos <= '9') || *pos == '-' || *pos == '+' || *pos == '.' ||
+                             *pos == 'e' || *pos == 'E')) {
+            pos++;
+        }
+        return pos != start;
+    }
+
+    bool hex4(uint32_t &code) {
+        if (end - pos < 4) {
+            return false;
+        }
+        code = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = *pos++;
+            code <<= 4;
+            if (c >= '0' && c <= '9') {
+                code |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                code |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                code |= c - 'A' + 10;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static char *utf8(char *out, uint32_t code) {
+        if (code < 0x80) {
+            *out++ = static_cast<char>(code);
+        } else if (code < 0x800) {
+            *out++ = static_cast<char>(0xC0 | code >> 6);
+            *out++ = static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            *out++ = static_cast<char>(0xE0 | code >> 12);
+            *out++ = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+            *out++ = static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            *out++ = static_cast<char>(0xF0 | code >> 18);
+            *out++ = static_cast<char>(0x80 | (code >> 12 & 0x3F));
+            *out++ = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+            *out++ = static_cast<char>(0x80 | (code & 0x3F));
+        }
+        return out;
+    }
+
+    char *pos;
+    char *end;
+};
+
+bool decodeField(Scanner &scanner, const FieldSpec &field, uint8_t *fields) {
+    uint8_t *target = fields + field.offset;
+    switch (field.type) {
+        case FieldType::STRING: {
+            size_t length;
+            const char *value = scanner.string(length);
+            if (value == nullptr || strlen(value) != length) {
+                return false; // An escaped NUL would silently cut the string short
+            }
+            memcpy(target, &value, sizeof(value));
+            return true;
+        }
+        case FieldType::BOOL: {
+            bool value;
+            if (scanner.literal("true")) {
+                value = true;
+            } else if (scanner.literal("false")) {
+                value = false;
+            } else {
+                return false;
+            }
+            memcpy(target, &value, sizeof(value));
+            return true;
+        }
+        case FieldType::UINT8:
+        case FieldType::UINT16:
+        case FieldType::UINT32: {
+            uint32_t value;
+            if (!scanner.unsignedNumber(value)) {
+                return false;
+            }
+            if (field.type == FieldType::UINT8) {
+                if (value > UINT8_MAX) {
+                    return false;
+                }
+                uint8_t narrow = value;
+                memcpy(target, &narrow, sizeof(narrow));
+            } else if (field.type == FieldType::UINT16) {
+                if (value > UINT16_MAX) {
+                    return false;
+                }
+                uint16_t narrow = value;
+                memcpy(target, &narrow, sizeof(narrow));
+            } else {
+                memcpy(target, &value, sizeof(value));
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decodes the members of the data object at the scanner into fields. Returns false with the offending member in
+// `bad` (nullptr when the text itself is malformed).
+bool decodeFields(Scanner &scanner, const CommandSpec &command, uint8_t *fields, const char *&bad) {
+    bad = nullptr;
+    uint32_t seen = 0;
+    if (scanner.literal("null")) {
+        // Same as an empty object
+    } else if (!scanner.consume('{')) {
+        return false;
+    } else if (!scanner.consume('}')) {
+        do {
+            size_t length;
+            const char *key = scanner.string(length);
+            if (key == nullptr || !scanner.consume(':')) {
+                return false;
+            }
+            const FieldSpec *field = nullptr;
+            for (uint8_t i = 0; i < command.fieldCount; i++) {
+                if (strcmp(command.fields[i].name, key) == 0) {
+                    field = &command.fields[i];
+                    seen |= 1u << i;
+                    break;
+                }
+            }
+            if (field == nullptr) {
+                if (!scanner.skipValue()) {
+                    return false;
+                }
+            } else if (scanner.literal("null")) {
+                seen &= ~(1u << (field - command.fields)); // Treated as absent
+            } else if (!decodeField(scanner, *field, fields)) {
+                bad = field->name;
+                return false;
+            }
+        } while (scanner.consume(','));
+        if (!scanner.consume('}')) {
+            return false;
+        }
+    }
+
+    for (uint8_t i = 0; i < command.fieldCount; i++) {
+        if (command.fields[i].required && !(seen & 1u << i)) {
+            bad = command.fields[i].name;
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+const CommandSpec *CommandRegistry::find(const char *name, size_t length) const {
+    uint32_t hash = 2166136261u ^ COMMAND_HASH_SEED;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+    }
+    uint8_t index = slots.index[hash >> (32 - COMMAND_SLOT_BITS)];
+    if (index == 0) {
+        return nullptr;
+    }
+    const CommandSpec &command = commands[index - 1];
+    // One comparison confirms the hit, since a slot holds at most one command
+    return strncmp(command.name, name, length) == 0 && command.name[length] == '\0' ? &command : nullptr;
+}
+
+CommandOutcome CommandRegistry::dispatch(char *text, size_t length) const {
+    Scanner scanner(text, length);
+    const char *eventType = nullptr;
+    size_t eventTypeLength = 0;
+    char *data = nullptr;
+
+    // First pass: find event_type and where data starts. data is stepped over untouched and decoded once the
+    // command, and so its fields, is known.
+    bool valid = scanner.consume('{');
+    if (valid && !scanner.consume('}')) {
+        do {
+            size_t keyLength;
+            const char *key = scanner.string(keyLength);
+            if (key == nullptr || !scanner.consume(':')) {
+                valid = false;
+                break;
+            }
+            if (strcmp(key, "event_type") == 0) {
+                eventType = scanner.string(eventTypeLength);
+                valid = eventType != nullptr;
+            } else {
+                if (strcmp(key, "data") == 0) {
+                    scanner.skipSpace();
+                    data = scanner.position();
+                }
+                valid = scanner.skipValue();
+            }
+        } while (valid && scanner.consume(','));
+        valid = valid && scanner.consume('}');
+    }
+    if (!valid || !scanner.atEnd()) {
+        return {CommandStatus::MALFORMED, nullptr, nullptr, nullptr};
+    }
+    if (eventType == nullptr) {
+        return {CommandStatus::NO_EVENT_TYPE, nullptr, nullptr, nullptr};
+    }
+
+    const CommandSpec *command = find(eventType, eventTypeLength);
+    if (command == nullptr) {
+        return {CommandStatus::UNKNOWN, nullptr, eventType, nullptr};
+    }
+    alignas(8) uint8_t fields[COMMAND_FIELDS_SIZE] = {};
+    if (data != nullptr || command->fieldCount > 0) {
+        // A missing data object is read as an empty one, so required fields are still reported
+        char empty[] = "{}";
+        Scanner dataScanner(data != nullptr ? data : empty, data != nullptr ? text + length - data : 2);
+        const char *bad;
+        if (!decodeFields(dataScanner, *command, fields, bad)) {
+            return {bad != nullptr ? CommandStatus::INVALID_FIELD : CommandStatus::INVALID_DATA, nullptr, eventType, bad};
+        }
+    }
+    command->handler(fields);
+    return {CommandStatus::HANDLED, command, eventType, nullptr};
+}
@@ -45,7 +45,7 @@ void ESPNow::onDataReceived(const uint8_t *mac, const uint8_t *data, int len) {
     receivedData[len] = '\0';
 
     LOG_I(TAG, "Received data: %s", receivedData);
-    eventDispatcher->dispatchEvent({ESPNOW_DATA_RECEIVED, std::string(receivedData), static_cast<size_t>(len)});
+    eventDispatcher->post({ESPNOW_DATA_RECEIVED, std::string(receivedData), static_cast<size_t>(len)});
 
     free(receivedData);
 }
@@ -1,62 +1,97 @@
 #include "event_handler.h"
+#include "intercom.h"
+#include "audio_spool.h"
+#include "event_outbox.h"
 #include "logger.h"
 #include "esp_now_manager.h"
-#include <ArduinoJson.h>
 
 static const char *TAG = "EventHandler";
 
+static constexpr uint32_t DISPLAY_WAKE_MS = 500; // Power-up time of the display before the visitor screen is drawn
+
 EventHandler::EventHandler(Audio &audio, NetworkManager &network, Gate &gate, LED &led, UI &ui, ESPNow &espNow,
                            FingerprintHandler &fingerprint, PIRSensor &pir)
         : audio(audio), network(network), gate(gate), led(led), ui(ui), espNow(espNow), fingerprint(fingerprint), pir(pir) {};
 
 void EventHandler::registerCallbacks(EventDispatcher &dispatcher) {
+    // Prompts, registered first so they start before the slower handlers below run
+    dispatcher.registerCallback(PERSON_DETECTED, [](const Event &e) {
+        Audio::playPrompt(PromptId::DOORBELL, e.postedAt);
+        Audio::playPrompt(PromptId::PLEASE_WAIT, 0);
+    });
+    dispatcher.registerCallback(CMD_GRANT_ACCESS, [](const Event &e) { Audio::playPrompt(PromptId::ACCESS_GRANTED, e.postedAt); });
+    dispatcher.registerCallback(CMD_DENY_ACCESS, [](const Event &e) { Audio::playPrompt(PromptId::ACCESS_DENIED, e.postedAt); });
+    dispatcher.registerCallback(FINGERPRINT_MATCHED, [](const Event &e) { Audio::playPrompt(PromptId::WELCOME, e.postedAt); });
+    dispatcher.registerCallback(PASSWORD_VALID, [](const Event &e) { Audio::playPrompt(PromptId::WELCOME, e.postedAt); });
+    dispatcher.registerCallback(FINGERPRINT_NO_MATCH, [](const Event &e) { Audio::playPrompt(PromptId::TRY_AGAIN, e.postedAt); });
+    dispatcher.registerCallback(PASSWORD_INVALID, [](const Event &e) { Audio::playPrompt(PromptId::TRY_AGAIN, e.postedAt); });
+
     // Audio Commands
-    dispatcher.registerCallback(CMD_TG_AUDIO, [this](const Event &e) { handleTelegramAudioCommand(e); });
-    dispatcher.registerCallback(CMD_ESP_AUDIO, [this](const Event &e) { handleESPAudioCommand(e); });
-    dispatcher.registerCallback(AUDIO_DATA_RECEIVED, [this](const Event &e) { handleAudioDataReceived(e); });
-    dispatcher.registerCallback(AUDIO_DATA_READY, [this](const Event &e) { handleAudioDataReady(e); });
+    dispatcher.registerCallback(CMD_TG_AUDIO, EventCallback::bind<EventHandler, &EventHandler::handleTelegramAudioCommand>(this));
+    dispatcher.registerCallback(CMD_ESP_AUDIO, EventCallback::bind<EventHandler, &EventHandler::handleESPAudioCommand>(this));
+    dispatcher.registerCallback(AUDIO_DATA_RECEIVED, EventCallback::bind<EventHandler, &EventHandler::handleAudioDataReceived>(this));
+    dispatcher.registerCallback(AUDIO_DATA_READY, EventCallback::bind<EventHandler, &EventHandler::handleAudioDataReady>(this));
+    dispatcher.registerCallback(AUDIO_CREDIT, EventCallback::bind<EventHandler, &EventHandler::handleAudioCredit>(this));
+    dispatcher.registerCallback(CMD_SET_CODEC, EventCallback::bind<EventHandler, &EventHandler::handleSetCodec>(this));
+    dispatcher.registerCallback(INTERCOM_AUDIO_READY, EventCallback::bind<EventHandler, &EventHandler::handleIntercomAudioReady>(this));
+    dispatcher.registerCallback(INTERCOM_ENDED, [this](const Event &e) { handleIntercomEnded(); });
+
+    // Audio Spool
+    dispatcher.registerCallback(RECORDING_STARTED, [](const Event &e) { AudioSpool::beginSession(e.payload<RECORDING_STARTED>()); });
+    dispatcher.registerCallback(SPOOL_ACK, [](const Event &e) { AudioSpool::acknowledge(e.payload<SPOOL_ACK>()); });
+    dispatcher.registerCallback(SPOOL_CHUNK_READY, EventCallback::bind<EventHandler, &EventHandler::handleSpoolChunkReady>(this));
+    dispatcher.registerCallback(SPOOL_SENT, EventCallback::bind<EventHandler, &EventHandler::handleSpoolSent>(this));
+    dispatcher.registerCallback(WS_CONNECTED, EventCallback::bind<EventHandler, &EventHandler::handleConnected>(this));
+    dispatcher.registerCallback(WS_DISCONNECTED, [](const Event &e) {
+        AudioSpool::setOnline(false);
+        EventOutbox::setOnline(false);
+    });
+    dispatcher.registerCallback(OUTBOX_BATCH_READY, [](const Event &e) {
+        EventOutbox::batchSent(NetworkManager::sendText(e.buffer));
+    });
 
     // Authentication Events
-    dispatcher.registerCallback(FINGERPRINT_MATCHED, [this](const Event &e) { handleFingerprintMatch(e); });
+    dispatcher.registerCallback(FINGERPRINT_MATCHED, EventCallback::bind<EventHandler, &EventHandler::handleFingerprintMatch>(this));
     dispatcher.registerCallback(FINGERPRINT_NO_MATCH, [this](const Event &e) { handleFingerprintNoMatch(); });
-    dispatcher.registerCallback(PASSWORD_VALID, [this](const Event &e) { handlePasswordValid(e); });
+    dispatcher.registerCallback(PASSWORD_VALID, EventCallback::bind<EventHandler, &EventHandler::handlePasswordValid>(this));
     dispatcher.registerCallback(PASSWORD_INVALID, [this](const Event &e) { handlePasswordInvalid(); });
 
     // State Change Commands
-    dispatcher.registerCallback(CMD_CHANGE_STATE, [this](const Event &e) { handleChangeState(e); });
-    dispatcher.registerCallback(GATE_OPENED, [this](const Event &e) { handleChangeStateSuccess(e); });
-    dispatcher.registerCallback(GATE_CLOSED, [this](const Event &e) { handleChangeStateSuccess(e); });
-    dispatcher.registerCallback(LED_TURNED_ON, [this](const Event &e) { handleChangeStateSuccess(e); });
-    dispatcher.registerCallback(LED_TURNED_OFF, [this](const Event &e) { handleChangeStateSuccess(e); });
+    dispatcher.registerCallback(CMD_CHANGE_STATE, EventCallback::bind<EventHandler, &EventHandler::handleChangeState>(this));
+    dispatcher.registerCallback(GATE_OPENED, EventCallback::bind<EventHandler, &EventHandler::handleChangeStateSuccess>(this));
+    dispatcher.registerCallback(GATE_CLOSED, EventCallback::bind<EventHandler, &EventHandler::handleChangeStateSuccess>(this));
+    dispatcher.registerCallback(LED_TURNED_ON, EventCallback::bind<EventHandler, &EventHandler::handleChangeStateSuccess>(this));
+    dispatcher.registerCallback(LED_TURNED_OFF, EventCallback::bind<EventHandler, &EventHandler::handleChangeStateSuccess>(this));
 
     // Access Control
-    dispatcher.registerCallback(CMD_GRANT_ACCESS, [this](const Event &e) { handleAccessGranted(); });
+    dispatcher.registerCallback(CMD_GRANT_ACCESS, EventCallback::bind<EventHandler, &EventHandler::handleAccessGranted>(this));
     dispatcher.registerCallback(CMD_DENY_ACCESS, [this](const Event &e) { handleAccessDenied(); });
 
     // Detection Events
     dispatcher.registerCallback(MOTION_DETECTED, [this](const Event &e) { handleMotionDetected(); });
     dispatcher.registerCallback(PERSON_DETECTED, [this](const Event &e) { handlePersonDetected(); });
+    dispatcher.registerCallback(DISPLAY_READY, [this](const Event &e) { handleDisplayReady(); });
+    displayTimer = xTimerCreate("DisplayTimer", pdMS_TO_TICKS(DISPLAY_WAKE_MS), pdFALSE, &dispatcher, displayTimerCallback);
 
     // Gate Events
     dispatcher.registerCallback(VISITOR_ENTERED, [this](const Event &e) { handleVisitorEntered(); });
 
     // Miscellaneous Events
-    dispatcher.registerCallback(RECORDING_SENT, [this](const Event &e) { handleRecordingSent(); });
+    dispatcher.registerCallback(AUDIO_STREAM_END, EventCallback::bind<EventHandler, &EventHandler::handleAudioStreamEnd>(this));
     dispatcher.registerCallback(NO_AUDIO_DATA, [this](const Event &e) { ui.setStateFor(3, UIState::NO_AUDIO_DATA); });
 
     // Power Saving
-    dispatcher.registerCallback(INACTIVITY_DETECTED, [this](const Event &e) { handleInactivityDetected(e); });
+    dispatcher.registerCallback(INACTIVITY_DETECTED, EventCallback::bind<EventHandler, &EventHandler::handleInactivityDetected>(this));
 
     // Fingerprint Enrollment
-    dispatcher.registerCallback(CMD_ENROLL_FINGERPRINT, [this](const Event &e) { handleFingerprintEnroll(e); });
-    dispatcher.registerCallback(CMD_ENROLL_FINGERPRINT, [this](const Event &e) { handleFingerprintEnroll(e); });
-    dispatcher.registerCallback(PLACE_FINGER, [this](const Event &e) { handlePlaceFinger(e); });
-    dispatcher.registerCallback(PLACE_FINGER_AGAIN, [this](const Event &e) { handlePlaceFingerAgain(e); });
-    dispatcher.registerCallback(REMOVE_FINGER, [this](const Event &e) { handleRemoveFinger(e); });
-    dispatcher.registerCallback(FINGERPRINT_ENROLLED, [this](const Event &e) { handleFingerprintEnrolled(e); });
-    dispatcher.registerCallback(FINGERPRINT_ENROLL_FAILED, [this](const Event &e) { handleFingerprintEnrollFailed(e); });
-
-    dispatcher.registerCallback(MOTION_ENABLE, [this](const Event &e) { handleMotionEnable(e); });
+    dispatcher.registerCallback(CMD_ENROLL_FINGERPRINT, EventCallback::bind<EventHandler, &EventHandler::handleFingerprintEnroll>(this));
+    dispatcher.registerCallback(PLACE_FINGER, EventCallback::bind<EventHandler, &EventHandler::handlePlaceFinger>(this));
+    dispatcher.registerCallback(PLACE_FINGER_AGAIN, EventCallback::bind<EventHandler, &EventHandler::handlePlaceFingerAgain>(this));
+    dispatcher.registerCallback(REMOVE_FINGER, EventCallback::bind<EventHandler, &EventHandler::handleRemoveFinger>(this));
+    dispatcher.registerCallback(FINGERPRINT_ENROLLED, EventCallback::bind<EventHandler, &EventHandler::handleFingerprintEnrolled>(this));
+    dispatcher.registerCallback(FINGERPRINT_ENROLL_FAILED, EventCallback::bind<EventHandler, &EventHandler::handleFingerprintEnrollFailed>(this));
+
+    dispatcher.registerCallback(MOTION_ENABLE, EventCallback::bind<EventHandler, &EventHandler::handleMotionEnable>(this));
 }
 
 void EventHandler::handleMotionEnable(const Event &event) {
@@ -77,18 +112,19 @@ void EventHandler::handleRemoveFinger(const Event &event) {
 
 void EventHandler::handleFingerprintEnrolled(const Event &event) {
     ui.setStateFor(2, UIState::FINGERPRINT_ENROLLED);
-    network.sendEvent("fingerprint_enrolled", JsonObject());
+    OutboundEvent enrolled("fingerprint_enrolled");
+    network.queueEvent(enrolled);
 }
 
 void EventHandler::handleFingerprintEnrollFailed(const Event &event) {
     ui.setStateFor(2, UIState::FINGERPRINT_ENROLL_FAILED);
-    network.sendEvent("fingerprint_enrollment_failed", JsonObject());
+    OutboundEvent failed("fingerprint_enrollment_failed");
+    network.queueEvent(failed);
 
 }
 
 void EventHandler::handleTelegramAudioCommand(const Event &event) {
     std::string action = event.data;
-    StaticJsonDocument<200> data;
 
     if (action == "start_recording") {
         audio.startRecording();
@@ -100,6 +136,12 @@ void EventHandler::handleTelegramAudioCommand(const Event &event) {
         audio.stopPlayback();
     } else if (action == "start_prefetch") {
         audio.startPrefetch();
+    } else if (action == "start_stream") {
+        audio.startStreamingPlayback();
+    } else if (action == "start_intercom") {
+        Intercom::start();
+    } else if (action == "stop_intercom") {
+        Intercom::stop();
     } else if (action == "stop_prefetch") {
         audio.stopPrefetch();
         ui.setStateFor(2, UIState::AUDIO_MESSAGE_RECEIVED);
@@ -112,59 +154,159 @@ void EventHandler::handleTelegramAudioCommand(const Event &event) {
 }
 
 void EventHandler::handleFingerprintEnroll(const Event &event) {
-    StaticJsonDocument<64> doc;
-    deserializeJson(doc, event.data);
-    uint8_t id = doc["id"];
-    fingerprint.startEnrollment(id);
+    fingerprint.startEnrollment(event.payload<CMD_ENROLL_FINGERPRINT>().id);
 }
 
-void EventHandler::handleRecordingSent() {
-    StaticJsonDocument<200> data;
-    data["event_type"] = "recording_sent";
-    network.sendEvent("recording_sent", data.as<JsonObject>());
-    LOG_I(TAG, "Recording sent event dispatched");
+void EventHandler::handleAudioStreamEnd(const Event &event) {
+    // Runs after every chunk of the stream has been handed to the socket
+    const AudioStreamEnd &end = event.payload<AUDIO_STREAM_END>();
+    uint32_t uploadLatency = (micros() - end.stoppedAt) / 1000;
+
+    uint32_t session = AudioSpool::endSession();
+    network.endStream(FrameType::AUDIO, session);
+    UploadStats upload = Audio::getUploadStats();
+    OutboundEvent sent("recording_sent");
+    sent.add("event_type", "recording_sent")
+        .add("session", session) // Acknowledge it with a spool_ack, or it is replayed
+        .add("bytes", end.bytes)
+        .add("upload_latency_ms", uploadLatency)
+        .add("bytes_saved", Audio::getVadStats().trimmedBytes)
+        .add("overruns", Audio::getI2SStats().rxOverruns)
+        .add("goodput_bps", upload.goodputBps)
+        .add("stalls", upload.stalls);
+    network.queueEvent(sent);
+    LOG_I(TAG, "Recording of %u bytes fully sent %u ms after it stopped", end.bytes, uploadLatency);
+    uint32_t meanDepth10 = upload.postedChunks ? upload.queueDepthSum * 10 / upload.postedChunks : 0;
+    LOG_I(TAG, "Upload: %u B/s goodput, %u stalls (%u ms), %u chunks failed, queue depth %u.%u mean %u max, "
+          "window %u bytes (min %u)", upload.goodputBps, upload.stalls,
+          static_cast<uint32_t>(upload.stallMicros / 1000), upload.chunksFailed, meanDepth10 / 10, meanDepth10 % 10,
+          upload.maxQueueDepth, upload.window, upload.minWindow);
 }
 
 void EventHandler::handleAudioDataReady(const Event &event) {
-    network.sendAudioChunk(reinterpret_cast<const uint8_t *>(event.data.c_str()), event.dataLength);
+    AudioSpool::append(event.buffer);
+    // How long the blocking socket write takes is the pacer's view of the link. It holds up only the bulk lane's
+    // task, and the stream events queued behind it on that lane have to wait for it to stay in order anyway.
+    uint32_t writeStart = micros();
+    bool sent = network.sendFrame(event.buffer, FrameType::AUDIO, AudioSpool::currentSessionId());
+    Audio::chunkSent(event.buffer.size(), micros() - writeStart, sent);
+}
+
+void EventHandler::handleSpoolChunkReady(const Event &event) {
+    const SpoolPosition &position = event.payload<SPOOL_CHUNK_READY>();
+    network.sendFrameAt(event.buffer, FrameType::SPOOL, position.session, position.offset);
+    AudioSpool::chunkSent();
+}
+
+void EventHandler::handleSpoolSent(const Event &event) {
+    const SpoolPosition &sent = event.payload<SPOOL_SENT>();
+    network.endStream(FrameType::SPOOL, sent.session);
+    OutboundEvent recording("recording_sent");
+    recording.add("session", sent.session).add("bytes", sent.offset).add("spooled", true);
+    network.queueEvent(recording);
+    LOG_I(TAG, "Spooled recording %u of %u bytes replayed", sent.session, sent.offset);
+}
+
+void EventHandler::handleConnected(const Event &event) {
+    SpoolStats stats = AudioSpool::getStats();
+    OutboundEvent spoolStats("spool_stats");
+    spoolStats.add("pending_recordings", stats.log.pendingSessions)
+              .add("pending_bytes", stats.log.pendingBytes)
+              .add("bytes_written", stats.log.bytesWritten)
+              .add("write_kbps", stats.flashMicros ? uint64_t(stats.log.bytesWritten) * 1000000 / 1024 / stats.flashMicros : 0)
+              .add("dropped_bytes", stats.log.droppedBytes)
+              .add("erases", stats.log.erases)
+              .add("min_erase_count", stats.log.minEraseCount)
+              .add("max_erase_count", stats.log.maxEraseCount);
+    network.sendEvent(spoolStats);
+
+    // A recording streaming through the outage carries on live; the server answers with a spool_ack of the
+    // highest contiguous offset it holds, and the spool refills the gap from there
+    uint32_t live = AudioSpool::requestResume();
+    if (live != 0) {
+        OutboundEvent resume("upload_resume");
+        resume.add("session", live).add("offset", network.streamOffset(FrameType::AUDIO, live));
+        network.sendEvent(resume);
+        LOG_I(TAG, "Resuming upload of recording %u", live);
+    }
+    AudioSpool::setOnline(true);
+    AudioSpool::logStats();
+    EventOutbox::setOnline(true);
 }
 
 void EventHandler::handleESPAudioCommand(const Event &event) {
     std::string action = event.data;
-    StaticJsonDocument<200> data;
+    OutboundEvent data("audio");
 
     if (action == "start_recording") {
         audio.startRecording();
-        data["action"] = "start_recording";
+        data.add("action", "start_recording");
     } else if (action == "stop_recording") {
         audio.stopRecording();
-        data["action"] = "stop_recording";
+        data.add("action", "stop_recording");
+        if (Audio::getVadStats().autoStopped) {
+            ui.setState(UIState::MENU_NOTIFY_OWNER); // Nobody pressed the stop key to leave the recording screen
+        }
     } else if (action == "start_playing") {
         audio.startPlayback();
-        data["action"] = "start_playing";
+        data.add("action", "start_playing");
     } else if (action == "stop_playing") {
         audio.stopPlayback();
-        data["action"] = "stop_playing";
+        data.add("action", "stop_playing");
     } else if (action == "start_prefetch") {
         audio.startPrefetch();
-        data["action"] = "start_prefetch";
+        data.add("action", "start_prefetch");
     } else if (action == "stop_prefetch") {
         audio.stopPrefetch();
-        data["action"] = "stop_prefetch";
+        data.add("action", "stop_prefetch");
         ui.setStateFor(2, UIState::AUDIO_MESSAGE_RECEIVED);
     } else {
         LOG_W(TAG, "Unknown ESP audio command: %s", action.c_str());
         return;
     }
 
-    network.sendEvent("audio", data.as<JsonObject>());
+    network.sendEvent(data);
     LOG_I(TAG, "ESP audio command executed: %s", action.c_str());
 }
 
+void EventHandler::handleAudioCredit(const Event &event) {
+    OutboundEvent credit("audio_credit");
+    credit.add("offset", event.payload<AUDIO_CREDIT>().offset);
+    network.sendEvent(credit);
+}
+
+void EventHandler::handleSetCodec(const Event &event) {
+    const CodecSelection &selection = event.payload<CMD_SET_CODEC>();
+    Audio::setCodecs(selection);
+    Intercom::setCodecs(selection.uplink, selection.downlink);
+}
+
 void EventHandler::handleAudioDataReceived(const Event &event) {
-    const auto *audioData = reinterpret_cast<const uint8_t *>(event.data.c_str());
-    size_t dataLength = event.dataLength;
-    Audio::addPrefetchData(audioData, dataLength);
+    if (Intercom::isActive()) {
+        Intercom::addPlaybackData(event.buffer.data(), event.buffer.size());
+    } else {
+        Audio::addPrefetchData(event.buffer.data(), event.buffer.size());
+    }
+}
+
+void EventHandler::handleIntercomAudioReady(const Event &event) {
+    network.sendFrame(event.buffer, FrameType::TALK, Intercom::sessionId());
+    Intercom::frameSent(event.postedAt);
+}
+
+void EventHandler::handleIntercomEnded() {
+    IntercomStats stats = Intercom::getStats();
+    OutboundEvent data("intercom_stats");
+    data.add("capture_ms", Intercom::captureLatencyMs())
+        .add("uplink_ms", Intercom::uplinkLatencyMs())
+        .add("jitter_ms", Intercom::jitterLatencyMs())
+        .add("playout_ms", Intercom::playoutLatencyMs())
+        .add("frames_sent", stats.framesSent)
+        .add("frames_dropped", stats.framesDropped)
+        .add("frames_played", stats.framesPlayed)
+        .add("underruns", stats.underruns)
+        .add("echo_suppressed", stats.suppressedFrames);
+    network.sendEvent(data);
 }
 
 void EventHandler::handleFingerprintMatch(const Event &event) {
@@ -188,33 +330,32 @@ void EventHandler::handlePasswordInvalid() {
 }
 
 void EventHandler::handleChangeState(const Event &event) {
-    StaticJsonDocument<256> doc;
-    deserializeJson(doc, event.data);
-
-    const char *device = doc["device"];
-    const char *state = doc["state"];
-
-    if (strcmp(device, "gate") == 0) {
-        strcmp(state, "open") == 0 ? gate.openGate() : gate.closeGate();
-    } else if (strcmp(device, "light") == 0) {
-        strcmp(state, "on") == 0 ? led.turnOn() : led.turnOff();
-    } else {
-        LOG_W(TAG, "Unknown device: %s", device);
+    const ChangeStateCommand &command = event.payload<CMD_CHANGE_STATE>();
+
+    switch (command.device) {
+        case Device::GATE:
+            command.on ? gate.openGate() : gate.closeGate();
+            break;
+        case Device::LIGHT:
+            command.on ? led.turnOn() : led.turnOff();
+            break;
     }
 }
 
 void EventHandler::handleChangeStateSuccess(const Event &event) {
-    StaticJsonDocument<256> data;
+    OutboundEvent data("change_state");
+    OutboxKey key = OutboxKey::NONE;
 
     if (event.type == GATE_OPENED || event.type == GATE_CLOSED) {
-        data["device"] = "gate";
-        data["state"] = event.type == GATE_OPENED ? "open" : "close";
+        data.add("device", "gate").add("state", event.type == GATE_OPENED ? "open" : "close");
+        key = OutboxKey::GATE_STATE;
     } else if (event.type == LED_TURNED_ON || event.type == LED_TURNED_OFF) {
-        data["device"] = "light";
-        data["state"] = event.type == LED_TURNED_ON ? "on" : "off";
+        data.add("device", "light").add("state", event.type == LED_TURNED_ON ? "on" : "off");
+        key = OutboxKey::LIGHT_STATE;
     }
 
-    network.sendEvent("change_state", data.as<JsonObject>());
+    // After an outage only the latest state of each device is reported
+    network.queueEvent(data, key);
 }
 
 void EventHandler::handleResidentAuthorized() {
@@ -222,10 +363,10 @@ void EventHandler::handleResidentAuthorized() {
     LOG_I(TAG, "Resident authorized!");
 }
 
-void EventHandler::handleAccessGranted() {
-    ui.setState(UIState::ACCESS_GRANTED);
+void EventHandler::handleAccessGranted(const Event &event) {
     gate.openGate();
-    LOG_I(TAG, "Access granted!");
+    ui.setState(UIState::ACCESS_GRANTED);
+    LOG_I(TAG, "Access granted! Gate opened %u us after the command was queued", micros() - event.postedAt);
 }
 
 void EventHandler::handleAccessDenied() {
@@ -236,23 +377,33 @@ void EventHandler::handleAccessDenied() {
 void EventHandler::handleMotionDetected() {
     LOG_I(TAG, "Motion detected and visitor identification initiated!");
     ui.enableDisplay();
-    vTaskDelay(pdMS_TO_TICKS(500));
+    // The rest waits for the display on a timer, so the dispatcher does not sleep through it
+    xTimerStart(displayTimer, 0);
+}
+
+void EventHandler::displayTimerCallback(TimerHandle_t timer) {
+    static_cast<EventDispatcher *>(pvTimerGetTimerID(timer))->post({DISPLAY_READY, ""});
+}
+
+void EventHandler::handleDisplayReady() {
     fingerprint.enableSensor();
     ui.setStateFor(2, UIState::MOTION_DETECTED);
     espNow.sendCommand("capture_image");
-    network.sendEvent("motion_detected", JsonObject());
+    OutboundEvent motion("motion_detected");
+    network.queueEvent(motion);
 }
 
 void EventHandler::handlePersonDetected() {
-    network.sendEvent("person_detected", JsonObject());
+    OutboundEvent person("person_detected");
+    network.queueEvent(person);
     LOG_I(TAG, "Person detected!");
 }
 
 void EventHandler::handleVisitorEntered() {
     LOG_I(TAG, "Visitor entered the premises!");
-    StaticJsonDocument<256> data;
-    data["event_type"] = "visitor_entered";
-    network.sendEvent("visitor_entered", data.as<JsonObject>());
+    OutboundEvent visitor("visitor_entered");
+    visitor.add("event_type", "visitor_entered");
+    network.queueEvent(visitor);
 }
 
 void EventHandler::handleInactivityDetected(const Event &event) {
@@ -0,0 +1,192 @@
+#include "event_journal.h"
+#include <chrono>
+#include <thread>
+
+static bool hasTypedPayload(const unsigned char *payload) {
+    for (size_t i = 0; i < EVENT_PAYLOAD_SIZE; i++) {
+        if (payload[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t recordSize(const JournalRecordHeader &header) {
+    size_t size = sizeof(JournalRecordHeader);
+    if (header.flags & JOURNAL_TYPED_PAYLOAD) {
+        size += EVENT_PAYLOAD_SIZE;
+    }
+    if (!(header.flags & JOURNAL_TRUNCATED)) {
+        size += header.length;
+    }
+    return size;
+}
+
+EventJournal::EventJournal(uint8_t *storage, size_t capacity, bool captureBuffers)
+        : storage(storage), capacity(capacity), captureBuffers(captureBuffers) {}
+
+void EventJournal::record(const Event &event, uint32_t timestamp) {
+    const bool isBuffer = static_cast<bool>(event.buffer);
+    const uint8_t *data = isBuffer ? event.buffer.data() : reinterpret_cast<const uint8_t *>(event.data.data());
+    size_t length = isBuffer ? event.buffer.size() : event.data.size();
+
+    JournalRecordHeader header{};
+    header.type = event.type;
+    header.timestamp = timestamp;
+    if (hasTypedPayload(event.payloadStorage)) {
+        header.flags |= JOURNAL_TYPED_PAYLOAD;
+    }
+    if (isBuffer) {
+        header.flags |= JOURNAL_BUFFER;
+    }
+    if ((isBuffer && !captureBuffers) || length > UINT16_MAX) {
+        header.flags |= JOURNAL_TRUNCATED;
+    }
+    header.length = static_cast<uint16_t>(length > UINT16_MAX ? UINT16_MAX : length);
+
+    size_t size = recordSize(header);
+    if (size > capacity) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    while (capacity - used < size) {
+        dropOldest();
+    }
+    write(&header, sizeof(header));
+    if (header.flags & JOURNAL_TYPED_PAYLOAD) {
+        write(event.payloadStorage, EVENT_PAYLOAD_SIZE);
+    }
+    if (!(header.flags & JOURNAL_TRUNCATED)) {
+        write(data, header.length);
+    }
+    records++;
+}
+
+void EventJournal::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    head = 0;
+    used = 0;
+    records = 0;
+}
+
+size_t EventJournal::copyOut(uint8_t *dst, size_t maxLength) const {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t copied = 0;
+    while (copied < used) {
+        JournalRecordHeader header{};
+        read(head + copied, &header, sizeof(header));
+        size_t size = recordSize(header);
+        if (copied + size > maxLength) {
+            break;
+        }
+        read(head + copied, dst + copied, size);
+        copied += size;
+    }
+    return copied;
+}
+
+size_t EventJournal::size() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return used;
+}
+
+uint32_t EventJournal::recordCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return records;
+}
+
+uint32_t EventJournal::droppedCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return dropped;
+}
+
+void EventJournal::write(const void *src, size_t length) {
+    const auto *bytes = static_cast<const uint8_t *>(src);
+    size_t tail = (head + used) % capacity;
+    size_t first = length < capacity - tail ? length : capacity - tail;
+    memcpy(storage + tail, bytes, first);
+    memcpy(storage, bytes + first, length - first);
+    used += length;
+}
+
+void EventJournal::read(size_t position, void *dst, size_t length) const {
+    auto *bytes = static_cast<uint8_t *>(dst);
+    position %= capacity;
+    size_t first = length < capacity - position ? length : capacity - position;
+    memcpy(bytes, storage + position, first);
+    memcpy(bytes + first, storage, length - first);
+}
+
+void EventJournal::dropOldest() {
+    JournalRecordHeader header{};
+    read(head, &header, sizeof(header));
+    size_t size = recordSize(header);
+    head = (head + size) % capacity;
+    used -= size;
+    records--;
+    dropped++;
+}
+
+ReplayStats EventReplayer::replay(const uint8_t *journal, size_t length, const EventCallback &sink, float speed) {
+    using Clock = std::chrono::steady_clock;
+
+    ReplayStats stats{};
+    const Clock::time_point start = Clock::now();
+    uint32_t firstTimestamp = 0;
+    size_t offset = 0;
+
+    while (offset + sizeof(JournalRecordHeader) <= length) {
+        JournalRecordHeader header{};
+        memcpy(&header, journal + offset, sizeof(header));
+        size_t size = recordSize(header);
+        if (offset + size > length) {
+            break;
+        }
+        const uint8_t *payload = journal + offset + sizeof(header);
+        offset += size;
+
+        if (stats.events == 0 && stats.skipped == 0) {
+            firstTimestamp = header.timestamp;
+        }
+        if (speed > 0) {
+            auto due = start + std::chrono::microseconds(
+                    static_cast<int64_t>(static_cast<uint32_t>(header.timestamp - firstTimestamp) / speed));
+            std::this_thread::sleep_until(due);
+        }
+
+        Event event(header.type);
+        if (header.flags & JOURNAL_TYPED_PAYLOAD) {
+            memcpy(event.payloadStorage, payload, EVENT_PAYLOAD_SIZE);
+            payload += EVENT_PAYLOAD_SIZE;
+        }
+        if (header.flags & JOURNAL_BUFFER) {
+            event.buffer = BufferPool::acquire();
+            if (!event.buffer || header.length > PooledBuffer::capacity()) {
+                stats.skipped++;
+                continue;
+            }
+            if (!(header.flags & JOURNAL_TRUNCATED)) {
+                memcpy(event.buffer.data(), payload, header.length);
+            }
+            event.buffer.setSize(header.length);
+        } else if (!(header.flags & JOURNAL_TRUNCATED)) {
+            event.data.assign(reinterpret_cast<const char *>(payload), header.length);
+        }
+        event.dataLength = header.length;
+
+        const Clock::time_point handlerStart = Clock::now();
+        sink(event);
+        auto handlerMicros = static_cast<uint32_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - handlerStart).count());
+
+        stats.events++;
+        stats.handlerMicros += handlerMicros;
+        if (handlerMicros > stats.maxHandlerMicros) {
+            stats.maxHandlerMicros = handlerMicros;
+        }
+    }
+
+    stats.wallMicros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    return stats;
+}
@@ -0,0 +1,430 @@
+#include "event_outbox.h"
+#include "logger.h"
+#include "partition_flash.h"
+
+static const char *TAG = "OUTBOX";
+
+static const char BATCH_PREFIX[] = R"({"event_type":"event_batch","data":{"events":[)";
+static const char BATCH_SUFFIX[] = "]}}";
+
+static portMUX_TYPE outboxLock = portMUX_INITIALIZER_UNLOCKED;
+
+EventDispatcher *EventOutbox::eventDispatcher = nullptr;
+TaskHandle_t EventOutbox::taskHandle = nullptr;
+SpoolLog *EventOutbox::log = nullptr;
+EventOutbox::Entry *EventOutbox::entries = nullptr;
+size_t EventOutbox::head = 0;
+size_t EventOutbox::count = 0;
+uint32_t EventOutbox::nextSequence = 1;
+uint32_t EventOutbox::latest[static_cast<size_t>(OutboxKey::COUNT)] = {};
+uint32_t EventOutbox::nextSession = 1;
+uint32_t EventOutbox::spillSession = 0;
+uint32_t EventOutbox::bootSession = 0;
+std::atomic<uint32_t> EventOutbox::flashEvents(0);
+PooledBuffer EventOutbox::batch;
+size_t EventOutbox::batchEvents = 0;
+size_t EventOutbox::batchRecords = 0;
+bool EventOutbox::batchFromFlash = false;
+uint32_t EventOutbox::batchSession = 0;
+uint32_t EventOutbox::batchEnd = 0;
+uint32_t EventOutbox::onlineAt = 0;
+std::atomic<bool> EventOutbox::online(false);
+std::atomic<bool> EventOutbox::batchInFlight(false);
+std::atomic<bool> EventOutbox::batchOk(false);
+OutboxStats EventOutbox::stats = {};
+
+void EventOutbox::begin(EventDispatcher &dispatcher) {
+    eventDispatcher = &dispatcher;
+    if (!OUTBOX_ENABLED) {
+        return;
+    }
+
+    entries = static_cast<Entry *>(ps_malloc(OUTBOX_RAM_EVENTS * sizeof(Entry)));
+    if (entries == nullptr) {
+        LOG_E(TAG, "Failed to allocate the outbox. Events are sent only while connected");
+        return;
+    }
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                static_cast<esp_partition_subtype_t>(0x42),
+                                                                OUTBOX_PARTITION_LABEL);
+    if (partition == nullptr) {
+        LOG_W(TAG, "No \"%s\" partition. Queued events stay in RAM", OUTBOX_PARTITION_LABEL);
+    } else {
+        log = new SpoolLog(*new PartitionFlash(partition), OUTBOX_SEGMENT_SIZE);
+        if (log->mount()) {
+            nextSession = log->lastSessionId() + 1;
+            bootSession = log->lastSessionId();
+            scanSpilled();
+        } else {
+            LOG_E(TAG, "Failed to mount the outbox partition. Queued events stay in RAM");
+            delete log;
+            log = nullptr;
+        }
+    }
+
+    xTaskCreatePinnedToCore(outboxTask, "OutboxTask", 4096, nullptr, 1, &taskHandle, 0);
+}
+
+void EventOutbox::scanSpilled() {
+    uint8_t record[sizeof(RecordHeader) + OUTBOX_MAX_EVENT];
+    uint32_t after = 0;
+    const SpoolSession *entry;
+    uint32_t events = 0;
+    while ((entry = log->nextPending(after)) != nullptr) {
+        uint32_t offset = entry->acked;
+        uint32_t recordOffset = 0;
+        size_t length;
+        while ((length = log->readChunk(entry->id, offset, record, sizeof(record), recordOffset)) > 0) {
+            offset = recordOffset + length;
+            if (length < sizeof(RecordHeader)) {
+                continue;
+            }
+            RecordHeader header;
+            memcpy(&header, record, sizeof(header));
+            if (header.key != OutboxKey::NONE && header.key < OutboxKey::COUNT) {
+                latest[static_cast<size_t>(header.key)] = header.sequence;
+            }
+            nextSequence = header.sequence >= nextSequence ? header.sequence + 1 : nextSequence;
+            events++;
+        }
+        after = entry->id;
+    }
+    flashEvents = events;
+    stats.depth = events;
+    stats.maxDepth = events;
+    LOG_I(TAG, "%u events from earlier outages waiting on flash", events);
+}
+
+bool EventOutbox::isEmpty() {
+    if (entries == nullptr) {
+        return true;
+    }
+    portENTER_CRITICAL(&outboxLock);
+    bool empty = count == 0;
+    portEXIT_CRITICAL(&outboxLock);
+    return empty && flashEvents == 0 && !batchInFlight;
+}
+
+bool EventOutbox::push(const char *json, size_t length, OutboxKey key) {
+    if (entries == nullptr || length > OUTBOX_MAX_EVENT) {
+        return false;
+    }
+    portENTER_CRITICAL(&outboxLock);
+    if (count == OUTBOX_RAM_EVENTS) {
+        stats.dropped++;
+        portEXIT_CRITICAL(&outboxLock);
+        return false;
+    }
+    Entry &entry = entries[(head + count) % OUTBOX_RAM_EVENTS];
+    entry.sequence = nextSequence++;
+    entry.queuedAt = millis();
+    entry.length = static_cast<uint16_t>(length);
+    entry.key = key;
+    memcpy(entry.json, json, length);
+    count++;
+    if (key != OutboxKey::NONE) {
+        latest[static_cast<size_t>(key)] = entry.sequence;
+    }
+    stats.queued++;
+    stats.depth = count + flashEvents;
+    stats.maxDepth = stats.depth > stats.maxDepth ? stats.depth : stats.maxDepth;
+    portEXIT_CRITICAL(&outboxLock);
+    wake();
+    return true;
+}
+
+void EventOutbox::setOnline(bool isOnline) {
+    online = isOnline;
+    wake();
+}
+
+void EventOutbox::batchSent(bool ok) {
+    batchOk = ok;
+    batchInFlight = false;
+    wake();
+}
+
+OutboxStats EventOutbox::getStats() {
+    portENTER_CRITICAL(&outboxLock);
+    OutboxStats snapshot = stats;
+    portEXIT_CRITICAL(&outboxLock);
+    return snapshot;
+}
+
+void EventOutbox::logStats() {
+    OutboxStats snapshot = getStats();
+    LOG_I(TAG, "%u events queued (depth %u, max %u), %u spilled (%u bytes), %u coalesced, %u dropped, "
+               "%u replayed in %u batches, last replay %u ms", snapshot.queued, snapshot.depth, snapshot.maxDepth,
+          snapshot.spilledEvents, snapshot.spilledBytes, snapshot.coalesced, snapshot.dropped,
+          snapshot.replayedEvents, snapshot.batches, snapshot.lastReplayMs);
+}
+
+void EventOutbox::outboxTask(void *parameter) {
+    bool wasOnline = false;
+    bool replaying = false;
+    while (true) {
+        bool isOnline = online;
+        if (isOnline && !wasOnline) {
+            closeSpill();
+            onlineAt = millis();
+            replaying = !isEmpty();
+        }
+        wasOnline = isOnline;
+
+        if (batch && !batchInFlight) {
+            finishBatch();
+        }
+
+        portENTER_CRITICAL(&outboxLock);
+        size_t queued = count;
+        uint32_t oldestAt = queued > 0 ? entries[head].queuedAt : 0;
+        portEXIT_CRITICAL(&outboxLock);
+
+        if (isOnline) {
+            // Flash holds the older events, so RAM only goes out once it has drained. A flash batch that cannot
+            // go out now (pool empty, lane full) is retried on the next poll rather than overtaken.
+            while (!batchInFlight) {
+                if (flashEvents > 0) {
+                    if (!postFlashBatch() && flashEvents > 0) {
+                        break;
+                    }
+                } else if (!postRamBatch()) {
+                    break;
+                }
+            }
+            if (replaying && isEmpty()) {
+                replaying = false;
+                portENTER_CRITICAL(&outboxLock);
+                stats.lastReplayMs = millis() - onlineAt;
+                portEXIT_CRITICAL(&outboxLock);
+                logStats();
+            }
+        } else if (log != nullptr && queued > 0 &&
+                   (queued >= OUTBOX_SPILL_WATERMARK || millis() - oldestAt >= OUTBOX_SPILL_DELAY_MS)) {
+            spill();
+        }
+
+        // Poll while events wait: offline so they spill in time, online in case the pool was out of chunks
+        bool waiting = isOnline ? !batchInFlight && !isEmpty() : queued > 0;
+        ulTaskNotifyTake(pdTRUE, waiting ? pdMS_TO_TICKS(1000) : portMAX_DELAY);
+    }
+}
+
+void EventOutbox::spill() {
+    portENTER_CRITICAL(&outboxLock);
+    size_t spilling = count;
+    portEXIT_CRITICAL(&outboxLock);
+
+    if (spillSession == 0) {
+        if (!log->beginSession(nextSession, {0, 0, 0})) {
+            return; // Every spill session is still waiting for replay; the events stay in RAM
+        }
+        spillSession = nextSession++;
+    }
+
+    size_t spilled = 0;
+    size_t coalesced = 0;
+    uint32_t bytes = 0;
+    uint8_t record[sizeof(RecordHeader) + OUTBOX_MAX_EVENT];
+    for (; spilled < spilling; spilled++) {
+        const Entry &entry = entries[(head + spilled) % OUTBOX_RAM_EVENTS];
+        if (isSuperseded(entry.sequence, entry.key)) {
+            coalesced++;
+            continue;
+        }
+        RecordHeader header{entry.sequence, entry.queuedAt, entry.key, {}};
+        memcpy(record, &header, sizeof(header));
+        memcpy(record + sizeof(header), entry.json, entry.length);
+        if (!log->append(spillSession, record, sizeof(header) + entry.length)) {
+            // Flash is full and the session refuses further appends; the rest stays in RAM until a new one opens
+            closeSpill();
+            break;
+        }
+        bytes += sizeof(header) + entry.length;
+    }
+    flashEvents += spilled - coalesced;
+
+    portENTER_CRITICAL(&outboxLock);
+    head = (head + spilled) % OUTBOX_RAM_EVENTS;
+    count -= spilled;
+    stats.spilledEvents += spilled - coalesced;
+    stats.spilledBytes += bytes;
+    stats.coalesced += coalesced;
+    portEXIT_CRITICAL(&outboxLock);
+    LOG_I(TAG, "Spilled %u events (%u bytes) to flash", spilled - coalesced, bytes);
+}
+
+void EventOutbox::closeSpill() {
+    if (spillSession != 0) {
+        log->endSession(spillSession);
+        spillSession = 0;
+    }
+}
+
+bool EventOutbox::postFlashBatch() {
+    if (log == nullptr || flashEvents == 0) {
+        return false;
+    }
+    const SpoolSession *entry = log->nextPending(0);
+    if (entry == nullptr) {
+        flashEvents = 0; // Out of step with the log, which is what gets replayed
+        return false;
+    }
+
+    uint8_t record[sizeof(RecordHeader) + OUTBOX_MAX_EVENT];
+    batchFromFlash = true;
+    batchSession = entry->id;
+    batchEnd = entry->acked;
+    batchEvents = 0;
+    batchRecords = 0;
+    uint32_t recordOffset = 0;
+    size_t length;
+    while ((length = log->readChunk(entry->id, batchEnd, record, sizeof(record), recordOffset)) > 0) {
+        if (length >= sizeof(RecordHeader)) {
+            RecordHeader header;
+            memcpy(&header, record, sizeof(header));
+            if (!isSuperseded(header.sequence, header.key) &&
+                !addToBatch(reinterpret_cast<const char *>(record + sizeof(header)), length - sizeof(header),
+                            header.queuedAt, entry->id > bootSession)) {
+                break;
+            }
+            batchRecords++;
+        }
+        batchEnd = recordOffset + length;
+    }
+    if (length == 0) {
+        batchEnd = entry->written; // Whatever is left is unreadable
+    }
+    if (batchEvents == 0 && batchEnd > entry->acked) {
+        // Only superseded or unreadable records: done with them without sending anything
+        batchOk = true;
+        finishBatch();
+        return true;
+    }
+    return postBatch();
+}
+
+bool EventOutbox::postRamBatch() {
+    portENTER_CRITICAL(&outboxLock);
+    size_t queued = count;
+    portEXIT_CRITICAL(&outboxLock);
+    if (queued == 0) {
+        return false;
+    }
+
+    batchFromFlash = false;
+    batchEvents = 0;
+    batchRecords = 0;
+    for (size_t i = 0; i < queued; i++) {
+        const Entry &entry = entries[(head + i) % OUTBOX_RAM_EVENTS];
+        if (!isSuperseded(entry.sequence, entry.key) && !addToBatch(entry.json, entry.length, entry.queuedAt, true)) {
+            break;
+        }
+        batchRecords++;
+    }
+    if (batchEvents == 0 && batchRecords > 0) {
+        batchOk = true;
+        finishBatch();
+        return true;
+    }
+    return postBatch();
+}
+
+bool EventOutbox::addToBatch(const char *json, size_t length, uint32_t queuedAt, bool thisBoot) {
+    if (length < 2 || json[0] != '{') {
+        return true; // Not an event object; left out
+    }
+    if (!batch) {
+        batch = BufferPool::acquire();
+        if (!batch) {
+            return false;
+        }
+        memcpy(batch.data(), BATCH_PREFIX, sizeof(BATCH_PREFIX) - 1);
+        batch.setSize(sizeof(BATCH_PREFIX) - 1);
+    }
+
+    // Each event gains its age, when its queuing time is from this boot: {"age_ms":N,...}
+    char age[24] = "{";
+    if (thisBoot) {
+        snprintf(age, sizeof(age), R"({"age_ms":%u,)", static_cast<unsigned>(millis() - queuedAt));
+    }
+    size_t ageLength = strlen(age);
+    size_t needed = (batchEvents > 0) + ageLength + length - 1;
+    if (batch.size() + needed + sizeof(BATCH_SUFFIX) - 1 > PooledBuffer::capacity()) {
+        return false;
+    }
+    uint8_t *out = batch.data() + batch.size();
+    if (batchEvents > 0) {
+        *out++ = ',';
+    }
+    memcpy(out, age, ageLength);
+    memcpy(out + ageLength, json + 1, length - 1);
+    batch.setSize(batch.size() + needed);
+    batchEvents++;
+    return true;
+}
+
+bool EventOutbox::postBatch() {
+    if (batchEvents == 0) {
+        batch.reset();
+        return false; // The pool is out of chunks; the task polls until it has one
+    }
+
+    memcpy(batch.data() + batch.size(), BATCH_SUFFIX, sizeof(BATCH_SUFFIX) - 1);
+    batch.setSize(batch.size() + sizeof(BATCH_SUFFIX) - 1);
+    batchInFlight = true;
+    if (!eventDispatcher->post({OUTBOX_BATCH_READY, batch})) {
+        batchInFlight = false;
+        batchOk = false;
+        finishBatch();
+        return false;
+    }
+    return true;
+}
+
+void EventOutbox::finishBatch() {
+    size_t sent = batchEvents;
+    size_t covered = batchRecords;
+    bool ok = batchOk;
+    batch.reset();
+    batchEvents = 0;
+    batchRecords = 0;
+    if (!ok) {
+        return; // Packed again from the same place next time
+    }
+
+    if (batchFromFlash) {
+        log->acknowledge(batchSession, batchEnd);
+        uint32_t remaining = flashEvents;
+        flashEvents = log->nextPending(0) == nullptr || covered >= remaining ? 0 : remaining - covered;
+        log->prepareNextSegment();
+    }
+
+    portENTER_CRITICAL(&outboxLock);
+    if (!batchFromFlash) {
+        head = (head + covered) % OUTBOX_RAM_EVENTS;
+        count -= covered;
+    }
+    stats.coalesced += covered - sent;
+    stats.replayedEvents += sent;
+    stats.batches += sent > 0;
+    stats.depth = count + flashEvents;
+    portEXIT_CRITICAL(&outboxLock);
+}
+
+bool EventOutbox::isSuperseded(uint32_t sequence, OutboxKey key) {
+    if (key == OutboxKey::NONE || key >= OutboxKey::COUNT) {
+        return false;
+    }
+    portENTER_CRITICAL(&outboxLock);
+    bool superseded = latest[static_cast<size_t>(key)] != sequence;
+    portEXIT_CRITICAL(&outboxLock);
+    return superseded;
+}
+
+void EventOutbox::wake() {
+    if (taskHandle != nullptr) {
+        xTaskNotifyGive(taskHandle);
+    }
+}
@@ -1,17 +1,162 @@
 #include "events.h"
 #include "logger.h"
+#include "freertos/task.h"
 
 static const char *TAG = "EventDispatcher";
 
-void EventDispatcher::registerCallback(EventType type, EventCallback callback) {
+static portMUX_TYPE callbackLock = portMUX_INITIALIZER_UNLOCKED;
+
+static size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 2;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+EventQueue::EventQueue(size_t capacity)
+        : slots(new Slot[roundUpToPowerOfTwo(capacity)]),
+          mask(roundUpToPowerOfTwo(capacity) - 1),
+          enqueuePos(0),
+          dequeuePos(0) {
+    for (size_t i = 0; i <= mask; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool EventQueue::push(Event &&event) {
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+        Slot &slot = slots[pos & mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.event = std::move(event);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // Full
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool EventQueue::pop(Event &event) {
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    while (true) {
+        Slot &slot = slots[pos & mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0) {
+            if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                event = std::move(slot.event);
+                slot.sequence.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // Empty
+        } else {
+            pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+size_t EventQueue::size() const {
+    size_t head = dequeuePos.load(std::memory_order_relaxed);
+    size_t tail = enqueuePos.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+void EventDispatcher::begin(size_t queueCapacity, UBaseType_t priority, BaseType_t core) {
+    static const char *taskNames[EVENT_CLASS_COUNT] = {"Critical Events", "Interactive Events", "Bulk Events"};
+    for (size_t lane = 0; lane < EVENT_CLASS_COUNT; lane++) {
+        queues[lane].reset(new EventQueue(queueCapacity));
+        pending[lane] = xSemaphoreCreateCounting(queues[lane]->capacity(), 0); // Published last, see enqueue()
+        laneTasks[lane] = {this, lane};
+        UBaseType_t lanePriority = lane == static_cast<size_t>(EventClass::CRITICAL) ? priority + 1 : priority;
+        xTaskCreatePinnedToCore(dispatcherTask, taskNames[lane], 8192, &laneTasks[lane], lanePriority, nullptr, core);
+    }
+    LOG_I(TAG, "Dispatcher started: %u lanes of %u events, one task each", EVENT_CLASS_COUNT, queues[0]->capacity());
+}
+
+constexpr uint16_t EventDispatcher::NO_SUBSCRIBER;
+
+EventDispatcher::EventDispatcher(size_t callbackCapacity)
+        : subscribers(new Subscriber[callbackCapacity < NO_SUBSCRIBER ? callbackCapacity : NO_SUBSCRIBER]),
+          subscriberCapacity(callbackCapacity < NO_SUBSCRIBER ? callbackCapacity : NO_SUBSCRIBER) {
+    for (auto &chain: chains) {
+        chain.store(NO_SUBSCRIBER, std::memory_order_relaxed);
+    }
+}
+
+bool EventDispatcher::registerCallback(EventType type, EventCallback callback) {
     if (type >= MAX_EVENTS) {
         LOG_E(TAG, "Event type out of range: %d", type);
-        return;
+        return false;
+    }
+
+    bool duplicate = false;
+    bool full = false;
+    portENTER_CRITICAL(&callbackLock);
+    Subscriber *freeNode = nullptr;
+    Subscriber *tail = nullptr;
+    for (uint16_t i = chains[type].load(std::memory_order_relaxed); i != NO_SUBSCRIBER;
+         i = subscribers[i].next.load(std::memory_order_relaxed)) {
+        Subscriber &node = subscribers[i];
+        if (node.callback == callback) {
+            duplicate = true;
+            break;
+        }
+        if (!node.callback && freeNode == nullptr) {
+            freeNode = &node;
+        }
+        tail = &node;
+    }
+    if (!duplicate && freeNode != nullptr) {
+        freeNode->callback = callback;
+    } else if (!duplicate && subscriberCount == subscriberCapacity) {
+        full = true;
+    } else if (!duplicate) {
+        auto index = static_cast<uint16_t>(subscriberCount++);
+        subscribers[index].callback = callback;
+        // Published last, so a dispatcher walking the chain never reaches a half-written node
+        (tail ? tail->next : chains[type]).store(index, std::memory_order_release);
     }
+    portEXIT_CRITICAL(&callbackLock);
 
-    callbacks.push_back({type, std::move(callback)});
-    registeredEvents.set(type);
+    if (duplicate) {
+        LOG_W(TAG, "Duplicate callback ignored for event type: %d", type);
+        return false;
+    }
+    if (full) {
+        LOG_E(TAG, "All %u callback slots taken, none left for event type: %d", subscriberCapacity, type);
+        return false;
+    }
     LOG_D(TAG, "Registered callback for event type: %d", type);
+    return true;
+}
+
+bool EventDispatcher::unregisterCallback(EventType type, const EventCallback &callback) {
+    if (type >= MAX_EVENTS) {
+        LOG_E(TAG, "Event type out of range: %d", type);
+        return false;
+    }
+
+    bool found = false;
+    portENTER_CRITICAL(&callbackLock);
+    for (uint16_t i = chains[type].load(std::memory_order_relaxed); i != NO_SUBSCRIBER;
+         i = subscribers[i].next.load(std::memory_order_relaxed)) {
+        if (subscribers[i].callback == callback) {
+            subscribers[i].callback = EventCallback();
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&callbackLock);
+    return found;
 }
 
 void EventDispatcher::dispatchEvent(const Event &event) {
@@ -20,15 +165,170 @@ void EventDispatcher::dispatchEvent(const Event &event) {
         return;
     }
 
-    if (!registeredEvents.test(event.type)) {
-        LOG_W(TAG, "No callbacks registered for event type: %d", event.type);
-        return;
+    if (recorder != nullptr) {
+        recorder->record(event, micros());
     }
 
     LOG_D(TAG, "Dispatching event: %d, data size: %zu", event.type, event.dataLength);
-    for (const auto &entry: callbacks) {
-        if (entry.type == event.type) {
-            entry.callback(event);
+    bool handled = false;
+    for (uint16_t i = chains[event.type].load(std::memory_order_acquire); i != NO_SUBSCRIBER;
+         i = subscribers[i].next.load(std::memory_order_acquire)) {
+        // Copied under the lock so a concurrent (un)register never hands us a torn delegate
+        portENTER_CRITICAL(&callbackLock);
+        EventCallback callback = subscribers[i].callback;
+        portEXIT_CRITICAL(&callbackLock);
+        if (callback) {
+            callback(event);
+            handled = true;
         }
     }
-}
\ No newline at end of file
+
+    if (!handled) {
+        LOG_W(TAG, "No callbacks registered for event type: %d", event.type);
+    }
+}
+
+ReplayStats EventDispatcher::replay(const uint8_t *journal, size_t length, float speed) {
+    EventJournal *journalRecorder = recorder;
+    recorder = nullptr;
+    ReplayStats stats = EventReplayer::replay(journal, length,
+                                              EventCallback::bind<EventDispatcher, &EventDispatcher::dispatchEvent>(this),
+                                              speed);
+    recorder = journalRecorder;
+    return stats;
+}
+
+bool EventDispatcher::post(const Event &event) {
+    return post(Event(event));
+}
+
+bool EventDispatcher::post(Event &&event) {
+    EventType type = event.type;
+    auto lane = static_cast<size_t>(eventClassOf(type));
+    if (!enqueue(lane, std::move(event))) {
+        LOG_W(TAG, "Event lane full, dropped event type: %d", type);
+        return false;
+    }
+
+    xSemaphoreGive(pending[lane]);
+    return true;
+}
+
+bool EventDispatcher::postFromISR(EventType type, BaseType_t *higherPriorityTaskWoken) {
+    auto lane = static_cast<size_t>(eventClassOf(type));
+    if (!enqueue(lane, Event(type))) {
+        return false;
+    }
+
+    xSemaphoreGiveFromISR(pending[lane], higherPriorityTaskWoken);
+    return true;
+}
+
+bool EventDispatcher::enqueue(size_t lane, Event &&event) {
+    if (event.type >= MAX_EVENTS || !pending[lane]) {
+        droppedCount++;
+        return false;
+    }
+
+    event.postedAt = micros();
+    if (!queues[lane]->push(std::move(event))) {
+        droppedCount++;
+        return false;
+    }
+
+    postedCount++;
+    recordDepth();
+    return true;
+}
+
+void EventDispatcher::recordDepth() {
+    size_t depth = 0;
+    for (const auto &lane: queues) {
+        depth += lane->size();
+    }
+    size_t previous = highWatermark.load(std::memory_order_relaxed);
+    while (depth > previous && !highWatermark.compare_exchange_weak(previous, depth, std::memory_order_relaxed)) {
+    }
+}
+
+void EventDispatcher::recordLatency(const Event &event) {
+    size_t lane = static_cast<size_t>(eventClassOf(event.type));
+    uint32_t latency = micros() - event.postedAt;
+
+    size_t bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && latency >= (1u << bucket)) {
+        bucket++;
+    }
+    latencyBuckets[lane][bucket]++;
+
+    uint32_t previous = maxLatency[lane].load(std::memory_order_relaxed);
+    while (latency > previous && !maxLatency[lane].compare_exchange_weak(previous, latency, std::memory_order_relaxed)) {
+    }
+}
+
+EventQueueStats EventDispatcher::getStats() const {
+    size_t depth = 0;
+    for (const auto &lane: queues) {
+        depth += lane ? lane->size() : 0;
+    }
+    return {
+            postedCount.load(),
+            dispatchedCount.load(),
+            droppedCount.load(),
+            depth,
+            highWatermark.load()
+    };
+}
+
+LatencyHistogram EventDispatcher::getLatencyHistogram(EventClass eventClass) const {
+    LatencyHistogram histogram{};
+    size_t lane = static_cast<size_t>(eventClass);
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        histogram.buckets[i] = latencyBuckets[lane][i].load();
+    }
+    histogram.maxMicros = maxLatency[lane].load();
+    return histogram;
+}
+
+void EventDispatcher::logStats() const {
+    static const char *laneNames[EVENT_CLASS_COUNT] = {"critical", "interactive", "bulk"};
+
+    EventQueueStats stats = getStats();
+    LOG_I(TAG, "Events posted %u, dispatched %u, dropped %u, depth %u (max %u)",
+          stats.posted, stats.dispatched, stats.dropped, stats.depth, stats.highWatermark);
+
+    for (size_t lane = 0; lane < EVENT_CLASS_COUNT; lane++) {
+        LatencyHistogram histogram = getLatencyHistogram(static_cast<EventClass>(lane));
+        char line[160];
+        int length = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS && length < static_cast<int>(sizeof(line)); i++) {
+            length += snprintf(line + length, sizeof(line) - length, "%u ", histogram.buckets[i]);
+        }
+        LOG_I(TAG, "Latency %s (log2 us buckets): %s max %u us", laneNames[lane], line, histogram.maxMicros);
+    }
+}
+
+bool EventDispatcher::dispatchNext(size_t lane, Event &event) {
+    if (!queues[lane]->pop(event)) {
+        return false;
+    }
+    recordLatency(event);
+    dispatchEvent(event);
+    dispatchedCount++;
+    event = Event();
+    return true;
+}
+
+[[noreturn]] void EventDispatcher::dispatcherTask(void *parameter) {
+    auto *task = static_cast<LaneTask *>(parameter);
+    Event event;
+    while (true) {
+        xSemaphoreTake(task->dispatcher->pending[task->lane], portMAX_DELAY);
+        // Each semaphore count stands for one event published on the lane. The pop can still miss it: a producer
+        // that claimed an earlier slot and has not published it yet hides every slot behind it. Retry rather than
+        // drop the count, or the event would wait for an unrelated post.
+        while (!task->dispatcher->dispatchNext(task->lane, event)) {
+            vTaskDelay(1); // Lets a preempted lower-priority producer finish publishing
+        }
+    }
+}
@@ -45,7 +45,7 @@ void FingerprintHandler::fingerprintTask(void *parameter) {
                 handler->isEnrolling = false;
                 vTaskDelay(pdMS_TO_TICKS(3000)); // Wait after successful enrollment before reading another finger
             } else {
-                handler->eventDispatcher->dispatchEvent({FINGERPRINT_ENROLL_FAILED, ""});
+                handler->eventDispatcher->post({FINGERPRINT_ENROLL_FAILED, ""});
                 handler->isEnrolling = false;
             }
             continue;
@@ -60,10 +60,10 @@ void FingerprintHandler::fingerprintTask(void *parameter) {
                 p = handler->fingerprint.fingerFastSearch();
                 if (p == FINGERPRINT_OK) {
                     LOG_I(TAG, "Finger found!");
-                    handler->eventDispatcher->dispatchEvent({FINGERPRINT_MATCHED, ""});
+                    handler->eventDispatcher->post({FINGERPRINT_MATCHED, ""});
                 } else if (p == FINGERPRINT_NOTFOUND) {
                     LOG_I(TAG, "No match found");
-                    handler->eventDispatcher->dispatchEvent({FINGERPRINT_NO_MATCH, ""});
+                    handler->eventDispatcher->post({FINGERPRINT_NO_MATCH, ""});
                 } else {
                     LOG_E(TAG, "Finger search error: %d", p);
                 }
@@ -81,7 +81,7 @@ void FingerprintHandler::startEnrollment(uint8_t id) {
     isEnrolling = true;
     enrollId = id;
     LOG_I(TAG, "Starting fingerprint enrollment for ID %d", id);
-    eventDispatcher->dispatchEvent({PLACE_FINGER, ""});
+    eventDispatcher->post({PLACE_FINGER, ""});
 }
 
 uint8_t FingerprintHandler::getFingerprintEnroll() {
@@ -129,7 +129,7 @@ uint8_t FingerprintHandler::getFingerprintEnroll() {
             return p;
     }
 
-    eventDispatcher->dispatchEvent({REMOVE_FINGER, ""});
+    eventDispatcher->post({REMOVE_FINGER, ""});
     vTaskDelay(pdMS_TO_TICKS(2000));
 
     p = 0;
@@ -139,7 +139,7 @@ uint8_t FingerprintHandler::getFingerprintEnroll() {
     }
 
     p = -1;
-    eventDispatcher->dispatchEvent({PLACE_FINGER_AGAIN, ""});
+    eventDispatcher->post({PLACE_FINGER_AGAIN, ""});
     while (p != FINGERPRINT_OK) {
         p = fingerprint.getImage();
         switch (p) {
@@ -200,7 +200,7 @@ uint8_t FingerprintHandler::getFingerprintEnroll() {
     p = fingerprint.storeModel(enrollId);
     if (p == FINGERPRINT_OK) {
         LOG_I(TAG, "Stored!");
-        eventDispatcher->dispatchEvent({FINGERPRINT_ENROLLED, ""});
+        eventDispatcher->post({FINGERPRINT_ENROLLED, ""});
     } else if (p == FINGERPRINT_PACKETRECIEVEERR) {
         LOG_E(TAG, "Communication error");
         return p;
@@ -0,0 +1,57 @@
+#include "frame_protocol.h"
+
+static_assert(sizeof(FrameHeader) == 16, "Frame header layout is part of the protocol");
+
+static void putLe32(uint8_t *out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+static uint32_t getLe32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+uint8_t *FrameCodec::encode(const FrameHeader &header, uint8_t *payload) {
+    uint8_t *frame = payload - HEADER_SIZE;
+    frame[0] = VERSION;
+    frame[1] = header.type;
+    frame[2] = header.flags;
+    frame[3] = HEADER_SIZE;
+    putLe32(frame + 4, header.stream);
+    putLe32(frame + 8, header.sequence);
+    putLe32(frame + 12, header.offset);
+    return frame;
+}
+
+bool FrameCodec::decode(const uint8_t *frame, size_t length, FrameHeader &header, const uint8_t *&payload,
+                        size_t &payloadLength) {
+    if (length < HEADER_SIZE || frame[0] != VERSION || frame[3] < HEADER_SIZE || frame[3] > length) {
+        return false;
+    }
+    header.version = frame[0];
+    header.type = frame[1];
+    header.flags = frame[2];
+    header.headerSize = frame[3];
+    header.stream = getLe32(frame + 4);
+    header.sequence = getLe32(frame + 8);
+    header.offset = getLe32(frame + 12);
+    payload = frame + header.headerSize;
+    payloadLength = length - header.headerSize;
+    return true;
+}
+
+const char *FrameCodec::name(FrameType type) {
+    switch (type) {
+        case FrameType::AUDIO:
+            return "audio";
+        case FrameType::TALK:
+            return "talk";
+        case FrameType::SPOOL:
+            return "spool";
+        case FrameType::JOURNAL:
+            return "journal";
+    }
+    return "unknown";
+}
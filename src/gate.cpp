@@ -44,7 +44,7 @@ void Gate::gateTask(void *parameter) {
                     gate->currentState = G_OPEN;
                     gate->stateStartTime = millis();
                     gate->personEntered = false;
-                    eventDispatcher->dispatchEvent({GATE_OPENED, ""});
+                    eventDispatcher->post({GATE_OPENED, ""});
                 }
                 break;
             case G_OPEN:
@@ -72,7 +72,7 @@ void Gate::gateTask(void *parameter) {
                 gate->personEntered = true;
                 gate->stateStartTime = millis();
                 LOG_I(TAG, "Person entered, gate will close in 3 seconds");
-                eventDispatcher->dispatchEvent({VISITOR_ENTERED, ""});
+                eventDispatcher->post({VISITOR_ENTERED, ""});
             }
         }
         vTaskDelay(pdMS_TO_TICKS(10));
@@ -119,6 +119,6 @@ void Gate::gateFullyClosed() {
     vTaskDelay(pdMS_TO_TICKS(100)); // Wait for the gate to fully close
     stopGate();
     currentState = G_CLOSED;
-    eventDispatcher->dispatchEvent({GATE_CLOSED, ""});
+    eventDispatcher->post({GATE_CLOSED, ""});
     LOG_I(TAG, "Gate fully closed");
 }
\ No newline at end of file
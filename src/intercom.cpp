@@ -0,0 +1,337 @@
+#include "intercom.h"
+#include "audio.h"
+#include "config.h"
+#include "logger.h"
+#include "pcm_convert.h"
+
+static const char *TAG = "INTERCOM";
+
+static constexpr size_t FRAME_SAMPLES = INTERCOM_FRAME_SAMPLES;
+static constexpr size_t FRAME_BYTES = FRAME_SAMPLES * sizeof(int16_t);
+static constexpr size_t CAPTURE_SLOT_BYTES = FRAME_SAMPLES * (MIC_SLOT_BITS / 8);
+static_assert(CAPTURE_SLOT_BYTES <= I2S_DMA_BUF_MAX_BYTES, "An intercom frame of mic slots must fit one DMA buffer");
+static constexpr size_t JITTER_SAMPLES = INTERCOM_JITTER_MS * SAMPLE_RATE / 1000;
+static constexpr int32_t UNITY_GAIN = 256;
+
+static uint32_t meanLevel(const int16_t *frame, size_t count) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += frame[i] < 0 ? -frame[i] : frame[i];
+    }
+    return sum / count;
+}
+
+bool SampleRing::begin(size_t capacity) {
+    samples = static_cast<int16_t *>(heap_caps_malloc(capacity * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    this->capacity = capacity;
+    return samples != nullptr;
+}
+
+int16_t *SampleRing::writeRegion(size_t &count) {
+    size_t offset = head.load() & (capacity - 1);
+    size_t contiguous = capacity - offset;
+    count = space() < contiguous ? space() : contiguous;
+    return samples + offset;
+}
+
+size_t SampleRing::read(int16_t *dst, size_t count) {
+    count = size() < count ? size() : count;
+    size_t offset = tail.load() & (capacity - 1);
+    size_t first = count < capacity - offset ? count : capacity - offset;
+    memcpy(dst, samples + offset, first * sizeof(int16_t));
+    memcpy(dst + first, samples, (count - first) * sizeof(int16_t));
+    tail.store(tail.load() + count);
+    return count;
+}
+
+EventDispatcher *Intercom::eventDispatcher = nullptr;
+TaskHandle_t Intercom::taskHandle = nullptr;
+volatile bool Intercom::active = false;
+uint32_t Intercom::session = 0;
+volatile bool Intercom::stopRequested = false;
+AudioCodecType Intercom::uplinkCodec = AudioCodecType::PCM16;
+AdpcmState Intercom::uplinkAdpcm;
+AudioCodecType Intercom::downlinkCodec = AudioCodecType::PCM16;
+int16_t *Intercom::captureFrames = nullptr;
+uint32_t *Intercom::captureTimes = nullptr;
+size_t Intercom::captureHead = 0;
+size_t Intercom::captureTail = 0;
+std::atomic<uint32_t> Intercom::framesInFlight(0);
+int32_t *Intercom::captureSlots = nullptr;
+int32_t Intercom::micDcOffset = 0;
+SampleRing Intercom::playbackRing;
+int16_t *Intercom::playbackFrame = nullptr;
+bool Intercom::playing = false;
+uint32_t Intercom::speakerLevel = 0;
+uint32_t Intercom::hangoverFrames = 0;
+int32_t Intercom::micGain = UNITY_GAIN;
+IntercomStats Intercom::stats = {};
+
+// Short DMA buffers keep both directions' hardware queues to a few frames
+const i2s_config_t Intercom::i2sConfigRx = {
+        .mode = (i2s_mode_t) (I2S_MODE_MASTER | I2S_MODE_RX),
+        .sample_rate = SAMPLE_RATE,
+        .bits_per_sample = static_cast<i2s_bits_per_sample_t>(MIC_SLOT_BITS),
+        .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+        .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+        .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+        .dma_buf_count = INTERCOM_DMA_BUF_COUNT,
+        .dma_buf_len = INTERCOM_FRAME_SAMPLES,
+        .use_apll = true,
+        .tx_desc_auto_clear = false,
+        .fixed_mclk = 0
+};
+
+const i2s_config_t Intercom::i2sConfigTx = {
+        .mode = (i2s_mode_t) (I2S_MODE_MASTER | I2S_MODE_TX),
+        .sample_rate = SAMPLE_RATE,
+        .bits_per_sample = static_cast<i2s_bits_per_sample_t>(BITS_PER_SAMPLE),
+        .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+        .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+        .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+        .dma_buf_count = INTERCOM_DMA_BUF_COUNT,
+        .dma_buf_len = INTERCOM_FRAME_SAMPLES,
+        .use_apll = true,
+        .tx_desc_auto_clear = true,
+        .fixed_mclk = 0
+};
+
+void Intercom::begin(EventDispatcher &dispatcher) {
+    eventDispatcher = &dispatcher;
+
+    // Both rings are small enough for internal RAM
+    captureFrames = static_cast<int16_t *>(heap_caps_malloc(INTERCOM_CAPTURE_FRAMES * FRAME_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    captureTimes = static_cast<uint32_t *>(heap_caps_malloc(INTERCOM_CAPTURE_FRAMES * sizeof(uint32_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    playbackFrame = static_cast<int16_t *>(heap_caps_malloc(FRAME_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    captureSlots = static_cast<int32_t *>(heap_caps_malloc(CAPTURE_SLOT_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    if (captureFrames == nullptr || captureTimes == nullptr || playbackFrame == nullptr || captureSlots == nullptr ||
+        !playbackRing.begin(INTERCOM_PLAYBACK_SAMPLES)) {
+        LOG_E(TAG, "Failed to allocate intercom buffers");
+        return;
+    }
+
+    xTaskCreatePinnedToCore(intercomTask, "IntercomTask", 4096, nullptr, 5, &taskHandle, 1);
+}
+
+bool Intercom::start() {
+    if (active) {
+        return true;
+    }
+    if (taskHandle == nullptr || !Audio::suspendForIntercom(i2sConfigRx, i2sConfigTx)) {
+        return false;
+    }
+
+    session++;
+    stats = {};
+    captureHead = 0;
+    captureTail = 0;
+    playbackRing.clear();
+    playing = false;
+    speakerLevel = 0;
+    hangoverFrames = 0;
+    micGain = UNITY_GAIN;
+    micDcOffset = 0;
+    uplinkAdpcm = {};
+    stopRequested = false;
+    active = true;
+    xTaskNotifyGive(taskHandle);
+    LOG_I(TAG, "Intercom started: uplink %s, downlink %s", AudioCodec::name(uplinkCodec), AudioCodec::name(downlinkCodec));
+    return true;
+}
+
+void Intercom::stop() {
+    // The task hands I2S back to Audio once it leaves its loop
+    if (active) {
+        stopRequested = true;
+    }
+}
+
+void Intercom::setCodecs(AudioCodecType uplink, AudioCodecType downlink) {
+    uplinkCodec = uplink;
+    downlinkCodec = downlink;
+}
+
+void Intercom::addPlaybackData(const uint8_t *data, size_t length) {
+    if (!active) {
+        return;
+    }
+
+    // Decoded straight into the ring, split at its wrap point
+    AudioChunkDecoder decoder(downlinkCodec, data, length);
+    while (decoder.remainingSamples() > 0) {
+        size_t count = 0;
+        int16_t *region = playbackRing.writeRegion(count);
+        if (count == 0) {
+            stats.overflowSamples += decoder.remainingSamples();
+            break;
+        }
+        playbackRing.commitWrite(decoder.decode(region, count));
+    }
+}
+
+void Intercom::frameSent(uint32_t postedAt) {
+    framesInFlight--;
+    uint32_t waited = micros() - postedAt;
+    stats.framesSent++;
+    stats.dispatchWaitUs += waited;
+    if (waited > stats.maxDispatchWaitUs) {
+        stats.maxDispatchWaitUs = waited;
+    }
+}
+
+IntercomStats Intercom::getStats() {
+    return stats;
+}
+
+uint32_t Intercom::captureLatencyMs() {
+    return FRAME_SAMPLES * 1000 / SAMPLE_RATE; // A read returns once a whole DMA buffer has filled
+}
+
+uint32_t Intercom::uplinkLatencyMs() {
+    return stats.framesSent ? static_cast<uint32_t>((stats.captureWaitUs + stats.dispatchWaitUs) / stats.framesSent / 1000) : 0;
+}
+
+uint32_t Intercom::jitterLatencyMs() {
+    return stats.framesPlayed ? static_cast<uint32_t>(stats.playoutFillSamples / stats.framesPlayed * 1000 / SAMPLE_RATE) : 0;
+}
+
+uint32_t Intercom::playoutLatencyMs() {
+    return INTERCOM_DMA_BUF_COUNT * FRAME_SAMPLES * 1000 / SAMPLE_RATE; // Every speaker DMA buffer kept full
+}
+
+void Intercom::captureFrame() {
+    if (captureHead - captureTail == INTERCOM_CAPTURE_FRAMES) {
+        captureTail++; // Uplink backed up: drop the oldest frame rather than grow the latency
+        stats.framesDropped++;
+    }
+
+    size_t slot = captureHead % INTERCOM_CAPTURE_FRAMES;
+    int16_t *frame = captureFrames + slot * FRAME_SAMPLES;
+    size_t bytesRead = 0;
+    esp_err_t result = i2s_read(I2S_NUM_0, captureSlots, CAPTURE_SLOT_BYTES, &bytesRead, pdMS_TO_TICKS(100));
+    if (result != ESP_OK || bytesRead < CAPTURE_SLOT_BYTES) {
+        LOG_E(TAG, "Error reading from I2S: %d (%u bytes)", result, bytesRead);
+        return;
+    }
+    PcmConvert::narrow32(captureSlots, frame, FRAME_SAMPLES, MIC_SAMPLE_SHIFT);
+    int32_t frameMean = PcmConvert::mean(frame, FRAME_SAMPLES);
+    PcmConvert::removeDcAndGain(frame, FRAME_SAMPLES, PcmConvert::saturate(micDcOffset), MIC_GAIN);
+    micDcOffset += (frameMean - micDcOffset) / 8;
+
+    suppressEcho(frame);
+    captureTimes[slot] = micros();
+    captureHead++;
+    stats.framesCaptured++;
+}
+
+void Intercom::publishFrames() {
+    while (captureTail != captureHead && framesInFlight < AUDIO_UPLOAD_WINDOW) {
+        PooledBuffer chunk = BufferPool::acquire();
+        if (!chunk) {
+            return;
+        }
+        size_t slot = captureTail % INTERCOM_CAPTURE_FRAMES;
+        chunk.setSize(AudioCodec::encode(uplinkCodec, captureFrames + slot * FRAME_SAMPLES, FRAME_SAMPLES, chunk.data(),
+                                           uplinkAdpcm));
+        BufferPool::recordCopy(chunk.size());
+        uint32_t waited = micros() - captureTimes[slot];
+
+        framesInFlight++;
+        if (!eventDispatcher->post({INTERCOM_AUDIO_READY, std::move(chunk)})) {
+            framesInFlight--;
+            return;
+        }
+        stats.captureWaitUs += waited;
+        captureTail++;
+    }
+}
+
+void Intercom::playFrame() {
+    size_t fill = playbackRing.size();
+    if (!playing && fill >= JITTER_SAMPLES) {
+        playing = true;
+    }
+    if (playing && fill > 3 * JITTER_SAMPLES) {
+        playbackRing.skip(FRAME_SAMPLES); // Sender clock ran fast or a burst arrived; drop a frame to stay near target
+        stats.framesSkipped++;
+        fill -= FRAME_SAMPLES;
+    }
+
+    if (playing && fill >= FRAME_SAMPLES) {
+        playbackRing.read(playbackFrame, FRAME_SAMPLES);
+        stats.framesPlayed++;
+        stats.playoutFillSamples += fill;
+    } else {
+        if (playing) {
+            stats.underruns++;
+            playing = false; // Rebuffer to the jitter target
+        }
+        memset(playbackFrame, 0, FRAME_BYTES);
+    }
+    speakerLevel = meanLevel(playbackFrame, FRAME_SAMPLES);
+
+    size_t bytesWritten = 0;
+    i2s_write(I2S_NUM_1, playbackFrame, FRAME_BYTES, &bytesWritten, portMAX_DELAY);
+}
+
+void Intercom::suppressEcho(int16_t *frame) {
+    // The speaker frame heard now left the DMA a few frames ago, so suppression is held for a hangover
+    if (speakerLevel >= INTERCOM_ECHO_THRESHOLD) {
+        hangoverFrames = INTERCOM_ECHO_HANGOVER_FRAMES;
+    } else if (hangoverFrames > 0) {
+        hangoverFrames--;
+    }
+
+    bool suppress = hangoverFrames > 0 && meanLevel(frame, FRAME_SAMPLES) < INTERCOM_DOUBLE_TALK_THRESHOLD;
+    int32_t targetGain = suppress ? UNITY_GAIN >> INTERCOM_ECHO_ATTENUATION_SHIFT : UNITY_GAIN;
+    if (suppress) {
+        stats.suppressedFrames++;
+    }
+    if (targetGain == UNITY_GAIN && micGain == UNITY_GAIN) {
+        return;
+    }
+
+    // Ramp the gain across the frame so switching does not click
+    for (size_t i = 0; i < FRAME_SAMPLES; i++) {
+        int32_t gain = micGain + (targetGain - micGain) * static_cast<int32_t>(i) / static_cast<int32_t>(FRAME_SAMPLES);
+        frame[i] = static_cast<int16_t>(frame[i] * gain / UNITY_GAIN);
+    }
+    micGain = targetGain;
+}
+
+void Intercom::logLatencyBudget() {
+    uint32_t capture = captureLatencyMs();
+    uint32_t uplink = uplinkLatencyMs();
+    uint32_t jitter = jitterLatencyMs();
+    uint32_t playout = playoutLatencyMs();
+    LOG_I(TAG, "Mouth-to-ear on device: capture %u + uplink %u + jitter buffer %u + playout %u = %u ms, plus the network both ways",
+          capture, uplink, jitter, playout, capture + uplink + jitter + playout);
+    LOG_I(TAG, "Frames: %u captured, %u sent, %u dropped, %u played, %u skipped, %u underruns, %u echo suppressed, %u samples overflowed",
+          stats.framesCaptured, stats.framesSent, stats.framesDropped, stats.framesPlayed, stats.framesSkipped,
+          stats.underruns, stats.suppressedFrames, stats.overflowSamples);
+}
+
+void Intercom::intercomTask(void *parameter) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Prime the speaker with silence so playout never starves while the first downlink frames arrive
+        memset(playbackFrame, 0, FRAME_BYTES);
+        size_t bytesWritten = 0;
+        for (int i = 0; i < INTERCOM_DMA_BUF_COUNT - 1; i++) {
+            i2s_write(I2S_NUM_1, playbackFrame, FRAME_BYTES, &bytesWritten, portMAX_DELAY);
+        }
+
+        // Each pass takes one frame in and puts one frame out, paced by the microphone DMA
+        while (!stopRequested) {
+            captureFrame();
+            publishFrames();
+            playFrame();
+        }
+
+        active = false;
+        Audio::resumeFromIntercom();
+        logLatencyBudget();
+        eventDispatcher->post({INTERCOM_ENDED, ""});
+    }
+}
@@ -0,0 +1,114 @@
+#include "json_writer.h"
+#include <cstring>
+
+JsonWriter &JsonWriter::beginObject() {
+    separate();
+    put('{');
+    if (depth == 31) {
+        overflowed = true; // Deeper than the comma bits can track
+        return *this;
+    }
+    depth++;
+    open &= ~(1u << depth);
+    return *this;
+}
+
+JsonWriter &JsonWriter::endObject() {
+    if (depth > 0) {
+        depth--;
+    }
+    put('}');
+    return *this;
+}
+
+JsonWriter &JsonWriter::key(const char *name) {
+    value(name);
+    put(':');
+    afterKey = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *text) {
+    if (text == nullptr) {
+        return raw("null");
+    }
+    separate();
+    put('"');
+    const char *run = text;
+    for (const char *c = text; *c != '\0'; c++) {
+        auto byte = static_cast<uint8_t>(*c);
+        if (byte >= 0x20 && byte != '"' && byte != '\\') {
+            continue;
+        }
+        put(run, c - run);
+        run = c + 1;
+        switch (byte) {
+            case '"': put("\\\"", 2); break;
+            case '\\': put("\\\\", 2); break;
+            case '\n': put("\\n", 2); break;
+            case '\r': put("\\r", 2); break;
+            case '\t': put("\\t", 2); break;
+            default: {
+                static const char hex[] = "0123456789abcdef";
+                char escape[] = {'\\', 'u', '0', '0', hex[byte >> 4], hex[byte & 0xF]};
+                put(escape, sizeof(escape));
+                break;
+            }
+        }
+    }
+    put(run, strlen(run));
+    put('"');
+    return *this;
+}
+
+JsonWriter &JsonWriter::writeSigned(long long number) {
+    if (number >= 0) {
+        return writeUnsigned(static_cast<unsigned long long>(number));
+    }
+    separate();
+    put('-');
+    afterKey = true; // The digits continue this value
+    return writeUnsigned(0ull - static_cast<unsigned long long>(number));
+}
+
+JsonWriter &JsonWriter::writeUnsigned(unsigned long long number) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = static_cast<char>('0' + number % 10);
+        number /= 10;
+    } while (number != 0);
+    separate();
+    put(digits + sizeof(digits) - count, count);
+    return *this;
+}
+
+void JsonWriter::separate() {
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (open & 1u << depth) {
+        put(',');
+    }
+    open |= 1u << depth;
+}
+
+JsonWriter &JsonWriter::raw(const char *text) {
+    separate();
+    put(text, strlen(text));
+    return *this;
+}
+
+void JsonWriter::put(char c) {
+    put(&c, 1);
+}
+
+void JsonWriter::put(const char *text, size_t length) {
+    if (overflowed || length > capacity - used) {
+        overflowed = true;
+        return;
+    }
+    memcpy(buffer + used, text, length);
+    used += length;
+}
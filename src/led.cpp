@@ -18,11 +18,11 @@ void LED::begin(EventDispatcher &dispatcher) {
 void LED::turnOn() {
     digitalWrite(pin, LOW);  // Trigger the relay LOW to turn ON
     LOG_I(TAG, "LED (Relay) turned on");
-    eventDispatcher->dispatchEvent({LED_TURNED_ON, ""});
+    eventDispatcher->post({LED_TURNED_ON, ""});
 }
 
 void LED::turnOff() {
     digitalWrite(pin, HIGH);  // Set the relay HIGH to turn OFF
     LOG_I(TAG, "LED (Relay) turned off");
-    eventDispatcher->dispatchEvent({LED_TURNED_OFF, ""});
+    eventDispatcher->post({LED_TURNED_OFF, ""});
 }
\ No newline at end of file
@@ -1,6 +1,12 @@
+// Unit tests bring their own setup() and loop() and build the modules they need from here
+#ifndef PIO_UNIT_TESTING
+
 #include <Arduino.h>
 #include "events.h"
 #include "audio.h"
+#include "intercom.h"
+#include "audio_spool.h"
+#include "event_outbox.h"
 #include "network_manager.h"
 #include "ui.h"
 #include "fingerprint.h"
@@ -15,10 +21,11 @@
 #include <PubSubClient.h>
 #include "config.h"
 #include "sensor_task.h"
+#include "event_journal.h"
 
 static const char *TAG = "MAIN";
 
-EventDispatcher eventDispatcher;
+EventDispatcher eventDispatcher(EVENT_MAX_CALLBACKS);
 NetworkManager network;
 UI ui;
 HardwareSerial fingerprintSerial(1);
@@ -35,6 +42,14 @@ PubSubClient mqttClient(espClient);
 
 void setup() {
     Serial.begin(115200);
+    BufferPool::begin(AUDIO_POOL_CHUNKS);
+    eventDispatcher.begin(EVENT_QUEUE_SIZE, EVENT_DISPATCHER_PRIORITY, EVENT_DISPATCHER_CORE);
+#if EVENT_JOURNAL_SIZE > 0
+    auto *journalStorage = static_cast<uint8_t *>(ps_malloc(EVENT_JOURNAL_SIZE));
+    if (journalStorage != nullptr) {
+        eventDispatcher.setRecorder(new EventJournal(journalStorage, EVENT_JOURNAL_SIZE));
+    }
+#endif
     network.begin(eventDispatcher);
     vTaskDelay(2000);
 
@@ -51,6 +66,9 @@ void setup() {
     gate.begin(eventDispatcher);
     ui.begin(eventDispatcher);
     audio.begin(eventDispatcher);
+    AudioSpool::begin(eventDispatcher);
+    EventOutbox::begin(eventDispatcher);
+    Intercom::begin(eventDispatcher);
     fingerprintHandler.begin(eventDispatcher);
     pirSensor.begin(eventDispatcher);
     led.begin(eventDispatcher);
@@ -63,4 +81,6 @@ void setup() {
 }
 
 void loop() {
-}
\ No newline at end of file
+}
+
+#endif // PIO_UNIT_TESTING
@@ -0,0 +1,394 @@
+#include "message_store.h"
+#include <Arduino.h>
+#include <new>
+#include "config.h"
+#include "logger.h"
+
+static const char *TAG = "MessageStore";
+
+static constexpr uint16_t NO_SLAB = 0xFFFF;
+static portMUX_TYPE storeLock = portMUX_INITIALIZER_UNLOCKED;
+
+uint8_t *MessageStore::memory = nullptr;
+uint16_t *MessageStore::nextSlab = nullptr;
+size_t MessageStore::slabCount = 0;
+uint16_t MessageStore::freeHead = NO_SLAB;
+size_t MessageStore::freeCount = 0;
+size_t MessageStore::minFree = 0;
+uint32_t MessageStore::evictions = 0;
+uint32_t MessageStore::allocationFailures = 0;
+uint16_t MessageStore::lastId = 0;
+StoredMessage MessageStore::messages[MESSAGE_STORE_MAX_MESSAGES] = {};
+
+bool MessageStore::begin(size_t capacity) {
+    size_t count = capacity / MESSAGE_SLAB_SIZE;
+    if (count == 0 || count >= NO_SLAB) {
+        LOG_E(TAG, "Unsupported slab count: %u", count);
+        return false;
+    }
+
+    memory = static_cast<uint8_t *>(ps_malloc(count * MESSAGE_SLAB_SIZE));
+    nextSlab = new(std::nothrow) uint16_t[count];
+    if (memory == nullptr || nextSlab == nullptr) {
+        LOG_E(TAG, "Failed to allocate %u slabs", count);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        nextSlab[i] = (i + 1 < count) ? static_cast<uint16_t>(i + 1) : NO_SLAB;
+    }
+    slabCount = count;
+    freeHead = 0;
+    freeCount = count;
+    minFree = count;
+
+    LOG_I(TAG, "Message store ready: %u slabs of %u bytes, %u messages", count, MESSAGE_SLAB_SIZE,
+          MESSAGE_STORE_MAX_MESSAGES);
+    return true;
+}
+
+uint16_t MessageStore::create(MessageDirection direction) {
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = findFree();
+    if (message == nullptr && evictOldestPlayed(0)) {
+        message = findFree();
+    }
+    uint16_t id = 0;
+    if (message != nullptr) {
+        lastId = lastId == UINT16_MAX ? 1 : lastId + 1;
+        id = lastId;
+        *message = {};
+        message->info = {id, direction, false, 0, static_cast<uint32_t>(millis())};
+        message->firstSlab = NO_SLAB;
+        message->lastSlab = NO_SLAB;
+        message->cursorSlab = NO_SLAB;
+    }
+    portEXIT_CRITICAL(&storeLock);
+
+    if (id == 0) {
+        LOG_W(TAG, "Message index full of unplayed messages");
+    }
+    return id;
+}
+
+void MessageStore::remove(uint16_t id) {
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = find(id);
+    if (message != nullptr) {
+        freeSlabs(message->firstSlab, message->lastSlab, message->slabCount);
+        message->info.id = 0;
+    }
+    portEXIT_CRITICAL(&storeLock);
+}
+
+bool MessageStore::getInfo(uint16_t id, MessageInfo &info) {
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = find(id);
+    if (message != nullptr) {
+        info = message->info;
+    }
+    portEXIT_CRITICAL(&storeLock);
+    return message != nullptr;
+}
+
+uint16_t MessageStore::nextUnplayed(MessageDirection direction) {
+    portENTER_CRITICAL(&storeLock);
+    const StoredMessage *oldest = nullptr;
+    for (const StoredMessage &message : messages) {
+        if (message.info.id != 0 && message.info.direction == direction && !message.info.played &&
+            (oldest == nullptr || message.info.timestamp - oldest->info.timestamp > UINT32_MAX / 2)) {
+            oldest = &message;
+        }
+    }
+    uint16_t id = oldest != nullptr ? oldest->info.id : 0;
+    portEXIT_CRITICAL(&storeLock);
+    return id;
+}
+
+void MessageStore::markPlayed(uint16_t id) {
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = find(id);
+    if (message != nullptr) {
+        message->info.played = true;
+    }
+    portEXIT_CRITICAL(&storeLock);
+}
+
+size_t MessageStore::length(uint16_t id) {
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = find(id);
+    size_t length = message != nullptr ? message->info.length : 0;
+    portEXIT_CRITICAL(&storeLock);
+    return length;
+}
+
+size_t MessageStore::writableBytes(uint16_t id) {
+    portENTER_CRITICAL(&storeLock);
+    size_t slabs = freeCount;
+    for (const StoredMessage &message : messages) {
+        if (message.info.id != 0 && message.info.played && message.info.id != id) {
+            slabs += message.slabCount;
+        }
+    }
+    size_t bytes = slabs * MESSAGE_SLAB_SIZE;
+    StoredMessage *message = find(id);
+    if (message != nullptr) {
+        bytes += message->baseOffset + message->slabCount * MESSAGE_SLAB_SIZE - message->info.length;
+    }
+    portEXIT_CRITICAL(&storeLock);
+    return bytes;
+}
+
+uint8_t *MessageStore::writeRegion(uint16_t id, size_t &length) {
+    uint8_t *region = nullptr;
+    length = 0;
+
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = find(id);
+    if (message != nullptr) {
+        size_t end = message->baseOffset + message->slabCount * MESSAGE_SLAB_SIZE;
+        if (message->info.length == end) {
+            uint16_t slab = allocateSlab(id);
+            if (slab != NO_SLAB) {
+                if (message->slabCount == 0) {
+                    message->firstSlab = slab;
+                    message->baseOffset = message->info.length;
+                    message->cursorSlab = NO_SLAB;
+                } else {
+                    nextSlab[message->lastSlab] = slab;
+                }
+                message->lastSlab = slab;
+                message->slabCount++;
+                end += MESSAGE_SLAB_SIZE;
+            }
+        }
+        if (message->info.length < end) {
+            length = end - message->info.length;
+            region = memory + message->lastSlab * MESSAGE_SLAB_SIZE + (MESSAGE_SLAB_SIZE - length);
+        }
+    }
+    portEXIT_CRITICAL(&storeLock);
+    return region;
+}
+
+void MessageStore::commitWrite(uint16_t id, size_t length) {
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = find(id);
+    if (message != nullptr) {
+        message->info.length += length;
+    }
+    portEXIT_CRITICAL(&storeLock);
+}
+
+size_t MessageStore::write(uint16_t id, const uint8_t *data, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        size_t space = 0;
+        uint8_t *region = writeRegion(id, space);
+        if (region == nullptr) {
+            break;
+        }
+        size_t count = length - written < space ? length - written : space;
+        memcpy(region, data + written, count);
+        commitWrite(id, count);
+        written += count;
+    }
+    return written;
+}
+
+uint8_t *MessageStore::readRegion(uint16_t id, size_t offset, size_t &length) {
+    uint8_t *region = nullptr;
+    length = 0;
+
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = find(id);
+    if (message != nullptr && offset >= message->baseOffset && offset < message->info.length) {
+        size_t slabStart = 0;
+        uint16_t slab = slabAt(*message, offset, slabStart);
+        size_t slabEnd = slabStart + MESSAGE_SLAB_SIZE;
+        length = (slabEnd < message->info.length ? slabEnd : message->info.length) - offset;
+        region = memory + slab * MESSAGE_SLAB_SIZE + (offset - slabStart);
+    }
+    portEXIT_CRITICAL(&storeLock);
+    return region;
+}
+
+void MessageStore::truncate(uint16_t id, size_t length) {
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = find(id);
+    if (message != nullptr && length < message->info.length) {
+        size_t keep = length > message->baseOffset
+                      ? (length - message->baseOffset + MESSAGE_SLAB_SIZE - 1) / MESSAGE_SLAB_SIZE : 0;
+        if (keep == 0) {
+            freeSlabs(message->firstSlab, message->lastSlab, message->slabCount);
+            message->firstSlab = NO_SLAB;
+            message->lastSlab = NO_SLAB;
+            message->baseOffset = length;
+        } else if (keep < message->slabCount) {
+            size_t slabStart = 0;
+            uint16_t last = slabAt(*message, message->baseOffset + (keep - 1) * MESSAGE_SLAB_SIZE, slabStart);
+            freeSlabs(nextSlab[last], message->lastSlab, message->slabCount - keep);
+            nextSlab[last] = NO_SLAB;
+            message->lastSlab = last;
+        }
+        message->slabCount = static_cast<uint16_t>(keep);
+        message->info.length = length;
+        message->cursorSlab = NO_SLAB;
+    }
+    portEXIT_CRITICAL(&storeLock);
+}
+
+void MessageStore::discardFront(uint16_t id, size_t bytes) {
+    size_t total = length(id);
+    if (bytes >= total) {
+        truncate(id, 0);
+        return;
+    }
+
+    // Slab by slab, so each move stays within contiguous memory; only the owner of the message writes it
+    size_t remaining = total - bytes;
+    size_t moved = 0;
+    while (moved < remaining) {
+        size_t srcLength = 0;
+        size_t dstLength = 0;
+        const uint8_t *src = readRegion(id, bytes + moved, srcLength);
+        uint8_t *dst = readRegion(id, moved, dstLength);
+        if (src == nullptr || dst == nullptr) {
+            break;
+        }
+        size_t count = srcLength < dstLength ? srcLength : dstLength;
+        count = count < remaining - moved ? count : remaining - moved;
+        memmove(dst, src, count);
+        moved += count;
+    }
+    truncate(id, moved);
+}
+
+void MessageStore::release(uint16_t id, size_t offset) {
+    portENTER_CRITICAL(&storeLock);
+    StoredMessage *message = find(id);
+    while (message != nullptr && message->slabCount > 0 && message->baseOffset + MESSAGE_SLAB_SIZE <= offset &&
+           message->baseOffset + MESSAGE_SLAB_SIZE <= message->info.length) {
+        uint16_t slab = message->firstSlab;
+        message->firstSlab = nextSlab[slab];
+        message->slabCount--;
+        message->baseOffset += MESSAGE_SLAB_SIZE;
+        freeSlabs(slab, slab, 1);
+        if (message->slabCount == 0) {
+            message->firstSlab = NO_SLAB;
+            message->lastSlab = NO_SLAB;
+        }
+        message->cursorSlab = NO_SLAB;
+    }
+    portEXIT_CRITICAL(&storeLock);
+}
+
+MessageStoreStats MessageStore::getStats() {
+    MessageStoreStats stats = {};
+    portENTER_CRITICAL(&storeLock);
+    stats.slabCount = slabCount;
+    stats.freeSlabs = freeCount;
+    stats.minFreeSlabs = minFree;
+    stats.evictions = evictions;
+    stats.allocationFailures = allocationFailures;
+    for (const StoredMessage &message : messages) {
+        if (message.info.id == 0) {
+            continue;
+        }
+        size_t held = message.info.length - message.baseOffset;
+        stats.messages++;
+        stats.storedBytes += held;
+        stats.slackBytes += message.slabCount * MESSAGE_SLAB_SIZE - held;
+    }
+    portEXIT_CRITICAL(&storeLock);
+    return stats;
+}
+
+void MessageStore::logStats() {
+    MessageStoreStats stats = getStats();
+    size_t allocated = (stats.slabCount - stats.freeSlabs) * MESSAGE_SLAB_SIZE;
+    LOG_I(TAG, "%u messages in %u/%u slabs (min free %u), %u bytes stored, %u bytes slack (%u%%), "
+               "%u evictions, %u failed allocations", stats.messages, stats.slabCount - stats.freeSlabs,
+          stats.slabCount, stats.minFreeSlabs, stats.storedBytes, stats.slackBytes,
+          allocated ? static_cast<uint32_t>(stats.slackBytes * 100 / allocated) : 0, stats.evictions,
+          stats.allocationFailures);
+}
+
+StoredMessage *MessageStore::find(uint16_t id) {
+    if (id == 0) {
+        return nullptr;
+    }
+    for (StoredMessage &message : messages) {
+        if (message.info.id == id) {
+            return &message;
+        }
+    }
+    return nullptr;
+}
+
+StoredMessage *MessageStore::findFree() {
+    for (StoredMessage &message : messages) {
+        if (message.info.id == 0) {
+            return &message;
+        }
+    }
+    return nullptr;
+}
+
+uint16_t MessageStore::allocateSlab(uint16_t forId) {
+    if (freeHead == NO_SLAB && !evictOldestPlayed(forId)) {
+        allocationFailures++;
+        return NO_SLAB;
+    }
+    uint16_t slab = freeHead;
+    freeHead = nextSlab[slab];
+    nextSlab[slab] = NO_SLAB;
+    freeCount--;
+    if (freeCount < minFree) {
+        minFree = freeCount;
+    }
+    return slab;
+}
+
+void MessageStore::freeSlabs(uint16_t first, uint16_t last, uint16_t count) {
+    // A message's chain is spliced onto the free list whole, whatever its length
+    if (count == 0) {
+        return;
+    }
+    nextSlab[last] = freeHead;
+    freeHead = first;
+    freeCount += count;
+}
+
+bool MessageStore::evictOldestPlayed(uint16_t keepId) {
+    StoredMessage *oldest = nullptr;
+    for (StoredMessage &message : messages) {
+        if (message.info.id != 0 && message.info.id != keepId && message.info.played &&
+            (oldest == nullptr || message.info.timestamp - oldest->info.timestamp > UINT32_MAX / 2)) {
+            oldest = &message;
+        }
+    }
+    if (oldest == nullptr) {
+        return false;
+    }
+    freeSlabs(oldest->firstSlab, oldest->lastSlab, oldest->slabCount);
+    oldest->info.id = 0;
+    evictions++;
+    return true;
+}
+
+uint16_t MessageStore::slabAt(StoredMessage &message, size_t offset, size_t &slabStart) {
+    uint16_t slab = message.firstSlab;
+    slabStart = message.baseOffset;
+    if (message.cursorSlab != NO_SLAB && message.cursorOffset <= offset) {
+        slab = message.cursorSlab;
+        slabStart = message.cursorOffset;
+    }
+    while (offset >= slabStart + MESSAGE_SLAB_SIZE) {
+        slab = nextSlab[slab];
+        slabStart += MESSAGE_SLAB_SIZE;
+    }
+    message.cursorSlab = slab;
+    message.cursorOffset = slabStart;
+    return slab;
+}
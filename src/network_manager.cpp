@@ -1,9 +1,10 @@
 #include "network_manager.h"
 #include "config.h"
 #include "audio.h"
-#include <ArduinoJson.h>
 #include <WiFi.h>
 #include "logger.h"
+#include "event_journal.h"
+#include "command_registry.h"
 #include <esp_system.h>
 
 static const char *TAG = "NetworkManager";
@@ -11,12 +12,190 @@ static const char *TAG = "NetworkManager";
 
 EventDispatcher *NetworkManager::eventDispatcher = nullptr;
 WebSocketsClient NetworkManager::webSocket;
+NetworkManager::FrameStream NetworkManager::frameStreams[static_cast<uint8_t>(FrameType::JOURNAL)];
+
+static_assert(WEBSOCKETS_MAX_HEADER_SIZE + FrameCodec::HEADER_SIZE <= POOL_CHUNK_HEADROOM,
+              "Pool chunk headroom must hold the WebSocket and frame headers");
 
 const char *WS_SERVER = "192.168.17.218";
+static char serverAddress[64];
+
+// Command handlers are free functions, so they post through their own copy of the dispatcher
+static EventDispatcher *commandDispatcher = nullptr;
+
+struct AudioFields {
+    const char *action;
+};
+
+struct ChangeStateFields {
+    const char *device;
+    const char *state;
+};
+
+struct EnrollFingerprintFields {
+    uint8_t id;
+};
+
+struct CodecFields {
+    const char *uplink;
+    const char *downlink;
+    uint16_t uplinkRate;
+    uint16_t downlinkRate;
+};
+
+struct SpoolAckFields {
+    uint32_t session;
+    uint32_t offset;
+};
+
+struct ChangeServerFields {
+    const char *server;
+};
+
+static void audioCommand(const AudioFields &fields) {
+    commandDispatcher->post({CMD_TG_AUDIO, fields.action});
+}
+
+static void changeStateCommand(const ChangeStateFields &fields) {
+    if (strcmp(fields.device, "gate") == 0) {
+        commandDispatcher->post(Event::of<CMD_CHANGE_STATE>({Device::GATE, strcmp(fields.state, "open") == 0}));
+    } else if (strcmp(fields.device, "light") == 0) {
+        commandDispatcher->post(Event::of<CMD_CHANGE_STATE>({Device::LIGHT, strcmp(fields.state, "on") == 0}));
+    } else {
+        LOG_W(TAG, "Unknown device: %s", fields.device);
+    }
+}
+
+static void grantAccessCommand(const NoFields &) {
+    LOG_I(TAG, "Received grant access command");
+    commandDispatcher->post({CMD_GRANT_ACCESS, ""});
+}
+
+static void denyAccessCommand(const NoFields &) {
+    LOG_I(TAG, "Received deny access command");
+    commandDispatcher->post({CMD_DENY_ACCESS, ""});
+}
+
+static void resetDeviceCommand(const NoFields &) {
+    LOG_I(TAG, "Received reset command. Restarting ESP32...");
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    esp_restart();
+}
+
+static void motionEnableCommand(const NoFields &) {
+    commandDispatcher->post({MOTION_ENABLE, ""});
+}
+
+static void enrollFingerprintCommand(const EnrollFingerprintFields &fields) {
+    commandDispatcher->post(Event::of<CMD_ENROLL_FINGERPRINT>({fields.id}));
+}
+
+static void codecCommand(const CodecFields &fields) {
+    // Anything left out stays raw PCM at the native rate
+    const char *uplink = fields.uplink ? fields.uplink : "pcm16";
+    const char *downlink = fields.downlink ? fields.downlink : "pcm16";
+    CodecSelection selection{AudioCodecType::PCM16, AudioCodecType::PCM16,
+                             fields.uplinkRate ? fields.uplinkRate : static_cast<uint16_t>(SAMPLE_RATE),
+                             fields.downlinkRate ? fields.downlinkRate : static_cast<uint16_t>(SAMPLE_RATE)};
+    if (AudioCodec::fromName(uplink, selection.uplink) && AudioCodec::fromName(downlink, selection.downlink)) {
+        commandDispatcher->post(Event::of<CMD_SET_CODEC>(selection));
+    } else {
+        LOG_E(TAG, "Invalid codec event: unsupported codec %s/%s", uplink, downlink);
+    }
+}
+
+static void spoolAckCommand(const SpoolAckFields &fields) {
+    commandDispatcher->post(Event::of<SPOOL_ACK>({fields.session, fields.offset}));
+}
+
+static void dumpJournalCommand(const NoFields &) {
+    NetworkManager::sendJournal();
+}
+
+static void changeServerCommand(const ChangeServerFields &fields) {
+    // The address points into the frame, which is freed after the callback
+    if (strlen(fields.server) >= sizeof(serverAddress)) {
+        LOG_E(TAG, "Invalid change_server event: server address too long");
+        return;
+    }
+    strcpy(serverAddress, fields.server);
+    NetworkManager::changeWebSocketServer(serverAddress);
+}
+
+static constexpr FieldSpec AUDIO_FIELDS[] = {
+        COMMAND_FIELD("action", AudioFields, action, true),
+};
+
+static constexpr FieldSpec CHANGE_STATE_FIELDS[] = {
+        COMMAND_FIELD("device", ChangeStateFields, device, true),
+        COMMAND_FIELD("state", ChangeStateFields, state, true),
+};
+
+static constexpr FieldSpec ENROLL_FINGERPRINT_FIELDS[] = {
+        COMMAND_FIELD("id", EnrollFingerprintFields, id, true),
+};
+
+static constexpr FieldSpec CODEC_FIELDS[] = {
+        COMMAND_FIELD("uplink", CodecFields, uplink, false),
+        COMMAND_FIELD("downlink", CodecFields, downlink, false),
+        COMMAND_FIELD("uplink_rate", CodecFields, uplinkRate, false),
+        COMMAND_FIELD("downlink_rate", CodecFields, downlinkRate, false),
+};
+
+static constexpr FieldSpec SPOOL_ACK_FIELDS[] = {
+        COMMAND_FIELD("session", SpoolAckFields, session, true),
+        COMMAND_FIELD("offset", SpoolAckFields, offset, true),
+};
+
+static constexpr FieldSpec CHANGE_SERVER_FIELDS[] = {
+        COMMAND_FIELD("server", ChangeServerFields, server, true),
+};
+
+static constexpr CommandSpec COMMANDS[] = {
+        command<AudioFields, audioCommand>("audio", AUDIO_FIELDS),
+        command<ChangeStateFields, changeStateCommand>("change_state", CHANGE_STATE_FIELDS),
+        command<grantAccessCommand>("grant_access"),
+        command<denyAccessCommand>("deny_access"),
+        command<resetDeviceCommand>("reset_device"),
+        command<motionEnableCommand>("motion_enable"),
+        command<EnrollFingerprintFields, enrollFingerprintCommand>("enroll_fingerprint", ENROLL_FINGERPRINT_FIELDS),
+        command<CodecFields, codecCommand>("codec", CODEC_FIELDS),
+        command<SpoolAckFields, spoolAckCommand>("spool_ack", SPOOL_ACK_FIELDS),
+        command<dumpJournalCommand>("dump_journal"),
+        command<ChangeServerFields, changeServerCommand>("change_server", CHANGE_SERVER_FIELDS),
+};
+
+static_assert(commandSlotsUnique(COMMANDS), "Command names collide in the hash table; change COMMAND_HASH_SEED");
+
+static constexpr CommandRegistry commandRegistry(COMMANDS);
+
+static void logCommand(const CommandOutcome &outcome) {
+    switch (outcome.status) {
+        case CommandStatus::HANDLED:
+            LOG_I(TAG, "Received event: %s", outcome.eventType);
+            break;
+        case CommandStatus::MALFORMED:
+            LOG_E(TAG, "Failed to parse command");
+            break;
+        case CommandStatus::NO_EVENT_TYPE:
+            LOG_E(TAG, "Invalid command: missing event_type");
+            break;
+        case CommandStatus::UNKNOWN:
+            LOG_W(TAG, "Unknown event type: %s", outcome.eventType);
+            break;
+        case CommandStatus::INVALID_FIELD:
+            LOG_E(TAG, "Invalid %s event: missing or invalid %s", outcome.eventType, outcome.field);
+            break;
+        case CommandStatus::INVALID_DATA:
+            LOG_E(TAG, "Invalid %s event: malformed data", outcome.eventType);
+            break;
+    }
+}
 
 
 void NetworkManager::begin(EventDispatcher &dispatcher) {
     eventDispatcher = &dispatcher;
+    commandDispatcher = &dispatcher;
     WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
     int connectionAttempts = 0;
     while (WiFiClass::status() != WL_CONNECTED && connectionAttempts < 3) {
@@ -73,80 +252,34 @@ void NetworkManager::webSocketEvent(WStype_t type, uint8_t *payload, size_t leng
     switch (type) {
         case WStype_DISCONNECTED:
             LOG_I(TAG, "WebSocket disconnected");
+            eventDispatcher->post({WS_DISCONNECTED, ""});
             break;
         case WStype_CONNECTED:
             LOG_I(TAG, "WebSocket connected");
             vTaskDelay(2000);
-            webSocket.sendTXT(R"({"event_type":"init","data":{"device":"esp_s3"}})");
+            // Servers that never answer with a "codec" event keep getting raw PCM
+            eventDispatcher->post(Event::of<CMD_SET_CODEC>({AudioCodecType::PCM16, AudioCodecType::PCM16,
+                                                             SAMPLE_RATE, SAMPLE_RATE}));
+            webSocket.sendTXT(R"({"event_type":"init","data":{"device":"esp_s3","codecs":["ima_adpcm","mulaw","pcm16"],)"
+                              R"("sample_rate":16000,"rates":[8000,48000],"frame_version":1}})");
+            eventDispatcher->post({WS_CONNECTED, ""});
             break;
-        case WStype_TEXT: {
-            StaticJsonDocument<256> doc;
-            DeserializationError error = deserializeJson(doc, payload, length);
-
-            if (error) {
-                LOG_E(TAG, "Failed to parse JSON: %s", error.c_str());
-                return;
-            }
-
-            const char *event_type = doc["event_type"];
-            if (event_type == nullptr) {
-                LOG_E(TAG, "Invalid JSON: missing event_type");
-                return;
-            }
-
-            LOG_I(TAG, "Received event: %s", event_type);
-
-            if (strcmp(event_type, "audio") == 0) {
-                JsonObject data = doc["data"];
-                const char *action = data["action"];
-
-                eventDispatcher->dispatchEvent({CMD_TG_AUDIO, action});
-
-            } else if (strcmp(event_type, "change_state") == 0) {
-                JsonObject data = doc["data"];
-                if (!data.isNull()) {
-                    String dataString;
-                    serializeJson(data, dataString);
-                    eventDispatcher->dispatchEvent({CMD_CHANGE_STATE, dataString.c_str()});
-                } else {
-                    LOG_E(TAG, "Invalid change_state event: missing data");
-                }
-            } else if (strcmp(event_type, "grant_access") == 0) {
-                LOG_I(TAG, "Received grant access command");
-                eventDispatcher->dispatchEvent({CMD_GRANT_ACCESS, ""});
-            } else if (strcmp(event_type, "deny_access") == 0) {
-                LOG_I(TAG, "Received deny access command");
-                eventDispatcher->dispatchEvent({CMD_DENY_ACCESS, ""});
-            } else if (strcmp(event_type, "reset_device") == 0) {
-                LOG_I(TAG, "Received reset command. Restarting ESP32...");
-                vTaskDelay(pdMS_TO_TICKS(1000));
-                esp_restart();
-            } else if (strcmp(event_type, "motion_enable") == 0) {
-                eventDispatcher->dispatchEvent({MOTION_ENABLE, ""});
-            } else if (strcmp(event_type, "enroll_fingerprint") == 0) {
-                JsonObject data = doc["data"];
-                if (!data.isNull()) {
-                    String dataString;
-                    serializeJson(data, dataString);
-                    eventDispatcher->dispatchEvent({CMD_ENROLL_FINGERPRINT, dataString.c_str()});
-                } else {
-                    LOG_E(TAG, "Invalid enroll_fingerprint event: missing data");
-                }
-            } else if (strcmp(event_type, "change_server") == 0) {
-                const char *newServer = doc["data"]["server"];
-                if (newServer) {
-                    changeWebSocketServer(newServer);
-                } else {
-                    LOG_E(TAG, "Invalid change_server event: missing server address");
-                }
-            } else {
-                LOG_W(TAG, "Unknown event type: %s", event_type);
-            }
+        case WStype_TEXT:
+            // The frame is parsed in place; the library frees it once this returns
+            logCommand(commandRegistry.dispatch(reinterpret_cast<char *>(payload), length));
             break;
-        }
         case WStype_BIN: {
-            Event event = {AUDIO_DATA_RECEIVED, std::string(reinterpret_cast<char *>(payload), length), length};
-            eventDispatcher->dispatchEvent(event);
+            // The library frees the frame after this callback, so copy it once into pool chunks.
+            // Frames are in the negotiated downlink codec; an IMA ADPCM frame must fit one chunk to keep its header.
+            for (size_t offset = 0; offset < length; offset += POOL_CHUNK_SIZE) {
+                size_t chunkLength = length - offset < POOL_CHUNK_SIZE ? length - offset : POOL_CHUNK_SIZE;
+                PooledBuffer chunk = BufferPool::copyFrom(payload + offset, chunkLength);
+                if (!chunk) {
+                    LOG_W(TAG, "Buffer pool exhausted. Dropping %u bytes of audio", length - offset);
+                    break;
+                }
+                eventDispatcher->post({AUDIO_DATA_RECEIVED, std::move(chunk)});
+            }
             break;
         }
         case WStype_PING:
@@ -162,31 +295,121 @@ void NetworkManager::webSocketEvent(WStype_t type, uint8_t *payload, size_t leng
     }
 }
 
-void NetworkManager::sendAudioChunk(const uint8_t *data, size_t len) {
-    if (webSocket.isConnected()) {
-        // Allocate a new buffer with space for the prefix
-        size_t totalLen = len + 6; // 6 is the length of "AUDIO:"
-        auto *buffer = new uint8_t[totalLen];
+bool NetworkManager::sendFrameAt(const PooledBuffer &chunk, FrameType type, uint32_t stream, uint32_t offset,
+                                 uint8_t flags) {
+    // The stream moves on even if the frame is lost, so offsets stay positions and the sequence shows the gap
+    FrameStream &state = frameStream(type);
+    if (!state.started || state.stream != stream) {
+        state = {stream, 0, 0, true};
+        flags |= FRAME_FIRST;
+    }
+    FrameHeader header{FrameCodec::VERSION, static_cast<uint8_t>(type), flags, FrameCodec::HEADER_SIZE,
+                       stream, state.sequence++, offset};
+    state.offset = offset + chunk.size();
+    if (!webSocket.isConnected()) {
+        LOG_W(TAG, "WebSocket not connected. Cannot send %s frame.", FrameCodec::name(type));
+        return false;
+    }
+
+    // Both headers go in the chunk's headroom so the payload is sent in place
+    uint8_t *frame = FrameCodec::encode(header, chunk.data());
+    return webSocket.sendBIN(frame - WEBSOCKETS_MAX_HEADER_SIZE, FrameCodec::HEADER_SIZE + chunk.size(), true);
+}
+
+bool NetworkManager::sendFrame(const PooledBuffer &chunk, FrameType type, uint32_t stream, uint8_t flags) {
+    return sendFrameAt(chunk, type, stream, streamOffset(type, stream), flags);
+}
+
+bool NetworkManager::endStream(FrameType type, uint32_t stream) {
+    PooledBuffer empty = BufferPool::acquire();
+    if (!empty) {
+        LOG_W(TAG, "Buffer pool exhausted. Cannot end %s stream %u.", FrameCodec::name(type), stream);
+        return false;
+    }
+    empty.setSize(0);
+    return sendFrame(empty, type, stream, FRAME_LAST);
+}
+
+uint32_t NetworkManager::streamOffset(FrameType type, uint32_t stream) {
+    const FrameStream &state = frameStream(type);
+    return state.started && state.stream == stream ? state.offset : 0;
+}
 
-        // Copy the prefix and the audio data
-        memcpy(buffer, "AUDIO:", 6);
-        memcpy(buffer + 6, data, len);
+NetworkManager::FrameStream &NetworkManager::frameStream(FrameType type) {
+    return frameStreams[static_cast<uint8_t>(type) - static_cast<uint8_t>(FrameType::AUDIO)];
+}
 
-        // Send the prefixed data
-        webSocket.sendBIN(buffer, totalLen);
+void NetworkManager::sendJournal() {
+    EventJournal *journal = eventDispatcher->getRecorder();
+    if (journal == nullptr) {
+        LOG_W(TAG, "Event recording is disabled");
+        return;
+    }
+
+    size_t capacity = journal->size();
+    auto *buffer = static_cast<uint8_t *>(ps_malloc(WEBSOCKETS_MAX_HEADER_SIZE + FrameCodec::HEADER_SIZE + capacity));
+    if (buffer == nullptr) {
+        LOG_E(TAG, "Failed to allocate %u bytes for the event journal", capacity);
+        return;
+    }
+
+    uint8_t *payload = buffer + WEBSOCKETS_MAX_HEADER_SIZE + FrameCodec::HEADER_SIZE;
+    size_t length = journal->copyOut(payload, capacity);
+    FrameHeader header{FrameCodec::VERSION, static_cast<uint8_t>(FrameType::JOURNAL), FRAME_FIRST | FRAME_LAST,
+                       FrameCodec::HEADER_SIZE, 0, 0, 0};
+    FrameCodec::encode(header, payload);
+    webSocket.sendBIN(buffer, FrameCodec::HEADER_SIZE + length, true);
+    free(buffer);
+    LOG_I(TAG, "Sent event journal: %u records, %u bytes", journal->recordCount(), length);
+}
+
+OutboundEvent::OutboundEvent(const char *eventType)
+        : eventType(eventType), json(reinterpret_cast<char *>(text()), OUTBOX_MAX_EVENT) {
+    json.beginObject().field("event_type", eventType);
+    json.key("data").beginObject();
+}
 
-        delete[] buffer;
+bool OutboundEvent::finish() {
+    json.endObject().endObject();
+    if (!json.ok()) {
+        LOG_E(TAG, "Event %s does not fit %u bytes. Dropped", eventType, OUTBOX_MAX_EVENT);
+        return false;
+    }
+    return true;
+}
+
+void NetworkManager::queueEvent(OutboundEvent &event, OutboxKey key) {
+    if (!event.finish()) {
+        return;
+    }
+    // Sent directly only when nothing queued would be overtaken
+    if (webSocket.isConnected() && EventOutbox::isEmpty() && sendText(event.text(), event.json.length())) {
+        LOG_I(TAG, "Sent event: %s", event.type());
+    } else if (EventOutbox::push(reinterpret_cast<const char *>(event.text()), event.json.length(), key)) {
+        LOG_I(TAG, "Queued event: %s", event.type());
     } else {
-        LOG_W(TAG, "WebSocket not connected. Cannot send audio chunk.");
+        LOG_W(TAG, "Event %s not sent and the outbox has no room. Dropped", event.type());
+    }
+}
+
+bool NetworkManager::sendText(const PooledBuffer &chunk) {
+    return sendText(chunk.data(), chunk.size());
+}
+
+bool NetworkManager::sendText(uint8_t *text, size_t length) {
+    if (!webSocket.isConnected()) {
+        return false;
     }
+    return webSocket.sendTXT(text - WEBSOCKETS_MAX_HEADER_SIZE, length, true);
 }
 
-void NetworkManager::sendEvent(const char *eventType, const JsonObject &data) {
-    StaticJsonDocument<256> doc;
-    doc["event_type"] = eventType;
-    doc["data"] = data;
-    char buffer[256];
-    size_t length = serializeJson(doc, buffer);
-    webSocket.sendTXT(buffer, length);
-    LOG_I(TAG, "Sent event: %s", eventType);
+void NetworkManager::sendEvent(OutboundEvent &event) {
+    if (!event.finish()) {
+        return;
+    }
+    if (sendText(event.text(), event.json.length())) {
+        LOG_I(TAG, "Sent event: %s", event.type());
+    } else {
+        LOG_W(TAG, "WebSocket not connected. Cannot send event %s.", event.type());
+    }
 }
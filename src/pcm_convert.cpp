@@ -0,0 +1,79 @@
+#include "pcm_convert.h"
+#include "config.h"
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+#define PCM_HAS_PIE 1
+#else
+#define PCM_HAS_PIE 0
+#endif
+#define PCM_USE_PIE (AUDIO_PIE_KERNELS && PCM_HAS_PIE)
+
+void PcmConvert::narrow32(const int32_t *src, int16_t *dst, size_t frames, uint8_t shift, size_t channels,
+                          size_t channel) {
+    src += channel;
+    for (size_t i = 0; i < frames; i++) {
+        dst[i] = saturate(*src >> shift);
+        src += channels;
+    }
+}
+
+int32_t PcmConvert::mean(const int16_t *samples, size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    int64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    return static_cast<int32_t>(sum / static_cast<int64_t>(count));
+}
+
+void PcmConvert::removeDcAndGainScalar(int16_t *samples, size_t count, int16_t offset, int16_t gain) {
+    for (size_t i = 0; i < count; i++) {
+        int32_t centred = saturate(static_cast<int32_t>(samples[i]) - offset);
+        samples[i] = saturate((centred * gain) >> 8);
+    }
+}
+
+#if PCM_HAS_PIE
+// Eight lanes per instruction: saturating subtract, then multiply shifted right by SAR and saturated.
+// The vector loads and stores need 16-byte alignment, so the unaligned head and the tail run scalar.
+static void removeDcAndGainBlocks(int16_t *samples, size_t blocks, int16_t offset, int16_t gain) {
+    int16_t lanes[2] __attribute__((aligned(16))) = {offset, gain};
+    asm volatile(
+            "movi.n       a8, 8\n"
+            "wsr.sar      a8\n"
+            "ee.vldbc.16  q1, %[offset]\n"
+            "ee.vldbc.16  q2, %[gain]\n"
+            "loopgtz      %[blocks], 1f\n"
+            "ee.vld.128.ip  q0, %[data], 0\n"
+            "ee.vsubs.s16   q0, q0, q1\n"
+            "ee.vmul.s16    q0, q0, q2\n"
+            "ee.vst.128.ip  q0, %[data], 16\n"
+            "1:\n"
+            : [data] "+r"(samples)
+            : [blocks] "r"(blocks), [offset] "r"(&lanes[0]), [gain] "r"(&lanes[1])
+            : "a8", "memory");
+}
+
+void PcmConvert::removeDcAndGainPie(int16_t *samples, size_t count, int16_t offset, int16_t gain) {
+    size_t head = ((16 - (reinterpret_cast<uintptr_t>(samples) & 15)) & 15) / sizeof(int16_t);
+    if ((reinterpret_cast<uintptr_t>(samples) & 1) != 0 || count < head + 8) {
+        removeDcAndGainScalar(samples, count, offset, gain);
+        return;
+    }
+    removeDcAndGainScalar(samples, head, offset, gain);
+    size_t blocks = (count - head) / 8;
+    removeDcAndGainBlocks(samples + head, blocks, offset, gain);
+    size_t done = head + blocks * 8;
+    removeDcAndGainScalar(samples + done, count - done, offset, gain);
+}
+#endif
+
+void PcmConvert::removeDcAndGain(int16_t *samples, size_t count, int16_t offset, int16_t gain) {
+#if PCM_USE_PIE
+    removeDcAndGainPie(samples, count, offset, gain);
+#else
+    removeDcAndGainScalar(samples, count, offset, gain);
+#endif
+}
@@ -32,7 +32,7 @@ void PIRSensor::pirTask(void *parameter) {
             if (currentState != lastState) {
                 if (currentState == HIGH) {
                     LOG_I(TAG_PIR, "Motion detected");
-                    eventDispatcher->dispatchEvent({MOTION_DETECTED, ""});
+                    eventDispatcher->post({MOTION_DETECTED, ""});
                     vTaskDelay(pdMS_TO_TICKS(180000)); // Wait for 3 minutes before checking again
                 }
                 lastState = currentState;
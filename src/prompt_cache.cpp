@@ -0,0 +1,82 @@
+#include "prompt_cache.h"
+#include "config.h"
+#include "logger.h"
+#include <esp_partition.h>
+
+static const char *TAG = "PROMPTS";
+
+const uint8_t *PromptCache::image = nullptr;
+size_t PromptCache::imageSize = 0;
+const PromptIndexEntry *PromptCache::index = nullptr;
+uint16_t PromptCache::count = 0;
+
+bool PromptCache::begin() {
+    if (!PROMPTS_ENABLED) {
+        return false;
+    }
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                static_cast<esp_partition_subtype_t>(0x41),
+                                                                PROMPTS_PARTITION_LABEL);
+    if (partition == nullptr) {
+        LOG_E(TAG, "No \"%s\" partition. Prompts are not available", PROMPTS_PARTITION_LABEL);
+        return false;
+    }
+
+    // Mapped for good; the mapping is never released
+    const void *mapped = nullptr;
+    spi_flash_mmap_handle_t handle;
+    if (esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &handle) != ESP_OK) {
+        LOG_E(TAG, "Failed to map the prompts partition (%u bytes)", partition->size);
+        return false;
+    }
+
+    const auto *header = static_cast<const PromptImageHeader *>(mapped);
+    if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION) {
+        LOG_W(TAG, "Prompts partition holds no prompt image. Flash one built by tools/pack_prompts.py");
+        return false;
+    }
+    if (header->sampleRate != SAMPLE_RATE ||
+        sizeof(PromptImageHeader) + header->count * sizeof(PromptIndexEntry) > partition->size) {
+        LOG_E(TAG, "Prompt image does not match this build: %u prompts at %u Hz", header->count, header->sampleRate);
+        return false;
+    }
+
+    image = static_cast<const uint8_t *>(mapped);
+    imageSize = partition->size;
+    index = reinterpret_cast<const PromptIndexEntry *>(image + sizeof(PromptImageHeader));
+    count = header->count;
+    LOG_I(TAG, "%u prompts mapped from flash", count);
+    return true;
+}
+
+bool PromptCache::find(PromptId id, Prompt &prompt) {
+    for (uint16_t i = 0; i < count; i++) {
+        const PromptIndexEntry &entry = index[i];
+        if (entry.id == static_cast<uint8_t>(id) && entry.offset % 4 == 0 && entry.offset <= imageSize &&
+            entry.length <= imageSize - entry.offset) {
+            prompt.samples = reinterpret_cast<const int16_t *>(image + entry.offset);
+            prompt.length = entry.length & ~size_t(1);
+            return prompt.length > 0;
+        }
+    }
+    return false;
+}
+
+const char *PromptCache::name(PromptId id) {
+    switch (id) {
+        case PromptId::DOORBELL:
+            return "doorbell";
+        case PromptId::PLEASE_WAIT:
+            return "please_wait";
+        case PromptId::ACCESS_GRANTED:
+            return "access_granted";
+        case PromptId::ACCESS_DENIED:
+            return "access_denied";
+        case PromptId::TRY_AGAIN:
+            return "try_again";
+        case PromptId::WELCOME:
+            return "welcome";
+    }
+    return "unknown";
+}
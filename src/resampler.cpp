@@ -0,0 +1,118 @@
+#include "resampler.h"
+#include "pcm_convert.h"
+#include <cmath>
+#include <cstring>
+
+static constexpr int COEFFICIENT_BITS = 14;       // Q14 keeps any full-scale input inside the 32-bit accumulator
+static constexpr float KAISER_BETA = 5.65f;       // About 60 dB of stop-band attenuation
+static constexpr float KAISER_TRANSITION = 3.62f; // Transition width times taps, as a fraction of the input rate
+
+// Zeroth-order modified Bessel function of the first kind, for the Kaiser window
+static float besselI0(float x) {
+    float sum = 1;
+    float term = 1;
+    for (int k = 1; k < 20; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+bool Resampler::supports(uint32_t inputRate, uint32_t outputRate) {
+    return inputRate >= RESAMPLER_MIN_RATE && inputRate <= RESAMPLER_MAX_RATE &&
+           outputRate >= RESAMPLER_MIN_RATE && outputRate <= RESAMPLER_MAX_RATE;
+}
+
+bool Resampler::configure(uint32_t inputRate, uint32_t outputRate) {
+    if (!supports(inputRate, outputRate)) {
+        return false;
+    }
+    this->inputRate = inputRate;
+    this->outputRate = outputRate;
+    step = (static_cast<uint64_t>(inputRate) << 32) / outputRate;
+
+    // Decimating narrows the pass band relative to the input rate, so the filter lengthens with the ratio to keep
+    // the transition band the same width at the output rate. Taps stay a multiple of four.
+    const float ratio = outputRate < inputRate ? static_cast<float>(inputRate) / outputRate : 1.0f;
+    size_t wanted = (static_cast<size_t>(ceilf(RESAMPLER_TAPS * ratio)) + 3) & ~static_cast<size_t>(3);
+    taps = wanted < RESAMPLER_MAX_TAPS ? wanted : RESAMPLER_MAX_TAPS;
+
+    // Cutoff as a fraction of the input rate: half a transition band under the lower Nyquist, so the stop band
+    // begins at it
+    const float cutoff = 0.5f / ratio - 0.5f * KAISER_TRANSITION / taps;
+    const float pi = 3.14159265f;
+    const float half = taps / 2.0f;
+    const float norm = besselI0(KAISER_BETA);
+    for (size_t phase = 0; phase < RESAMPLER_PHASES; phase++) {
+        float h[RESAMPLER_MAX_TAPS];
+        float sum = 0;
+        for (size_t k = 0; k < taps; k++) {
+            // Distance from the output instant, which lies `phase` of the way past tap taps / 2 - 1
+            float t = static_cast<float>(k) - (half - 1) - static_cast<float>(phase) / RESAMPLER_PHASES;
+            float x = 2 * cutoff * t;
+            float sinc = x == 0 ? 1.0f : sinf(pi * x) / (pi * x);
+            float r = t / half; // -1..1 over the filter span
+            float window = r * r < 1 ? besselI0(KAISER_BETA * sqrtf(1 - r * r)) / norm : 0;
+            h[k] = sinc * window;
+            sum += h[k];
+        }
+        for (size_t k = 0; k < taps; k++) {
+            coefficients[phase][k] = static_cast<int16_t>(lroundf(h[k] / sum * (1 << COEFFICIENT_BITS)));
+        }
+    }
+
+    reset();
+    return true;
+}
+
+void Resampler::reset() {
+    memset(window, 0, sizeof(window));
+    position = 0;
+}
+
+size_t Resampler::maxOutput(size_t inputCount) const {
+    if (isPassthrough()) {
+        return inputCount;
+    }
+    return static_cast<size_t>((static_cast<uint64_t>(inputCount) * outputRate + inputRate - 1) / inputRate) + 1;
+}
+
+size_t Resampler::maxInput(size_t outputCapacity) const {
+    if (isPassthrough()) {
+        return outputCapacity;
+    }
+    return outputCapacity > 1 ? static_cast<size_t>(static_cast<uint64_t>(outputCapacity - 1) * inputRate / outputRate) : 0;
+}
+
+size_t Resampler::process(const int16_t *input, size_t count, int16_t *out) {
+    if (isPassthrough()) {
+        memcpy(out, input, count * sizeof(int16_t));
+        return count;
+    }
+
+    const size_t history = taps - 1;
+    size_t written = 0;
+    while (count > 0) {
+        size_t block = count < RESAMPLER_BLOCK ? count : RESAMPLER_BLOCK;
+        memcpy(window + history, input, block * sizeof(int16_t));
+
+        // An output at position p needs window[floor(p)] .. window[floor(p) + taps - 1]
+        while ((position >> 32) < block) {
+            const int16_t *x = window + (position >> 32);
+            const int16_t *h = coefficients[static_cast<uint32_t>(position) >> (32 - RESAMPLER_PHASE_BITS)];
+            int32_t acc = 0;
+            for (size_t k = 0; k < taps; k += 4) {
+                acc += static_cast<int32_t>(x[k]) * h[k] + static_cast<int32_t>(x[k + 1]) * h[k + 1] +
+                       static_cast<int32_t>(x[k + 2]) * h[k + 2] + static_cast<int32_t>(x[k + 3]) * h[k + 3];
+            }
+            out[written++] = PcmConvert::saturate((acc + (1 << (COEFFICIENT_BITS - 1))) >> COEFFICIENT_BITS);
+            position += step;
+        }
+
+        position -= static_cast<uint64_t>(block) << 32;
+        memmove(window, window + block, history * sizeof(int16_t));
+        input += block;
+        count -= block;
+    }
+    return written;
+}
@@ -0,0 +1,443 @@
+#include "spool_log.h"
+#include <cstring>
+
+static constexpr size_t SEGMENT_DATA_START = (sizeof(SpoolSegmentHeader) + 3) & ~size_t(3);
+static constexpr size_t CRC_BLOCK = 256;
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t length) {
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+            }
+            table[i] = value;
+        }
+        tableReady = true;
+    }
+
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t headerCrc(SpoolRecordHeader header) {
+    header.crc = 0;
+    return crc32(0, &header, sizeof(header));
+}
+
+static uint32_t segmentCrc(SpoolSegmentHeader header) {
+    header.crc = 0;
+    return crc32(0, &header, sizeof(header));
+}
+
+static size_t recordSize(size_t payloadLength) {
+    return (sizeof(SpoolRecordHeader) + payloadLength + 3) & ~size_t(3);
+}
+
+static bool isErased(const void *data, size_t length) {
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < length; i++) {
+        if (bytes[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SpoolLog::SpoolLog(SpoolFlash &flash, size_t segmentSize)
+        : flash(flash), segmentSize(segmentSize), segmentCount(0), segments(), sessions() {}
+
+bool SpoolLog::mount() {
+    segmentCount = flash.size() / segmentSize;
+    segmentCount = segmentCount < MAX_SEGMENTS ? segmentCount : MAX_SEGMENTS;
+    if (segmentCount < 2 || segmentSize % SpoolFlash::SECTOR_SIZE != 0) {
+        return false;
+    }
+
+    // Segment headers first: the newest one says which older segments are stale
+    uint32_t newestTail = 0;
+    uint32_t maxEraseCount = 0;
+    bool unknownWear = false;
+    for (size_t i = 0; i < segmentCount; i++) {
+        SpoolSegmentHeader header{};
+        segments[i] = {0, 0, false};
+        if (!flash.read(i * segmentSize, &header, sizeof(header)) || header.magic != SEGMENT_MAGIC ||
+            header.crc != segmentCrc(header) || header.sequence == 0) {
+            unknownWear = true;
+            continue;
+        }
+        segments[i] = {header.sequence, header.eraseCount, false};
+        maxEraseCount = header.eraseCount > maxEraseCount ? header.eraseCount : maxEraseCount;
+        if (header.sequence > headSequence) {
+            headSequence = header.sequence;
+            head = static_cast<int>(i);
+            newestTail = header.tailSequence;
+        }
+    }
+    for (size_t i = 0; i < segmentCount; i++) {
+        if (segments[i].sequence != 0 && segments[i].sequence < newestTail) {
+            segments[i].sequence = 0;
+        }
+        if (unknownWear && segments[i].sequence == 0 && segments[i].eraseCount == 0) {
+            segments[i].eraseCount = maxEraseCount; // Lost with its header; assume the worst seen
+        }
+    }
+
+    // Replay the records in sequence order to rebuild the recordings
+    uint32_t previous = 0;
+    while (true) {
+        int next = -1;
+        for (size_t i = 0; i < segmentCount; i++) {
+            if (segments[i].sequence > previous &&
+                (next < 0 || segments[i].sequence < segments[static_cast<size_t>(next)].sequence)) {
+                next = static_cast<int>(i);
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+        previous = segments[static_cast<size_t>(next)].sequence;
+
+        size_t base = static_cast<size_t>(next) * segmentSize;
+        size_t position = SEGMENT_DATA_START;
+        bool clean = true;
+        while (position + sizeof(SpoolRecordHeader) <= segmentSize) {
+            SpoolRecordHeader header{};
+            flash.read(base + position, &header, sizeof(header));
+            if (isErased(&header, sizeof(header))) {
+                break;
+            }
+            if (position + recordSize(header.length) > segmentSize) {
+                clean = false;
+                break;
+            }
+
+            uint8_t block[CRC_BLOCK];
+            uint8_t begin[sizeof(SpoolBegin)] = {};
+            uint32_t crc = headerCrc(header);
+            for (size_t done = 0; done < header.length;) {
+                size_t count = header.length - done < CRC_BLOCK ? header.length - done : CRC_BLOCK;
+                flash.read(base + position + sizeof(header) + done, block, count);
+                if (done == 0) {
+                    memcpy(begin, block, count < sizeof(begin) ? count : sizeof(begin));
+                }
+                crc = crc32(crc, block, count);
+                done += count;
+            }
+            if (crc != header.crc) {
+                clean = false;
+                break;
+            }
+            applyRecord(header, begin, previous);
+            if (header.type == SpoolRecordType::END || header.type == SpoolRecordType::ACK) {
+                dropCompleted(); // Frees the session slot for recordings further on
+            }
+            position += recordSize(header.length);
+        }
+        if (!clean) {
+            stats.tornRecords++;
+        }
+        if (next == head) {
+            // A torn record may have left programmed bytes behind it; the next append opens a fresh segment
+            headPosition = clean ? position : segmentSize;
+        }
+    }
+
+    // Recordings cut short by a reboot are complete as far as they go
+    for (SpoolSession &entry : sessions) {
+        if (entry.id != 0) {
+            entry.ended = true;
+        }
+    }
+    dropCompleted();
+    return true;
+}
+
+bool SpoolLog::beginSession(uint32_t id, const SpoolBegin &format) {
+    SpoolSession *entry = session(0);
+    if (entry == nullptr) {
+        return false;
+    }
+    if (!writeRecord(SpoolRecordType::BEGIN, id, 0, &format, sizeof(format))) {
+        return false;
+    }
+    *entry = {id, format, headSequence, 0, 0, false, false};
+    lastSession = id > lastSession ? id : lastSession;
+    return true;
+}
+
+bool SpoolLog::append(uint32_t id, const uint8_t *data, size_t length) {
+    SpoolSession *entry = session(id);
+    if (entry == nullptr || entry->ended || entry->truncated ||
+        !writeRecord(SpoolRecordType::DATA, id, entry->written, data, length)) {
+        // Later chunks are refused too, so the spooled part has no gaps
+        if (entry != nullptr) {
+            entry->truncated = true;
+        }
+        stats.droppedBytes += length;
+        return false;
+    }
+    entry->written += length;
+    return true;
+}
+
+bool SpoolLog::endSession(uint32_t id) {
+    SpoolSession *entry = session(id);
+    if (entry == nullptr) {
+        return false;
+    }
+    entry->ended = true; // Even unrecorded, a reboot ends it in mount()
+    bool written = writeRecord(SpoolRecordType::END, id, entry->written, nullptr, 0);
+    dropCompleted();
+    return written;
+}
+
+bool SpoolLog::acknowledge(uint32_t id, uint32_t offset) {
+    SpoolSession *entry = session(id);
+    if (entry == nullptr || offset <= entry->acked) {
+        return entry != nullptr;
+    }
+    // Applied before it is written: the ack may be what frees the segment it needs
+    entry->acked = offset;
+    dropCompleted();
+    return writeRecord(SpoolRecordType::ACK, id, offset, nullptr, 0);
+}
+
+const SpoolSession *SpoolLog::findSession(uint32_t id) const {
+    for (const SpoolSession &entry : sessions) {
+        if (entry.id != 0 && entry.id == id) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+const SpoolSession *SpoolLog::nextPending(uint32_t after) const {
+    const SpoolSession *oldest = nullptr;
+    for (const SpoolSession &entry : sessions) {
+        if (entry.id > after && entry.ended && entry.acked < entry.written &&
+            (oldest == nullptr || entry.id < oldest->id)) {
+            oldest = &entry;
+        }
+    }
+    return oldest;
+}
+
+size_t SpoolLog::readChunk(uint32_t id, uint32_t fromOffset, uint8_t *dst, size_t capacity, uint32_t &chunkOffset) {
+    const SpoolSession *entry = findSession(id);
+    if (entry == nullptr) {
+        return 0;
+    }
+    if (readSession != id || fromOffset < readOffset) {
+        readSession = id;
+        readSequence = entry->firstSegment;
+        readPosition = SEGMENT_DATA_START;
+        readOffset = 0;
+    }
+
+    while (readSequence <= headSequence) {
+        int index = -1;
+        for (size_t i = 0; i < segmentCount; i++) {
+            if (segments[i].sequence == readSequence) {
+                index = static_cast<int>(i);
+                break;
+            }
+        }
+        size_t end = index == head ? headPosition : segmentSize;
+        SpoolRecordHeader header{};
+        if (index < 0 || readPosition + sizeof(header) > end ||
+            !flash.read(static_cast<size_t>(index) * segmentSize + readPosition, &header, sizeof(header)) ||
+            isErased(&header, sizeof(header)) || readPosition + recordSize(header.length) > end) {
+            readSequence++;
+            readPosition = SEGMENT_DATA_START;
+            continue;
+        }
+
+        size_t position = readPosition;
+        readPosition += recordSize(header.length);
+        if (header.type != SpoolRecordType::DATA || header.session != id ||
+            header.offset + header.length <= fromOffset || header.length > capacity) {
+            continue;
+        }
+        flash.read(static_cast<size_t>(index) * segmentSize + position + sizeof(header), dst, header.length);
+        if (crc32(headerCrc(header), dst, header.length) != header.crc) {
+            continue;
+        }
+        chunkOffset = header.offset;
+        readOffset = header.offset + header.length;
+        return header.length;
+    }
+    return 0;
+}
+
+void SpoolLog::prepareNextSegment() {
+    if (spare >= 0 || (head >= 0 && headPosition < segmentSize / 2)) {
+        return;
+    }
+    int index = pickFreeSegment();
+    if (index >= 0 && (segments[index].erased || eraseSegment(static_cast<size_t>(index)))) {
+        spare = index;
+    }
+}
+
+SpoolLogStats SpoolLog::getStats() const {
+    SpoolLogStats result = stats;
+    result.segments = static_cast<uint32_t>(segmentCount);
+    result.minEraseCount = UINT32_MAX;
+    for (size_t i = 0; i < segmentCount; i++) {
+        if (segments[i].sequence != 0 && !isFree(i)) {
+            result.liveSegments++;
+        }
+        result.minEraseCount = segments[i].eraseCount < result.minEraseCount ? segments[i].eraseCount : result.minEraseCount;
+        result.maxEraseCount = segments[i].eraseCount > result.maxEraseCount ? segments[i].eraseCount : result.maxEraseCount;
+    }
+    for (const SpoolSession &entry : sessions) {
+        if (entry.id != 0 && entry.ended && entry.acked < entry.written) {
+            result.pendingSessions++;
+            result.pendingBytes += entry.written - entry.acked;
+        }
+    }
+    return result;
+}
+
+bool SpoolLog::writeRecord(SpoolRecordType type, uint32_t session, uint32_t offset, const void *payload, size_t length) {
+    size_t size = recordSize(length);
+    if (length > UINT16_MAX || size > segmentSize - SEGMENT_DATA_START) {
+        return false;
+    }
+    if (head < 0 || headPosition + size > segmentSize) {
+        if (!openSegment()) {
+            return false;
+        }
+    }
+
+    SpoolRecordHeader header{type, 0, static_cast<uint16_t>(length), session, offset, 0};
+    header.crc = crc32(headerCrc(header), payload, length);
+    size_t position = static_cast<size_t>(head) * segmentSize + headPosition;
+    // Header first: a cut before the payload is complete fails the CRC and ends the segment on mount
+    bool written = flash.write(position, &header, sizeof(header)) &&
+                   (length == 0 || flash.write(position + sizeof(header), payload, length));
+    headPosition += size;
+    if (written) {
+        stats.bytesWritten += size;
+        stats.recordsWritten++;
+    }
+    return written;
+}
+
+bool SpoolLog::openSegment() {
+    int index = spare >= 0 ? spare : pickFreeSegment();
+    spare = -1;
+    if (index < 0 || (!segments[index].erased && !eraseSegment(static_cast<size_t>(index)))) {
+        return false;
+    }
+
+    uint32_t sequence = headSequence + 1;
+    uint32_t tail = tailSequence();
+    SpoolSegmentHeader header{SEGMENT_MAGIC, sequence, tail < sequence ? tail : sequence,
+                              segments[index].eraseCount, 0};
+    header.crc = segmentCrc(header);
+    if (!flash.write(static_cast<size_t>(index) * segmentSize, &header, sizeof(header))) {
+        segments[index].erased = false;
+        return false;
+    }
+    segments[index] = {sequence, header.eraseCount, false};
+    head = index;
+    headSequence = sequence;
+    headPosition = SEGMENT_DATA_START;
+    return true;
+}
+
+int SpoolLog::pickFreeSegment() const {
+    // Least-worn first, so erases spread over the whole partition
+    int best = -1;
+    for (size_t i = 0; i < segmentCount; i++) {
+        if (static_cast<int>(i) != head && isFree(i) &&
+            (best < 0 || segments[i].eraseCount < segments[static_cast<size_t>(best)].eraseCount)) {
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+
+bool SpoolLog::eraseSegment(size_t index) {
+    if (!flash.erase(index * segmentSize, segmentSize)) {
+        return false;
+    }
+    segments[index].sequence = 0;
+    segments[index].eraseCount++;
+    segments[index].erased = true;
+    stats.erases++;
+    return true;
+}
+
+uint32_t SpoolLog::tailSequence() const {
+    uint32_t tail = UINT32_MAX;
+    for (const SpoolSession &entry : sessions) {
+        if (entry.id != 0 && entry.firstSegment < tail) {
+            tail = entry.firstSegment;
+        }
+    }
+    return tail;
+}
+
+bool SpoolLog::isFree(size_t index) const {
+    if (static_cast<int>(index) == head) {
+        return false;
+    }
+    uint32_t tail = tailSequence();
+    return segments[index].sequence == 0 || segments[index].sequence < (tail < headSequence ? tail : headSequence);
+}
+
+void SpoolLog::applyRecord(const SpoolRecordHeader &header, const uint8_t *payload, uint32_t segmentSequence) {
+    lastSession = header.session > lastSession ? header.session : lastSession;
+    SpoolSession *entry = session(header.session);
+
+    switch (header.type) {
+        case SpoolRecordType::BEGIN:
+            if (entry == nullptr && (entry = session(0)) != nullptr) {
+                SpoolBegin format{};
+                memcpy(&format, payload, sizeof(format));
+                *entry = {header.session, format, segmentSequence, 0, 0, false, false};
+            }
+            break;
+        case SpoolRecordType::DATA:
+            if (entry != nullptr && header.offset + header.length > entry->written) {
+                entry->written = header.offset + header.length;
+            }
+            break;
+        case SpoolRecordType::END:
+            if (entry != nullptr) {
+                entry->ended = true;
+            }
+            break;
+        case SpoolRecordType::ACK:
+            if (entry != nullptr && header.offset > entry->acked) {
+                entry->acked = header.offset;
+            }
+            break;
+    }
+}
+
+SpoolSession *SpoolLog::session(uint32_t id) {
+    for (SpoolSession &entry : sessions) {
+        if (entry.id == id) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void SpoolLog::dropCompleted() {
+    for (SpoolSession &entry : sessions) {
+        if (entry.id != 0 && entry.ended && entry.acked >= entry.written) {
+            entry.id = 0;
+        }
+    }
+}
@@ -133,14 +133,14 @@ void UI::handleKeyPress(char key) {
             break;
         case UIState::RECORDING_AUDIO:
             if (key == '1') {
-                eventDispatcher->dispatchEvent({CMD_ESP_AUDIO, "stop_recording"});
+                eventDispatcher->post({CMD_ESP_AUDIO, "stop_recording"});
                 vTaskDelay(pdMS_TO_TICKS(1000)); // Wait for one second
                 setState(UIState::MENU_NOTIFY_OWNER); // Go back to the menu
             }
             break;
         case UIState::PLAYING_AUDIO:
             if (key == '1') {
-                eventDispatcher->dispatchEvent({CMD_ESP_AUDIO, "stop_playing"});
+                eventDispatcher->post({CMD_ESP_AUDIO, "stop_playing"});
                 vTaskDelay(pdMS_TO_TICKS(1000)); // Wait for one second
                 setState(UIState::MENU_NOTIFY_OWNER); // Go back to the menu
             }
@@ -176,18 +176,18 @@ void UI::handleMenuKeyPress(char key) {
             switch (currentState) {
                 case UIState::MENU_NOTIFY_OWNER:
                     setState(UIState::OWNER_NOTIFIED);
-                    eventDispatcher->dispatchEvent({PERSON_DETECTED, ""});
+                    eventDispatcher->post({PERSON_DETECTED, ""});
                     break;
                 case UIState::MENU_ENTER_PASSWORD:
                     setState(UIState::ENTER_PASSWORD);
                     break;
                 case UIState::MENU_RECORD_AUDIO:
                     setState(UIState::RECORDING_AUDIO);
-                    eventDispatcher->dispatchEvent({CMD_ESP_AUDIO, "start_recording"});
+                    eventDispatcher->post({CMD_ESP_AUDIO, "start_recording"});
                     break;
                 case UIState::MENU_PLAY_AUDIO:
                     setState(UIState::PLAYING_AUDIO);
-                    eventDispatcher->dispatchEvent({CMD_ESP_AUDIO, "start_playing"});
+                    eventDispatcher->post({CMD_ESP_AUDIO, "start_playing"});
                     break;
             }
             break;
@@ -210,7 +210,7 @@ void UI::handlePasswordKeyPress(char key) {
     } else if (key == '9') {
         enteringPassword = false;
         bool passwordCorrect = (strcmp(enteredPassword, correctPassword) == 0);
-        eventDispatcher->dispatchEvent({passwordCorrect ? PASSWORD_VALID : PASSWORD_INVALID, ""});
+        eventDispatcher->post({passwordCorrect ? PASSWORD_VALID : PASSWORD_INVALID, ""});
         setState(passwordCorrect ? UIState::PASSWORD_CORRECT : UIState::PASSWORD_INCORRECT);
         passwordIndex = 0;
         memset(enteredPassword, 0, sizeof(enteredPassword));
@@ -0,0 +1,93 @@
+#include "upload_pacer.h"
+
+constexpr size_t UploadPacer::INITIAL_WINDOW;
+
+UploadPacer::UploadPacer(uint32_t maxChunks, size_t minChunk, uint32_t stallMicros)
+        : maxChunks(maxChunks), minChunk(minChunk), stallMicros(stallMicros), minWindow(2 * minChunk),
+          maxWindow(maxChunks * POOL_CHUNK_SIZE) {}
+
+void UploadPacer::reset(uint32_t now) {
+    inFlightBytes = 0;
+    inFlightChunks = 0;
+    recoveryBytes = 0;
+    holding = false;
+    startedAt = now;
+    stats = {};
+    stats.window = window;
+    stats.minWindow = window;
+}
+
+size_t UploadPacer::chunkBytes() const {
+    size_t bytes = window / 2;
+    if (bytes < minChunk) {
+        return minChunk;
+    }
+    return bytes < POOL_CHUNK_SIZE ? bytes : POOL_CHUNK_SIZE;
+}
+
+bool UploadPacer::canPost(uint32_t now) const {
+    if (holding && static_cast<int32_t>(now - holdUntil) < 0) {
+        return false;
+    }
+    if (inFlightChunks >= maxChunks) {
+        return false;
+    }
+    // An empty pipe always takes one chunk, so a window smaller than a chunk cannot stall the upload
+    return inFlightChunks == 0 || inFlightBytes + chunkBytes() <= window;
+}
+
+void UploadPacer::posted(size_t bytes) {
+    inFlightBytes += bytes;
+    inFlightChunks++;
+    stats.postedChunks++;
+    stats.queueDepthSum += inFlightChunks;
+    if (inFlightChunks > stats.maxQueueDepth) {
+        stats.maxQueueDepth = inFlightChunks;
+    }
+}
+
+void UploadPacer::withdraw(size_t bytes) {
+    stats.queueDepthSum -= inFlightChunks;
+    stats.postedChunks--;
+    inFlightBytes -= bytes;
+    inFlightChunks--;
+}
+
+void UploadPacer::sent(size_t bytes, uint32_t writeMicros, bool ok, uint32_t now) {
+    inFlightBytes -= bytes < inFlightBytes ? bytes : inFlightBytes;
+    if (inFlightChunks > 0) {
+        inFlightChunks--;
+    }
+    if (!ok) {
+        stats.chunksFailed++; // The socket is down, which says nothing about congestion
+        return;
+    }
+
+    stats.bytesSent += bytes;
+    stats.chunksSent++;
+    uint32_t elapsed = now - startedAt;
+    if (elapsed > 0) {
+        stats.goodputBps = static_cast<uint32_t>(stats.bytesSent * 1000000 / elapsed);
+    }
+    recoveryBytes -= bytes < recoveryBytes ? bytes : recoveryBytes;
+
+    if (writeMicros >= stallMicros) {
+        stats.stalls++;
+        stats.stallMicros += writeMicros;
+        holding = true;
+        holdUntil = now + writeMicros / 2;
+        if (recoveryBytes == 0) {
+            // Chunks already queued were posted under the old window; only the first stall among them counts
+            window = window / 2 > minWindow ? window / 2 : minWindow;
+            recoveryBytes = inFlightBytes;
+        }
+    } else if (recoveryBytes == 0) {
+        window += POOL_CHUNK_SIZE * bytes / window;
+        window = window < maxWindow ? window : maxWindow;
+    }
+
+    stats.window = window;
+    if (window < stats.minWindow) {
+        stats.minWindow = window;
+    }
+}
@@ -0,0 +1,81 @@
+#include "vad.h"
+
+bool VoiceActivityDetector::process(const int16_t *samples, size_t count) {
+    if (count == 0) {
+        return false;
+    }
+
+    int32_t sum = 0;
+    uint32_t magnitude = 0;
+    uint32_t crossings = 0;
+    bool wasPositive = samples[0] >= dcOffset;
+    for (size_t i = 0; i < count; i++) {
+        int32_t sample = samples[i];
+        int32_t centred = sample - dcOffset;
+        bool positive = centred >= 0;
+        sum += sample;
+        magnitude += positive ? centred : -centred;
+        crossings += positive != wasPositive;
+        wasPositive = positive;
+    }
+
+    // Follow the bias slowly so speech itself barely moves it
+    dcOffset += (sum / static_cast<int32_t>(count) - dcOffset) / 8;
+
+    uint32_t energy = magnitude / count;
+    uint32_t zcr = crossings * 100 / count;
+    return energy >= config.energyThreshold ||
+           (energy >= config.energyThreshold / 4u && zcr >= config.zcrThreshold);
+}
+
+void SilenceTrimmer::start(bool keepEverything) {
+    vad.reset();
+    vadStats = {};
+    speech = keepEverything;
+    silentBytes = 0;
+    speechEndIndex = 0;
+    recording = true;
+}
+
+TrimVerdict SilenceTrimmer::frame(const int16_t *samples, size_t bytes, size_t recorded) {
+    if (vad.process(samples, bytes / sizeof(int16_t))) {
+        vadStats.speechFrames++;
+        speech = true;
+        silentBytes = 0;
+        speechEndIndex = recorded + bytes;
+        return {true, false};
+    }
+
+    vadStats.silentFrames++;
+    silentBytes += bytes;
+    TrimVerdict verdict = {true, false};
+    if (speech && config.maxPauseBytes > 0 && silentBytes > config.maxPauseBytes) {
+        vadStats.trimmedBytes += bytes; // Collapsed pause
+        verdict.keep = false;
+    }
+    if (config.autoStopBytes > 0 && silentBytes >= config.autoStopBytes && !vadStats.autoStopped) {
+        vadStats.autoStopped = true;
+        verdict.autoStop = true;
+    }
+    return verdict;
+}
+
+size_t SilenceTrimmer::leadingDrop(size_t recorded, size_t stored) {
+    if (speech || recorded < 2 * config.prerollBytes || stored == 0) {
+        return 0;
+    }
+    size_t dropped = recorded - config.prerollBytes;
+    dropped = dropped < stored ? dropped : stored;
+    vadStats.trimmedBytes += dropped;
+    return dropped;
+}
+
+size_t SilenceTrimmer::trailingEnd(size_t recorded, size_t uploaded) {
+    size_t end = speech ? speechEndIndex + config.hangoverBytes : 0;
+    end = end < uploaded ? uploaded : end;
+    if (end >= recorded) {
+        return recorded;
+    }
+    vadStats.trimmedBytes += recorded - end;
+    return end;
+}
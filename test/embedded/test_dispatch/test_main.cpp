@@ -0,0 +1,117 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <functional>
+#include <vector>
+#include "events.h"
+
+// Types the firmware uses, so subscribers spread the way they do in the app
+static constexpr EventType EVENT_TYPES = DISPLAY_READY + 1;
+static constexpr uint32_t DISPATCHES = 4000;
+
+// The dispatch this replaced: one vector of every subscription, scanned in full for each event
+struct LinearDispatcher {
+    struct Entry {
+        EventType type;
+        std::function<void(const Event &)> callback;
+    };
+
+    std::vector<Entry> callbacks;
+
+    void dispatchEvent(const Event &event) {
+        for (const auto &entry: callbacks) {
+            if (entry.type == event.type) {
+                entry.callback(event);
+            }
+        }
+    }
+};
+
+struct Counter {
+    uint32_t *count;
+    uint32_t id; // Makes each subscriber a distinct callback
+
+    void operator()(const Event &) const { (*count)++; }
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_duplicate_and_unregister() {
+    EventDispatcher dispatcher(4);
+    uint32_t count = 0;
+    EventCallback first = Counter{&count, 1};
+    EventCallback second = Counter{&count, 2};
+
+    TEST_ASSERT_TRUE(dispatcher.registerCallback(GATE_OPENED, first));
+    TEST_ASSERT_FALSE(dispatcher.registerCallback(GATE_OPENED, first));
+    TEST_ASSERT_TRUE(dispatcher.registerCallback(GATE_OPENED, second));
+    dispatcher.dispatchEvent(Event(GATE_OPENED));
+    TEST_ASSERT_EQUAL_UINT32(2, count);
+
+    TEST_ASSERT_TRUE(dispatcher.unregisterCallback(GATE_OPENED, first));
+    TEST_ASSERT_FALSE(dispatcher.unregisterCallback(GATE_OPENED, first));
+    dispatcher.dispatchEvent(Event(GATE_OPENED));
+    TEST_ASSERT_EQUAL_UINT32(3, count);
+
+    // The freed slot is reused by the same type rather than taking a new one
+    TEST_ASSERT_TRUE(dispatcher.registerCallback(GATE_OPENED, first));
+    TEST_ASSERT_TRUE(dispatcher.registerCallback(GATE_CLOSED, first));
+    TEST_ASSERT_TRUE(dispatcher.registerCallback(LED_TURNED_ON, first));
+    TEST_ASSERT_FALSE(dispatcher.registerCallback(LED_TURNED_OFF, first)); // All 4 slots taken
+}
+
+static void benchmark(size_t subscribers) {
+    std::unique_ptr<EventDispatcher> indexed(new EventDispatcher(subscribers));
+    LinearDispatcher linear;
+    uint32_t indexedCalls = 0;
+    uint32_t linearCalls = 0;
+    EventType types = subscribers < EVENT_TYPES ? subscribers : EVENT_TYPES;
+    for (size_t i = 0; i < subscribers; i++) {
+        auto type = static_cast<EventType>(i % types);
+        TEST_ASSERT_TRUE(indexed->registerCallback(type, Counter{&indexedCalls, static_cast<uint32_t>(i)}));
+        linear.callbacks.push_back({type, Counter{&linearCalls, static_cast<uint32_t>(i)}});
+    }
+
+    uint32_t start = micros();
+    for (uint32_t i = 0; i < DISPATCHES; i++) {
+        indexed->dispatchEvent(Event(static_cast<EventType>(i % types)));
+    }
+    uint32_t indexedMicros = micros() - start;
+
+    start = micros();
+    for (uint32_t i = 0; i < DISPATCHES; i++) {
+        linear.dispatchEvent(Event(static_cast<EventType>(i % types)));
+    }
+    uint32_t linearMicros = micros() - start;
+
+    TEST_ASSERT_EQUAL_UINT32(linearCalls, indexedCalls);
+    char line[128];
+    snprintf(line, sizeof(line), "%u subscribers: indexed %u ns/dispatch, linear scan %u ns/dispatch",
+             static_cast<unsigned>(subscribers), indexedMicros * 1000 / DISPATCHES, linearMicros * 1000 / DISPATCHES);
+    TEST_MESSAGE(line);
+}
+
+static void test_dispatch_30() {
+    benchmark(30);
+}
+
+static void test_dispatch_128() {
+    benchmark(128);
+}
+
+static void test_dispatch_1000() {
+    benchmark(1000);
+}
+
+void setup() {
+    delay(2000); // Lets the test runner attach to the serial port
+    UNITY_BEGIN();
+    RUN_TEST(test_duplicate_and_unregister);
+    RUN_TEST(test_dispatch_30);
+    RUN_TEST(test_dispatch_128);
+    RUN_TEST(test_dispatch_1000);
+    UNITY_END();
+}
+
+void loop() {}
@@ -0,0 +1,124 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "config.h"
+#include "pcm_convert.h"
+#include "../../test_random.h"
+
+static constexpr size_t BLOCK_SAMPLES = 512; // One capture DMA buffer
+static constexpr uint32_t PASSES = 2000;
+
+// Room for every head alignment in front of a full block, plus a guard on each side
+static int16_t input[BLOCK_SAMPLES + 32] __attribute__((aligned(16)));
+static int16_t scalar[BLOCK_SAMPLES + 32] __attribute__((aligned(16)));
+static int16_t pie[BLOCK_SAMPLES + 32] __attribute__((aligned(16)));
+
+// Mostly full-scale noise, with runs pinned at the rails so both saturation points are exercised
+static void fillInput() {
+    for (size_t i = 0; i < sizeof(input) / sizeof(input[0]); i++) {
+        uint32_t r = nextRandom();
+        input[i] = (r & 0x700) == 0 ? (r & 1 ? INT16_MAX : INT16_MIN) : static_cast<int16_t>(r >> 16);
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+static void compare(size_t start, size_t count, int16_t offset, int16_t gain) {
+    memcpy(scalar, input, sizeof(input));
+    memcpy(pie, input, sizeof(input));
+    PcmConvert::removeDcAndGainScalar(scalar + start, count, offset, gain);
+    PcmConvert::removeDcAndGainPie(pie + start, count, offset, gain);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(scalar, pie, sizeof(input) / sizeof(input[0])); // Guards included
+}
+
+static void test_pie_matches_scalar_bit_for_bit() {
+    static const int16_t offsets[] = {0, 1, -1, 300, -2048, INT16_MAX, INT16_MIN};
+    static const int16_t gains[] = {PCM_UNITY_GAIN, 0, 1, 255, 257, 1024, 4096, INT16_MAX, -256, INT16_MIN};
+    for (int16_t offset: offsets) {
+        for (int16_t gain: gains) {
+            fillInput();
+            for (size_t start = 0; start < 16; start++) {
+                for (size_t count: {size_t(0), size_t(1), size_t(7), size_t(8), size_t(9), size_t(23), BLOCK_SAMPLES}) {
+                    compare(start, count, offset, gain);
+                }
+            }
+        }
+    }
+    for (uint32_t i = 0; i < 500; i++) {
+        fillInput();
+        compare(nextRandom() % 16, nextRandom() % (BLOCK_SAMPLES + 1), static_cast<int16_t>(nextRandom()),
+                static_cast<int16_t>(nextRandom()));
+    }
+}
+#endif
+
+static unsigned ksamplesPerSecond(uint32_t micros) {
+    return static_cast<unsigned>(PASSES * BLOCK_SAMPLES * 1000ull / (micros ? micros : 1));
+}
+
+// Every kernel over one capture DMA buffer per pass, as the audio task calls them
+static void test_throughput() {
+    static int32_t slots[2 * BLOCK_SAMPLES];
+    for (int32_t &slot: slots) {
+        slot = static_cast<int32_t>(nextRandom());
+    }
+    fillInput();
+    volatile int32_t sink = 0;
+
+    uint32_t start = micros();
+    for (uint32_t i = 0; i < PASSES; i++) {
+        PcmConvert::narrow32(slots, scalar, BLOCK_SAMPLES, MIC_SAMPLE_SHIFT);
+    }
+    uint32_t monoMicros = micros() - start;
+
+    start = micros();
+    for (uint32_t i = 0; i < PASSES; i++) {
+        PcmConvert::narrow32(slots, scalar, BLOCK_SAMPLES, MIC_SAMPLE_SHIFT, 2, 1);
+    }
+    uint32_t stereoMicros = micros() - start;
+
+    start = micros();
+    for (uint32_t i = 0; i < PASSES; i++) {
+        sink = sink + PcmConvert::mean(input, BLOCK_SAMPLES);
+    }
+    uint32_t meanMicros = micros() - start;
+
+    start = micros();
+    for (uint32_t i = 0; i < PASSES; i++) {
+        PcmConvert::removeDcAndGainScalar(scalar, BLOCK_SAMPLES, 300, MIC_GAIN);
+    }
+    uint32_t scalarMicros = micros() - start;
+
+    char line[160];
+    snprintf(line, sizeof(line), "ksamples/s: narrow32 mono %u, narrow32 stereo->mono %u, mean %u",
+             ksamplesPerSecond(monoMicros), ksamplesPerSecond(stereoMicros), ksamplesPerSecond(meanMicros));
+    TEST_MESSAGE(line);
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+    start = micros();
+    for (uint32_t i = 0; i < PASSES; i++) {
+        PcmConvert::removeDcAndGainPie(pie, BLOCK_SAMPLES, 300, MIC_GAIN);
+    }
+    uint32_t pieMicros = micros() - start;
+    snprintf(line, sizeof(line), "removeDcAndGain: scalar %u ksamples/s, PIE %u ksamples/s",
+             ksamplesPerSecond(scalarMicros), ksamplesPerSecond(pieMicros));
+#else
+    snprintf(line, sizeof(line), "removeDcAndGain: scalar %u ksamples/s, no PIE on this target",
+             ksamplesPerSecond(scalarMicros));
+#endif
+    TEST_MESSAGE(line);
+}
+
+void setup() {
+    delay(2000); // Lets the test runner attach to the serial port
+    seedRandom(12345);
+    UNITY_BEGIN();
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+    RUN_TEST(test_pie_matches_scalar_bit_for_bit);
+#endif
+    RUN_TEST(test_throughput);
+    UNITY_END();
+}
+
+void loop() {}
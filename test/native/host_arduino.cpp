@@ -0,0 +1,104 @@
+// Arduino core, FreeRTOS tasks and semaphores, and logger for host tests, see test/native/shim
+#include <Arduino.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <thread>
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "logger.h"
+
+static const auto start = std::chrono::steady_clock::now();
+
+uint32_t millis() {
+    return static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+uint32_t micros() {
+    return static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void *ps_malloc(size_t size) {
+    return malloc(size);
+}
+
+struct HostSemaphore {
+    std::mutex mutex;
+    std::condition_variable available;
+    UBaseType_t count;
+    UBaseType_t maxCount;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+    auto *semaphore = new HostSemaphore();
+    semaphore->count = initialCount;
+    semaphore->maxCount = maxCount;
+    return semaphore;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> guard(semaphore->mutex);
+    if (semaphore->count == semaphore->maxCount) {
+        return pdFALSE;
+    }
+    semaphore->count++;
+    semaphore->available.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higherPriorityTaskWoken) {
+    if (higherPriorityTaskWoken != nullptr) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+    return xSemaphoreGive(semaphore);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait) {
+    std::unique_lock<std::mutex> guard(semaphore->mutex);
+    auto counted = [semaphore]() { return semaphore->count > 0; };
+    if (ticksToWait == portMAX_DELAY) {
+        semaphore->available.wait(guard, counted);
+    } else if (!semaphore->available.wait_for(guard, std::chrono::milliseconds(ticksToWait * portTICK_PERIOD_MS), counted)) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *createdTask, BaseType_t core) {
+    std::thread(function, parameter).detach();
+    if (createdTask != nullptr) {
+        *createdTask = nullptr;
+    }
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+// Quiet unless a test raises the level
+LogLevel Logger::currentLogLevel = LOG_NONE;
+
+Logger logger;
+
+Logger::Logger() : mqttLogger(nullptr), mqttInitialized(false) {}
+
+void Logger::log(LogLevel level, const char *tag, const char *format, ...) {
+    if (level > currentLogLevel) {
+        return;
+    }
+    char line[LOG_BUFFER_SIZE]; // Not logBuffer: host tests log from several threads at once
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    printf("[%s] %s\n", tag, line);
+}
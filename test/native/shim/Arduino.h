@@ -0,0 +1,24 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// The part of the Arduino core the firmware modules built for host tests use, implemented in
+// test/native/host_arduino.cpp
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "freertos/FreeRTOS.h"
+
+#define IRAM_ATTR
+
+// 32 bits wide, as on the ESP32, so wraparound behaves the same
+uint32_t millis();
+
+uint32_t micros();
+
+void delay(uint32_t ms);
+
+void *ps_malloc(size_t size);
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,7 @@
+#ifndef HOST_MQTT_LOGGER_H
+#define HOST_MQTT_LOGGER_H
+
+// Host tests log to nowhere; logger.h only needs the name
+class MqttLogger;
+
+#endif // HOST_MQTT_LOGGER_H
@@ -0,0 +1,6 @@
+#ifndef HOST_PUBSUBCLIENT_H
+#define HOST_PUBSUBCLIENT_H
+
+class PubSubClient;
+
+#endif // HOST_PUBSUBCLIENT_H
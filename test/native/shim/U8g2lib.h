@@ -0,0 +1,6 @@
+#ifndef HOST_U8G2LIB_H
+#define HOST_U8G2LIB_H
+
+// config.h includes the display library; nothing built for host tests draws
+
+#endif // HOST_U8G2LIB_H
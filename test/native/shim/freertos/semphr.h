@@ -0,0 +1,18 @@
+#ifndef HOST_SEMPHR_H
+#define HOST_SEMPHR_H
+
+// Counting semaphores for host tests, a mutex and condition variable each
+#include "freertos/FreeRTOS.h"
+
+typedef struct HostSemaphore *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount);
+
+// Fails once the count is at maxCount, as on the device
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higherPriorityTaskWoken);
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait);
+
+#endif // HOST_SEMPHR_H
@@ -0,0 +1,16 @@
+#ifndef HOST_TASK_H
+#define HOST_TASK_H
+
+// Tasks for host tests. Each is a detached thread that runs until the test exits; priority and core are
+// ignored, so tasks only run side by side rather than preempt one another.
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *createdTask, BaseType_t core);
+
+void vTaskDelay(TickType_t ticks);
+
+#endif // HOST_TASK_H
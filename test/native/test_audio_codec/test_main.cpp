@@ -0,0 +1,175 @@
+#include <unity.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "audio_codec.h"
+
+static constexpr size_t CHUNK_SAMPLES = 320; // One intercom frame
+static constexpr size_t CHUNKS = 50;
+
+static std::vector<int16_t> sine(size_t samples, double hertz, double amplitude) {
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = static_cast<int16_t>(lround(amplitude * sin(2 * M_PI * hertz * i / 16000)));
+    }
+    return pcm;
+}
+
+// Encodes pcm as a stream of chunks, then decodes each chunk on its own the way the receivers do
+static void roundTrip(AudioCodecType type, const std::vector<int16_t> &pcm, size_t chunkSamples, std::vector<int16_t> &decoded) {
+    decoded.clear();
+    std::vector<uint8_t> encoded(AudioCodec::encodedSize(type, chunkSamples));
+    std::vector<int16_t> out(chunkSamples);
+    AdpcmState state;
+    for (size_t start = 0; start < pcm.size(); start += chunkSamples) {
+        size_t samples = pcm.size() - start < chunkSamples ? pcm.size() - start : chunkSamples;
+        size_t length = AudioCodec::encode(type, pcm.data() + start, samples, encoded.data(), state);
+        TEST_ASSERT_EQUAL(AudioCodec::encodedSize(type, samples), length);
+        AudioChunkDecoder decoder(type, encoded.data(), length);
+        TEST_ASSERT_EQUAL(samples, decoder.remainingSamples());
+        TEST_ASSERT_EQUAL(samples, decoder.decode(out.data(), out.size()));
+        decoded.insert(decoded.end(), out.begin(), out.begin() + samples);
+    }
+}
+
+// Signal to noise ratio in dB over [from, to)
+static double snr(const std::vector<int16_t> &reference, const std::vector<int16_t> &decoded, size_t from, size_t to) {
+    double signal = 0;
+    double noise = 0;
+    for (size_t i = from; i < to; i++) {
+        double error = static_cast<double>(reference[i]) - decoded[i];
+        signal += static_cast<double>(reference[i]) * reference[i];
+        noise += error * error;
+    }
+    return 10 * log10(signal / (noise > 0 ? noise : 1));
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_pcm16_is_lossless() {
+    std::vector<int16_t> pcm = sine(CHUNK_SAMPLES * 4 + 7, 440, 20000);
+    std::vector<int16_t> decoded;
+    roundTrip(AudioCodecType::PCM16, pcm, CHUNK_SAMPLES, decoded);
+    TEST_ASSERT_TRUE(decoded == pcm);
+}
+
+static void test_mulaw_error_stays_within_its_segment() {
+    for (int32_t value = INT16_MIN; value <= INT16_MAX; value++) {
+        int32_t decoded = AudioCodec::decodeMulaw(AudioCodec::encodeMulaw(static_cast<int16_t>(value)));
+        int32_t magnitude = value < 0 ? -value : value;
+        int32_t bound = magnitude > 32635 ? magnitude - 32124 : (magnitude + 0x84) / 16 + 8;
+        TEST_ASSERT_LESS_OR_EQUAL(bound, std::abs(decoded - value));
+    }
+
+    std::vector<int16_t> pcm = sine(CHUNK_SAMPLES * CHUNKS, 440, 20000);
+    std::vector<int16_t> decoded;
+    roundTrip(AudioCodecType::MULAW, pcm, CHUNK_SAMPLES, decoded);
+    TEST_ASSERT_GREATER_THAN_FLOAT(35.0f, snr(pcm, decoded, 0, pcm.size()));
+}
+
+static void test_adpcm_stream_has_no_chunk_boundary_clicks() {
+    std::vector<int16_t> pcm = sine(CHUNK_SAMPLES * CHUNKS, 440, 20000);
+    std::vector<int16_t> decoded;
+    roundTrip(AudioCodecType::IMA_ADPCM, pcm, CHUNK_SAMPLES, decoded);
+    TEST_ASSERT_EQUAL(pcm.size(), decoded.size());
+
+    // Past the first chunk, where the step size adapts from rest, every boundary is as clean as the chunk body
+    double overall = snr(pcm, decoded, CHUNK_SAMPLES, pcm.size());
+    TEST_ASSERT_GREATER_THAN_FLOAT(35.0f, overall);
+    for (size_t chunk = 1; chunk < CHUNKS; chunk++) {
+        size_t boundary = chunk * CHUNK_SAMPLES;
+        for (size_t i = boundary; i < boundary + 8; i++) {
+            TEST_ASSERT_LESS_THAN(500, std::abs(pcm[i] - decoded[i]));
+        }
+    }
+
+    char line[96];
+    snprintf(line, sizeof(line), "ima_adpcm 440 Hz sine: %.1f dB SNR", overall);
+    TEST_MESSAGE(line);
+}
+
+static void test_adpcm_chunk_decodes_without_the_ones_before_it() {
+    std::vector<int16_t> pcm = sine(CHUNK_SAMPLES * 3, 1000, 12000);
+    std::vector<uint8_t> chunks[3];
+    AdpcmState state;
+    for (size_t i = 0; i < 3; i++) {
+        chunks[i].resize(AudioCodec::encodedSize(AudioCodecType::IMA_ADPCM, CHUNK_SAMPLES));
+        AudioCodec::encode(AudioCodecType::IMA_ADPCM, pcm.data() + i * CHUNK_SAMPLES, CHUNK_SAMPLES, chunks[i].data(), state);
+    }
+    std::vector<int16_t> inOrder;
+    roundTrip(AudioCodecType::IMA_ADPCM, pcm, CHUNK_SAMPLES, inOrder);
+
+    // The third chunk alone, as if the second had been lost
+    std::vector<int16_t> out(CHUNK_SAMPLES);
+    AudioChunkDecoder decoder(AudioCodecType::IMA_ADPCM, chunks[2].data(), chunks[2].size());
+    decoder.decode(out.data(), out.size());
+    TEST_ASSERT_EQUAL_INT16_ARRAY(inOrder.data() + 2 * CHUNK_SAMPLES, out.data(), CHUNK_SAMPLES);
+}
+
+static void test_adpcm_odd_counts_keep_their_length() {
+    std::vector<int16_t> decoded;
+    for (size_t samples: {1, 5, 319, 321}) {
+        roundTrip(AudioCodecType::IMA_ADPCM, sine(samples, 700, 8000), samples, decoded);
+        TEST_ASSERT_EQUAL(samples, decoded.size());
+    }
+
+    // Decoded in pieces, as into a ring buffer at its wrap point
+    std::vector<int16_t> pcm = sine(5, 700, 8000);
+    std::vector<uint8_t> encoded(AudioCodec::encodedSize(AudioCodecType::IMA_ADPCM, 5));
+    AdpcmState state;
+    AudioCodec::encode(AudioCodecType::IMA_ADPCM, pcm.data(), 5, encoded.data(), state);
+    AudioChunkDecoder decoder(AudioCodecType::IMA_ADPCM, encoded.data(), encoded.size());
+    int16_t out[8];
+    TEST_ASSERT_EQUAL(3, decoder.decode(out, 3));
+    TEST_ASSERT_EQUAL(2, decoder.decode(out + 3, 8));
+    TEST_ASSERT_EQUAL(0, decoder.remainingSamples());
+}
+
+static void benchmark(AudioCodecType type) {
+    std::vector<int16_t> pcm = sine(CHUNK_SAMPLES * 500, 440, 20000);
+    std::vector<uint8_t> encoded(AudioCodec::encodedSize(type, CHUNK_SAMPLES));
+    std::vector<int16_t> out(CHUNK_SAMPLES);
+    AdpcmState state;
+    uint32_t checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < pcm.size(); i += CHUNK_SAMPLES) {
+        AudioCodec::encode(type, pcm.data() + i, CHUNK_SAMPLES, encoded.data(), state);
+        checksum += encoded[encoded.size() - 1];
+    }
+    auto encodeNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < pcm.size(); i += CHUNK_SAMPLES) {
+        AudioChunkDecoder decoder(type, encoded.data(), encoded.size());
+        decoder.decode(out.data(), out.size());
+        checksum += out[CHUNK_SAMPLES - 1];
+    }
+    auto decodeNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    char line[128];
+    snprintf(line, sizeof(line), "%s: encode %.2f ns/sample, decode %.2f ns/sample (checksum %u)", AudioCodec::name(type),
+             static_cast<double>(encodeNanos) / pcm.size(), static_cast<double>(decodeNanos) / pcm.size(), checksum);
+    TEST_MESSAGE(line);
+}
+
+static void test_codec_throughput() {
+    benchmark(AudioCodecType::PCM16);
+    benchmark(AudioCodecType::MULAW);
+    benchmark(AudioCodecType::IMA_ADPCM);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_pcm16_is_lossless);
+    RUN_TEST(test_mulaw_error_stays_within_its_segment);
+    RUN_TEST(test_adpcm_stream_has_no_chunk_boundary_clicks);
+    RUN_TEST(test_adpcm_chunk_decodes_without_the_ones_before_it);
+    RUN_TEST(test_adpcm_odd_counts_keep_their_length);
+    RUN_TEST(test_codec_throughput);
+    return UNITY_END();
+}
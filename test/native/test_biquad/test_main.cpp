@@ -0,0 +1,208 @@
+#include <unity.h>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <vector>
+#include "biquad.h"
+
+static constexpr double SAMPLE_RATE = 16000;
+static constexpr size_t BLOCK_SAMPLES = 512;
+
+// The capture chain with config.h's defaults; config.h itself needs Arduino
+static constexpr BiquadCoefficients CAPTURE_FILTER[] = {
+        Biquad::highPass(SAMPLE_RATE, 100, 0.7071),
+        Biquad::peaking(SAMPLE_RATE, 3000, 1.0, 4),
+};
+static constexpr size_t CAPTURE_STAGES = sizeof(CAPTURE_FILTER) / sizeof(CAPTURE_FILTER[0]);
+
+static double fromFixed(int32_t value) {
+    return static_cast<double>(value) / (1 << BIQUAD_FRACTION_BITS);
+}
+
+// Response of the quantised chain at frequency, in dB
+static double designResponse(const BiquadCoefficients *stages, size_t count, double frequency) {
+    std::complex<double> z1 = std::polar(1.0, -2 * M_PI * frequency / SAMPLE_RATE);
+    std::complex<double> z2 = z1 * z1;
+    std::complex<double> response = 1;
+    for (size_t s = 0; s < count; s++) {
+        const BiquadCoefficients &c = stages[s];
+        response *= (fromFixed(c.b0) + fromFixed(c.b1) * z1 + fromFixed(c.b2) * z2) /
+                    (1.0 + fromFixed(c.a1) * z1 + fromFixed(c.a2) * z2);
+    }
+    return 20 * log10(std::abs(response));
+}
+
+// Gain the fixed-point chain applies to a sine, measured once the filter has settled
+static double measuredResponse(double frequency, double amplitude) {
+    BiquadChain chain(CAPTURE_FILTER, CAPTURE_STAGES);
+    std::vector<int16_t> block(BLOCK_SAMPLES);
+    double in = 0;
+    double out = 0;
+    size_t n = 0;
+    for (size_t b = 0; b < 64; b++) {
+        std::vector<double> input(BLOCK_SAMPLES);
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++, n++) {
+            input[i] = amplitude * sin(2 * M_PI * frequency * n / SAMPLE_RATE);
+            block[i] = static_cast<int16_t>(lround(input[i]));
+        }
+        chain.process(block.data(), block.size());
+        if (b >= 32) {
+            for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+                in += input[i] * input[i];
+                out += static_cast<double>(block[i]) * block[i];
+            }
+        }
+    }
+    return 10 * log10(out / in);
+}
+
+// The same cascade in double precision, as a float implementation would run it
+struct FloatChain {
+    struct Stage {
+        double b0, b1, b2, a1, a2;
+        double x1, x2, y1, y2;
+    };
+
+    std::vector<Stage> stages;
+
+    FloatChain(const BiquadCoefficients *coefficients, size_t count) {
+        for (size_t s = 0; s < count; s++) {
+            const BiquadCoefficients &c = coefficients[s];
+            stages.push_back({fromFixed(c.b0), fromFixed(c.b1), fromFixed(c.b2), fromFixed(c.a1), fromFixed(c.a2), 0, 0, 0, 0});
+        }
+    }
+
+    void process(float *samples, size_t count) {
+        for (Stage &st: stages) {
+            for (size_t i = 0; i < count; i++) {
+                double x = samples[i];
+                double y = st.b0 * x + st.b1 * st.x1 + st.b2 * st.x2 - st.a1 * st.y1 - st.a2 * st.y2;
+                st.x2 = st.x1;
+                st.x1 = x;
+                st.y2 = st.y1;
+                st.y1 = y;
+                samples[i] = static_cast<float>(y);
+            }
+        }
+    }
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_compile_time_designs_match_cmath() {
+    double w = 2 * M_PI * 100 / SAMPLE_RATE;
+    double alpha = sin(w) / (2 * 0.7071);
+    double a0 = 1 + alpha;
+    const BiquadCoefficients &hp = CAPTURE_FILTER[0];
+    TEST_ASSERT_INT_WITHIN(1, lround((1 + cos(w)) / 2 / a0 * 16384), hp.b0);
+    TEST_ASSERT_INT_WITHIN(1, lround(-(1 + cos(w)) / a0 * 16384), hp.b1);
+    TEST_ASSERT_INT_WITHIN(1, lround(-2 * cos(w) / a0 * 16384), hp.a1);
+    TEST_ASSERT_INT_WITHIN(1, lround((1 - alpha) / a0 * 16384), hp.a2);
+
+    w = 2 * M_PI * 3000 / SAMPLE_RATE;
+    alpha = sin(w) / 2;
+    double amplitude = pow(10, 4.0 / 40);
+    a0 = 1 + alpha / amplitude;
+    const BiquadCoefficients &peak = CAPTURE_FILTER[1];
+    TEST_ASSERT_INT_WITHIN(1, lround((1 + alpha * amplitude) / a0 * 16384), peak.b0);
+    TEST_ASSERT_INT_WITHIN(1, lround(-2 * cos(w) / a0 * 16384), peak.b1);
+    TEST_ASSERT_INT_WITHIN(1, lround((1 - alpha * amplitude) / a0 * 16384), peak.b2);
+    TEST_ASSERT_INT_WITHIN(1, lround((1 - alpha / amplitude) / a0 * 16384), peak.a2);
+}
+
+static void test_capture_chain_design_points() {
+    TEST_ASSERT_FLOAT_WITHIN(0.5, -3.0, designResponse(CAPTURE_FILTER, CAPTURE_STAGES, 100)); // The peak's skirt lifts it a little
+    TEST_ASSERT_FLOAT_WITHIN(0.2, 4.0, designResponse(CAPTURE_FILTER, CAPTURE_STAGES, 3000));
+    TEST_ASSERT_LESS_THAN_FLOAT(-20.0f, designResponse(CAPTURE_FILTER, CAPTURE_STAGES, 20));
+    TEST_ASSERT_FLOAT_WITHIN(0.5, 0.0, designResponse(CAPTURE_FILTER, CAPTURE_STAGES, 500));
+}
+
+static void test_fixed_point_chain_follows_its_design() {
+    // Below 60 Hz the output is so far down that rounding noise, not the response, dominates what is measured
+    char line[96];
+    for (double frequency: {60.0, 100.0, 200.0, 500.0, 1000.0, 2000.0, 3000.0, 4000.0, 6000.0, 7500.0}) {
+        double expected = designResponse(CAPTURE_FILTER, CAPTURE_STAGES, frequency);
+        double measured = measuredResponse(frequency, 8000);
+        snprintf(line, sizeof(line), "%6.0f Hz: design %6.2f dB, fixed point %6.2f dB", frequency, expected, measured);
+        TEST_MESSAGE(line);
+        TEST_ASSERT_FLOAT_WITHIN(0.1, expected, measured);
+    }
+}
+
+static void test_full_scale_input_saturates_instead_of_wrapping() {
+    // The presence peak lifts a near full-scale 3 kHz sine past int16. Each stage saturates its output and feeds
+    // that back, so clipped samples differ from an unbounded float chain, but none may wrap to the other sign.
+    BiquadChain chain(CAPTURE_FILTER, CAPTURE_STAGES);
+    FloatChain reference(CAPTURE_FILTER, CAPTURE_STAGES);
+    std::vector<int16_t> block(BLOCK_SAMPLES);
+    std::vector<float> exact(BLOCK_SAMPLES);
+    size_t clipped = 0;
+    size_t railed = 0;
+    for (size_t b = 0, n = 0; b < 16; b++) {
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++, n++) {
+            block[i] = static_cast<int16_t>(lround(30000 * sin(2 * M_PI * 3000 * n / SAMPLE_RATE)));
+            exact[i] = block[i];
+        }
+        chain.process(block.data(), block.size());
+        reference.process(exact.data(), exact.size());
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+            if (exact[i] > 32767 || exact[i] < -32768) {
+                clipped++;
+                TEST_ASSERT_TRUE((exact[i] > 0) == (block[i] > 0));
+            }
+            if (block[i] == INT16_MAX || block[i] == INT16_MIN) {
+                railed++;
+            }
+        }
+    }
+    TEST_ASSERT_GREATER_THAN(0, clipped);
+    TEST_ASSERT_GREATER_THAN(0, railed);
+}
+
+static void test_chain_throughput() {
+    // Each pass filters a fresh copy of the input, as the capture path does
+    std::vector<int16_t> input(BLOCK_SAMPLES);
+    std::vector<float> floatInput(BLOCK_SAMPLES);
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+        input[i] = static_cast<int16_t>(lround(8000 * sin(2 * M_PI * 440 * i / SAMPLE_RATE)));
+        floatInput[i] = input[i];
+    }
+    std::vector<int16_t> block(BLOCK_SAMPLES);
+    std::vector<float> floats(BLOCK_SAMPLES);
+    static constexpr size_t BLOCKS = 20000;
+
+    BiquadChain chain(CAPTURE_FILTER, CAPTURE_STAGES);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t b = 0; b < BLOCKS; b++) {
+        block = input;
+        chain.process(block.data(), block.size());
+    }
+    auto fixedNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    FloatChain reference(CAPTURE_FILTER, CAPTURE_STAGES);
+    start = std::chrono::steady_clock::now();
+    for (size_t b = 0; b < BLOCKS; b++) {
+        floats = floatInput;
+        reference.process(floats.data(), floats.size());
+    }
+    auto floatNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    char line[160];
+    snprintf(line, sizeof(line), "%u-stage chain: Q14 %.2f ns/sample, double %.2f ns/sample (checksum %d %.0f)",
+             static_cast<unsigned>(CAPTURE_STAGES), static_cast<double>(fixedNanos) / (BLOCKS * BLOCK_SAMPLES),
+             static_cast<double>(floatNanos) / (BLOCKS * BLOCK_SAMPLES), block[0], floats[0]);
+    TEST_MESSAGE(line);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_compile_time_designs_match_cmath);
+    RUN_TEST(test_capture_chain_design_points);
+    RUN_TEST(test_fixed_point_chain_follows_its_design);
+    RUN_TEST(test_full_scale_input_saturates_instead_of_wrapping);
+    RUN_TEST(test_chain_throughput);
+    return UNITY_END();
+}
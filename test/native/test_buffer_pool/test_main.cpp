@@ -0,0 +1,131 @@
+#include <unity.h>
+#include <thread>
+#include <vector>
+#include "buffer_pool.h"
+
+static constexpr size_t CHUNKS = 8;
+
+void setUp() {
+    TEST_ASSERT_EQUAL(0, BufferPool::getStats().chunksInUse);
+}
+
+void tearDown() {}
+
+static void test_exhausted_pool_returns_empty_buffers() {
+    uint32_t exhausted = BufferPool::getStats().exhausted;
+    std::vector<PooledBuffer> held;
+    for (size_t i = 0; i < CHUNKS; i++) {
+        held.push_back(BufferPool::acquire());
+        TEST_ASSERT_TRUE(static_cast<bool>(held.back()));
+    }
+    // Chunks never overlap, headroom included
+    for (size_t i = 0; i < CHUNKS; i++) {
+        for (size_t j = i + 1; j < CHUNKS; j++) {
+            size_t apart = held[i].data() > held[j].data() ? held[i].data() - held[j].data()
+                                                           : held[j].data() - held[i].data();
+            TEST_ASSERT_GREATER_OR_EQUAL(POOL_CHUNK_HEADROOM + POOL_CHUNK_SIZE, apart);
+        }
+    }
+
+    PooledBuffer none = BufferPool::acquire();
+    TEST_ASSERT_FALSE(static_cast<bool>(none));
+    TEST_ASSERT_NULL(none.data());
+    TEST_ASSERT_EQUAL(0, none.size());
+    uint32_t copied = BufferPool::getStats().bytesCopied;
+    uint8_t byte = 1;
+    TEST_ASSERT_FALSE(static_cast<bool>(BufferPool::copyFrom(&byte, 1)));
+
+    BufferPoolStats stats = BufferPool::getStats();
+    TEST_ASSERT_EQUAL(CHUNKS, stats.chunkCount);
+    TEST_ASSERT_EQUAL(CHUNKS, stats.chunksInUse);
+    TEST_ASSERT_EQUAL(0, stats.minFree);
+    TEST_ASSERT_EQUAL_UINT32(exhausted + 2, stats.exhausted);
+    TEST_ASSERT_EQUAL_UINT32(copied, stats.bytesCopied); // A failed copy is not counted
+
+    // One returned chunk is enough to get going again
+    uint8_t *freed = held.back().data();
+    held.pop_back();
+    PooledBuffer again = BufferPool::acquire();
+    TEST_ASSERT_EQUAL_PTR(freed, again.data());
+}
+
+static void test_chunk_returns_with_its_last_view() {
+    PooledBuffer first = BufferPool::acquire();
+    first.setSize(3);
+    {
+        PooledBuffer copy = first;
+        PooledBuffer assigned;
+        assigned = copy;
+        assigned = assigned;
+        TEST_ASSERT_EQUAL_PTR(first.data(), assigned.data());
+        TEST_ASSERT_EQUAL(3, assigned.size());
+        first.reset();
+        TEST_ASSERT_EQUAL(1, BufferPool::getStats().chunksInUse); // Still held by the copies
+        first = std::move(copy);
+        TEST_ASSERT_FALSE(static_cast<bool>(copy));
+    }
+    TEST_ASSERT_EQUAL(1, BufferPool::getStats().chunksInUse);
+    PooledBuffer moved(std::move(first));
+    moved = PooledBuffer();
+    TEST_ASSERT_EQUAL(0, BufferPool::getStats().chunksInUse);
+}
+
+static void test_copy_from_checks_length() {
+    std::vector<uint8_t> payload(POOL_CHUNK_SIZE + 1, 0x5A);
+    uint32_t copied = BufferPool::getStats().bytesCopied;
+    TEST_ASSERT_FALSE(static_cast<bool>(BufferPool::copyFrom(payload.data(), payload.size())));
+    TEST_ASSERT_EQUAL(0, BufferPool::getStats().chunksInUse);
+
+    PooledBuffer chunk = BufferPool::copyFrom(payload.data(), POOL_CHUNK_SIZE);
+    TEST_ASSERT_EQUAL(POOL_CHUNK_SIZE, chunk.size());
+    TEST_ASSERT_EQUAL_MEMORY(payload.data(), chunk.data(), POOL_CHUNK_SIZE);
+    TEST_ASSERT_EQUAL_UINT32(copied + POOL_CHUNK_SIZE, BufferPool::getStats().bytesCopied);
+}
+
+// Threads contend for a pool too small for all of them, sharing views of what they get. A chunk handed out
+// twice, or returned while still viewed, shows up as a pattern overwritten by another thread.
+static void test_contended_pool_keeps_chunks_apart() {
+    static constexpr int THREADS = 6;
+    static constexpr int ROUNDS = 20000;
+    std::vector<std::thread> threads;
+    std::vector<uint32_t> corrupted(THREADS);
+    std::vector<uint32_t> misses(THREADS);
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([t, &corrupted, &misses]() {
+            for (int round = 0; round < ROUNDS; round++) {
+                PooledBuffer chunk = BufferPool::acquire();
+                if (!chunk) {
+                    misses[t]++;
+                    continue;
+                }
+                uint8_t mark = static_cast<uint8_t>(t * 37 + round);
+                memset(chunk.data(), mark, 64);
+                PooledBuffer view = chunk;
+                chunk.reset();
+                std::this_thread::yield();
+                for (int i = 0; i < 64; i++) {
+                    corrupted[t] += view.data()[i] != mark;
+                }
+            }
+        });
+    }
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+    for (int t = 0; t < THREADS; t++) {
+        TEST_ASSERT_EQUAL_UINT32(0, corrupted[t]);
+    }
+    TEST_ASSERT_EQUAL(0, BufferPool::getStats().chunksInUse);
+}
+
+int main() {
+    if (!BufferPool::begin(CHUNKS)) {
+        return 1;
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_exhausted_pool_returns_empty_buffers);
+    RUN_TEST(test_chunk_returns_with_its_last_view);
+    RUN_TEST(test_copy_from_checks_length);
+    RUN_TEST(test_contended_pool_keeps_chunks_apart);
+    return UNITY_END();
+}
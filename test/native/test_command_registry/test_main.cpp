@@ -0,0 +1,726 @@
+#include <unity.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "command_registry.h"
+#include "events.h"
+#include "json_writer.h"
+#include "../../test_random.h"
+
+#if __has_include(<ArduinoJson.h>)
+#include <ArduinoJson.h>
+#define HAVE_ARDUINOJSON 1
+#endif
+
+// The same shapes as the commands in network_manager.cpp, recording what the handlers were given
+
+struct TextFields {
+    const char *action;
+};
+
+struct PairFields {
+    const char *device;
+    const char *state;
+};
+
+struct ByteFields {
+    uint8_t id;
+};
+
+struct MixedFields {
+    const char *uplink;
+    const char *downlink;
+    uint16_t uplinkRate;
+    uint16_t downlinkRate;
+    bool enabled;
+};
+
+struct AckFields {
+    uint32_t session;
+    uint32_t offset;
+};
+
+static const char *frameStart;
+static const char *frameEnd;
+static uint32_t handled;
+static const char *lastCommand;
+static TextFields lastText;
+static PairFields lastPair;
+static ByteFields lastByte;
+static MixedFields lastMixed;
+static AckFields lastAck;
+
+// Strings handed to a handler lie in the frame and end before it does
+static bool inFrame(const char *text) {
+    if (text == nullptr) {
+        return true;
+    }
+    if (text < frameStart || text >= frameEnd) {
+        return false;
+    }
+    return memchr(text, '\0', frameEnd - text) != nullptr;
+}
+
+static void record(const char *name) {
+    handled++;
+    lastCommand = name;
+}
+
+static void textCommand(const TextFields &fields) {
+    TEST_ASSERT_TRUE(inFrame(fields.action));
+    lastText = fields;
+    record("audio");
+}
+
+static void pairCommand(const PairFields &fields) {
+    TEST_ASSERT_TRUE(inFrame(fields.device) && inFrame(fields.state));
+    lastPair = fields;
+    record("change_state");
+}
+
+static void byteCommand(const ByteFields &fields) {
+    lastByte = fields;
+    record("enroll_fingerprint");
+}
+
+static void mixedCommand(const MixedFields &fields) {
+    TEST_ASSERT_TRUE(inFrame(fields.uplink) && inFrame(fields.downlink));
+    lastMixed = fields;
+    record("codec");
+}
+
+static void ackCommand(const AckFields &fields) {
+    lastAck = fields;
+    record("spool_ack");
+}
+
+static void emptyCommand(const NoFields &) {
+    record("grant_access");
+}
+
+static constexpr FieldSpec TEXT_FIELDS[] = {
+        COMMAND_FIELD("action", TextFields, action, true),
+};
+
+static constexpr FieldSpec PAIR_FIELDS[] = {
+        COMMAND_FIELD("device", PairFields, device, true),
+        COMMAND_FIELD("state", PairFields, state, true),
+};
+
+static constexpr FieldSpec BYTE_FIELDS[] = {
+        COMMAND_FIELD("id", ByteFields, id, true),
+};
+
+static constexpr FieldSpec MIXED_FIELDS[] = {
+        COMMAND_FIELD("uplink", MixedFields, uplink, false),
+        COMMAND_FIELD("downlink", MixedFields, downlink, false),
+        COMMAND_FIELD("uplink_rate", MixedFields, uplinkRate, false),
+        COMMAND_FIELD("downlink_rate", MixedFields, downlinkRate, false),
+        COMMAND_FIELD("enabled", MixedFields, enabled, false),
+};
+
+static constexpr FieldSpec ACK_FIELDS[] = {
+        COMMAND_FIELD("session", AckFields, session, true),
+        COMMAND_FIELD("offset", AckFields, offset, true),
+};
+
+static constexpr CommandSpec COMMANDS[] = {
+        command<TextFields, textCommand>("audio", TEXT_FIELDS),
+        command<PairFields, pairCommand>("change_state", PAIR_FIELDS),
+        command<emptyCommand>("grant_access"),
+        command<ByteFields, byteCommand>("enroll_fingerprint", BYTE_FIELDS),
+        command<MixedFields, mixedCommand>("codec", MIXED_FIELDS),
+        command<AckFields, ackCommand>("spool_ack", ACK_FIELDS),
+};
+
+static_assert(commandSlotsUnique(COMMANDS), "Test commands collide in the hash table");
+
+static constexpr CommandRegistry registry(COMMANDS);
+
+// Dispatches a copy of text sized exactly to the frame, so any read past its end trips the sanitizer
+static CommandOutcome dispatch(const std::string &text) {
+    std::vector<char> frame(text.begin(), text.end());
+    frameStart = frame.data();
+    frameEnd = frame.data() + frame.size();
+    handled = 0;
+    CommandOutcome outcome = registry.dispatch(frame.data(), frame.size());
+    frameStart = frameEnd = nullptr;
+    return outcome;
+}
+
+// Dispatches in a buffer the caller keeps, for reading the decoded strings afterwards
+static CommandOutcome dispatchIn(std::vector<char> &frame) {
+    frameStart = frame.data();
+    frameEnd = frame.data() + frame.size();
+    handled = 0;
+    return registry.dispatch(frame.data(), frame.size());
+}
+
+static std::vector<char> bufferOf(const std::string &text) {
+    return std::vector<char>(text.begin(), text.end());
+}
+
+void setUp() {
+    lastMixed = MixedFields{};
+}
+
+void tearDown() {}
+
+static void test_every_field_type_decodes() {
+    std::vector<char> frame = bufferOf(
+            R"({"event_type":"codec","data":{"uplink":"ima_adpcm","downlink_rate":48000,"enabled":true,"uplink_rate":8000}})");
+    CommandOutcome outcome = dispatchIn(frame);
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED), static_cast<int>(outcome.status));
+    TEST_ASSERT_EQUAL_STRING("codec", outcome.command->name);
+    TEST_ASSERT_EQUAL_STRING("codec", outcome.eventType);
+    TEST_ASSERT_EQUAL_STRING("ima_adpcm", lastMixed.uplink);
+    TEST_ASSERT_NULL(lastMixed.downlink); // Optional and absent
+    TEST_ASSERT_EQUAL_UINT16(8000, lastMixed.uplinkRate);
+    TEST_ASSERT_EQUAL_UINT16(48000, lastMixed.downlinkRate);
+    TEST_ASSERT_TRUE(lastMixed.enabled);
+
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED),
+                      static_cast<int>(dispatch(R"({"data":{"offset":4294967295,"session":7},"event_type":"spool_ack"})").status));
+    TEST_ASSERT_EQUAL_UINT32(7, lastAck.session);
+    TEST_ASSERT_EQUAL_UINT32(4294967295u, lastAck.offset);
+
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED),
+                      static_cast<int>(dispatch(R"({"event_type":"enroll_fingerprint","data":{"id":255}})").status));
+    TEST_ASSERT_EQUAL_UINT8(255, lastByte.id);
+
+    // No data at all, or data: null, is an empty object
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED),
+                      static_cast<int>(dispatch(R"({"event_type":"grant_access"})").status));
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED),
+                      static_cast<int>(dispatch(R"({"event_type":"codec","data":null})").status));
+}
+
+static void test_strings_are_unescaped_in_place() {
+    std::vector<char> frame = bufferOf(
+            R"({"event_type":"change_state","data":{"device":"a\"b\\c\/d\n\t\u00e9\ud83d\ude00","state":"on"}})");
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED), static_cast<int>(dispatchIn(frame).status));
+    TEST_ASSERT_EQUAL_STRING("a\"b\\c/d\n\t\xC3\xA9\xF0\x9F\x98\x80", lastPair.device);
+    TEST_ASSERT_EQUAL_STRING("on", lastPair.state);
+
+    // An escaped event_type still finds its command
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED),
+                      static_cast<int>(dispatch(R"({"event_type":"grant\u005faccess"})").status));
+}
+
+static void test_unknown_members_are_skipped() {
+    std::vector<char> frame = bufferOf(
+            R"( { "extra" : [1, {"a": [true, null, -2.5e3]}, "x\"y"], "event_type" : "audio", )"
+            R"("data" : { "nested": {"action": "wrong"}, "action" : "start_recording", "n": -1 } , "z": false } )");
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED), static_cast<int>(dispatchIn(frame).status));
+    TEST_ASSERT_EQUAL_STRING("start_recording", lastText.action);
+}
+
+static void test_rejections_name_what_was_wrong() {
+    struct Case {
+        const char *text;
+        CommandStatus status;
+        const char *field;
+    };
+    const Case cases[] = {
+            {"", CommandStatus::MALFORMED, nullptr},
+            {"[]", CommandStatus::MALFORMED, nullptr},
+            {R"({"event_type":"audio","data":{"action":"x"}} trailing)", CommandStatus::MALFORMED, nullptr},
+            {R"({"event_type":"audio","data":{"action":"x"})", CommandStatus::MALFORMED, nullptr},
+            {R"({"event_type":7})", CommandStatus::MALFORMED, nullptr},
+            {R"({"data":{}})", CommandStatus::NO_EVENT_TYPE, nullptr},
+            {R"({})", CommandStatus::NO_EVENT_TYPE, nullptr},
+            {R"({"event_type":"nope"})", CommandStatus::UNKNOWN, nullptr},
+            {R"({"event_type":"audi"})", CommandStatus::UNKNOWN, nullptr},
+            {R"({"event_type":"audio"})", CommandStatus::INVALID_FIELD, "action"},
+            {R"({"event_type":"audio","data":{"action":null}})", CommandStatus::INVALID_FIELD, "action"},
+            {R"({"event_type":"audio","data":{"action":3}})", CommandStatus::INVALID_FIELD, "action"},
+            {R"({"event_type":"audio","data":{"action":"a\u0000b"}})", CommandStatus::INVALID_FIELD, "action"},
+            {R"({"event_type":"enroll_fingerprint","data":{"id":256}})", CommandStatus::INVALID_FIELD, "id"},
+            {R"({"event_type":"enroll_fingerprint","data":{"id":1.5}})", CommandStatus::INVALID_FIELD, "id"},
+            {R"({"event_type":"enroll_fingerprint","data":{"id":-1}})", CommandStatus::INVALID_FIELD, "id"},
+            {R"({"event_type":"spool_ack","data":{"session":4294967296,"offset":0}})", CommandStatus::INVALID_FIELD,
+             "session"},
+            {R"({"event_type":"spool_ack","data":{"session":1}})", CommandStatus::INVALID_FIELD, "offset"},
+            {R"({"event_type":"codec","data":{"enabled":1}})", CommandStatus::INVALID_FIELD, "enabled"},
+            {R"({"event_type":"codec","data":{"uplink_rate":65536}})", CommandStatus::INVALID_FIELD, "uplink_rate"},
+            {R"({"event_type":"codec","data":"pcm16"})", CommandStatus::INVALID_DATA, nullptr},
+            {R"({"event_type":"codec","data":[1]})", CommandStatus::INVALID_DATA, nullptr},
+            {R"({"event_type":"codec","data":{"uplink":"x",}})", CommandStatus::MALFORMED, nullptr},
+    };
+    for (const Case &each: cases) {
+        CommandOutcome outcome = dispatch(each.text);
+        TEST_ASSERT_EQUAL_MESSAGE(static_cast<int>(each.status), static_cast<int>(outcome.status), each.text);
+        TEST_ASSERT_EQUAL_MESSAGE(0, handled, each.text);
+        TEST_ASSERT_NULL(outcome.command);
+        if (each.field != nullptr) {
+            TEST_ASSERT_EQUAL_STRING_MESSAGE(each.field, outcome.field, each.text);
+        }
+    }
+}
+
+static void test_nesting_is_bounded() {
+    // Rejected once past MAX_DEPTH, long before the stack or the frame runs out
+    std::string deep = R"({"event_type":"grant_access","data":{"x":)" + std::string(100000, '[');
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::MALFORMED), static_cast<int>(dispatch(deep).status));
+    std::string balanced = R"({"event_type":"grant_access","x":)" + std::string(16, '[') + std::string(16, ']') + "}";
+    TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED), static_cast<int>(dispatch(balanced).status));
+}
+
+static void appendRandomText(std::string &text) {
+    static const char *const pieces[] = {"\\\"", "\\\\", "\\n", "\\u00e9", "\\ud83d\\ude00", "\xC3\xA9", " ", "a", "Z"};
+    size_t count = nextRandom() % 8;
+    for (size_t i = 0; i < count; i++) {
+        text += pieces[nextRandom() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+}
+
+// A valid frame for a random command, its members in random order with unknown ones mixed in
+static std::string randomFrame() {
+    static const char *const values[] = {R"("text")", "true", "false", "null", "0", "255", "65535", "4294967295",
+                                         "-1", "1e3", R"({"k":[1,2,{}]})", "[]"};
+    const CommandSpec &spec = COMMANDS[nextRandom() % (sizeof(COMMANDS) / sizeof(COMMANDS[0]))];
+    std::vector<std::string> members;
+    members.push_back(std::string(R"("event_type":")") + spec.name + "\"");
+    std::string data = "{";
+    for (uint8_t i = 0; i < spec.fieldCount; i++) {
+        if (nextRandom() % 8 == 0) {
+            continue;
+        }
+        data += data.size() > 1 ? "," : "";
+        data += std::string("\"") + spec.fields[i].name + "\":";
+        if (spec.fields[i].type == FieldType::STRING) {
+            data += "\"";
+            appendRandomText(data);
+            data += "\"";
+        } else {
+            data += values[nextRandom() % (sizeof(values) / sizeof(values[0]))];
+        }
+    }
+    data += "}";
+    if (nextRandom() % 16 == 0) {
+        data = values[nextRandom() % (sizeof(values) / sizeof(values[0]))];
+    }
+    members.push_back("\"data\":" + data);
+    if (nextRandom() % 2) {
+        members.push_back(std::string(R"("unknown":)") + values[nextRandom() % (sizeof(values) / sizeof(values[0]))]);
+    }
+    for (size_t i = members.size(); i > 1; i--) {
+        std::swap(members[i - 1], members[nextRandom() % i]);
+    }
+    std::string frame = "{";
+    for (size_t i = 0; i < members.size(); i++) {
+        frame += (i ? "," : "") + members[i];
+    }
+    return frame + "}";
+}
+
+static void mutate(std::string &frame) {
+    static const char interesting[] = "{}[]\",:\\u0123456789eE.-tfn \x01\x7F\xC3\xFF";
+    switch (nextRandom() % 5) {
+        case 0: // Truncate
+            frame.resize(frame.empty() ? 0 : nextRandom() % frame.size());
+            break;
+        case 1: // Overwrite a byte
+            if (!frame.empty()) {
+                frame[nextRandom() % frame.size()] = interesting[nextRandom() % (sizeof(interesting) - 1)];
+            }
+            break;
+        case 2: // Insert a byte
+            frame.insert(frame.begin() + (frame.empty() ? 0 : nextRandom() % frame.size()),
+                         interesting[nextRandom() % (sizeof(interesting) - 1)]);
+            break;
+        case 3: // Delete a run
+            if (!frame.empty()) {
+                size_t at = nextRandom() % frame.size();
+                frame.erase(at, 1 + nextRandom() % 8);
+            }
+            break;
+        default: // Any byte at all
+            if (!frame.empty()) {
+                frame[nextRandom() % frame.size()] = static_cast<char>(nextRandom());
+            }
+            break;
+    }
+}
+
+// Mutated, truncated and random frames: nothing may crash or read past the frame, and a handler runs exactly
+// when the outcome says so
+static void test_fuzzed_frames() {
+    static constexpr uint32_t ROUNDS = 300000;
+    uint32_t counts[6] = {};
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        std::string frame;
+        if (round % 16 == 0) {
+            frame.resize(nextRandom() % 64);
+            for (char &c: frame) {
+                c = static_cast<char>(nextRandom());
+            }
+        } else {
+            frame = randomFrame();
+            for (uint32_t edits = nextRandom() % 4; edits > 0; edits--) {
+                mutate(frame);
+            }
+        }
+        CommandOutcome outcome = dispatch(frame);
+        counts[static_cast<int>(outcome.status)]++;
+        bool ran = outcome.status == CommandStatus::HANDLED;
+        TEST_ASSERT_EQUAL_UINT32(ran ? 1 : 0, handled);
+        TEST_ASSERT_TRUE(ran == (outcome.command != nullptr));
+        if (ran) {
+            TEST_ASSERT_EQUAL_STRING(outcome.command->name, lastCommand);
+        }
+        TEST_ASSERT_TRUE((outcome.field != nullptr) == (outcome.status == CommandStatus::INVALID_FIELD));
+    }
+    // The mix has to reach every outcome for the run to mean anything
+    for (uint32_t count: counts) {
+        TEST_ASSERT_GREATER_THAN_UINT32(ROUNDS / 1000, count);
+    }
+
+    char line[160];
+    snprintf(line, sizeof(line), "%u frames: %u handled, %u malformed, %u no event_type, %u unknown, %u bad field, "
+                                 "%u bad data", ROUNDS, counts[0], counts[1], counts[2], counts[3], counts[4], counts[5]);
+    TEST_MESSAGE(line);
+}
+
+// Whatever the writer emits, the registry reads back unchanged
+static void test_writer_output_round_trips() {
+    char buffer[512];
+    for (int i = 0; i < 20000; i++) {
+        std::string device;
+        std::string state;
+        for (size_t length = nextRandom() % 40; length > 0; length--) {
+            device += static_cast<char>(1 + nextRandom() % 255);
+        }
+        for (size_t length = nextRandom() % 10; length > 0; length--) {
+            state += static_cast<char>(1 + nextRandom() % 127);
+        }
+        JsonWriter json(buffer, sizeof(buffer));
+        json.beginObject().field("event_type", "change_state");
+        json.key("data").beginObject().field("state", state.c_str()).field("device", device.c_str()).endObject();
+        json.endObject();
+        TEST_ASSERT_TRUE(json.ok());
+
+        std::vector<char> frame(buffer, buffer + json.length());
+        TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED), static_cast<int>(dispatchIn(frame).status));
+        TEST_ASSERT_EQUAL_STRING(device.c_str(), lastPair.device);
+        TEST_ASSERT_EQUAL_STRING(state.c_str(), lastPair.state);
+
+        uint32_t session = nextRandom();
+        uint32_t offset = nextRandom();
+        json = JsonWriter(buffer, sizeof(buffer));
+        json.beginObject().field("event_type", "spool_ack");
+        json.key("data").beginObject().field("session", session).field("offset", offset).endObject();
+        json.endObject();
+        frame.assign(buffer, buffer + json.length());
+        TEST_ASSERT_EQUAL(static_cast<int>(CommandStatus::HANDLED), static_cast<int>(dispatchIn(frame).status));
+        TEST_ASSERT_EQUAL_UINT32(session, lastAck.session);
+        TEST_ASSERT_EQUAL_UINT32(offset, lastAck.offset);
+    }
+}
+
+static const char *const BENCH_FRAMES[] = {
+        R"({"event_type":"spool_ack","data":{"session":1234,"offset":8388608}})",
+        R"({"event_type":"audio","data":{"action":"start_recording"}})",
+        R"({"event_type":"change_state","data":{"device":"gate","state":"open"}})",
+        R"({"event_type":"codec","data":{"uplink":"ima_adpcm","downlink":"mulaw","uplink_rate":16000,"downlink_rate":8000}})",
+        R"({"event_type":"grant_access","data":{}})",
+};
+
+static constexpr size_t BENCH_FRAME_COUNT = sizeof(BENCH_FRAMES) / sizeof(BENCH_FRAMES[0]);
+
+static double nanosSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// What recording_sent carries
+static size_t writeEvent(char *buffer, size_t capacity, uint32_t i) {
+    JsonWriter json(buffer, capacity);
+    json.beginObject().field("event_type", "recording_sent");
+    json.key("data").beginObject()
+        .field("session", i).field("bytes", i * 4096u).field("upload_latency_ms", i % 5000)
+        .field("bytes_saved", i * 3u).field("overruns", 0u).field("goodput_bps", 250000u).field("stalls", i % 3)
+        .endObject();
+    json.endObject();
+    return json.length();
+}
+
+#ifdef HAVE_ARDUINOJSON
+// The code this replaced: a StaticJsonDocument<256> per frame, then a strcmp chain over the command names
+static uint32_t baselineDispatch(uint8_t *payload, size_t length) {
+    StaticJsonDocument<256> doc;
+    if (deserializeJson(doc, payload, length)) {
+        return 0;
+    }
+    const char *eventType = doc["event_type"];
+    if (eventType == nullptr) {
+        return 0;
+    }
+    if (strcmp(eventType, "audio") == 0) {
+        const char *action = doc["data"]["action"];
+        return action ? action[0] : 0;
+    } else if (strcmp(eventType, "change_state") == 0) {
+        const char *device = doc["data"]["device"];
+        const char *state = doc["data"]["state"];
+        return device && state ? device[0] + state[0] : 0;
+    } else if (strcmp(eventType, "grant_access") == 0) {
+        return 1;
+    } else if (strcmp(eventType, "deny_access") == 0) {
+        return 2;
+    } else if (strcmp(eventType, "reset_device") == 0) {
+        return 3;
+    } else if (strcmp(eventType, "motion_enable") == 0) {
+        return 4;
+    } else if (strcmp(eventType, "enroll_fingerprint") == 0) {
+        JsonVariant id = doc["data"]["id"];
+        return id.is<uint8_t>() ? id.as<uint8_t>() : 0;
+    } else if (strcmp(eventType, "codec") == 0) {
+        const char *uplink = doc["data"]["uplink"];
+        JsonVariant rate = doc["data"]["uplink_rate"];
+        return (uplink ? uplink[0] : 0) + (rate.is<uint16_t>() ? rate.as<uint16_t>() : 0);
+    } else if (strcmp(eventType, "spool_ack") == 0) {
+        JsonVariant session = doc["data"]["session"];
+        JsonVariant offset = doc["data"]["offset"];
+        return session.is<uint32_t>() && offset.is<uint32_t>() ? session.as<uint32_t>() + offset.as<uint32_t>() : 0;
+    } else if (strcmp(eventType, "dump_journal") == 0) {
+        return 5;
+    } else if (strcmp(eventType, "change_server") == 0) {
+        const char *server = doc["data"]["server"];
+        return server ? server[0] : 0;
+    }
+    return 0;
+}
+
+static size_t baselineEvent(char *buffer, size_t capacity, uint32_t i) {
+    StaticJsonDocument<256> doc;
+    doc["event_type"] = "recording_sent";
+    JsonObject data = doc.createNestedObject("data");
+    data["session"] = i;
+    data["bytes"] = i * 4096u;
+    data["upload_latency_ms"] = i % 5000;
+    data["bytes_saved"] = i * 3u;
+    data["overruns"] = 0u;
+    data["goodput_bps"] = 250000u;
+    data["stalls"] = i % 3;
+    return serializeJson(doc, buffer, capacity);
+}
+#endif
+
+// Decode to handler for the two commands that used to reach their handler as re-serialized JSON. Both sides run
+// the handler through EventDispatcher::dispatchEvent; queueing between them is test_event_dispatcher's.
+static const char *const TYPED_BENCH_FRAMES[] = {
+        R"({"event_type":"change_state","data":{"device":"gate","state":"open"}})",
+        R"({"event_type":"change_state","data":{"device":"light","state":"off"}})",
+        R"({"event_type":"enroll_fingerprint","data":{"id":17}})",
+};
+
+static constexpr size_t TYPED_BENCH_FRAME_COUNT = sizeof(TYPED_BENCH_FRAMES) / sizeof(TYPED_BENCH_FRAMES[0]);
+
+// What the gate, light and fingerprint sensor were told
+static uint32_t gateOpened;
+static uint32_t lightOff;
+static uint32_t enrolledIds;
+
+static EventDispatcher handlerDispatcher(4);
+
+static void handleChangeState(const Event &event) {
+    const ChangeStateCommand &command = event.payload<CMD_CHANGE_STATE>();
+    gateOpened += command.device == Device::GATE && command.on;
+    lightOff += command.device == Device::LIGHT && !command.on;
+}
+
+static void handleFingerprintEnroll(const Event &event) {
+    enrolledIds += event.payload<CMD_ENROLL_FINGERPRINT>().id;
+}
+
+// As network_manager.cpp turns the decoded fields into typed events
+static void changeStateCommand(const PairFields &fields) {
+    if (strcmp(fields.device, "gate") == 0) {
+        handlerDispatcher.dispatchEvent(Event::of<CMD_CHANGE_STATE>({Device::GATE, strcmp(fields.state, "open") == 0}));
+    } else if (strcmp(fields.device, "light") == 0) {
+        handlerDispatcher.dispatchEvent(Event::of<CMD_CHANGE_STATE>({Device::LIGHT, strcmp(fields.state, "on") == 0}));
+    }
+}
+
+static void enrollFingerprintCommand(const ByteFields &fields) {
+    handlerDispatcher.dispatchEvent(Event::of<CMD_ENROLL_FINGERPRINT>({fields.id}));
+}
+
+static constexpr CommandSpec TYPED_COMMANDS[] = {
+        command<PairFields, changeStateCommand>("change_state", PAIR_FIELDS),
+        command<ByteFields, enrollFingerprintCommand>("enroll_fingerprint", BYTE_FIELDS),
+};
+
+static_assert(commandSlotsUnique(TYPED_COMMANDS), "Typed commands collide in the hash table");
+
+static constexpr CommandRegistry typedRegistry(TYPED_COMMANDS);
+
+#ifdef HAVE_ARDUINOJSON
+// Before typed payloads: the network task parsed the frame and re-serialized its data into Event::data, and the
+// handler parsed that again
+static EventDispatcher stringDispatcher(4);
+
+static void stringDispatch(uint8_t *payload, size_t length) {
+    StaticJsonDocument<256> doc;
+    if (deserializeJson(doc, payload, length)) {
+        return;
+    }
+    const char *eventType = doc["event_type"];
+    if (eventType == nullptr) {
+        return;
+    }
+    EventType type;
+    if (strcmp(eventType, "change_state") == 0) {
+        type = CMD_CHANGE_STATE;
+    } else if (strcmp(eventType, "enroll_fingerprint") == 0) {
+        type = CMD_ENROLL_FINGERPRINT;
+    } else {
+        return;
+    }
+    JsonObject data = doc["data"];
+    if (!data.isNull()) {
+        std::string dataString; // An Arduino String on the device
+        serializeJson(data, dataString);
+        stringDispatcher.dispatchEvent({type, dataString.c_str()});
+    }
+}
+
+static void handleChangeStateString(const Event &event) {
+    StaticJsonDocument<256> doc;
+    deserializeJson(doc, event.data);
+    const char *device = doc["device"];
+    const char *state = doc["state"];
+    if (strcmp(device, "gate") == 0) {
+        gateOpened += strcmp(state, "open") == 0;
+    } else if (strcmp(device, "light") == 0) {
+        lightOff += strcmp(state, "on") != 0;
+    }
+}
+
+static void handleFingerprintEnrollString(const Event &event) {
+    StaticJsonDocument<64> doc;
+    deserializeJson(doc, event.data);
+    uint8_t id = doc["id"];
+    enrolledIds += id;
+}
+#endif
+
+static void test_decode_to_handler_benchmark() {
+    static constexpr uint32_t COMMANDS = 300000;
+    TEST_ASSERT_TRUE(handlerDispatcher.registerCallback(CMD_CHANGE_STATE, handleChangeState));
+    TEST_ASSERT_TRUE(handlerDispatcher.registerCallback(CMD_ENROLL_FINGERPRINT, handleFingerprintEnroll));
+    char work[256];
+    size_t lengths[TYPED_BENCH_FRAME_COUNT];
+    for (size_t i = 0; i < TYPED_BENCH_FRAME_COUNT; i++) {
+        lengths[i] = strlen(TYPED_BENCH_FRAMES[i]);
+    }
+    frameStart = work;
+    frameEnd = work + sizeof(work);
+
+    gateOpened = lightOff = enrolledIds = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < COMMANDS; i++) {
+        size_t which = i % TYPED_BENCH_FRAME_COUNT;
+        memcpy(work, TYPED_BENCH_FRAMES[which], lengths[which]);
+        typedRegistry.dispatch(work, lengths[which]);
+    }
+    double typedNanos = nanosSince(start) / COMMANDS;
+    uint32_t perFrame = COMMANDS / TYPED_BENCH_FRAME_COUNT;
+    TEST_ASSERT_EQUAL_UINT32(perFrame, gateOpened);
+    TEST_ASSERT_EQUAL_UINT32(perFrame, lightOff);
+    TEST_ASSERT_EQUAL_UINT32(perFrame * 17, enrolledIds);
+
+    char line[160];
+#ifdef HAVE_ARDUINOJSON
+    TEST_ASSERT_TRUE(stringDispatcher.registerCallback(CMD_CHANGE_STATE, handleChangeStateString));
+    TEST_ASSERT_TRUE(stringDispatcher.registerCallback(CMD_ENROLL_FINGERPRINT, handleFingerprintEnrollString));
+    gateOpened = lightOff = enrolledIds = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < COMMANDS; i++) {
+        size_t which = i % TYPED_BENCH_FRAME_COUNT;
+        memcpy(work, TYPED_BENCH_FRAMES[which], lengths[which]);
+        stringDispatch(reinterpret_cast<uint8_t *>(work), lengths[which]);
+    }
+    double stringNanos = nanosSince(start) / COMMANDS;
+    // The handlers were told the same things either way
+    TEST_ASSERT_EQUAL_UINT32(perFrame, gateOpened);
+    TEST_ASSERT_EQUAL_UINT32(perFrame, lightOff);
+    TEST_ASSERT_EQUAL_UINT32(perFrame * 17, enrolledIds);
+
+    snprintf(line, sizeof(line), "decode to handler: registry + typed payload %.0f ns/command, "
+                                 "ArduinoJson + re-serialized data %.0f ns/command", typedNanos, stringNanos);
+#else
+    snprintf(line, sizeof(line), "decode to handler: registry + typed payload %.0f ns/command "
+                                 "(ArduinoJson not found, no baseline)", typedNanos);
+#endif
+    TEST_MESSAGE(line);
+}
+
+// Both sides parse destructively, so each run starts from a fresh copy of the frame
+static void test_benchmark() {
+    static constexpr uint32_t FRAMES = 500000;
+    char work[256];
+    size_t lengths[BENCH_FRAME_COUNT];
+    for (size_t i = 0; i < BENCH_FRAME_COUNT; i++) {
+        lengths[i] = strlen(BENCH_FRAMES[i]);
+    }
+    uint32_t checksum = 0;
+    frameStart = work;
+    frameEnd = work + sizeof(work);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < FRAMES; i++) {
+        size_t which = i % BENCH_FRAME_COUNT;
+        memcpy(work, BENCH_FRAMES[which], lengths[which]);
+        CommandOutcome outcome = registry.dispatch(work, lengths[which]);
+        checksum += static_cast<uint32_t>(outcome.status) + handled;
+    }
+    double parseNanos = nanosSince(start) / FRAMES;
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < FRAMES; i++) {
+        checksum += writeEvent(work, sizeof(work), i);
+    }
+    double writeNanos = nanosSince(start) / FRAMES;
+
+    char line[200];
+#ifdef HAVE_ARDUINOJSON
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < FRAMES; i++) {
+        size_t which = i % BENCH_FRAME_COUNT;
+        memcpy(work, BENCH_FRAMES[which], lengths[which]);
+        checksum += baselineDispatch(reinterpret_cast<uint8_t *>(work), lengths[which]);
+    }
+    double baselineParseNanos = nanosSince(start) / FRAMES;
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < FRAMES; i++) {
+        checksum += baselineEvent(work, sizeof(work), i);
+    }
+    double baselineWriteNanos = nanosSince(start) / FRAMES;
+
+    snprintf(line, sizeof(line), "parse + dispatch: registry %.0f ns/frame, ArduinoJson + strcmp %.0f ns/frame; "
+                                 "serialize: JsonWriter %.0f ns/event, ArduinoJson %.0f ns/event (checksum %u)",
+             parseNanos, baselineParseNanos, writeNanos, baselineWriteNanos, checksum);
+#else
+    snprintf(line, sizeof(line), "parse + dispatch: registry %.0f ns/frame; serialize: JsonWriter %.0f ns/event "
+                                 "(ArduinoJson not found, no baseline; checksum %u)", parseNanos, writeNanos, checksum);
+#endif
+    TEST_MESSAGE(line);
+}
+
+int main() {
+    seedRandom(88675123u);
+    UNITY_BEGIN();
+    RUN_TEST(test_every_field_type_decodes);
+    RUN_TEST(test_strings_are_unescaped_in_place);
+    RUN_TEST(test_unknown_members_are_skipped);
+    RUN_TEST(test_rejections_name_what_was_wrong);
+    RUN_TEST(test_nesting_is_bounded);
+    RUN_TEST(test_fuzzed_frames);
+    RUN_TEST(test_writer_output_round_trips);
+    RUN_TEST(test_benchmark);
+    RUN_TEST(test_decode_to_handler_benchmark);
+    return UNITY_END();
+}
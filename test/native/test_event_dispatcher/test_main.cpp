@@ -0,0 +1,192 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "events.h"
+
+static constexpr size_t QUEUE_CAPACITY = 64; // EVENT_QUEUE_SIZE in config.h
+static constexpr int PRODUCERS = 4;
+static constexpr uint32_t POSTS_PER_PRODUCER = 50000;
+
+// Begun once: its lane tasks run until the test exits
+static EventDispatcher *dispatcher = nullptr;
+
+// Each producer numbers its events; within a lane they must arrive in that order
+static std::atomic<uint32_t> handled[EVENT_CLASS_COUNT];
+static uint32_t lastSequence[EVENT_CLASS_COUNT][PRODUCERS];
+static std::atomic<uint32_t> outOfOrder{0};
+
+static void checkOrder(EventClass lane, uint32_t tag) {
+    size_t laneIndex = static_cast<size_t>(lane);
+    uint32_t producer = tag >> 24;
+    uint32_t sequence = tag & 0xFFFFFF;
+    // Only this lane's task writes its row
+    outOfOrder += sequence <= lastSequence[laneIndex][producer];
+    lastSequence[laneIndex][producer] = sequence;
+    handled[laneIndex]++;
+}
+
+static uint32_t handledTotal() {
+    uint32_t total = 0;
+    for (auto &count: handled) {
+        total += count.load();
+    }
+    return total;
+}
+
+static bool waitFor(uint32_t expected, uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (handledTotal() < expected) {
+        if (millis() - start > timeoutMs) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return true;
+}
+
+// Reads the p-th percentile bucket of a latency histogram as its upper bound in microseconds
+static uint32_t percentile(const LatencyHistogram &histogram, double p) {
+    uint32_t total = 0;
+    for (uint32_t count: histogram.buckets) {
+        total += count;
+    }
+    uint32_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram.buckets[i];
+        if (seen >= total * p) {
+            return 1u << i;
+        }
+    }
+    return histogram.maxMicros;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// Producers on several threads race for all three lanes, retrying when a lane is full the way the audio task
+// retries a chunk. Measures what a post costs the producer and how long events wait for their lane's task. The
+// host semaphore behind each post is a mutex and condition variable, so much of the post cost here is the shim's.
+static void test_contended_post() {
+    dispatcher->registerCallback(CMD_GRANT_ACCESS, [](const Event &e) {
+        checkOrder(EventClass::CRITICAL, e.payload<AUDIO_CREDIT>().offset);
+    });
+    dispatcher->registerCallback(AUDIO_CREDIT, [](const Event &e) {
+        checkOrder(EventClass::INTERACTIVE, e.payload<AUDIO_CREDIT>().offset);
+    });
+    dispatcher->registerCallback(SPOOL_CHUNK_READY, [](const Event &e) {
+        checkOrder(EventClass::BULK, e.payload<SPOOL_CHUNK_READY>().offset);
+    });
+
+    EventQueueStats before = dispatcher->getStats();
+    std::vector<std::thread> producers;
+    std::vector<double> postNanos(PRODUCERS);
+    std::vector<uint32_t> retries(PRODUCERS);
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([p, &postNanos, &retries]() {
+            for (uint32_t i = 1; i <= POSTS_PER_PRODUCER; i++) {
+                uint32_t tag = static_cast<uint32_t>(p) << 24 | i;
+                Event event;
+                if (i % 16 == 0) {
+                    event = Event::of<AUDIO_CREDIT>({tag});
+                    event.type = CMD_GRANT_ACCESS; // Untyped on the device; the payload only carries the tag here
+                } else if (i % 2 == 0) {
+                    event = Event::of<AUDIO_CREDIT>({tag});
+                } else {
+                    event = Event::of<SPOOL_CHUNK_READY>({0, tag});
+                }
+                while (true) {
+                    Event attempt = event;
+                    auto start = std::chrono::steady_clock::now();
+                    bool posted = dispatcher->post(std::move(attempt));
+                    auto elapsed = std::chrono::steady_clock::now() - start;
+                    postNanos[p] += std::chrono::duration<double, std::nano>(elapsed).count();
+                    if (posted) {
+                        break;
+                    }
+                    retries[p]++;
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (std::thread &producer: producers) {
+        producer.join();
+    }
+
+    TEST_ASSERT_TRUE(waitFor(PRODUCERS * POSTS_PER_PRODUCER, 10000));
+    TEST_ASSERT_EQUAL_UINT32(0, outOfOrder.load());
+    uint32_t totalRetries = 0;
+    double totalNanos = 0;
+    for (int p = 0; p < PRODUCERS; p++) {
+        totalRetries += retries[p];
+        totalNanos += postNanos[p];
+    }
+    EventQueueStats after = dispatcher->getStats();
+    TEST_ASSERT_EQUAL_UINT32(PRODUCERS * POSTS_PER_PRODUCER, after.posted - before.posted);
+    TEST_ASSERT_EQUAL_UINT32(totalRetries, after.dropped - before.dropped); // A full lane refuses, never loses
+    TEST_ASSERT_LESS_OR_EQUAL(EVENT_CLASS_COUNT * QUEUE_CAPACITY, after.highWatermark);
+
+    char line[200];
+    snprintf(line, sizeof(line), "%d producers: %.0f ns per post attempt, %u of %u attempts found the lane full",
+             PRODUCERS, totalNanos / (PRODUCERS * POSTS_PER_PRODUCER + totalRetries), totalRetries,
+             PRODUCERS * POSTS_PER_PRODUCER + totalRetries);
+    TEST_MESSAGE(line);
+    static const char *laneNames[EVENT_CLASS_COUNT] = {"critical", "interactive", "bulk"};
+    for (size_t lane = 0; lane < EVENT_CLASS_COUNT; lane++) {
+        LatencyHistogram histogram = dispatcher->getLatencyHistogram(static_cast<EventClass>(lane));
+        snprintf(line, sizeof(line), "%s lane: %u events, dispatch latency p50 < %u us, p99 < %u us, max %u us",
+                 laneNames[lane], handled[lane].load(), percentile(histogram, 0.5), percentile(histogram, 0.99),
+                 histogram.maxMicros);
+        TEST_MESSAGE(line);
+    }
+}
+
+static std::atomic<bool> bulkBlocked{false};
+static std::atomic<uint32_t> criticalLatency{0};
+static std::atomic<uint32_t> interactiveLatency{0};
+
+// A bulk handler stuck in a slow socket write holds up its own lane only
+static void test_blocked_bulk_handler_holds_only_its_lane() {
+    dispatcher->registerCallback(SPOOL_SENT, [](const Event &e) {
+        bulkBlocked = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        bulkBlocked = false;
+    });
+    dispatcher->registerCallback(CMD_DENY_ACCESS, [](const Event &e) { criticalLatency = micros() - e.postedAt + 1; });
+    dispatcher->registerCallback(DISPLAY_READY, [](const Event &e) { interactiveLatency = micros() - e.postedAt + 1; });
+
+    TEST_ASSERT_TRUE(dispatcher->post(Event::of<SPOOL_SENT>({1, 0})));
+    while (!bulkBlocked) {
+        std::this_thread::yield();
+    }
+    TEST_ASSERT_TRUE(dispatcher->post(Event(CMD_DENY_ACCESS)));
+    TEST_ASSERT_TRUE(dispatcher->post(Event(DISPLAY_READY)));
+    uint32_t start = millis();
+    while ((criticalLatency == 0 || interactiveLatency == 0) && millis() - start < 1000) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    TEST_ASSERT_TRUE(bulkBlocked.load()); // Both ran while the bulk handler was still asleep
+    TEST_ASSERT_NOT_EQUAL(0, criticalLatency.load());
+    TEST_ASSERT_NOT_EQUAL(0, interactiveLatency.load());
+    TEST_ASSERT_LESS_THAN(50000, criticalLatency.load());
+    TEST_ASSERT_LESS_THAN(50000, interactiveLatency.load());
+
+    // The bulk lane still delivers what queued behind the slow handler
+    uint32_t before = handledTotal();
+    TEST_ASSERT_TRUE(dispatcher->post(Event::of<SPOOL_CHUNK_READY>({0, 0xFFFFFF})));
+    TEST_ASSERT_TRUE(waitFor(before + 1, 1000));
+}
+
+int main() {
+    dispatcher = new EventDispatcher(16);
+    dispatcher->begin(QUEUE_CAPACITY, 3, 0);
+    UNITY_BEGIN();
+    RUN_TEST(test_contended_post);
+    RUN_TEST(test_blocked_bulk_handler_holds_only_its_lane);
+    return UNITY_END();
+}
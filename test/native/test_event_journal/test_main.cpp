@@ -0,0 +1,235 @@
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "event_journal.h"
+
+// Back ends standing in for Gate, UI, Audio and NetworkManager: they only count what they are asked to do
+struct FakeGate {
+    uint32_t opens = 0;
+    uint32_t closes = 0;
+};
+
+struct FakeUI {
+    uint32_t screens = 0;
+};
+
+struct FakeAudio {
+    std::vector<std::string> commands;
+    size_t prefetchedBytes = 0;
+    uint32_t checksum = 0;
+
+    void addPrefetchData(const uint8_t *data, size_t length) {
+        prefetchedBytes += length;
+        for (size_t i = 0; i < length; i++) {
+            checksum = checksum * 31 + data[i];
+        }
+    }
+};
+
+struct FakeNetwork {
+    std::vector<std::string> sent;
+};
+
+// Routes events onto the fakes the way EventHandler routes them onto the real back ends
+class HostHandler {
+public:
+    void dispatch(const Event &event) {
+        order.push_back(event.type);
+        switch (event.type) {
+            case CMD_GRANT_ACCESS:
+            case FINGERPRINT_MATCHED:
+            case PASSWORD_VALID:
+                gate.opens++;
+                ui.screens++;
+                break;
+            case CMD_CHANGE_STATE: {
+                const ChangeStateCommand &command = event.payload<CMD_CHANGE_STATE>();
+                if (command.device == Device::GATE) {
+                    command.on ? gate.opens++ : gate.closes++;
+                }
+                break;
+            }
+            case GATE_OPENED:
+            case GATE_CLOSED:
+                network.sent.push_back("change_state");
+                break;
+            case MOTION_DETECTED:
+                ui.screens++;
+                network.sent.push_back("motion_detected");
+                break;
+            case PERSON_DETECTED:
+                network.sent.push_back("person_detected");
+                break;
+            case VISITOR_ENTERED:
+                network.sent.push_back("visitor_entered");
+                break;
+            case CMD_TG_AUDIO:
+                audio.commands.push_back(event.data);
+                break;
+            case AUDIO_DATA_RECEIVED:
+                audio.addPrefetchData(event.buffer.data(), event.buffer.size());
+                break;
+            default:
+                break;
+        }
+    }
+
+    EventCallback callback() { return EventCallback::bind<HostHandler, &HostHandler::dispatch>(this); }
+
+    std::vector<EventType> order;
+    FakeGate gate;
+    FakeUI ui;
+    FakeAudio audio;
+    FakeNetwork network;
+};
+
+// A busy doorbell evening: visitors ring, leave a message or get let in, and the owner's replies stream back
+static std::vector<Event> doorbellEvening(size_t visits) {
+    std::vector<Event> events;
+    for (size_t visit = 0; visit < visits; visit++) {
+        events.emplace_back(MOTION_DETECTED);
+        events.emplace_back(PERSON_DETECTED);
+        events.emplace_back(CMD_TG_AUDIO, "start_prefetch");
+        for (size_t chunk = 0; chunk < 6; chunk++) {
+            PooledBuffer buffer = BufferPool::acquire();
+            for (size_t i = 0; i < 2048; i++) {
+                buffer.data()[i] = static_cast<uint8_t>(visit * 7 + chunk * 13 + i);
+            }
+            buffer.setSize(2048);
+            events.emplace_back(AUDIO_DATA_RECEIVED, std::move(buffer));
+        }
+        events.emplace_back(CMD_TG_AUDIO, "stop_prefetch");
+        if (visit % 3 == 0) {
+            events.emplace_back(CMD_GRANT_ACCESS);
+            events.emplace_back(GATE_OPENED);
+            events.emplace_back(VISITOR_ENTERED);
+            events.push_back(Event::of<CMD_CHANGE_STATE>({Device::GATE, false}));
+            events.emplace_back(GATE_CLOSED);
+        }
+    }
+    return events;
+}
+
+static std::vector<uint8_t> journalStorage(size_t size) {
+    return std::vector<uint8_t>(size);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_replay_matches_live() {
+    std::vector<uint8_t> storage = journalStorage(1024 * 1024);
+    EventJournal journal(storage.data(), storage.size(), true);
+    HostHandler live;
+    uint32_t timestamp = 0;
+    for (const Event &event: doorbellEvening(20)) {
+        journal.record(event, timestamp += 1500);
+        live.dispatch(event);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, journal.droppedCount());
+
+    std::vector<uint8_t> copy(journal.size());
+    TEST_ASSERT_EQUAL(journal.size(), journal.copyOut(copy.data(), copy.size()));
+    HostHandler replayed;
+    ReplayStats stats = EventReplayer::replay(copy.data(), copy.size(), replayed.callback(), 0);
+
+    TEST_ASSERT_EQUAL_UINT32(journal.recordCount(), stats.events);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.skipped);
+    TEST_ASSERT_TRUE(live.order == replayed.order);
+    TEST_ASSERT_EQUAL_UINT32(live.gate.opens, replayed.gate.opens);
+    TEST_ASSERT_EQUAL_UINT32(live.gate.closes, replayed.gate.closes);
+    TEST_ASSERT_EQUAL_UINT32(live.ui.screens, replayed.ui.screens);
+    TEST_ASSERT_TRUE(live.audio.commands == replayed.audio.commands);
+    TEST_ASSERT_EQUAL(live.audio.prefetchedBytes, replayed.audio.prefetchedBytes);
+    TEST_ASSERT_EQUAL_UINT32(live.audio.checksum, replayed.audio.checksum);
+    TEST_ASSERT_TRUE(live.network.sent == replayed.network.sent);
+}
+
+static void test_ring_keeps_newest_whole_records() {
+    std::vector<uint8_t> storage = journalStorage(256);
+    EventJournal journal(storage.data(), storage.size());
+    for (uint32_t i = 0; i < 50; i++) {
+        journal.record(Event(CMD_TG_AUDIO, "stop_prefetch"), i);
+    }
+    journal.record(Event(VISITOR_ENTERED), 50);
+    TEST_ASSERT_GREATER_THAN(0, journal.droppedCount());
+    TEST_ASSERT_EQUAL_UINT32(51, journal.recordCount() + journal.droppedCount());
+
+    std::vector<uint8_t> copy(storage.size());
+    size_t length = journal.copyOut(copy.data(), copy.size());
+    HostHandler replayed;
+    ReplayStats stats = EventReplayer::replay(copy.data(), length, replayed.callback(), 0);
+    TEST_ASSERT_EQUAL_UINT32(journal.recordCount(), stats.events);
+    TEST_ASSERT_EQUAL(VISITOR_ENTERED, replayed.order.back());
+    for (size_t i = 0; i + 1 < replayed.audio.commands.size(); i++) {
+        TEST_ASSERT_EQUAL_STRING("stop_prefetch", replayed.audio.commands[i].c_str());
+    }
+}
+
+static void test_uncaptured_buffers_keep_their_length() {
+    std::vector<uint8_t> storage = journalStorage(64 * 1024);
+    EventJournal journal(storage.data(), storage.size(), false);
+    HostHandler live;
+    for (const Event &event: doorbellEvening(2)) {
+        journal.record(event, 0);
+        live.dispatch(event);
+    }
+
+    std::vector<uint8_t> copy(journal.size());
+    journal.copyOut(copy.data(), copy.size());
+    HostHandler replayed;
+    EventReplayer::replay(copy.data(), copy.size(), replayed.callback(), 0);
+    TEST_ASSERT_TRUE(live.order == replayed.order);
+    TEST_ASSERT_EQUAL(live.audio.prefetchedBytes, replayed.audio.prefetchedBytes);
+}
+
+static void test_accelerated_replay_keeps_scaled_gaps() {
+    std::vector<uint8_t> storage = journalStorage(4096);
+    EventJournal journal(storage.data(), storage.size());
+    for (uint32_t i = 0; i <= 10; i++) {
+        journal.record(Event(MOTION_DETECTED), 1000000 + i * 20000); // 200 ms of events
+    }
+
+    std::vector<uint8_t> copy(journal.size());
+    journal.copyOut(copy.data(), copy.size());
+    HostHandler replayed;
+    ReplayStats stats = EventReplayer::replay(copy.data(), copy.size(), replayed.callback(), 10.0f);
+    TEST_ASSERT_EQUAL_UINT32(11, stats.events);
+    TEST_ASSERT_GREATER_OR_EQUAL(20000, stats.wallMicros);
+    TEST_ASSERT_LESS_THAN(200000, stats.wallMicros);
+}
+
+static void test_replay_throughput() {
+    std::vector<uint8_t> storage = journalStorage(8 * 1024 * 1024);
+    EventJournal journal(storage.data(), storage.size(), true);
+    uint32_t timestamp = 0;
+    for (const Event &event: doorbellEvening(400)) {
+        journal.record(event, timestamp += 1000);
+    }
+
+    std::vector<uint8_t> copy(journal.size());
+    journal.copyOut(copy.data(), copy.size());
+    HostHandler replayed;
+    ReplayStats stats = EventReplayer::replay(copy.data(), copy.size(), replayed.callback(), 0);
+    TEST_ASSERT_EQUAL_UINT32(journal.recordCount(), stats.events);
+
+    char line[160];
+    snprintf(line, sizeof(line), "%u events in %llu us: %llu events/s, handler mean %llu ns, max %u us",
+             stats.events, static_cast<unsigned long long>(stats.wallMicros),
+             static_cast<unsigned long long>(stats.wallMicros ? stats.events * 1000000ull / stats.wallMicros : 0),
+             static_cast<unsigned long long>(stats.handlerMicros * 1000 / stats.events), stats.maxHandlerMicros);
+    TEST_MESSAGE(line);
+}
+
+int main() {
+    BufferPool::begin(2560); // doorbellEvening(400) holds 2400 chunks at once
+    UNITY_BEGIN();
+    RUN_TEST(test_replay_matches_live);
+    RUN_TEST(test_ring_keeps_newest_whole_records);
+    RUN_TEST(test_uncaptured_buffers_keep_their_length);
+    RUN_TEST(test_accelerated_replay_keeps_scaled_gaps);
+    RUN_TEST(test_replay_throughput);
+    return UNITY_END();
+}
@@ -0,0 +1,165 @@
+#include <unity.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "buffer_pool.h"
+#include "frame_protocol.h"
+#include "../../test_random.h"
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_header_layout_is_little_endian() {
+    uint8_t frame[FrameCodec::HEADER_SIZE + 2] = {};
+    uint8_t *payload = frame + FrameCodec::HEADER_SIZE;
+    payload[0] = 0xAB;
+    payload[1] = 0xCD;
+    FrameHeader header{0, static_cast<uint8_t>(FrameType::SPOOL), FRAME_FIRST | FRAME_LAST, 0, 0x04030201,
+                       0x08070605, 0x0C0B0A09};
+    TEST_ASSERT_EQUAL_PTR(frame, FrameCodec::encode(header, payload));
+
+    // The version and header size come from the codec, whatever the caller put in
+    const uint8_t expected[] = {FrameCodec::VERSION, 3, 0x03, 16, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0xAB, 0xCD};
+    TEST_ASSERT_EQUAL_MEMORY(expected, frame, sizeof(expected));
+}
+
+static void test_random_frames_round_trip() {
+    std::vector<uint8_t> buffer(FrameCodec::HEADER_SIZE + 1024);
+    for (int i = 0; i < 10000; i++) {
+        size_t length = nextRandom() % 1025;
+        uint8_t *payload = buffer.data() + FrameCodec::HEADER_SIZE;
+        for (size_t b = 0; b < length; b++) {
+            payload[b] = static_cast<uint8_t>(nextRandom());
+        }
+        std::vector<uint8_t> original(payload, payload + length);
+        FrameHeader header{FrameCodec::VERSION, static_cast<uint8_t>(1 + nextRandom() % 4),
+                           static_cast<uint8_t>(nextRandom() & 3), FrameCodec::HEADER_SIZE, nextRandom(), nextRandom(),
+                           nextRandom()};
+
+        const uint8_t *frame = FrameCodec::encode(header, payload);
+        FrameHeader decoded{};
+        const uint8_t *decodedPayload = nullptr;
+        size_t decodedLength = 0;
+        TEST_ASSERT_TRUE(FrameCodec::decode(frame, FrameCodec::HEADER_SIZE + length, decoded, decodedPayload,
+                                            decodedLength));
+        TEST_ASSERT_EQUAL(header.type, decoded.type);
+        TEST_ASSERT_EQUAL(header.flags, decoded.flags);
+        TEST_ASSERT_EQUAL_UINT32(header.stream, decoded.stream);
+        TEST_ASSERT_EQUAL_UINT32(header.sequence, decoded.sequence);
+        TEST_ASSERT_EQUAL_UINT32(header.offset, decoded.offset);
+        TEST_ASSERT_EQUAL_PTR(payload, decodedPayload); // Decoding points into the frame instead of copying
+        TEST_ASSERT_EQUAL(length, decodedLength);
+        TEST_ASSERT_TRUE(length == 0 || memcmp(original.data(), payload, length) == 0);
+    }
+}
+
+static void test_malformed_frames_are_rejected() {
+    uint8_t frame[FrameCodec::HEADER_SIZE + 8] = {};
+    FrameCodec::encode({FrameCodec::VERSION, 1, 0, 0, 7, 0, 0}, frame + FrameCodec::HEADER_SIZE);
+    FrameHeader header{};
+    const uint8_t *payload = nullptr;
+    size_t length = 0;
+    TEST_ASSERT_TRUE(FrameCodec::decode(frame, sizeof(frame), header, payload, length));
+
+    TEST_ASSERT_FALSE(FrameCodec::decode(frame, FrameCodec::HEADER_SIZE - 1, header, payload, length));
+    TEST_ASSERT_FALSE(FrameCodec::decode(frame, 0, header, payload, length));
+
+    frame[0] = FrameCodec::VERSION + 1;
+    TEST_ASSERT_FALSE(FrameCodec::decode(frame, sizeof(frame), header, payload, length));
+    frame[0] = FrameCodec::VERSION;
+
+    frame[3] = FrameCodec::HEADER_SIZE - 1; // Header claims to end inside itself
+    TEST_ASSERT_FALSE(FrameCodec::decode(frame, sizeof(frame), header, payload, length));
+    frame[3] = sizeof(frame) + 1; // Header claims to run past the frame
+    TEST_ASSERT_FALSE(FrameCodec::decode(frame, sizeof(frame), header, payload, length));
+}
+
+static void test_longer_header_is_skipped() {
+    // A later version may append fields; the payload still starts where headerSize says
+    uint8_t frame[FrameCodec::HEADER_SIZE + 8] = {};
+    FrameCodec::encode({FrameCodec::VERSION, 1, 0, 0, 7, 0, 0}, frame + FrameCodec::HEADER_SIZE);
+    frame[3] = FrameCodec::HEADER_SIZE + 4;
+    FrameHeader header{};
+    const uint8_t *payload = nullptr;
+    size_t length = 0;
+    TEST_ASSERT_TRUE(FrameCodec::decode(frame, sizeof(frame), header, payload, length));
+    TEST_ASSERT_EQUAL_PTR(frame + FrameCodec::HEADER_SIZE + 4, payload);
+    TEST_ASSERT_EQUAL(4, length);
+    TEST_ASSERT_EQUAL_UINT32(7, header.stream);
+}
+
+static void test_header_fits_pool_headroom() {
+    PooledBuffer chunk = BufferPool::acquire();
+    TEST_ASSERT_TRUE(static_cast<bool>(chunk));
+    memset(chunk.data(), 0x5A, POOL_CHUNK_SIZE);
+    chunk.setSize(POOL_CHUNK_SIZE);
+    uint8_t *frame = FrameCodec::encode({FrameCodec::VERSION, 1, FRAME_FIRST, 0, 1, 0, 0}, chunk.data());
+    TEST_ASSERT_TRUE(FrameCodec::HEADER_SIZE <= POOL_CHUNK_HEADROOM);
+    TEST_ASSERT_EQUAL_PTR(chunk.data() - FrameCodec::HEADER_SIZE, frame);
+    TEST_ASSERT_EQUAL_UINT8(0x5A, chunk.data()[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x5A, chunk.data()[POOL_CHUNK_SIZE - 1]);
+}
+
+static void test_name_covers_every_type() {
+    TEST_ASSERT_EQUAL_STRING("audio", FrameCodec::name(FrameType::AUDIO));
+    TEST_ASSERT_EQUAL_STRING("talk", FrameCodec::name(FrameType::TALK));
+    TEST_ASSERT_EQUAL_STRING("spool", FrameCodec::name(FrameType::SPOOL));
+    TEST_ASSERT_EQUAL_STRING("journal", FrameCodec::name(FrameType::JOURNAL));
+    TEST_ASSERT_EQUAL_STRING("unknown", FrameCodec::name(static_cast<FrameType>(0)));
+}
+
+// Header in the chunk's headroom against what sendAudioChunk used to do: allocate, copy a prefix and the chunk
+static void test_throughput() {
+    static constexpr size_t FRAMES = 200000;
+    PooledBuffer chunk = BufferPool::acquire();
+    for (size_t i = 0; i < POOL_CHUNK_SIZE; i++) {
+        chunk.data()[i] = static_cast<uint8_t>(i);
+    }
+    chunk.setSize(POOL_CHUNK_SIZE);
+    uint32_t checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < FRAMES; i++) {
+        FrameHeader header{FrameCodec::VERSION, static_cast<uint8_t>(FrameType::AUDIO), 0, FrameCodec::HEADER_SIZE,
+                           1, i, static_cast<uint32_t>(i * POOL_CHUNK_SIZE)};
+        const uint8_t *frame = FrameCodec::encode(header, chunk.data());
+        FrameHeader decoded{};
+        const uint8_t *payload = nullptr;
+        size_t length = 0;
+        FrameCodec::decode(frame, FrameCodec::HEADER_SIZE + chunk.size(), decoded, payload, length);
+        checksum += decoded.sequence + payload[length - 1];
+    }
+    auto inPlaceNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    static constexpr size_t COPIED_FRAMES = FRAMES / 20;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < COPIED_FRAMES; i++) {
+        auto *frame = new uint8_t[chunk.size() + 6];
+        memcpy(frame, "AUDIO:", 6);
+        memcpy(frame + 6, chunk.data(), chunk.size());
+        checksum += frame[i % (chunk.size() + 6)];
+        delete[] frame;
+    }
+    auto copiedNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    char line[160];
+    snprintf(line, sizeof(line), "8 KB frames: in place %.1f M frames/s, copied %.2f M frames/s (checksum %u)",
+             FRAMES * 1e3 / inPlaceNanos, COPIED_FRAMES * 1e3 / copiedNanos, checksum);
+    TEST_MESSAGE(line);
+}
+
+int main() {
+    seedRandom(362436069u);
+    BufferPool::begin(4);
+    UNITY_BEGIN();
+    RUN_TEST(test_header_layout_is_little_endian);
+    RUN_TEST(test_random_frames_round_trip);
+    RUN_TEST(test_malformed_frames_are_rejected);
+    RUN_TEST(test_longer_header_is_skipped);
+    RUN_TEST(test_header_fits_pool_headroom);
+    RUN_TEST(test_name_covers_every_type);
+    RUN_TEST(test_throughput);
+    return UNITY_END();
+}
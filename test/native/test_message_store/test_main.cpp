@@ -0,0 +1,299 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <vector>
+#include "config.h"
+#include "message_store.h"
+#include "../../test_random.h"
+
+static constexpr size_t STORE_SLABS = 48;
+static constexpr uint32_t OPERATIONS = 20000;
+static constexpr size_t MAX_MESSAGE_BYTES = 6 * MESSAGE_SLAB_SIZE;
+
+// What the store should hold for one message. Bytes before readableFrom have been released.
+struct Model {
+    uint16_t id;
+    MessageDirection direction;
+    bool played;
+    size_t readableFrom;
+    std::vector<uint8_t> bytes;
+};
+
+static std::vector<Model> models;
+static uint32_t expectedEvictions = 0;
+
+static size_t slabsFor(const Model &model) {
+    size_t firstSlab = model.readableFrom / MESSAGE_SLAB_SIZE;
+    size_t end = (model.bytes.size() + MESSAGE_SLAB_SIZE - 1) / MESSAGE_SLAB_SIZE;
+    return end > firstSlab ? end - firstSlab : 0;
+}
+
+static void verifyContent(const Model &model) {
+    TEST_ASSERT_EQUAL(model.bytes.size(), MessageStore::length(model.id));
+    size_t offset = model.readableFrom;
+    while (offset < model.bytes.size()) {
+        size_t length = 0;
+        const uint8_t *region = MessageStore::readRegion(model.id, offset, length);
+        TEST_ASSERT_NOT_NULL(region);
+        TEST_ASSERT_TRUE(length > 0 && length <= MESSAGE_SLAB_SIZE);
+        TEST_ASSERT_TRUE((offset + length) % MESSAGE_SLAB_SIZE == 0 || offset + length == model.bytes.size());
+        TEST_ASSERT_EQUAL_MEMORY(model.bytes.data() + offset, region, length);
+        offset += length;
+    }
+    size_t length = 0;
+    TEST_ASSERT_NULL(MessageStore::readRegion(model.id, model.bytes.size(), length));
+}
+
+// Drops models whose message the store evicted; only played ones may go
+static void reconcile() {
+    for (size_t i = 0; i < models.size();) {
+        MessageInfo info;
+        if (MessageStore::getInfo(models[i].id, info)) {
+            TEST_ASSERT_EQUAL(models[i].played, info.played);
+            TEST_ASSERT_EQUAL(static_cast<int>(models[i].direction), static_cast<int>(info.direction));
+            i++;
+            continue;
+        }
+        TEST_ASSERT_TRUE(models[i].played);
+        expectedEvictions++;
+        models.erase(models.begin() + i);
+    }
+}
+
+// Every slab is either free or counted by exactly one message, and the byte accounting adds up
+static void verifyStats() {
+    MessageStoreStats stats = MessageStore::getStats();
+    size_t usedSlabs = 0;
+    size_t stored = 0;
+    for (const Model &model: models) {
+        usedSlabs += slabsFor(model);
+        stored += model.bytes.size() - model.readableFrom / MESSAGE_SLAB_SIZE * MESSAGE_SLAB_SIZE;
+    }
+    TEST_ASSERT_EQUAL(STORE_SLABS, stats.slabCount);
+    TEST_ASSERT_EQUAL(models.size(), stats.messages);
+    TEST_ASSERT_EQUAL(STORE_SLABS - usedSlabs, stats.freeSlabs);
+    TEST_ASSERT_EQUAL(stored, stats.storedBytes);
+    TEST_ASSERT_EQUAL(usedSlabs * MESSAGE_SLAB_SIZE, stats.storedBytes + stats.slackBytes);
+    TEST_ASSERT_LESS_OR_EQUAL(stats.freeSlabs, stats.minFreeSlabs);
+    TEST_ASSERT_EQUAL_UINT32(expectedEvictions, stats.evictions);
+}
+
+static bool canGrow(uint16_t id) {
+    size_t free = MessageStore::getStats().freeSlabs;
+    for (const Model &model: models) {
+        if (model.played && model.id != id) {
+            free += slabsFor(model);
+        }
+    }
+    return free > 0;
+}
+
+struct Append {
+    size_t wanted;
+    size_t promised; // What writableBytes() said would fit
+    size_t written;
+};
+
+static Append appendTo(Model &model, uint32_t &maxAllocationMicros) {
+    size_t length = 1 + nextRandom() % (MESSAGE_SLAB_SIZE + MESSAGE_SLAB_SIZE / 2);
+    if (model.bytes.size() + length > MAX_MESSAGE_BYTES) {
+        return {0, 0, 0};
+    }
+    size_t room = MessageStore::writableBytes(model.id);
+    std::vector<uint8_t> data(length);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = static_cast<uint8_t>(nextRandom());
+    }
+
+    uint32_t start = micros();
+    size_t written = MessageStore::write(model.id, data.data(), length);
+    uint32_t elapsed = micros() - start;
+    if (elapsed > maxAllocationMicros) {
+        maxAllocationMicros = elapsed;
+    }
+    model.bytes.insert(model.bytes.end(), data.begin(), data.begin() + written);
+    return {length, room, written};
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_random_operations_match_model() {
+    uint32_t failedCreates = 0;
+    uint32_t maxAllocationMicros = 0;
+    for (uint32_t op = 0; op < OPERATIONS; op++) {
+        uint32_t choice = nextRandom() % 100;
+        Model *model = models.empty() ? nullptr : &models[nextRandom() % models.size()];
+
+        if (model == nullptr || choice < 10) {
+            auto direction = nextRandom() & 1 ? MessageDirection::INBOUND : MessageDirection::OUTBOUND;
+            uint16_t id = MessageStore::create(direction);
+            reconcile();
+            if (id == 0) {
+                failedCreates++;
+                TEST_ASSERT_EQUAL(MESSAGE_STORE_MAX_MESSAGES, models.size());
+                for (const Model &other: models) {
+                    TEST_ASSERT_FALSE(other.played);
+                }
+            } else {
+                models.push_back({id, direction, false, 0, {}});
+            }
+        } else if (choice < 55) {
+            uint16_t id = model->id;
+            Append append = appendTo(*model, maxAllocationMicros);
+            reconcile();
+            // Never short of what was promised, evicting played messages (but not this one) to get it
+            TEST_ASSERT_EQUAL(append.wanted < append.promised ? append.wanted : append.promised, append.written);
+            if (append.written < append.wanted) {
+                TEST_ASSERT_FALSE(canGrow(id)); // Only when no free or played slab is left
+            }
+        } else if (choice < 62) {
+            model->played = true;
+            MessageStore::markPlayed(model->id);
+        } else if (choice < 68) {
+            MessageStore::remove(model->id);
+            models.erase(models.begin() + (model - models.data()));
+        } else if (choice < 76 && model->readableFrom == 0) {
+            size_t length = model->bytes.empty() ? 0 : nextRandom() % model->bytes.size();
+            MessageStore::truncate(model->id, length);
+            model->bytes.resize(length);
+        } else if (choice < 84 && model->readableFrom == 0) {
+            size_t bytes = model->bytes.empty() ? 0 : nextRandom() % (model->bytes.size() + 1);
+            MessageStore::discardFront(model->id, bytes);
+            model->bytes.erase(model->bytes.begin(), model->bytes.begin() + bytes);
+        } else if (choice < 90) {
+            // Played while still arriving: the whole slabs before the read position go back to the pool
+            size_t offset = model->bytes.empty() ? 0 : nextRandom() % (model->bytes.size() + 1);
+            MessageStore::release(model->id, offset);
+            size_t whole = offset / MESSAGE_SLAB_SIZE * MESSAGE_SLAB_SIZE;
+            size_t limit = model->bytes.size() / MESSAGE_SLAB_SIZE * MESSAGE_SLAB_SIZE;
+            whole = whole < limit ? whole : limit;
+            model->readableFrom = whole > model->readableFrom ? whole : model->readableFrom;
+        } else if (!model->bytes.empty()) {
+            verifyContent(*model);
+        }
+
+        verifyStats();
+        if (op % 1000 == 0) {
+            for (const Model &each: models) {
+                verifyContent(each);
+            }
+        }
+    }
+
+    MessageStoreStats stats = MessageStore::getStats();
+    size_t allocated = (stats.slabCount - stats.freeSlabs) * MESSAGE_SLAB_SIZE;
+    char line[192];
+    snprintf(line, sizeof(line),
+             "%u ops: %u evictions, %u failed allocations, %u failed creates, min free %u/%u slabs, "
+             "slack %u%%, slowest write %u us",
+             OPERATIONS, stats.evictions, stats.allocationFailures, failedCreates,
+             static_cast<unsigned>(stats.minFreeSlabs), static_cast<unsigned>(stats.slabCount),
+             allocated ? static_cast<unsigned>(stats.slackBytes * 100 / allocated) : 0, maxAllocationMicros);
+    TEST_MESSAGE(line);
+}
+
+// Taking and returning slabs costs the same with the pool empty or full
+static void test_allocation_time_is_flat() {
+    for (const Model &model: models) {
+        MessageStore::remove(model.id);
+    }
+    models.clear();
+
+    uint16_t id = MessageStore::create(MessageDirection::OUTBOUND);
+    TEST_ASSERT_NOT_EQUAL(0, id);
+    uint32_t first = 0;
+    uint32_t last = 0;
+    for (size_t slab = 0; slab < STORE_SLABS; slab++) {
+        size_t length = 0;
+        uint32_t start = micros();
+        TEST_ASSERT_NOT_NULL(MessageStore::writeRegion(id, length));
+        uint32_t elapsed = micros() - start;
+        MessageStore::commitWrite(id, length);
+        if (slab == 0) {
+            first = elapsed;
+        }
+        last = elapsed;
+    }
+    size_t length = 0;
+    TEST_ASSERT_NULL(MessageStore::writeRegion(id, length));
+    MessageStore::remove(id);
+    TEST_ASSERT_EQUAL(STORE_SLABS, MessageStore::getStats().freeSlabs);
+
+    char line[96];
+    snprintf(line, sizeof(line), "slab allocation: %u us with the pool full, %u us with one slab left", first, last);
+    TEST_MESSAGE(line);
+}
+
+// Playback cost per second of audio: the read cursor over the store against the single buffer playback used
+// to shift down after every I2S write. Both copy each block into a stand-in DMA buffer, as i2s_write does.
+static void test_playback_bytes_moved() {
+    static constexpr size_t BYTES_PER_SECOND = SAMPLE_RATE * (BITS_PER_SAMPLE / 8);
+    static constexpr size_t BLOCK = DMA_BUF_LEN * (BITS_PER_SAMPLE / 8); // What playNextBlock() writes
+    static constexpr size_t SHIFTED_BLOCK = 1024; // What the old loop wrote before shifting the rest down
+    static const uint32_t lengths[] = {5, 20, 40}; // Seconds; the longest nearly fills the test store
+    std::vector<uint8_t> dma(BLOCK);
+    volatile uint8_t sink = 0;
+
+    for (uint32_t seconds: lengths) {
+        size_t bytes = seconds * BYTES_PER_SECOND;
+        std::vector<uint8_t> audio(bytes);
+        for (uint8_t &byte: audio) {
+            byte = static_cast<uint8_t>(nextRandom());
+        }
+
+        uint16_t id = MessageStore::create(MessageDirection::INBOUND);
+        TEST_ASSERT_NOT_EQUAL(0, id);
+        TEST_ASSERT_EQUAL(bytes, MessageStore::write(id, audio.data(), bytes));
+        uint64_t cursorMoved = 0;
+        uint32_t start = micros();
+        for (size_t index = 0; index < bytes;) {
+            size_t contiguous = 0;
+            const uint8_t *block = MessageStore::readRegion(id, index, contiguous);
+            TEST_ASSERT_NOT_NULL(block);
+            size_t length = contiguous < BLOCK ? contiguous : BLOCK;
+            memcpy(dma.data(), block, length);
+            sink = sink + dma[0];
+            cursorMoved += length;
+            index += length;
+        }
+        uint32_t cursorMicros = micros() - start;
+        MessageStore::remove(id);
+
+        uint64_t shiftedMoved = 0;
+        start = micros();
+        for (size_t filled = bytes; filled > 0;) {
+            size_t length = filled < SHIFTED_BLOCK ? filled : SHIFTED_BLOCK;
+            memcpy(dma.data(), audio.data(), length);
+            sink = sink + dma[0];
+            memmove(audio.data(), audio.data() + length, filled - length);
+            shiftedMoved += filled;
+            filled -= length;
+        }
+        uint32_t shiftedMicros = micros() - start;
+
+        // The cursor moves each byte once; shifting moves it again for every block played ahead of it, so its
+        // cost per second grows with the length of the message
+        TEST_ASSERT_EQUAL_UINT32(bytes, static_cast<uint32_t>(cursorMoved));
+        TEST_ASSERT_TRUE(shiftedMoved >= cursorMoved * (bytes / SHIFTED_BLOCK / 2));
+
+        char line[192];
+        snprintf(line, sizeof(line), "%u s message, bytes moved per second of audio: cursor %u in %u us, "
+                                     "shifting buffer %u in %u us",
+                 seconds, static_cast<unsigned>(cursorMoved / seconds), cursorMicros,
+                 static_cast<unsigned>(shiftedMoved / seconds), shiftedMicros);
+        TEST_MESSAGE(line);
+    }
+}
+
+int main() {
+    seedRandom(2463534242u);
+    if (!MessageStore::begin(STORE_SLABS * MESSAGE_SLAB_SIZE)) {
+        return 1;
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_random_operations_match_model);
+    RUN_TEST(test_allocation_time_is_flat);
+    RUN_TEST(test_playback_bytes_moved);
+    return UNITY_END();
+}
@@ -0,0 +1,203 @@
+#include <unity.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "config.h"
+#include "pcm_convert.h"
+#include "../../test_random.h"
+
+static constexpr size_t BLOCK_SAMPLES = CAPTURE_DMA_BUF_LEN;
+
+// Straight from the definitions, in 64-bit arithmetic so nothing here can overflow the way a kernel might
+static int16_t clamp(int64_t value) {
+    return static_cast<int16_t>(value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value);
+}
+
+static int32_t randomSlot() {
+    uint32_t r = nextRandom();
+    switch (r & 7) {
+        case 0:
+            return INT32_MAX;
+        case 1:
+            return INT32_MIN;
+        case 2:
+            return static_cast<int32_t>(nextRandom()) >> 12; // Near zero, where the sign of the shift shows
+        default:
+            return static_cast<int32_t>(nextRandom());
+    }
+}
+
+static int16_t randomSample() {
+    uint32_t r = nextRandom();
+    return (r & 0x700) == 0 ? (r & 1 ? INT16_MAX : INT16_MIN) : static_cast<int16_t>(r >> 16);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_saturate_clamps_to_int16() {
+    TEST_ASSERT_EQUAL_INT16(INT16_MAX, PcmConvert::saturate(INT16_MAX + 1));
+    TEST_ASSERT_EQUAL_INT16(INT16_MAX, PcmConvert::saturate(INT32_MAX));
+    TEST_ASSERT_EQUAL_INT16(INT16_MIN, PcmConvert::saturate(INT16_MIN - 1));
+    TEST_ASSERT_EQUAL_INT16(INT16_MIN, PcmConvert::saturate(INT32_MIN));
+    TEST_ASSERT_EQUAL_INT16(-5, PcmConvert::saturate(-5));
+}
+
+static void test_narrow32_shifts_and_saturates() {
+    const int32_t slots[] = {0x12345678, -0x12345678, INT32_MAX, INT32_MIN, -1, 1 << 15, (1 << 15) - 1};
+    int16_t out[7];
+    PcmConvert::narrow32(slots, out, 7, 16);
+    const int16_t top[] = {0x1234, -0x1235, INT16_MAX, INT16_MIN, -1, 0, 0}; // Arithmetic shift rounds down
+    TEST_ASSERT_EQUAL_INT16_ARRAY(top, out, 7);
+
+    PcmConvert::narrow32(slots, out, 7, 8); // 6 dB per step lower: the loud slots hit the rails
+    const int16_t louder[] = {INT16_MAX, INT16_MIN, INT16_MAX, INT16_MIN, -1, 128, 127};
+    TEST_ASSERT_EQUAL_INT16_ARRAY(louder, out, 7);
+
+    std::vector<int32_t> random(4096);
+    std::vector<int16_t> narrowed(random.size());
+    for (int32_t &slot: random) {
+        slot = randomSlot();
+    }
+    for (uint8_t shift = 0; shift < 32; shift++) {
+        PcmConvert::narrow32(random.data(), narrowed.data(), random.size(), shift);
+        for (size_t i = 0; i < random.size(); i++) {
+            TEST_ASSERT_EQUAL_INT16(clamp(static_cast<int64_t>(random[i]) >> shift), narrowed[i]);
+        }
+    }
+}
+
+static void test_narrow32_keeps_one_channel() {
+    for (size_t channels = 1; channels <= 4; channels++) {
+        for (size_t channel = 0; channel < channels; channel++) {
+            size_t frames = 1 + nextRandom() % 300;
+            std::vector<int32_t> interleaved(frames * channels);
+            for (size_t i = 0; i < interleaved.size(); i++) {
+                // Each channel in its own range, so a slot from the wrong one cannot pass
+                interleaved[i] = static_cast<int32_t>((i % channels) * 0x10000000 + (i / channels) * 0x10000);
+            }
+            std::vector<int16_t> mono(frames + 1, 0x5A5A); // One guard sample
+            PcmConvert::narrow32(interleaved.data(), mono.data(), frames, 16, channels, channel);
+            for (size_t frame = 0; frame < frames; frame++) {
+                TEST_ASSERT_EQUAL_INT16(clamp(interleaved[frame * channels + channel] >> 16), mono[frame]);
+            }
+            TEST_ASSERT_EQUAL_INT16(0x5A5A, mono[frames]);
+        }
+    }
+}
+
+static void test_mean() {
+    TEST_ASSERT_EQUAL_INT32(0, PcmConvert::mean(nullptr, 0));
+    const int16_t small[] = {-1, -2};
+    TEST_ASSERT_EQUAL_INT32(-1, PcmConvert::mean(small, 2)); // Truncated toward zero
+    const int16_t mixed[] = {100, -40, 7};
+    TEST_ASSERT_EQUAL_INT32(22, PcmConvert::mean(mixed, 3));
+
+    // A long block at a rail cannot overflow the sum
+    std::vector<int16_t> rail(1 << 20, INT16_MIN);
+    TEST_ASSERT_EQUAL_INT32(INT16_MIN, PcmConvert::mean(rail.data(), rail.size()));
+    rail.assign(rail.size(), INT16_MAX);
+    TEST_ASSERT_EQUAL_INT32(INT16_MAX, PcmConvert::mean(rail.data(), rail.size()));
+
+    std::vector<int16_t> random(BLOCK_SAMPLES);
+    for (int i = 0; i < 200; i++) {
+        int64_t sum = 0;
+        size_t count = 1 + nextRandom() % BLOCK_SAMPLES;
+        for (size_t s = 0; s < count; s++) {
+            random[s] = randomSample();
+            sum += random[s];
+        }
+        TEST_ASSERT_EQUAL_INT32(static_cast<int32_t>(sum / static_cast<int64_t>(count)),
+                                PcmConvert::mean(random.data(), count));
+    }
+}
+
+static void test_remove_dc_and_gain_saturates_both_steps() {
+    // Centring saturates before the gain: INT16_MIN - 1 pins at INT16_MIN, and at unity gain it stays there
+    int16_t samples[] = {INT16_MIN, INT16_MAX, 0, 1000};
+    PcmConvert::removeDcAndGain(samples, 4, 1, PCM_UNITY_GAIN);
+    const int16_t centred[] = {INT16_MIN, INT16_MAX - 1, -1, 999};
+    TEST_ASSERT_EQUAL_INT16_ARRAY(centred, samples, 4);
+
+    int16_t loud[] = {20000, -20000, 100, -1};
+    PcmConvert::removeDcAndGain(loud, 4, 0, 2 * PCM_UNITY_GAIN);
+    const int16_t doubled[] = {INT16_MAX, INT16_MIN, 200, -2};
+    TEST_ASSERT_EQUAL_INT16_ARRAY(doubled, loud, 4);
+
+    static const int16_t offsets[] = {0, 1, -1, 300, -2048, INT16_MAX, INT16_MIN};
+    static const int16_t gains[] = {PCM_UNITY_GAIN, 0, 1, 255, 257, 1024, 4096, INT16_MAX, -256, INT16_MIN};
+    std::vector<int16_t> input(BLOCK_SAMPLES);
+    std::vector<int16_t> output(BLOCK_SAMPLES);
+    for (int16_t offset: offsets) {
+        for (int16_t gain: gains) {
+            for (int16_t &sample: input) {
+                sample = randomSample();
+            }
+            output = input;
+            PcmConvert::removeDcAndGain(output.data(), output.size(), offset, gain);
+            for (size_t i = 0; i < input.size(); i++) {
+                int64_t expected = clamp(clamp(static_cast<int64_t>(input[i]) - offset) * static_cast<int64_t>(gain) >> 8);
+                TEST_ASSERT_EQUAL_INT16(expected, output[i]);
+            }
+            // Off the ESP32-S3 the dispatching entry point is the scalar kernel
+            std::vector<int16_t> scalar = input;
+            PcmConvert::removeDcAndGainScalar(scalar.data(), scalar.size(), offset, gain);
+            TEST_ASSERT_EQUAL_INT16_ARRAY(output.data(), scalar.data(), output.size());
+        }
+    }
+}
+
+template<typename Kernel>
+static double samplesPerSecond(size_t samplesPerPass, Kernel kernel) {
+    static constexpr int PASSES = 20000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < PASSES; i++) {
+        kernel();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return samplesPerPass * PASSES / seconds;
+}
+
+// One capture DMA buffer per pass, as the audio and intercom tasks call them
+static void test_throughput() {
+    std::vector<int32_t> slots(2 * BLOCK_SAMPLES);
+    for (int32_t &slot: slots) {
+        slot = randomSlot();
+    }
+    std::vector<int16_t> pcm(BLOCK_SAMPLES);
+    volatile int32_t sink = 0;
+
+    double mono = samplesPerSecond(BLOCK_SAMPLES, [&]() {
+        PcmConvert::narrow32(slots.data(), pcm.data(), BLOCK_SAMPLES, MIC_SAMPLE_SHIFT);
+        sink = sink + pcm[sink & 7];
+    });
+    double stereo = samplesPerSecond(BLOCK_SAMPLES, [&]() {
+        PcmConvert::narrow32(slots.data(), pcm.data(), BLOCK_SAMPLES, MIC_SAMPLE_SHIFT, 2, 1);
+        sink = sink + pcm[sink & 7];
+    });
+    double mean = samplesPerSecond(BLOCK_SAMPLES, [&]() {
+        sink = sink + PcmConvert::mean(pcm.data(), BLOCK_SAMPLES);
+    });
+    double gain = samplesPerSecond(BLOCK_SAMPLES, [&]() {
+        PcmConvert::removeDcAndGain(pcm.data(), BLOCK_SAMPLES, 3, MIC_GAIN);
+        sink = sink + pcm[sink & 7];
+    });
+
+    char line[200];
+    snprintf(line, sizeof(line), "M samples/s: narrow32 mono %.0f, narrow32 stereo->mono %.0f, mean %.0f, "
+                                 "removeDcAndGain %.0f", mono / 1e6, stereo / 1e6, mean / 1e6, gain / 1e6);
+    TEST_MESSAGE(line);
+}
+
+int main() {
+    seedRandom(12345);
+    UNITY_BEGIN();
+    RUN_TEST(test_saturate_clamps_to_int16);
+    RUN_TEST(test_narrow32_shifts_and_saturates);
+    RUN_TEST(test_narrow32_keeps_one_channel);
+    RUN_TEST(test_mean);
+    RUN_TEST(test_remove_dc_and_gain_saturates_both_steps);
+    RUN_TEST(test_throughput);
+    return UNITY_END();
+}
@@ -0,0 +1,167 @@
+#include <unity.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "resampler.h"
+
+static constexpr size_t CHUNK_SAMPLES = 333; // Odd-sized chunks, so blocks and phases never line up with them
+static constexpr double AMPLITUDE = 16000;
+
+static Resampler resampler; // Too large for the stack on target, so kept static here as well
+
+// Resamples one second of a sine in chunks and measures the output level relative to the input, in dB.
+// The first and last 100 ms are skipped, so the filter's start-up and the chunk edges do not count.
+static void response(uint32_t inputRate, uint32_t outputRate, double frequency, double &level) {
+    TEST_ASSERT_TRUE(resampler.configure(inputRate, outputRate));
+    std::vector<int16_t> input(inputRate);
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = static_cast<int16_t>(lround(AMPLITUDE * sin(2 * M_PI * frequency * i / inputRate)));
+    }
+    std::vector<int16_t> output;
+    std::vector<int16_t> out(resampler.maxOutput(CHUNK_SAMPLES));
+    for (size_t start = 0; start < input.size(); start += CHUNK_SAMPLES) {
+        size_t count = input.size() - start < CHUNK_SAMPLES ? input.size() - start : CHUNK_SAMPLES;
+        size_t written = resampler.process(input.data() + start, count, out.data());
+        TEST_ASSERT_LESS_OR_EQUAL(resampler.maxOutput(count), written);
+        output.insert(output.end(), out.begin(), out.begin() + written);
+    }
+    TEST_ASSERT_INT_WITHIN(2, outputRate, output.size());
+
+    double power = 0;
+    size_t from = outputRate / 10;
+    size_t to = output.size() - outputRate / 10;
+    for (size_t i = from; i < to; i++) {
+        power += static_cast<double>(output[i]) * output[i];
+    }
+    power /= to - from;
+    level = 10 * log10(power / (AMPLITUDE * AMPLITUDE / 2));
+}
+
+// Pass band up to 3/4 of the lower Nyquist stays flat; everything above that Nyquist is at least 50 dB down
+static void checkPair(uint32_t inputRate, uint32_t outputRate) {
+    double nyquist = (inputRate < outputRate ? inputRate : outputRate) / 2.0;
+    char line[128];
+    for (double fraction: {0.05, 0.25, 0.5, 0.75}) {
+        double level = 0;
+        response(inputRate, outputRate, nyquist * fraction, level);
+        snprintf(line, sizeof(line), "%u -> %u Hz: %.0f Hz at %.2f dB", inputRate, outputRate, nyquist * fraction, level);
+        TEST_MESSAGE(line);
+        TEST_ASSERT_FLOAT_WITHIN(0.5, 0.0, level);
+    }
+    if (outputRate >= inputRate) {
+        return; // Nothing above the input's Nyquist can reach an upsampler
+    }
+    for (double fraction: {1.02, 1.05, 1.125, 1.25, 1.5, 2.0}) {
+        double frequency = nyquist * fraction;
+        if (frequency >= inputRate / 2.0) {
+            break;
+        }
+        double level = 0;
+        response(inputRate, outputRate, frequency, level);
+        snprintf(line, sizeof(line), "%u -> %u Hz: %.0f Hz at %.1f dB", inputRate, outputRate, frequency, level);
+        TEST_MESSAGE(line);
+        TEST_ASSERT_LESS_THAN_FLOAT(-50.0f, level);
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_rate_limits() {
+    TEST_ASSERT_TRUE(Resampler::supports(8000, 48000));
+    TEST_ASSERT_FALSE(Resampler::supports(7999, 16000));
+    TEST_ASSERT_FALSE(Resampler::supports(16000, 48001));
+    TEST_ASSERT_FALSE(resampler.configure(16000, 96000));
+}
+
+static void test_passthrough_copies() {
+    TEST_ASSERT_TRUE(resampler.configure(16000, 16000));
+    TEST_ASSERT_TRUE(resampler.isPassthrough());
+    int16_t input[5] = {1, -2, 3, -4, 5};
+    int16_t out[5];
+    TEST_ASSERT_EQUAL(5, resampler.process(input, 5, out));
+    TEST_ASSERT_EQUAL_INT16_ARRAY(input, out, 5);
+}
+
+static void test_upload_16k_to_8k() {
+    checkPair(16000, 8000);
+}
+
+static void test_prefetch_44k1_to_16k() {
+    checkPair(44100, 16000);
+}
+
+static void test_prefetch_48k_to_16k() {
+    checkPair(48000, 16000);
+}
+
+static void test_prefetch_22k05_to_16k() {
+    checkPair(22050, 16000);
+}
+
+static void test_prefetch_8k_to_16k() {
+    checkPair(8000, 16000);
+}
+
+static void test_max_input_never_overflows_output() {
+    TEST_ASSERT_TRUE(resampler.configure(44100, 16000));
+    std::vector<int16_t> input(4096, 1000);
+    std::vector<int16_t> out(160);
+    size_t produced = 0;
+    size_t consumed = 0;
+    while (consumed + resampler.maxInput(out.size()) <= input.size()) {
+        size_t count = resampler.maxInput(out.size());
+        size_t written = resampler.process(input.data() + consumed, count, out.data());
+        TEST_ASSERT_LESS_OR_EQUAL(out.size(), written);
+        consumed += count;
+        produced += written;
+    }
+    TEST_ASSERT_INT_WITHIN(2, static_cast<long long>(consumed) * 16000 / 44100, produced);
+}
+
+static void benchmark(uint32_t inputRate, uint32_t outputRate) {
+    TEST_ASSERT_TRUE(resampler.configure(inputRate, outputRate));
+    std::vector<int16_t> input(inputRate * 10 / RESAMPLER_BLOCK * RESAMPLER_BLOCK); // About ten seconds
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = static_cast<int16_t>(lround(AMPLITUDE * sin(2 * M_PI * 440 * i / inputRate)));
+    }
+    std::vector<int16_t> out(resampler.maxOutput(RESAMPLER_BLOCK));
+    size_t written = 0;
+    int32_t checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < input.size(); i += RESAMPLER_BLOCK) {
+        size_t count = resampler.process(input.data() + i, RESAMPLER_BLOCK, out.data());
+        written += count;
+        checksum += out[0];
+    }
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    char line[128];
+    snprintf(line, sizeof(line), "%u -> %u Hz: %.1f ns per output sample, %.0fx real time (checksum %d)", inputRate,
+             outputRate, static_cast<double>(nanos) / written, input.size() * 1e9 / inputRate / nanos, checksum);
+    TEST_MESSAGE(line);
+}
+
+static void test_throughput() {
+    benchmark(16000, 8000);
+    benchmark(8000, 16000);
+    benchmark(44100, 16000);
+    benchmark(48000, 16000);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_rate_limits);
+    RUN_TEST(test_passthrough_copies);
+    RUN_TEST(test_upload_16k_to_8k);
+    RUN_TEST(test_prefetch_44k1_to_16k);
+    RUN_TEST(test_prefetch_48k_to_16k);
+    RUN_TEST(test_prefetch_22k05_to_16k);
+    RUN_TEST(test_prefetch_8k_to_16k);
+    RUN_TEST(test_max_input_never_overflows_output);
+    RUN_TEST(test_throughput);
+    return UNITY_END();
+}
@@ -0,0 +1,352 @@
+#include <unity.h>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "spool_log.h"
+#include "../../test_random.h"
+
+static constexpr size_t SEGMENT_SIZE = 2 * SpoolFlash::SECTOR_SIZE; // Two sectors, so an erase can be cut halfway
+static constexpr size_t SEGMENTS = 4;
+
+// NOR flash in a temporary file. Erase sets whole sectors to 0xFF and a write can only clear bits. Programming a
+// byte and erasing a sector each cost one step; once cutAfter()'s budget is spent the power goes: the operation
+// in progress stops where it is and everything fails until powerOn().
+class FileFlash : public SpoolFlash {
+public:
+    explicit FileFlash(size_t bytes) : file(std::tmpfile()), bytes(bytes) {
+        std::vector<uint8_t> blank(bytes, 0xFF);
+        std::fwrite(blank.data(), 1, bytes, file);
+    }
+
+    ~FileFlash() override { std::fclose(file); }
+
+    size_t size() const override { return bytes; }
+
+    bool read(size_t offset, void *dst, size_t length) override {
+        return !dead && offset + length <= bytes && std::fseek(file, static_cast<long>(offset), SEEK_SET) == 0 &&
+               std::fread(dst, 1, length, file) == length;
+    }
+
+    bool write(size_t offset, const void *src, size_t length) override {
+        std::vector<uint8_t> current(length);
+        if (!read(offset, current.data(), length)) {
+            return false;
+        }
+        const auto *data = static_cast<const uint8_t *>(src);
+        size_t done = 0;
+        for (; done < length && spend(); done++) {
+            if ((current[done] & data[done]) != data[done]) {
+                overwrites++; // Would need an erase first; the spool must never do this
+            }
+            current[done] &= data[done];
+        }
+        std::fseek(file, static_cast<long>(offset), SEEK_SET);
+        std::fwrite(current.data(), 1, done, file);
+        return done == length;
+    }
+
+    bool erase(size_t offset, size_t length) override {
+        if (dead || offset % SECTOR_SIZE != 0 || length % SECTOR_SIZE != 0 || offset + length > bytes) {
+            return false;
+        }
+        std::vector<uint8_t> blank(SECTOR_SIZE, 0xFF);
+        for (size_t sector = offset; sector < offset + length; sector += SECTOR_SIZE) {
+            if (!spend()) {
+                return false;
+            }
+            std::fseek(file, static_cast<long>(sector), SEEK_SET);
+            std::fwrite(blank.data(), 1, SECTOR_SIZE, file);
+        }
+        return true;
+    }
+
+    void cutAfter(size_t steps) { budget = steps; }
+
+    void powerOn() {
+        dead = false;
+        budget = SIZE_MAX;
+    }
+
+    size_t steps = 0;
+    size_t overwrites = 0;
+
+private:
+    bool spend() {
+        if (budget == 0) {
+            dead = true;
+            return false;
+        }
+        budget--;
+        steps++;
+        return true;
+    }
+
+    std::FILE *file;
+    size_t bytes;
+    size_t budget = SIZE_MAX;
+    bool dead = false;
+};
+
+// What the scenario asked of the log, and which of it the log reported as done
+struct Recording {
+    uint32_t id;
+    std::vector<uint8_t> bytes; // Every chunk appended, accepted or not
+    bool begun;
+    uint32_t durable;    // Bytes whose appends returned true
+    uint32_t ackedUpTo;  // Highest ack that returned true
+    uint32_t maxAsked;   // Highest ack offered
+};
+
+// Recordings of a few KB each, most acknowledged once ended and one only halfway, so segments fill, get
+// reclaimed and are erased again. prepareNextSegment() runs between operations as the spool task runs it.
+static void runScenario(SpoolLog &log, std::vector<Recording> &recordings) {
+    seedRandom(88172645u);
+    recordings.clear();
+    for (uint32_t id = 1; id <= 8; id++) {
+        recordings.push_back({id, {}, false, 0, 0, 0});
+        Recording &r = recordings.back();
+        r.begun = log.beginSession(id, {16000, 1, 0});
+        log.prepareNextSegment();
+        size_t chunks = 4 + nextRandom() % 8;
+        bool accepted = r.begun;
+        for (size_t c = 0; c < chunks; c++) {
+            std::vector<uint8_t> chunk(1 + nextRandom() % 700);
+            for (uint8_t &byte: chunk) {
+                byte = static_cast<uint8_t>(nextRandom());
+            }
+            accepted = log.append(id, chunk.data(), chunk.size()) && accepted;
+            r.bytes.insert(r.bytes.end(), chunk.begin(), chunk.end());
+            if (accepted) {
+                r.durable = static_cast<uint32_t>(r.bytes.size());
+            }
+            log.prepareNextSegment();
+        }
+        log.endSession(id);
+        log.prepareNextSegment();
+
+        // The server takes all but the last two; recording 3 only gets halfway before the link drops
+        if (id >= 2 && id <= 6) {
+            Recording &previous = recordings[id - 2];
+            uint32_t offset = previous.id == 3 ? previous.durable / 2 : previous.durable;
+            previous.maxAsked = offset > previous.maxAsked ? offset : previous.maxAsked;
+            if (log.acknowledge(previous.id, offset)) {
+                previous.ackedUpTo = offset;
+            }
+            log.prepareNextSegment();
+        }
+    }
+}
+
+// Reads a recording back from its acknowledged offset: the chunks must be contiguous, match what was
+// appended and end at `written`
+static void verifyReadable(SpoolLog &log, const Recording &r, const SpoolSession &entry) {
+    std::vector<uint8_t> chunk(SEGMENT_SIZE);
+    uint32_t offset = entry.acked;
+    uint32_t chunkOffset = 0;
+    size_t length = 0;
+    while ((length = log.readChunk(r.id, offset, chunk.data(), chunk.size(), chunkOffset)) > 0) {
+        TEST_ASSERT_LESS_OR_EQUAL(offset, chunkOffset);
+        TEST_ASSERT_TRUE(chunkOffset + length <= r.bytes.size());
+        TEST_ASSERT_EQUAL_MEMORY(r.bytes.data() + chunkOffset, chunk.data(), length);
+        offset = chunkOffset + static_cast<uint32_t>(length);
+    }
+    TEST_ASSERT_EQUAL_UINT32(entry.written, offset);
+}
+
+// After a remount nothing the log confirmed may be lost, and nothing it did not write may appear
+static void verifyRecovered(SpoolLog &log, const std::vector<Recording> &recordings) {
+    for (const Recording &r: recordings) {
+        if (r.begun) {
+            TEST_ASSERT_GREATER_OR_EQUAL_UINT32(r.id, log.lastSessionId()); // Ids keep increasing across reboots
+        }
+        const SpoolSession *entry = log.findSession(r.id);
+        if (entry == nullptr) {
+            // Gone only if it was never begun or the server had everything that was confirmed
+            TEST_ASSERT_TRUE(r.durable <= r.maxAsked || !r.begun);
+            continue;
+        }
+        TEST_ASSERT_TRUE(entry->ended);
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(r.durable, entry->written);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(r.bytes.size(), entry->written);
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(r.ackedUpTo, entry->acked);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(r.maxAsked, entry->acked);
+        verifyReadable(log, r, *entry);
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_recordings_survive_a_remount() {
+    FileFlash flash(SEGMENTS * SEGMENT_SIZE);
+    std::vector<Recording> recordings;
+    {
+        SpoolLog log(flash, SEGMENT_SIZE);
+        TEST_ASSERT_TRUE(log.mount());
+        runScenario(log, recordings);
+    }
+    TEST_ASSERT_EQUAL(0, flash.overwrites);
+
+    SpoolLog log(flash, SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(log.mount());
+    SpoolLogStats stats = log.getStats();
+    TEST_ASSERT_EQUAL_UINT32(0, stats.tornRecords);
+    TEST_ASSERT_EQUAL_UINT32(8, log.lastSessionId());
+    verifyRecovered(log, recordings);
+
+    // Unacknowledged recordings are pending, oldest first; 3 is still owed its second half
+    const SpoolSession *pending = log.nextPending(0);
+    TEST_ASSERT_NOT_NULL(pending);
+    TEST_ASSERT_EQUAL_UINT32(3, pending->id);
+    TEST_ASSERT_EQUAL_UINT32(recordings[2].durable / 2, pending->acked);
+    TEST_ASSERT_NULL(log.findSession(1));
+}
+
+static void test_acknowledged_segments_are_reused_evenly() {
+    FileFlash flash(8 * SEGMENT_SIZE);
+    SpoolLog log(flash, SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(log.mount());
+    std::vector<uint8_t> chunk(600, 0x5A);
+    for (uint32_t id = 1; id <= 400; id++) {
+        TEST_ASSERT_TRUE(log.beginSession(id, {16000, 1, 0}));
+        for (int c = 0; c < 5; c++) {
+            TEST_ASSERT_TRUE(log.append(id, chunk.data(), chunk.size()));
+        }
+        TEST_ASSERT_TRUE(log.endSession(id));
+        TEST_ASSERT_TRUE(log.acknowledge(id, 5 * 600));
+        log.prepareNextSegment();
+    }
+    SpoolLogStats stats = log.getStats();
+    TEST_ASSERT_EQUAL_UINT32(0, stats.pendingSessions);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.droppedBytes);
+    TEST_ASSERT_GREATER_THAN_UINT32(8 * 10, stats.erases); // Every segment went round many times
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, stats.maxEraseCount - stats.minEraseCount);
+    TEST_ASSERT_EQUAL(0, flash.overwrites);
+
+    // Wear is carried in the segment headers, so a remount still knows the worst of it
+    SpoolLog remounted(flash, SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(remounted.mount());
+    TEST_ASSERT_EQUAL_UINT32(stats.maxEraseCount, remounted.getStats().maxEraseCount);
+    TEST_ASSERT_EQUAL_UINT32(400, remounted.lastSessionId());
+
+    char line[128];
+    snprintf(line, sizeof(line), "400 recordings: %u erases over %u segments, wear %u-%u", stats.erases,
+             stats.segments, stats.minEraseCount, stats.maxEraseCount);
+    TEST_MESSAGE(line);
+}
+
+static void test_full_spool_truncates_instead_of_overwriting() {
+    FileFlash flash(SEGMENTS * SEGMENT_SIZE);
+    SpoolLog log(flash, SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(log.mount());
+    TEST_ASSERT_TRUE(log.beginSession(1, {16000, 1, 0}));
+    std::vector<uint8_t> chunk(1000, 0x11);
+    size_t accepted = 0;
+    while (log.append(1, chunk.data(), chunk.size())) {
+        accepted += chunk.size();
+    }
+    TEST_ASSERT_FALSE(log.append(1, chunk.data(), 1)); // Refused from here on, so the spooled part has no gap
+    TEST_ASSERT_TRUE(log.findSession(1)->truncated);
+    TEST_ASSERT_EQUAL_UINT32(accepted, log.findSession(1)->written);
+    TEST_ASSERT_GREATER_THAN(0, log.getStats().droppedBytes);
+    TEST_ASSERT_EQUAL(0, flash.overwrites);
+}
+
+// Cuts the power at evenly spread points across the scenario, including inside segment header writes and
+// halfway through erases, then remounts and checks every recording against what the log had confirmed
+static void test_power_cut_anywhere_recovers() {
+    size_t total = 0;
+    {
+        FileFlash flash(SEGMENTS * SEGMENT_SIZE);
+        SpoolLog log(flash, SEGMENT_SIZE);
+        TEST_ASSERT_TRUE(log.mount());
+        std::vector<Recording> recordings;
+        runScenario(log, recordings);
+        total = flash.steps;
+    }
+
+    const size_t stride = total / 3000 + 1;
+    uint32_t torn = 0;
+    size_t cuts = 0;
+    for (size_t cut = 0; cut <= total; cut += stride, cuts++) {
+        // Shift the cut within the stride too, so it lands on every byte of a record header over the sweep
+        size_t at = cut + cuts % stride;
+        FileFlash flash(SEGMENTS * SEGMENT_SIZE);
+        std::vector<Recording> recordings;
+        {
+            SpoolLog log(flash, SEGMENT_SIZE);
+            TEST_ASSERT_TRUE(log.mount());
+            flash.cutAfter(at);
+            runScenario(log, recordings);
+        }
+        flash.powerOn();
+
+        SpoolLog log(flash, SEGMENT_SIZE);
+        TEST_ASSERT_TRUE(log.mount());
+        SpoolLogStats stats = log.getStats();
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, stats.tornRecords);
+        torn += stats.tornRecords;
+        verifyRecovered(log, recordings);
+
+        // The log carries on: a new recording lands after the torn one and survives another remount
+        uint32_t id = log.lastSessionId() + 1;
+        std::vector<uint8_t> chunk(300, 0xA5);
+        if (log.beginSession(id, {16000, 1, 0}) && log.append(id, chunk.data(), chunk.size())) {
+            TEST_ASSERT_TRUE(log.endSession(id));
+            SpoolLog again(flash, SEGMENT_SIZE);
+            TEST_ASSERT_TRUE(again.mount());
+            const SpoolSession *entry = again.findSession(id);
+            TEST_ASSERT_NOT_NULL(entry);
+            TEST_ASSERT_EQUAL_UINT32(chunk.size(), entry->written);
+            uint32_t chunkOffset = 1;
+            std::vector<uint8_t> read(chunk.size());
+            TEST_ASSERT_EQUAL(chunk.size(), again.readChunk(id, 0, read.data(), read.size(), chunkOffset));
+            TEST_ASSERT_EQUAL_UINT32(0, chunkOffset);
+            TEST_ASSERT_TRUE(read == chunk);
+        }
+        TEST_ASSERT_EQUAL(0, flash.overwrites);
+    }
+
+    char line[128];
+    snprintf(line, sizeof(line), "%u power cuts over %u flash steps, %u torn records recovered",
+             static_cast<unsigned>(cuts), static_cast<unsigned>(total), torn);
+    TEST_MESSAGE(line);
+}
+
+static void test_foreign_data_is_treated_as_free() {
+    FileFlash flash(SEGMENTS * SEGMENT_SIZE);
+    std::vector<uint8_t> junk(SEGMENT_SIZE);
+    for (uint8_t &byte: junk) {
+        byte = static_cast<uint8_t>(nextRandom());
+    }
+    for (size_t i = 0; i < SEGMENTS; i++) {
+        TEST_ASSERT_TRUE(flash.erase(i * SEGMENT_SIZE, SEGMENT_SIZE));
+        TEST_ASSERT_TRUE(flash.write(i * SEGMENT_SIZE, junk.data(), junk.size()));
+    }
+
+    SpoolLog log(flash, SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(log.mount());
+    TEST_ASSERT_EQUAL_UINT32(0, log.getStats().liveSegments);
+    TEST_ASSERT_NULL(log.nextPending(0));
+    TEST_ASSERT_TRUE(log.beginSession(1, {8000, 0, 0}));
+    std::vector<uint8_t> chunk(100, 0x42);
+    TEST_ASSERT_TRUE(log.append(1, chunk.data(), chunk.size()));
+    TEST_ASSERT_TRUE(log.endSession(1));
+
+    SpoolLog remounted(flash, SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(remounted.mount());
+    TEST_ASSERT_NOT_NULL(remounted.findSession(1));
+    TEST_ASSERT_EQUAL_UINT32(100, remounted.findSession(1)->written);
+}
+
+int main() {
+    seedRandom(88172645u);
+    UNITY_BEGIN();
+    RUN_TEST(test_recordings_survive_a_remount);
+    RUN_TEST(test_acknowledged_segments_are_reused_evenly);
+    RUN_TEST(test_full_spool_truncates_instead_of_overwriting);
+    RUN_TEST(test_power_cut_anywhere_recovers);
+    RUN_TEST(test_foreign_data_is_treated_as_free);
+    return UNITY_END();
+}
@@ -0,0 +1,272 @@
+#include <unity.h>
+#include <cstdio>
+#include <deque>
+#include "upload_pacer.h"
+
+// The device's settings from config.h, which needs Arduino
+static constexpr uint32_t MAX_CHUNKS = 4;
+static constexpr size_t MIN_CHUNK = 1024;
+static constexpr uint32_t STALL_US = 40000;
+static constexpr uint32_t TICK_US = 250;
+
+// A TCP connection as the blocking socket write sees it: a send buffer that the link drains at a fixed rate,
+// except during a retransmit timeout when nothing drains at all. A write returns once its bytes fit the buffer.
+class ThrottledLink {
+public:
+    ThrottledLink(uint32_t bytesPerSecond, size_t sendBuffer) : bytesPerSecond(bytesPerSecond), sendBuffer(sendBuffer) {}
+
+    // Nothing drains from `from` for `micros`
+    void stallAt(uint32_t from, uint32_t micros) {
+        stallFrom = from;
+        stallUntil = from + micros;
+    }
+
+    // Returns how long the write blocked
+    uint32_t write(size_t bytes, uint32_t now) {
+        drainTo(now);
+        double excess = buffered + bytes - static_cast<double>(sendBuffer);
+        uint32_t blocked = 0;
+        if (excess > 0) {
+            uint32_t start = now >= stallFrom && now < stallUntil ? stallUntil : now;
+            uint32_t drainMicros = static_cast<uint32_t>(excess * 1e6 / bytesPerSecond + 0.5);
+            if (start == now && now < stallFrom && now + drainMicros > stallFrom) {
+                drainMicros += stallUntil - stallFrom; // The stall starts while this write waits
+            }
+            blocked = start - now + drainMicros;
+            drainTo(now + blocked);
+        }
+        buffered += bytes;
+        return blocked;
+    }
+
+private:
+    void drainTo(uint32_t now) {
+        // Time since the last drain, less any of it spent in the stall
+        uint32_t from = drainedAt;
+        uint32_t active = now - from;
+        uint32_t overlapFrom = from > stallFrom ? from : stallFrom;
+        uint32_t overlapTo = now < stallUntil ? now : stallUntil;
+        if (overlapTo > overlapFrom) {
+            active -= overlapTo - overlapFrom;
+        }
+        buffered -= static_cast<double>(active) * bytesPerSecond / 1e6;
+        buffered = buffered > 0 ? buffered : 0;
+        drainedAt = now;
+    }
+
+    uint32_t bytesPerSecond;
+    size_t sendBuffer;
+    double buffered = 0;
+    uint32_t drainedAt = 0;
+    uint32_t stallFrom = UINT32_MAX;
+    uint32_t stallUntil = UINT32_MAX;
+};
+
+struct UploadRun {
+    uint32_t finishedAt;
+    uint32_t longestWrite; // Longest the dispatcher was blocked in one socket write
+    uint32_t longestLateWrite; // The same over the last three quarters of the upload, once the pacer has adapted
+};
+
+// Uploads `total` bytes the way Audio::publishAudioChunks and the AUDIO_DATA_READY handler do: chunks are posted
+// while the pacer allows and written to the socket one at a time, each write reported back to the pacer
+static UploadRun upload(UploadPacer &pacer, ThrottledLink &link, size_t total) {
+    UploadRun run = {0, 0, 0};
+    std::deque<size_t> queue;
+    size_t posted = 0;
+    size_t sent = 0;
+    bool writing = false;
+    size_t writeBytes = 0;
+    uint32_t writeMicros = 0;
+    uint32_t writeDone = 0;
+    uint32_t now = 0;
+    pacer.reset(now);
+    while (sent < total) {
+        while (posted < total && pacer.canPost(now)) {
+            size_t bytes = total - posted < pacer.chunkBytes() ? total - posted : pacer.chunkBytes();
+            pacer.posted(bytes);
+            queue.push_back(bytes);
+            posted += bytes;
+        }
+        if (!writing && !queue.empty()) {
+            writeBytes = queue.front();
+            queue.pop_front();
+            writeMicros = link.write(writeBytes, now);
+            writeDone = now + writeMicros;
+            run.longestWrite = writeMicros > run.longestWrite ? writeMicros : run.longestWrite;
+            if (sent >= total / 4 && writeMicros > run.longestLateWrite) {
+                run.longestLateWrite = writeMicros;
+            }
+            writing = true;
+        }
+        if (writing && static_cast<int32_t>(now - writeDone) >= 0) {
+            pacer.sent(writeBytes, writeMicros, true, now);
+            sent += writeBytes;
+            writing = false;
+            continue; // The dispatcher takes the next chunk straight away
+        }
+        now += TICK_US;
+    }
+    run.finishedAt = now;
+    return run;
+}
+
+// What sendAudioData did before the pacer: a full chunk every 10 ms, whatever the link does with them
+static UploadRun uploadFixed(ThrottledLink &link, size_t total) {
+    UploadRun run = {0, 0, 0};
+    uint32_t now = 0;
+    uint32_t writerFree = 0;
+    for (size_t posted = 0; posted < total; posted += POOL_CHUNK_SIZE) {
+        uint32_t start = now > writerFree ? now : writerFree;
+        uint32_t blocked = link.write(POOL_CHUNK_SIZE, start);
+        writerFree = start + blocked;
+        run.longestWrite = blocked > run.longestWrite ? blocked : run.longestWrite;
+        if (posted >= total / 4 && blocked > run.longestLateWrite) {
+            run.longestLateWrite = blocked;
+        }
+        now += 10000;
+    }
+    run.finishedAt = writerFree > now - 10000 ? writerFree : now - 10000;
+    return run;
+}
+
+static void report(const char *link, const UploadRun &paced, const UploadRun &fixed, size_t total,
+                   const UploadStats &stats) {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "%s: paced %u KB/s, longest write %u ms (%u ms once adapted), %u stalls, window %u-%u, queue max %u | "
+             "fixed 10 ms %u KB/s, longest write %u ms (%u ms)",
+             link, static_cast<unsigned>(total * 1000000ull / 1024 / paced.finishedAt), paced.longestWrite / 1000,
+             paced.longestLateWrite / 1000, stats.stalls, stats.minWindow, stats.window, stats.maxQueueDepth,
+             static_cast<unsigned>(total * 1000000ull / 1024 / fixed.finishedAt), fixed.longestWrite / 1000,
+             fixed.longestLateWrite / 1000);
+    TEST_MESSAGE(line);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_chunk_size_follows_window() {
+    UploadPacer pacer(MAX_CHUNKS, MIN_CHUNK, STALL_US);
+    pacer.reset(0);
+    TEST_ASSERT_EQUAL(POOL_CHUNK_SIZE, pacer.chunkBytes()); // Starts with two full chunks
+    TEST_ASSERT_TRUE(pacer.canPost(0));
+
+    // Stalls halve the window once per window's worth of writes, down to two minimum chunks
+    uint32_t now = 0;
+    for (int i = 0; i < 20; i++) {
+        pacer.posted(pacer.chunkBytes());
+        pacer.sent(pacer.chunkBytes(), STALL_US, true, now += STALL_US);
+    }
+    TEST_ASSERT_EQUAL(MIN_CHUNK, pacer.chunkBytes());
+    TEST_ASSERT_EQUAL_UINT32(2 * MIN_CHUNK, pacer.getStats().minWindow);
+    TEST_ASSERT_EQUAL_UINT32(20, pacer.getStats().stalls);
+
+    // A stall holds off the next post for half the stalled write
+    TEST_ASSERT_FALSE(pacer.canPost(now + STALL_US / 2 - 1));
+    TEST_ASSERT_TRUE(pacer.canPost(now + STALL_US / 2));
+}
+
+static void test_queue_never_exceeds_max_chunks() {
+    UploadPacer pacer(MAX_CHUNKS, MIN_CHUNK, STALL_US);
+    pacer.reset(0);
+    for (int i = 0; i < 200; i++) {
+        pacer.posted(MIN_CHUNK);
+        pacer.sent(MIN_CHUNK, 100, true, i * 1000);
+    }
+    TEST_ASSERT_EQUAL(POOL_CHUNK_SIZE, pacer.chunkBytes());
+    uint32_t queued = 0;
+    while (pacer.canPost(200000)) {
+        pacer.posted(pacer.chunkBytes());
+        queued++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(MAX_CHUNKS, queued);
+    TEST_ASSERT_EQUAL_UINT32(MAX_CHUNKS, pacer.getStats().maxQueueDepth);
+}
+
+static void test_withdraw_and_failures_leave_window_alone() {
+    UploadPacer pacer(MAX_CHUNKS, MIN_CHUNK, STALL_US);
+    pacer.reset(0);
+    uint32_t window = pacer.getStats().window;
+    pacer.posted(POOL_CHUNK_SIZE);
+    pacer.withdraw(POOL_CHUNK_SIZE); // The event queue refused it
+    TEST_ASSERT_EQUAL_UINT32(0, pacer.getStats().postedChunks);
+    TEST_ASSERT_EQUAL_UINT64(0, pacer.getStats().queueDepthSum);
+
+    // A socket that is down fails fast; that is not congestion
+    for (int i = 0; i < 10; i++) {
+        pacer.posted(POOL_CHUNK_SIZE);
+        pacer.sent(POOL_CHUNK_SIZE, STALL_US * 2, false, i * 1000);
+    }
+    TEST_ASSERT_EQUAL_UINT32(window, pacer.getStats().window);
+    TEST_ASSERT_EQUAL_UINT32(10, pacer.getStats().chunksFailed);
+    TEST_ASSERT_EQUAL_UINT32(0, pacer.getStats().stalls);
+    TEST_ASSERT_TRUE(pacer.canPost(20000));
+}
+
+static void test_fast_link_beats_fixed_pacing() {
+    static constexpr size_t TOTAL = 2 * 1024 * 1024;
+    UploadPacer pacer(MAX_CHUNKS, MIN_CHUNK, STALL_US);
+    ThrottledLink link(4 * 1024 * 1024, 16 * 1024);
+    UploadRun paced = upload(pacer, link, TOTAL);
+    ThrottledLink fixedLink(4 * 1024 * 1024, 16 * 1024);
+    UploadRun fixed = uploadFixed(fixedLink, TOTAL);
+    const UploadStats &stats = pacer.getStats();
+    report("4 MB/s", paced, fixed, TOTAL, stats);
+
+    // The fixed sleeps cap the upload near 800 KB/s; paced, it runs at the link's speed
+    TEST_ASSERT_LESS_THAN(fixed.finishedAt / 3, paced.finishedAt);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.stalls);
+    TEST_ASSERT_EQUAL_UINT32(MAX_CHUNKS * POOL_CHUNK_SIZE, stats.window);
+    TEST_ASSERT_EQUAL_UINT64(TOTAL, stats.bytesSent);
+    TEST_ASSERT_INT_WITHIN(stats.goodputBps / 50, TOTAL * 1000000ull / paced.finishedAt, stats.goodputBps);
+}
+
+static void test_weak_hotspot_keeps_writes_short() {
+    static constexpr size_t TOTAL = 256 * 1024;
+    static constexpr uint32_t RATE = 24 * 1024;
+    UploadPacer pacer(MAX_CHUNKS, MIN_CHUNK, STALL_US);
+    ThrottledLink link(RATE, 16 * 1024);
+    UploadRun paced = upload(pacer, link, TOTAL);
+    ThrottledLink fixedLink(RATE, 16 * 1024);
+    UploadRun fixed = uploadFixed(fixedLink, TOTAL);
+    const UploadStats &stats = pacer.getStats();
+    report("24 KB/s", paced, fixed, TOTAL, stats);
+
+    // The link stays busy, but once the window has shrunk no write holds the dispatcher for long. Until the
+    // first stall the pacer cannot know better than to write full chunks.
+    TEST_ASSERT_GREATER_OR_EQUAL(RATE * 9 / 10, stats.goodputBps);
+    TEST_ASSERT_LESS_THAN(fixed.longestLateWrite / 2, paced.longestLateWrite);
+    TEST_ASSERT_EQUAL_UINT32(2 * MIN_CHUNK, stats.minWindow);
+    TEST_ASSERT_LESS_OR_EQUAL(MAX_CHUNKS, stats.maxQueueDepth);
+}
+
+static void test_window_recovers_after_retransmit_timeout() {
+    static constexpr size_t TOTAL = 4 * 1024 * 1024;
+    UploadPacer pacer(MAX_CHUNKS, MIN_CHUNK, STALL_US);
+    ThrottledLink link(1024 * 1024, 16 * 1024);
+    link.stallAt(500000, 400000); // A 400 ms retransmit timeout half a second in
+    UploadRun paced = upload(pacer, link, TOTAL);
+    ThrottledLink fixedLink(1024 * 1024, 16 * 1024);
+    fixedLink.stallAt(500000, 400000);
+    UploadRun fixed = uploadFixed(fixedLink, TOTAL);
+    const UploadStats &stats = pacer.getStats();
+    report("1 MB/s, 400 ms RTO", paced, fixed, TOTAL, stats);
+
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1, stats.stalls);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT64(400000, stats.stallMicros);
+    TEST_ASSERT_LESS_THAN_UINT32(MAX_CHUNKS * POOL_CHUNK_SIZE, stats.minWindow);
+    TEST_ASSERT_EQUAL_UINT32(MAX_CHUNKS * POOL_CHUNK_SIZE, stats.window); // Grown back by the end
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_chunk_size_follows_window);
+    RUN_TEST(test_queue_never_exceeds_max_chunks);
+    RUN_TEST(test_withdraw_and_failures_leave_window_alone);
+    RUN_TEST(test_fast_link_beats_fixed_pacing);
+    RUN_TEST(test_weak_hotspot_keeps_writes_short);
+    RUN_TEST(test_window_recovers_after_retransmit_timeout);
+    return UNITY_END();
+}
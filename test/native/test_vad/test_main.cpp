@@ -0,0 +1,237 @@
+#include <unity.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "config.h"
+#include "vad.h"
+#include "../../test_random.h"
+
+static constexpr size_t FRAME_SAMPLES = CAPTURE_DMA_BUF_LEN;
+static constexpr size_t FRAME_BYTES = FRAME_SAMPLES * sizeof(int16_t);
+static constexpr size_t BYTES_PER_MS = SAMPLE_RATE * (BITS_PER_SAMPLE / 8) / 1000;
+static constexpr VadConfig VAD = {VAD_ENERGY_THRESHOLD, VAD_ZCR_THRESHOLD};
+static constexpr SilenceTrimConfig TRIM = {VAD_PREROLL_MS * BYTES_PER_MS, VAD_HANGOVER_MS * BYTES_PER_MS,
+                                           VAD_MAX_PAUSE_MS * BYTES_PER_MS, VAD_AUTO_STOP_MS * BYTES_PER_MS};
+static constexpr uint32_t TARGET_MHZ = 240;
+static constexpr double CYCLES_PER_SAMPLE_BUDGET = 8; // From vad.h
+
+static std::vector<int16_t> tone(double hz, int16_t amplitude, int16_t bias = 0) {
+    std::vector<int16_t> frame(FRAME_SAMPLES);
+    for (size_t i = 0; i < frame.size(); i++) {
+        frame[i] = static_cast<int16_t>(bias + amplitude * std::sin(2 * M_PI * hz * i / SAMPLE_RATE));
+    }
+    return frame;
+}
+
+static std::vector<int16_t> noise(int16_t amplitude) {
+    std::vector<int16_t> frame(FRAME_SAMPLES);
+    for (int16_t &sample: frame) {
+        sample = static_cast<int16_t>(static_cast<int32_t>(nextRandom() % (2 * amplitude + 1)) - amplitude);
+    }
+    return frame;
+}
+
+static const std::vector<int16_t> SILENCE = noise(VAD_ENERGY_THRESHOLD / 20);
+static const std::vector<int16_t> SPEECH = tone(300, 4 * VAD_ENERGY_THRESHOLD);
+
+// A recording as Audio keeps it: every kept frame reaches the store, and the pre-roll slides along behind
+struct Recording {
+    SilenceTrimmer trimmer{VAD, TRIM};
+    size_t length = 0;
+    uint32_t autoStops = 0;
+
+    Recording() { trimmer.start(false); }
+
+    void add(const std::vector<int16_t> &frame, size_t count = 1) {
+        for (size_t i = 0; i < count; i++) {
+            TrimVerdict verdict = trimmer.frame(frame.data(), FRAME_BYTES, length);
+            autoStops += verdict.autoStop;
+            if (verdict.keep) {
+                length += FRAME_BYTES;
+            }
+            if (!trimmer.heardSpeech()) {
+                length -= trimmer.leadingDrop(length, length);
+            }
+        }
+    }
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_classifies_frames() {
+    VoiceActivityDetector vad(VAD);
+    TEST_ASSERT_FALSE(vad.process(nullptr, 0));
+    TEST_ASSERT_FALSE(vad.process(SILENCE.data(), SILENCE.size()));
+    TEST_ASSERT_TRUE(vad.process(SPEECH.data(), SPEECH.size()));
+    // Quiet but hissing, like a fricative, counts; as quiet and low it does not
+    std::vector<int16_t> hiss = tone(6000, VAD_ENERGY_THRESHOLD / 2);
+    TEST_ASSERT_TRUE(vad.process(hiss.data(), hiss.size()));
+    std::vector<int16_t> hum = tone(100, VAD_ENERGY_THRESHOLD / 2);
+    TEST_ASSERT_FALSE(vad.process(hum.data(), hum.size()));
+}
+
+static void test_follows_microphone_bias() {
+    VoiceActivityDetector vad(VAD);
+    std::vector<int16_t> biased = tone(100, VAD_ENERGY_THRESHOLD / 20, 3000);
+    TEST_ASSERT_TRUE(vad.process(biased.data(), biased.size())); // The bias reads as energy at first
+    for (int i = 0; i < 60; i++) {
+        vad.process(biased.data(), biased.size());
+    }
+    TEST_ASSERT_FALSE(vad.process(biased.data(), biased.size()));
+    vad.reset();
+    TEST_ASSERT_TRUE(vad.process(biased.data(), biased.size()));
+}
+
+static void test_trims_leading_silence_to_the_preroll() {
+    Recording recording;
+    size_t frames = 3 * TRIM.prerollBytes / FRAME_BYTES;
+    for (size_t i = 0; i < frames; i++) {
+        recording.add(SILENCE);
+        TEST_ASSERT_LESS_THAN(2 * TRIM.prerollBytes, recording.length);
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(TRIM.prerollBytes, recording.length);
+    TEST_ASSERT_EQUAL(frames * FRAME_BYTES - recording.length, recording.trimmer.stats().trimmedBytes);
+
+    // Speech keeps the pre-roll in front of it and nothing more is dropped
+    size_t preroll = recording.length;
+    recording.add(SPEECH, 2 * TRIM.prerollBytes / FRAME_BYTES);
+    TEST_ASSERT_TRUE(recording.trimmer.heardSpeech());
+    TEST_ASSERT_EQUAL(preroll + 2 * TRIM.prerollBytes / FRAME_BYTES * FRAME_BYTES, recording.length);
+    TEST_ASSERT_EQUAL(0, recording.trimmer.leadingDrop(recording.length, recording.length));
+
+    // Only what reached the store can go
+    Recording staged;
+    staged.add(SILENCE, 2 * TRIM.prerollBytes / FRAME_BYTES - 1);
+    TEST_ASSERT_EQUAL(0, staged.trimmer.leadingDrop(2 * TRIM.prerollBytes, 0));
+    TEST_ASSERT_EQUAL(FRAME_BYTES, staged.trimmer.leadingDrop(2 * TRIM.prerollBytes, FRAME_BYTES));
+}
+
+static void test_trims_trailing_silence_to_the_hangover() {
+    Recording recording;
+    recording.add(SPEECH, 10);
+    size_t speechEnd = recording.length;
+    recording.add(SILENCE, 2 * TRIM.hangoverBytes / FRAME_BYTES);
+    uint32_t trimmed = recording.trimmer.stats().trimmedBytes;
+    TEST_ASSERT_EQUAL(speechEnd + TRIM.hangoverBytes, recording.trimmer.trailingEnd(recording.length, 0));
+    TEST_ASSERT_EQUAL_UINT32(trimmed + recording.length - speechEnd - TRIM.hangoverBytes,
+                             recording.trimmer.stats().trimmedBytes);
+
+    // Audio already uploaded stays, and a short tail is kept whole
+    Recording uploaded;
+    uploaded.add(SPEECH, 4);
+    uploaded.add(SILENCE, 2 * TRIM.hangoverBytes / FRAME_BYTES);
+    size_t sent = uploaded.length - FRAME_BYTES;
+    TEST_ASSERT_EQUAL(sent, uploaded.trimmer.trailingEnd(uploaded.length, sent));
+    Recording tail;
+    tail.add(SPEECH, 4);
+    tail.add(SILENCE);
+    TEST_ASSERT_EQUAL(tail.length, tail.trimmer.trailingEnd(tail.length, 0));
+    TEST_ASSERT_EQUAL_UINT32(0, tail.trimmer.stats().trimmedBytes);
+
+    // Nothing but silence leaves nothing
+    Recording silent;
+    silent.add(SILENCE, 10);
+    TEST_ASSERT_EQUAL(0, silent.trimmer.trailingEnd(silent.length, 0));
+}
+
+static void test_collapses_long_pauses() {
+    Recording recording;
+    recording.add(SPEECH, 4);
+    size_t before = recording.length;
+    size_t pauseFrames = 3 * TRIM.maxPauseBytes / FRAME_BYTES;
+    recording.add(SILENCE, pauseFrames);
+    TEST_ASSERT_EQUAL(before + TRIM.maxPauseBytes / FRAME_BYTES * FRAME_BYTES, recording.length);
+    recording.add(SPEECH);
+    TEST_ASSERT_EQUAL(before + (TRIM.maxPauseBytes / FRAME_BYTES + 1) * FRAME_BYTES, recording.length);
+}
+
+static void test_auto_stops_once_at_the_threshold() {
+    size_t framesToStop = (TRIM.autoStopBytes + FRAME_BYTES - 1) / FRAME_BYTES;
+    Recording recording;
+    recording.add(SPEECH, 4);
+    recording.add(SILENCE, framesToStop - 1);
+    TEST_ASSERT_EQUAL_UINT32(0, recording.autoStops);
+    recording.add(SPEECH); // Speech starts the count again
+    recording.add(SILENCE, framesToStop - 1);
+    TEST_ASSERT_EQUAL_UINT32(0, recording.autoStops);
+    TEST_ASSERT_FALSE(recording.trimmer.stats().autoStopped);
+    recording.add(SILENCE);
+    TEST_ASSERT_EQUAL_UINT32(1, recording.autoStops);
+    TEST_ASSERT_TRUE(recording.trimmer.stats().autoStopped);
+    recording.add(SILENCE, framesToStop); // Frames still in flight while the stop goes round
+    recording.add(SPEECH);
+    recording.add(SILENCE, framesToStop);
+    TEST_ASSERT_EQUAL_UINT32(1, recording.autoStops);
+
+    // The next recording can stop itself again
+    recording.trimmer.start(false);
+    recording.autoStops = 0;
+    recording.add(SILENCE, framesToStop);
+    TEST_ASSERT_EQUAL_UINT32(1, recording.autoStops);
+}
+
+static void test_stop_after_auto_stop_ends_nothing() {
+    Recording recording;
+    recording.add(SILENCE, (TRIM.autoStopBytes + FRAME_BYTES - 1) / FRAME_BYTES);
+    TEST_ASSERT_EQUAL_UINT32(1, recording.autoStops);
+    TEST_ASSERT_TRUE(recording.trimmer.stop());  // The auto-stop's stop_recording
+    TEST_ASSERT_FALSE(recording.trimmer.stop()); // The stop key a moment later
+    TEST_ASSERT_FALSE(recording.trimmer.stop()); // The store filling with the last frames
+
+    // Raced from several tasks, one stop still wins
+    for (int round = 0; round < 200; round++) {
+        recording.trimmer.start(false);
+        std::atomic<int> ended{0};
+        std::vector<std::thread> stoppers;
+        for (int t = 0; t < 3; t++) {
+            stoppers.emplace_back([&recording, &ended]() { ended += recording.trimmer.stop(); });
+        }
+        for (std::thread &stopper: stoppers) {
+            stopper.join();
+        }
+        TEST_ASSERT_EQUAL(1, ended.load());
+    }
+
+    SilenceTrimmer idle(VAD, TRIM);
+    TEST_ASSERT_FALSE(idle.stop()); // Nothing was started
+}
+
+// The host is several times faster than the 240 MHz S3, so this catches a loop that has grown well past its
+// budget rather than measuring the budget itself
+static void test_stays_within_cycle_budget() {
+    static constexpr int FRAMES = 20000;
+    VoiceActivityDetector vad(VAD);
+    std::vector<int16_t> speech = noise(4 * VAD_ENERGY_THRESHOLD);
+    volatile uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < FRAMES; i++) {
+        sink = sink + vad.process((i & 1 ? SILENCE : speech).data(), FRAME_SAMPLES);
+    }
+    double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    double nanosPerSample = nanos / (static_cast<double>(FRAMES) * FRAME_SAMPLES);
+    double cycles = nanosPerSample * TARGET_MHZ / 1000;
+
+    char line[160];
+    snprintf(line, sizeof(line), "%.2f ns per sample, %.0f ns per %u-sample frame: %.2f cycles per sample at %u MHz",
+             nanosPerSample, nanosPerSample * FRAME_SAMPLES, static_cast<unsigned>(FRAME_SAMPLES), cycles, TARGET_MHZ);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(cycles <= CYCLES_PER_SAMPLE_BUDGET);
+}
+
+int main() {
+    seedRandom(521288629u);
+    UNITY_BEGIN();
+    RUN_TEST(test_classifies_frames);
+    RUN_TEST(test_follows_microphone_bias);
+    RUN_TEST(test_trims_leading_silence_to_the_preroll);
+    RUN_TEST(test_trims_trailing_silence_to_the_hangover);
+    RUN_TEST(test_collapses_long_pauses);
+    RUN_TEST(test_auto_stops_once_at_the_threshold);
+    RUN_TEST(test_stop_after_auto_stop_ends_nothing);
+    RUN_TEST(test_stays_within_cycle_budget);
+    return UNITY_END();
+}
@@ -0,0 +1,21 @@
+#ifndef TEST_RANDOM_H
+#define TEST_RANDOM_H
+
+#include <cstdint>
+
+// Xorshift32 shared by the host and on-target tests: cheap, repeatable input. Each test seeds it with
+// seedRandom() before it runs, so its sequence does not depend on what ran before it.
+static uint32_t rngState = 2463534242u;
+
+static inline void seedRandom(uint32_t seed) {
+    rngState = seed;
+}
+
+static inline uint32_t nextRandom() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+#endif // TEST_RANDOM_H
@@ -0,0 +1,125 @@
+"""Packs prompts/<name>.wav into the image flashed to the "prompts" partition.
+
+Prompt ids come from the PromptId enum in include/prompt_cache.h: DOORBELL is prompts/doorbell.wav,
+PLEASE_WAIT is prompts/please_wait.wav, and so on. Missing files are left out of the index and the firmware
+logs them when asked to play one. WAVs may be 8- or 16-bit PCM, mono or stereo, at any rate; they are mixed
+down and resampled to the firmware's SAMPLE_RATE as 16-bit PCM, the format the speaker plays as is.
+
+Run by PlatformIO as a pre: extra script, it writes the image to the build directory and adds it to the
+images uploaded with the firmware. It also runs on its own:
+
+    python tools/pack_prompts.py --output prompts.bin
+"""
+
+import argparse
+import csv
+import re
+import struct
+import wave
+from pathlib import Path
+
+MAGIC = 0x544D5250  # "PRMT"
+VERSION = 1
+HEADER = struct.Struct("<IHHII")  # magic, version, count, sample rate, reserved
+ENTRY = struct.Struct("<B3xII")  # id, offset, length
+PARTITION_LABEL = "prompts"
+
+
+def read_prompt_ids(header_path):
+    text = Path(header_path).read_text()
+    body = re.search(r"enum class PromptId[^{]*{([^}]*)}", text).group(1)
+    body = re.sub(r"//[^\n]*", "", body)
+    names = [item.split("=")[0].strip() for item in body.split(",")]
+    return [name for name in names if name]
+
+
+def read_sample_rate(config_path):
+    return int(re.search(r"#define SAMPLE_RATE (\d+)", Path(config_path).read_text()).group(1))
+
+
+def read_partition(csv_path, label):
+    with open(csv_path, newline="") as file:
+        for row in csv.reader(line for line in file if not line.lstrip().startswith("#")):
+            fields = [field.strip() for field in row]
+            if fields and fields[0] == label:
+                return int(fields[3], 0), int(fields[4], 0)
+    raise SystemExit(f"No {label} partition in {csv_path}")
+
+
+def load_wav(path, rate):
+    with wave.open(str(path), "rb") as wav:
+        width = wav.getsampwidth()
+        channels = wav.getnchannels()
+        source_rate = wav.getframerate()
+        frames = wav.readframes(wav.getnframes())
+    if width == 1:
+        samples = [(value - 128) << 8 for value in frames]
+    elif width == 2:
+        samples = list(struct.unpack(f"<{len(frames) // 2}h", frames))
+    else:
+        raise SystemExit(f"{path}: {width * 8}-bit samples are not supported, use 8- or 16-bit PCM")
+    if channels > 1:
+        samples = [sum(samples[i:i + channels]) // channels for i in range(0, len(samples), channels)]
+
+    if source_rate != rate and samples:
+        # Linear interpolation; record prompts at the firmware rate to skip it
+        count = len(samples) * rate // source_rate
+        step = source_rate / rate
+        resampled = []
+        for i in range(count):
+            position = i * step
+            index = int(position)
+            following = samples[min(index + 1, len(samples) - 1)]
+            resampled.append(round(samples[index] + (following - samples[index]) * (position - index)))
+        samples = resampled
+    return struct.pack(f"<{len(samples)}h", *samples)
+
+
+def pack(prompt_dir, names, rate, capacity):
+    prompts = []
+    for prompt_id, name in enumerate(names):
+        path = Path(prompt_dir) / f"{name.lower()}.wav"
+        if path.exists():
+            prompts.append((prompt_id, name, load_wav(path, rate)))
+
+    base = HEADER.size + ENTRY.size * len(prompts)
+    index = b""
+    data = b""
+    for prompt_id, name, pcm in prompts:
+        data += b"\0" * (-(base + len(data)) % 4)
+        index += ENTRY.pack(prompt_id, base + len(data), len(pcm))
+        data += pcm
+        print(f"Prompt {name}: {len(pcm)} bytes, {len(pcm) * 500 // rate} ms")
+
+    image = HEADER.pack(MAGIC, VERSION, len(prompts), rate, 0) + index + data
+    if len(image) > capacity:
+        raise SystemExit(f"Prompt image is {len(image)} bytes, the partition holds {capacity}")
+    return image
+
+
+def build(root, output):
+    names = read_prompt_ids(root / "include" / "prompt_cache.h")
+    rate = read_sample_rate(root / "include" / "config.h")
+    offset, size = read_partition(root / "partitions.csv", PARTITION_LABEL)
+    image = pack(root / "prompts", names, rate, size)
+    Path(output).parent.mkdir(parents=True, exist_ok=True)
+    Path(output).write_bytes(image)
+    print(f"Prompt image: {len(image)} of {size} bytes at 0x{offset:X} -> {output}")
+    return offset
+
+
+try:
+    Import("env")  # noqa: F821 - defined when PlatformIO runs this as an extra script
+except NameError:
+    env = None
+
+if env is not None:
+    project_dir = Path(env.subst("$PROJECT_DIR"))
+    image_path = Path(env.subst("$BUILD_DIR")) / "prompts.bin"
+    partition_offset = build(project_dir, image_path)
+    env.Append(FLASH_EXTRA_IMAGES=[(f"0x{partition_offset:X}", str(image_path))])
+elif __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Pack prompts/*.wav into the prompts partition image")
+    parser.add_argument("--output", default="prompts.bin")
+    args = parser.parse_args()
+    build(Path(__file__).resolve().parent.parent, args.output)
@@ -0,0 +1,226 @@
+"""Stand-in upload server that drops the device's WebSocket at random points and checks every recording arrives intact.
+
+Point the firmware at this machine (the change_server command, or WS_SERVER) and run:
+
+    pip install websockets
+    python tools/resume_standin.py --recordings 20 --kill-probability 0.05
+
+It speaks the server's side of the upload protocol. Binary frames are placed by stream and offset from their
+FrameHeader (include/frame_protocol.h). An upload_resume or recording_sent is answered with a spool_ack of the
+highest contiguous offset held. Each recording is started with an "audio" start_recording command and stopped a
+few seconds later, the commands waiting for the device to reconnect if the link is down.
+
+After any binary frame the connection may be aborted without a close handshake, as a lost link would. The
+device then reconnects and has to refill the gap: a live recording through upload_resume and SPOOL frames, a
+finished one through a spool replay.
+
+Since the device records from its microphone there is no reference copy. Delivery is byte-exact when:
+- every byte that arrives more than once, live or replayed from flash, is identical each time
+- a finished recording has no holes up to the length its recording_sent reports
+- the FRAME_LAST frame agrees with that length
+The exit status is 1 if any check fails or a recording is still incomplete when the run ends.
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import struct
+import sys
+
+FRAME_HEADER = struct.Struct("<BBBBIII")  # version, type, flags, header size, stream, sequence, offset
+FRAME_VERSION = 1
+FRAME_AUDIO = 1
+FRAME_SPOOL = 3
+FRAME_LAST = 0x02
+
+
+class Recording:
+    """Bytes of one recording as they arrive, in any order and any number of times."""
+
+    def __init__(self, session):
+        self.session = session
+        self.data = bytearray()
+        self.have = bytearray()  # 1 for each byte received
+        self.length = None  # From recording_sent
+        self.last_offset = None  # From the FRAME_LAST frame
+        self.duplicate_bytes = 0
+        self.errors = []
+
+    def place(self, offset, payload):
+        end = offset + len(payload)
+        if end > len(self.data):
+            grow = end - len(self.data)
+            self.data.extend(bytes(grow))
+            self.have.extend(bytes(grow))
+        for i, byte in enumerate(payload):
+            position = offset + i
+            if self.have[position]:
+                self.duplicate_bytes += 1
+                if self.data[position] != byte:
+                    self.errors.append("byte %d differs between copies" % position)
+                    return
+            else:
+                self.data[position] = byte
+                self.have[position] = 1
+
+    def contiguous(self):
+        hole = self.have.find(0)
+        return len(self.have) if hole < 0 else hole
+
+    def complete(self):
+        return self.length is not None and self.contiguous() >= self.length
+
+    def check(self):
+        errors = list(self.errors)
+        if self.length is None:
+            errors.append("never reported sent")
+        elif self.contiguous() < self.length:
+            errors.append("hole at byte %d of %d" % (self.contiguous(), self.length))
+        elif len(self.data) > self.length:
+            errors.append("%d bytes past the reported end" % (len(self.data) - self.length))
+        if self.last_offset is not None and self.length is not None and self.last_offset != self.length:
+            errors.append("FRAME_LAST at %d, recording_sent says %d" % (self.last_offset, self.length))
+        return errors
+
+
+class StandIn:
+    def __init__(self, args):
+        self.args = args
+        self.random = random.Random(args.seed)
+        self.recordings = {}
+        self.connections = 0
+        self.kills = 0
+        self.ws = None
+        self.connected = asyncio.Event()
+        self.driven = False
+        self.done = asyncio.Event()
+
+    def recording(self, session):
+        if session not in self.recordings:
+            self.recordings[session] = Recording(session)
+        return self.recordings[session]
+
+    async def send(self, ws, event_type, data):
+        await ws.send(json.dumps({"event_type": event_type, "data": data}))
+
+    async def ack(self, ws, session):
+        await self.send(ws, "spool_ack", {"session": session, "offset": self.recording(session).contiguous()})
+
+    async def on_binary(self, ws, frame):
+        if len(frame) < FRAME_HEADER.size:
+            print("short frame of %d bytes" % len(frame))
+            return
+        version, frame_type, flags, header_size, stream, _, offset = FRAME_HEADER.unpack_from(frame)
+        if version != FRAME_VERSION or frame_type not in (FRAME_AUDIO, FRAME_SPOOL):
+            return
+        recording = self.recording(stream)
+        payload = frame[header_size:]
+        recording.place(offset, payload)
+        if flags & FRAME_LAST:
+            recording.last_offset = offset
+
+        if self.random.random() < self.args.kill_probability:
+            self.kills += 1
+            print("killing connection %d at %s byte %d of recording %d"
+                  % (self.connections, "spool" if frame_type == FRAME_SPOOL else "live", offset, stream))
+            ws.transport.abort()
+
+    async def on_text(self, ws, text):
+        message = json.loads(text)
+        event_type = message.get("event_type")
+        data = message.get("data", {})
+        if event_type == "upload_resume":
+            print("resume of recording %d asked from byte %d; holding %d"
+                  % (data["session"], data["offset"], self.recording(data["session"]).contiguous()))
+            await self.ack(ws, data["session"])
+        elif event_type == "recording_sent":
+            recording = self.recording(data["session"])
+            recording.length = data["bytes"]
+            await self.ack(ws, data["session"])
+            if recording.complete():
+                print("recording %d complete: %d bytes, %d received twice"
+                      % (recording.session, recording.length, recording.duplicate_bytes))
+            self.check_done()
+
+    def check_done(self):
+        if self.driven and all(r.complete() for r in self.recordings.values()):
+            self.done.set()
+
+    async def command(self, action):
+        # Retried on the next connection if the link is down; the device keeps recording meanwhile
+        while True:
+            await self.connected.wait()
+            try:
+                await self.send(self.ws, "audio", {"action": action})
+                return
+            except Exception:
+                await asyncio.sleep(0.1)
+
+    async def drive(self):
+        for _ in range(self.args.recordings):
+            await self.command("start_recording")
+            await asyncio.sleep(self.args.record_seconds)
+            await self.command("stop_recording")
+            await asyncio.sleep(self.args.record_seconds / 2)
+        self.driven = True
+        self.check_done()
+
+    async def handler(self, ws, *_):
+        self.connections += 1
+        number = self.connections
+        print("device connected (%d)" % number)
+        self.ws = ws
+        self.connected.set()
+        try:
+            async for message in ws:
+                if isinstance(message, bytes):
+                    await self.on_binary(ws, message)
+                else:
+                    await self.on_text(ws, message)
+        except Exception as error:  # A killed connection ends here
+            print("connection %d closed: %s" % (number, type(error).__name__))
+        if self.ws is ws:
+            self.ws = None
+            self.connected.clear()
+
+    def report(self):
+        failed = False
+        for session in sorted(self.recordings):
+            recording = self.recordings[session]
+            errors = recording.check()
+            failed = failed or bool(errors)
+            print("recording %d: %s" % (session, "; ".join(errors) if errors else
+                                        "%d bytes intact" % recording.length))
+        print("%d recordings, %d connections killed" % (len(self.recordings), self.kills))
+        return 1 if failed or len(self.recordings) < self.args.recordings else 0
+
+
+async def run(args):
+    import websockets
+
+    standin = StandIn(args)
+    async with websockets.serve(standin.handler, args.host, args.port, max_size=None):
+        driver = asyncio.ensure_future(standin.drive())
+        try:
+            await asyncio.wait_for(standin.done.wait(), args.timeout)
+        except asyncio.TimeoutError:
+            print("timed out with recordings incomplete")
+        driver.cancel()
+    return standin.report()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8765, help="WS_PORT in include/config.h")
+    parser.add_argument("--recordings", type=int, default=10)
+    parser.add_argument("--record-seconds", type=float, default=4)
+    parser.add_argument("--kill-probability", type=float, default=0.05, help="chance per binary frame")
+    parser.add_argument("--timeout", type=float, default=600, help="seconds to wait for every recording")
+    parser.add_argument("--seed", type=int, default=1)
+    sys.exit(asyncio.run(run(parser.parse_args())))
+
+
+if __name__ == "__main__":
+    main()